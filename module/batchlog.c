@@ -0,0 +1,116 @@
+/*****************************************************************************
+ *
+ * BATCHLOG.C - Example of a NEB module using batched callbacks
+ *
+ * Description:
+ *
+ * This module appends a line for every processed host and service
+ * check to a file. Rather than getting one callback per check, it
+ * registers a batch function, formats each batch into a single buffer
+ * and writes it with one system call. Modules that forward events to
+ * a database or a message bus can do the same with multi-row inserts
+ * or batched publishes.
+ *
+ * Instructions:
+ *
+ * Compile with the following command:
+ *
+ *     gcc -shared -fPIC $(pkg-config --cflags naemon) -o batchlog.o batchlog.c
+ *
+ * and load it with
+ *
+ *     broker_module=/path/to/batchlog.o /path/to/checks.log
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "naemon/naemon.h"
+
+/* specify event broker API version (required) */
+NEB_API_VERSION(CURRENT_NEB_API_VERSION);
+
+/* checks per batch, and roughly what a line takes */
+#define BATCHLOG_EVENTS 512
+#define BATCHLOG_LINE 256
+
+static void *batchlog_module_handle;
+static int batchlog_fd = -1;
+static char *batchlog_buf;
+
+static int batchlog_write(const neb_batch_event *events, unsigned int count)
+{
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		const neb_batch_event *ev = &events[i];
+		int n;
+
+		n = snprintf(batchlog_buf + len, BATCHLOG_LINE, "%lu.%06lu\t%s\t%s\t%d\t%s\n",
+		             (unsigned long)ev->timestamp.tv_sec, (unsigned long)ev->timestamp.tv_usec,
+		             ev->hst->name, ev->svc ? ev->svc->description : "",
+		             ev->state, ev->state_type == HARD_STATE ? "HARD" : "SOFT");
+		if (n >= BATCHLOG_LINE)
+			n = BATCHLOG_LINE - 1;
+		len += n;
+	}
+
+	/* the whole batch in one go */
+	if (write(batchlog_fd, batchlog_buf, len) != (ssize_t)len)
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "batchlog: Failed to write %u events: %s\n", count, strerror(errno));
+
+	return 0;
+}
+
+/* this function gets called when the module is loaded by the event broker */
+int nebmodule_init(int flags, char *args, nebmodule *handle)
+{
+	neb_cb_filter filter;
+
+	batchlog_module_handle = handle;
+	neb_set_module_info(batchlog_module_handle, NEBMODULE_MODINFO_TITLE, "batchlog");
+	neb_set_module_info(batchlog_module_handle, NEBMODULE_MODINFO_DESC, "Logs check results using batched callbacks");
+	neb_set_module_info(batchlog_module_handle, NEBMODULE_MODINFO_LICENSE, "GPL v2");
+
+	if (!args || !*args) {
+		logit(NSLOG_CONFIG_ERROR, TRUE, "batchlog: No output file given\n");
+		return -1;
+	}
+	if ((batchlog_fd = open(args, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0) {
+		logit(NSLOG_CONFIG_ERROR, TRUE, "batchlog: Failed to open '%s': %s\n", args, strerror(errno));
+		return -1;
+	}
+	if (!(batchlog_buf = malloc(BATCHLOG_EVENTS * BATCHLOG_LINE))) {
+		close(batchlog_fd);
+		return -1;
+	}
+
+	/* we only care about checks once they're done */
+	memset(&filter, 0, sizeof(filter));
+	filter.subtypes = neb_subtype_flag(NEBTYPE_HOSTCHECK_PROCESSED);
+	neb_register_batch_callback(NEBCALLBACK_HOST_CHECK_DATA, batchlog_module_handle, 0, &filter, BATCHLOG_EVENTS, batchlog_write);
+	filter.subtypes = neb_subtype_flag(NEBTYPE_SERVICECHECK_PROCESSED);
+	neb_register_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, batchlog_module_handle, 0, &filter, BATCHLOG_EVENTS, batchlog_write);
+
+	return 0;
+}
+
+/* this function gets called when the module is unloaded by the event broker */
+int nebmodule_deinit(int flags, int reason)
+{
+	/* pending events were delivered before we got here */
+	neb_deregister_batch_callback(NEBCALLBACK_HOST_CHECK_DATA, batchlog_write);
+	neb_deregister_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, batchlog_write);
+
+	if (batchlog_fd >= 0)
+		close(batchlog_fd);
+	batchlog_fd = -1;
+	free(batchlog_buf);
+	batchlog_buf = NULL;
+
+	return 0;
+}
@@ -22,10 +22,15 @@
 void broker_program_state(int type, int flags, int attr, struct timeval *timestamp)
 {
 	nebstruct_process_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_PROGRAM_STATE))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_PROCESS_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -33,7 +38,7 @@ void broker_program_state(int type, int flags, int attr, struct timeval *timesta
 	ds.timestamp = get_broker_timestamp(timestamp);
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_PROCESS_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_PROCESS_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -43,6 +48,7 @@ void broker_program_state(int type, int flags, int attr, struct timeval *timesta
 void broker_timed_event(int type, int flags, int attr, timed_event *event, struct timeval *timestamp)
 {
 	nebstruct_timed_event_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_TIMED_EVENTS))
 		return;
@@ -50,6 +56,10 @@ void broker_timed_event(int type, int flags, int attr, timed_event *event, struc
 	if (event == NULL)
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_TIMED_EVENT_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -63,7 +73,7 @@ void broker_timed_event(int type, int flags, int attr, timed_event *event, struc
 	ds.event_ptr = (void *)event;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_TIMED_EVENT_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_TIMED_EVENT_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -73,10 +83,15 @@ void broker_timed_event(int type, int flags, int attr, timed_event *event, struc
 void broker_log_data(int type, int flags, int attr, char *data, unsigned long data_type, time_t entry_time, struct timeval *timestamp)
 {
 	nebstruct_log_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_LOGGED_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_LOG_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -88,7 +103,7 @@ void broker_log_data(int type, int flags, int attr, char *data, unsigned long da
 	ds.data = data;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_LOG_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_LOG_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -98,6 +113,7 @@ void broker_log_data(int type, int flags, int attr, char *data, unsigned long da
 void broker_system_command(int type, int flags, int attr, struct timeval start_time, struct timeval end_time, double exectime, int timeout, int early_timeout, int retcode, char *cmd, char *output, struct timeval *timestamp)
 {
 	nebstruct_system_command_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_SYSTEM_COMMANDS))
 		return;
@@ -105,6 +121,10 @@ void broker_system_command(int type, int flags, int attr, struct timeval start_t
 	if (cmd == NULL)
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_SYSTEM_COMMAND_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -121,7 +141,7 @@ void broker_system_command(int type, int flags, int attr, struct timeval start_t
 	ds.output = output;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_SYSTEM_COMMAND_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_SYSTEM_COMMAND_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -136,6 +156,7 @@ int broker_event_handler(int type, int flags, int attr, int eventhandler_type, v
 	char *command_name = NULL;
 	char *command_args = NULL;
 	nebstruct_event_handler_data ds;
+	neb_event ev;
 	int return_code = OK;
 
 	if (!(event_broker_options & BROKER_EVENT_HANDLERS))
@@ -144,6 +165,13 @@ int broker_event_handler(int type, int flags, int attr, int eventhandler_type, v
 	if (data == NULL)
 		return ERROR;
 
+	if (eventhandler_type == SERVICE_EVENTHANDLER || eventhandler_type == GLOBAL_SERVICE_EVENTHANDLER)
+		neb_event_init(&ev, type, NULL, (service *)data);
+	else
+		neb_event_init(&ev, type, (host *)data, NULL);
+	if (!neb_wants_event(NEBCALLBACK_EVENT_HANDLER_DATA, &ev))
+		return return_code;
+
 	/* get command name/args */
 	if (cmd != NULL) {
 		command_buf = nm_strdup(cmd);
@@ -182,7 +210,7 @@ int broker_event_handler(int type, int flags, int attr, int eventhandler_type, v
 	ds.output = output;
 
 	/* make callbacks */
-	return_code = neb_make_callbacks(NEBCALLBACK_EVENT_HANDLER_DATA, (void *)&ds);
+	return_code = neb_make_event_callbacks(NEBCALLBACK_EVENT_HANDLER_DATA, &ev, (void *)&ds);
 
 	/* free memory */
 	my_free(command_buf);
@@ -198,6 +226,7 @@ int broker_host_check(int type, int flags, int attr, host *hst, int check_type,
 	char *command_name = NULL;
 	char *command_args = NULL;
 	nebstruct_host_check_data ds;
+	neb_event ev;
 	int return_code = OK;
 
 	if (!(event_broker_options & BROKER_HOST_CHECKS))
@@ -206,6 +235,10 @@ int broker_host_check(int type, int flags, int attr, host *hst, int check_type,
 	if (hst == NULL)
 		return ERROR;
 
+	neb_event_init(&ev, type, hst, NULL);
+	if (!neb_wants_event(NEBCALLBACK_HOST_CHECK_DATA, &ev))
+		return OK;
+
 	/* get command name/args */
 	if (cmd != NULL) {
 		command_buf = nm_strdup(cmd);
@@ -242,7 +275,7 @@ int broker_host_check(int type, int flags, int attr, host *hst, int check_type,
 	ds.check_result_ptr = cr;
 
 	/* make callbacks */
-	return_code = neb_make_callbacks(NEBCALLBACK_HOST_CHECK_DATA, (void *)&ds);
+	return_code = neb_make_event_callbacks(NEBCALLBACK_HOST_CHECK_DATA, &ev, (void *)&ds);
 
 	/* free data */
 	my_free(command_buf);
@@ -258,6 +291,7 @@ int broker_service_check(int type, int flags, int attr, service *svc, int check_
 	char *command_name = NULL;
 	char *command_args = NULL;
 	nebstruct_service_check_data ds;
+	neb_event ev;
 	int return_code = OK;
 
 	if (!(event_broker_options & BROKER_SERVICE_CHECKS))
@@ -266,6 +300,10 @@ int broker_service_check(int type, int flags, int attr, service *svc, int check_
 	if (svc == NULL)
 		return ERROR;
 
+	neb_event_init(&ev, type, NULL, svc);
+	if (!neb_wants_event(NEBCALLBACK_SERVICE_CHECK_DATA, &ev))
+		return OK;
+
 	/* get command name/args */
 	if (cmd != NULL) {
 		command_buf = nm_strdup(cmd);
@@ -303,7 +341,7 @@ int broker_service_check(int type, int flags, int attr, service *svc, int check_
 	ds.check_result_ptr = cr;
 
 	/* make callbacks */
-	return_code = neb_make_callbacks(NEBCALLBACK_SERVICE_CHECK_DATA, (void *)&ds);
+	return_code = neb_make_event_callbacks(NEBCALLBACK_SERVICE_CHECK_DATA, &ev, (void *)&ds);
 
 	/* free data */
 	my_free(command_buf);
@@ -316,10 +354,20 @@ int broker_service_check(int type, int flags, int attr, service *svc, int check_
 void broker_comment_data(int type, int flags, int attr, int comment_type, int entry_type, char *host_name, char *svc_description, time_t entry_time, char *author_name, char *comment_data, int persistent, int source, int expires, time_t expire_time, unsigned long comment_id, struct timeval *timestamp)
 {
 	nebstruct_comment_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_COMMENT_DATA))
 		return;
 
+	if (!host_name)
+		neb_event_init(&ev, type, NULL, NULL);
+	else if (svc_description)
+		neb_event_init(&ev, type, NULL, find_service(host_name, svc_description));
+	else
+		neb_event_init(&ev, type, find_host(host_name), NULL);
+	if (!neb_wants_event(NEBCALLBACK_COMMENT_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -341,7 +389,7 @@ void broker_comment_data(int type, int flags, int attr, int comment_type, int en
 	ds.comment_id = comment_id;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_COMMENT_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_COMMENT_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -351,10 +399,20 @@ void broker_comment_data(int type, int flags, int attr, int comment_type, int en
 void broker_downtime_data(int type, int flags, int attr, int downtime_type, char *host_name, char *svc_description, time_t entry_time, char *author_name, char *comment_data, time_t start_time, time_t end_time, int fixed, unsigned long triggered_by, unsigned long duration, unsigned long downtime_id, struct timeval *timestamp)
 {
 	nebstruct_downtime_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_DOWNTIME_DATA))
 		return;
 
+	if (!host_name)
+		neb_event_init(&ev, type, NULL, NULL);
+	else if (svc_description)
+		neb_event_init(&ev, type, NULL, find_service(host_name, svc_description));
+	else
+		neb_event_init(&ev, type, find_host(host_name), NULL);
+	if (!neb_wants_event(NEBCALLBACK_DOWNTIME_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -376,7 +434,7 @@ void broker_downtime_data(int type, int flags, int attr, int downtime_type, char
 	ds.downtime_id = downtime_id;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_DOWNTIME_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_DOWNTIME_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -386,6 +444,7 @@ void broker_downtime_data(int type, int flags, int attr, int downtime_type, char
 void broker_flapping_data(int type, int flags, int attr, int flapping_type, void *data, double percent_change, double high_threshold, double low_threshold, struct timeval *timestamp)
 {
 	nebstruct_flapping_data ds;
+	neb_event ev;
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 
@@ -395,6 +454,13 @@ void broker_flapping_data(int type, int flags, int attr, int flapping_type, void
 	if (data == NULL)
 		return;
 
+	if (flapping_type == SERVICE_FLAPPING)
+		neb_event_init(&ev, type, NULL, (service *)data);
+	else
+		neb_event_init(&ev, type, (host *)data, NULL);
+	if (!neb_wants_event(NEBCALLBACK_FLAPPING_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -419,7 +485,7 @@ void broker_flapping_data(int type, int flags, int attr, int flapping_type, void
 	ds.low_threshold = low_threshold;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_FLAPPING_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_FLAPPING_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -429,10 +495,15 @@ void broker_flapping_data(int type, int flags, int attr, int flapping_type, void
 void broker_program_status(int type, int flags, int attr, struct timeval *timestamp)
 {
 	nebstruct_program_status_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_STATUS_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_PROGRAM_STATUS_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -459,7 +530,7 @@ void broker_program_status(int type, int flags, int attr, struct timeval *timest
 	ds.global_service_event_handler = global_service_event_handler;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_PROGRAM_STATUS_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_PROGRAM_STATUS_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -469,10 +540,15 @@ void broker_program_status(int type, int flags, int attr, struct timeval *timest
 void broker_host_status(int type, int flags, int attr, host *hst, struct timeval *timestamp)
 {
 	nebstruct_host_status_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_STATUS_DATA))
 		return;
 
+	neb_event_init(&ev, type, hst, NULL);
+	if (!neb_wants_event(NEBCALLBACK_HOST_STATUS_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -482,7 +558,7 @@ void broker_host_status(int type, int flags, int attr, host *hst, struct timeval
 	ds.object_ptr = (void *)hst;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_HOST_STATUS_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_HOST_STATUS_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -492,10 +568,15 @@ void broker_host_status(int type, int flags, int attr, host *hst, struct timeval
 void broker_service_status(int type, int flags, int attr, service *svc, struct timeval *timestamp)
 {
 	nebstruct_service_status_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_STATUS_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, svc);
+	if (!neb_wants_event(NEBCALLBACK_SERVICE_STATUS_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -505,7 +586,7 @@ void broker_service_status(int type, int flags, int attr, service *svc, struct t
 	ds.object_ptr = (void *)svc;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_SERVICE_STATUS_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_SERVICE_STATUS_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -515,10 +596,15 @@ void broker_service_status(int type, int flags, int attr, service *svc, struct t
 void broker_contact_status(int type, int flags, int attr, contact *cntct, struct timeval *timestamp)
 {
 	nebstruct_service_status_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_STATUS_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_CONTACT_STATUS_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -528,7 +614,7 @@ void broker_contact_status(int type, int flags, int attr, contact *cntct, struct
 	ds.object_ptr = (void *)cntct;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_CONTACT_STATUS_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_CONTACT_STATUS_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -538,6 +624,7 @@ void broker_contact_status(int type, int flags, int attr, contact *cntct, struct
 int broker_notification_data(int type, int flags, int attr, int notification_type, int reason_type, struct timeval start_time, struct timeval end_time, void *data, char *ack_author, char *ack_data, int escalated, int contacts_notified, struct timeval *timestamp)
 {
 	nebstruct_notification_data ds;
+	neb_event ev;
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 	int return_code = OK;
@@ -545,6 +632,13 @@ int broker_notification_data(int type, int flags, int attr, int notification_typ
 	if (!(event_broker_options & BROKER_NOTIFICATIONS))
 		return return_code;
 
+	if (notification_type == SERVICE_NOTIFICATION)
+		neb_event_init(&ev, type, NULL, (service *)data);
+	else
+		neb_event_init(&ev, type, (host *)data, NULL);
+	if (!neb_wants_event(NEBCALLBACK_NOTIFICATION_DATA, &ev))
+		return return_code;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -575,7 +669,7 @@ int broker_notification_data(int type, int flags, int attr, int notification_typ
 	ds.contacts_notified = contacts_notified;
 
 	/* make callbacks */
-	return_code = neb_make_callbacks(NEBCALLBACK_NOTIFICATION_DATA, (void *)&ds);
+	return_code = neb_make_event_callbacks(NEBCALLBACK_NOTIFICATION_DATA, &ev, (void *)&ds);
 
 	return return_code;
 }
@@ -585,6 +679,7 @@ int broker_notification_data(int type, int flags, int attr, int notification_typ
 int broker_contact_notification_data(int type, int flags, int attr, int notification_type, int reason_type, struct timeval start_time, struct timeval end_time, void *data, contact *cntct, char *ack_author, char *ack_data, int escalated, struct timeval *timestamp)
 {
 	nebstruct_contact_notification_data ds;
+	neb_event ev;
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 	int return_code = OK;
@@ -592,6 +687,13 @@ int broker_contact_notification_data(int type, int flags, int attr, int notifica
 	if (!(event_broker_options & BROKER_NOTIFICATIONS))
 		return return_code;
 
+	if (notification_type == SERVICE_NOTIFICATION)
+		neb_event_init(&ev, type, NULL, (service *)data);
+	else
+		neb_event_init(&ev, type, (host *)data, NULL);
+	if (!neb_wants_event(NEBCALLBACK_CONTACT_NOTIFICATION_DATA, &ev))
+		return return_code;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -623,7 +725,7 @@ int broker_contact_notification_data(int type, int flags, int attr, int notifica
 	ds.escalated = escalated;
 
 	/* make callbacks */
-	return_code = neb_make_callbacks(NEBCALLBACK_CONTACT_NOTIFICATION_DATA, (void *)&ds);
+	return_code = neb_make_event_callbacks(NEBCALLBACK_CONTACT_NOTIFICATION_DATA, &ev, (void *)&ds);
 
 	return return_code;
 }
@@ -633,6 +735,7 @@ int broker_contact_notification_data(int type, int flags, int attr, int notifica
 int broker_contact_notification_method_data(int type, int flags, int attr, int notification_type, int reason_type, struct timeval start_time, struct timeval end_time, void *data, contact *cntct, char *cmd, char *ack_author, char *ack_data, int escalated, struct timeval *timestamp)
 {
 	nebstruct_contact_notification_method_data ds;
+	neb_event ev;
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 	char *command_buf = NULL;
@@ -643,6 +746,13 @@ int broker_contact_notification_method_data(int type, int flags, int attr, int n
 	if (!(event_broker_options & BROKER_NOTIFICATIONS))
 		return return_code;
 
+	if (notification_type == SERVICE_NOTIFICATION)
+		neb_event_init(&ev, type, NULL, (service *)data);
+	else
+		neb_event_init(&ev, type, (host *)data, NULL);
+	if (!neb_wants_event(NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA, &ev))
+		return return_code;
+
 	/* get command name/args */
 	if (cmd != NULL) {
 		command_buf = nm_strdup(cmd);
@@ -683,7 +793,7 @@ int broker_contact_notification_method_data(int type, int flags, int attr, int n
 	ds.escalated = escalated;
 
 	/* make callbacks */
-	return_code = neb_make_callbacks(NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA, (void *)&ds);
+	return_code = neb_make_event_callbacks(NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA, &ev, (void *)&ds);
 
 	/* free memory */
 	my_free(command_buf);
@@ -696,10 +806,15 @@ int broker_contact_notification_method_data(int type, int flags, int attr, int n
 void broker_adaptive_program_data(int type, int flags, int attr, int command_type, unsigned long modhattr, unsigned long modhattrs, unsigned long modsattr, unsigned long modsattrs, struct timeval *timestamp)
 {
 	nebstruct_adaptive_program_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_ADAPTIVE_PROGRAM_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -713,7 +828,7 @@ void broker_adaptive_program_data(int type, int flags, int attr, int command_typ
 	ds.modified_service_attributes = modsattrs;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_ADAPTIVE_PROGRAM_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_ADAPTIVE_PROGRAM_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -723,10 +838,15 @@ void broker_adaptive_program_data(int type, int flags, int attr, int command_typ
 void broker_adaptive_host_data(int type, int flags, int attr, host *hst, int command_type, unsigned long modattr, unsigned long modattrs, struct timeval *timestamp)
 {
 	nebstruct_adaptive_host_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
 		return;
 
+	neb_event_init(&ev, type, hst, NULL);
+	if (!neb_wants_event(NEBCALLBACK_ADAPTIVE_HOST_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -739,7 +859,7 @@ void broker_adaptive_host_data(int type, int flags, int attr, host *hst, int com
 	ds.object_ptr = (void *)hst;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_ADAPTIVE_HOST_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_ADAPTIVE_HOST_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -749,10 +869,15 @@ void broker_adaptive_host_data(int type, int flags, int attr, host *hst, int com
 void broker_adaptive_service_data(int type, int flags, int attr, service *svc, int command_type, unsigned long modattr, unsigned long modattrs, struct timeval *timestamp)
 {
 	nebstruct_adaptive_service_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, svc);
+	if (!neb_wants_event(NEBCALLBACK_ADAPTIVE_SERVICE_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -765,7 +890,7 @@ void broker_adaptive_service_data(int type, int flags, int attr, service *svc, i
 	ds.object_ptr = (void *)svc;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_ADAPTIVE_SERVICE_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_ADAPTIVE_SERVICE_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -775,10 +900,15 @@ void broker_adaptive_service_data(int type, int flags, int attr, service *svc, i
 void broker_adaptive_contact_data(int type, int flags, int attr, contact *cntct, int command_type, unsigned long modattr, unsigned long modattrs, unsigned long modhattr, unsigned long modhattrs, unsigned long modsattr, unsigned long modsattrs, struct timeval *timestamp)
 {
 	nebstruct_adaptive_contact_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_ADAPTIVE_CONTACT_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -795,7 +925,7 @@ void broker_adaptive_contact_data(int type, int flags, int attr, contact *cntct,
 	ds.object_ptr = (void *)cntct;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_ADAPTIVE_CONTACT_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_ADAPTIVE_CONTACT_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -805,10 +935,15 @@ void broker_adaptive_contact_data(int type, int flags, int attr, contact *cntct,
 void broker_external_command(int type, int flags, int attr, int command_type, time_t entry_time, char *command_string, char *command_args, struct timeval *timestamp)
 {
 	nebstruct_external_command_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_EXTERNALCOMMAND_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_EXTERNAL_COMMAND_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -821,7 +956,7 @@ void broker_external_command(int type, int flags, int attr, int command_type, ti
 	ds.command_args = command_args;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_EXTERNAL_COMMAND_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_EXTERNAL_COMMAND_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -831,10 +966,15 @@ void broker_external_command(int type, int flags, int attr, int command_type, ti
 void broker_aggregated_status_data(int type, int flags, int attr, struct timeval *timestamp)
 {
 	nebstruct_aggregated_status_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_STATUS_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_AGGREGATED_STATUS_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -842,7 +982,7 @@ void broker_aggregated_status_data(int type, int flags, int attr, struct timeval
 	ds.timestamp = get_broker_timestamp(timestamp);
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_AGGREGATED_STATUS_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_AGGREGATED_STATUS_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -852,10 +992,15 @@ void broker_aggregated_status_data(int type, int flags, int attr, struct timeval
 void broker_retention_data(int type, int flags, int attr, struct timeval *timestamp)
 {
 	nebstruct_retention_data ds;
+	neb_event ev;
 
 	if (!(event_broker_options & BROKER_RETENTION_DATA))
 		return;
 
+	neb_event_init(&ev, type, NULL, NULL);
+	if (!neb_wants_event(NEBCALLBACK_RETENTION_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -863,7 +1008,7 @@ void broker_retention_data(int type, int flags, int attr, struct timeval *timest
 	ds.timestamp = get_broker_timestamp(timestamp);
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_RETENTION_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_RETENTION_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -873,12 +1018,20 @@ void broker_retention_data(int type, int flags, int attr, struct timeval *timest
 void broker_acknowledgement_data(int type, int flags, int attr, int acknowledgement_type, void *data, char *ack_author, char *ack_data, int subtype, int notify_contacts, int persistent_comment, struct timeval *timestamp)
 {
 	nebstruct_acknowledgement_data ds;
+	neb_event ev;
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 
 	if (!(event_broker_options & BROKER_ACKNOWLEDGEMENT_DATA))
 		return;
 
+	if (acknowledgement_type == SERVICE_ACKNOWLEDGEMENT)
+		neb_event_init(&ev, type, NULL, (service *)data);
+	else
+		neb_event_init(&ev, type, (host *)data, NULL);
+	if (!neb_wants_event(NEBCALLBACK_ACKNOWLEDGEMENT_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -905,7 +1058,7 @@ void broker_acknowledgement_data(int type, int flags, int attr, int acknowledgem
 	ds.persistent_comment = persistent_comment;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_ACKNOWLEDGEMENT_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_ACKNOWLEDGEMENT_DATA, &ev, (void *)&ds);
 
 	return;
 }
@@ -915,12 +1068,20 @@ void broker_acknowledgement_data(int type, int flags, int attr, int acknowledgem
 void broker_statechange_data(int type, int flags, int attr, int statechange_type, void *data, int state, int state_type, int current_attempt, int max_attempts, struct timeval *timestamp)
 {
 	nebstruct_statechange_data ds;
+	neb_event ev;
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 
 	if (!(event_broker_options & BROKER_STATECHANGE_DATA))
 		return;
 
+	if (statechange_type == SERVICE_STATECHANGE)
+		neb_event_init(&ev, type, NULL, (service *)data);
+	else
+		neb_event_init(&ev, type, (host *)data, NULL);
+	if (!neb_wants_event(NEBCALLBACK_STATE_CHANGE_DATA, &ev))
+		return;
+
 	/* fill struct with relevant data */
 	ds.type = type;
 	ds.flags = flags;
@@ -946,7 +1107,7 @@ void broker_statechange_data(int type, int flags, int attr, int statechange_type
 	ds.max_attempts = max_attempts;
 
 	/* make callbacks */
-	neb_make_callbacks(NEBCALLBACK_STATE_CHANGE_DATA, (void *)&ds);
+	neb_make_event_callbacks(NEBCALLBACK_STATE_CHANGE_DATA, &ev, (void *)&ds);
 
 	return;
 }
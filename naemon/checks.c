@@ -8,6 +8,7 @@
 #include "broker.h"
 #include "perfdata.h"
 #include "workers.h"
+#include "resultq.h"
 #include "utils.h"
 #include "events.h"
 #include "flapping.h"
@@ -16,7 +17,10 @@
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "simulation.h"
+#include "snapshot.h"
 #include <string.h>
+#include <math.h>
 
 /*#define DEBUG_CHECKS*/
 /*#define DEBUG_HOST_CHECKS 1*/
@@ -78,12 +82,428 @@ static void handle_worker_check(wproc_result *wpres, void *arg, int flags)
 		cr->exited_ok = wpres->exited_ok;
 		cr->engine = NULL;
 		cr->source = wpres->source;
-		process_check_result(cr);
+		resultq_add(cr);
 	}
 	free_check_result(cr);
 	free(cr);
 }
 
+/******************************************************************/
+/********************* CONCURRENCY LIMITS *************************/
+/******************************************************************/
+
+/*
+ * Commands and hosts may limit how many checks using them can run at
+ * once. A check that would go over a limit waits in a small queue of
+ * that limit's own, and the first one waiting is started as soon as
+ * a running check finishes. When the queue is full, the check is
+ * rescheduled like any other check that can't run right now.
+ */
+#define CHECK_LIMIT_MIN_QUEUE 32	/* checks that may wait per limit is 4x the limit, but at least this */
+
+struct deferred_check {
+	int object_check_type;
+	void *object_ptr;
+	int check_options;
+	int scheduled_check;
+	int reschedule_check;
+	double latency;
+	struct timeval queued;
+};
+
+struct check_limit {
+	unsigned int running;
+	unsigned int head, waiting, size;
+	struct deferred_check *queue;
+};
+
+/* a running check that counts against at least one limit */
+struct limited_check {
+	check_result *cr;
+	int command_id, host_id;	/* -1 if unlimited */
+	int counted;
+};
+
+static struct check_limit *command_limits, *host_limits;
+static unsigned int num_command_limits, num_host_limits;
+
+static struct check_limit *get_check_limit(struct check_limit **limits, unsigned int *len, unsigned int num, int id)
+{
+	if (id < 0)
+		return NULL;
+	if (!*limits) {
+		*limits = nm_calloc(num ? num : 1, sizeof(**limits));
+		*len = num;
+	}
+	return (unsigned int)id < *len ? &(*limits)[id] : NULL;
+}
+
+static struct check_limit *command_limit(int id)
+{
+	return get_check_limit(&command_limits, &num_command_limits, num_objects.commands, id);
+}
+
+static struct check_limit *host_limit(int id)
+{
+	return get_check_limit(&host_limits, &num_host_limits, num_objects.hosts, id);
+}
+
+static struct deferred_check *find_deferred_check(struct check_limit *limit, void *object_ptr)
+{
+	unsigned int i;
+
+	if (!limit)
+		return NULL;
+	for (i = 0; i < limit->waiting; i++) {
+		struct deferred_check *dc = &limit->queue[(limit->head + i) % limit->size];
+		if (dc->object_ptr == object_ptr)
+			return dc;
+	}
+	return NULL;
+}
+
+/*
+ * Returns TRUE if a check using cmd against hst may start now. If
+ * not, the check is queued to start later and *result is what the
+ * caller should return: OK if it's queued, ERROR if the check has to
+ * be rescheduled.
+ */
+static int check_fits_limits(struct deferred_check *check, command *cmd, host *hst, int *result)
+{
+	struct check_limit *limit = NULL, *cl, *hl;
+	struct deferred_check *dc;
+	int max = 0;
+
+	cl = cmd && cmd->max_concurrent_checks > 0 ? command_limit(cmd->id) : NULL;
+	hl = hst && hst->max_concurrent_checks > 0 ? host_limit(hst->id) : NULL;
+
+	/* one that's already waiting just picks up the new options */
+	if ((dc = find_deferred_check(cl, check->object_ptr)) || (dc = find_deferred_check(hl, check->object_ptr))) {
+		dc->check_options |= check->check_options;
+		dc->scheduled_check |= check->scheduled_check;
+		dc->reschedule_check |= check->reschedule_check;
+		*result = OK;
+		return FALSE;
+	}
+
+	if (cl && cl->running >= (unsigned int)cmd->max_concurrent_checks) {
+		limit = cl;
+		max = cmd->max_concurrent_checks;
+	} else if (hl && hl->running >= (unsigned int)hst->max_concurrent_checks) {
+		limit = hl;
+		max = hst->max_concurrent_checks;
+	}
+	if (!limit)
+		return TRUE;
+
+	if (!limit->queue) {
+		limit->size = max * 4 < CHECK_LIMIT_MIN_QUEUE ? CHECK_LIMIT_MIN_QUEUE : max * 4;
+		limit->queue = nm_malloc(limit->size * sizeof(*limit->queue));
+	}
+	if (limit->waiting == limit->size) {
+		log_debug_info(DEBUGL_CHECKS, 1, "Too many checks waiting for the %s limit. Rescheduling this one.\n", limit == cl ? "command" : "host");
+		*result = ERROR;
+		return FALSE;
+	}
+
+	sim_gettimeofday(&check->queued, NULL);
+	limit->queue[(limit->head + limit->waiting++) % limit->size] = *check;
+	log_debug_info(DEBUGL_CHECKS, 1, "Check held back by the %s's max_concurrent_checks (%d), %u waiting\n",
+	               limit == cl ? "command" : "host", max, limit->waiting);
+	*result = OK;
+	return FALSE;
+}
+
+static struct limited_check *create_limited_check(check_result *cr, command *cmd, host *hst)
+{
+	struct limited_check *lc;
+	int command_id = cmd && cmd->max_concurrent_checks > 0 ? (int)cmd->id : -1;
+	int host_id = hst && hst->max_concurrent_checks > 0 ? (int)hst->id : -1;
+
+	if (command_id < 0 && host_id < 0)
+		return NULL;
+
+	lc = nm_malloc(sizeof(*lc));
+	lc->cr = cr;
+	lc->command_id = command_id;
+	lc->host_id = host_id;
+	lc->counted = FALSE;
+	return lc;
+}
+
+/* called once the check has been handed to a worker */
+static void count_limited_check(struct limited_check *lc, int add)
+{
+	struct check_limit *limit;
+
+	if ((limit = command_limit(lc->command_id)))
+		limit->running += add;
+	if ((limit = host_limit(lc->host_id)))
+		limit->running += add;
+	lc->counted = add > 0;
+}
+
+static void run_deferred_check(struct deferred_check *dc)
+{
+	struct timeval now;
+	double latency;
+
+	sim_gettimeofday(&now, NULL);
+	latency = dc->latency + tv_delta_f(&dc->queued, &now);
+
+	if (dc->object_check_type == SERVICE_CHECK) {
+		service *svc = dc->object_ptr;
+
+		/* the scheduler has picked it up again in the meantime */
+		if (dc->scheduled_check && svc->next_check_event)
+			return;
+		if (dc->scheduled_check)
+			run_scheduled_service_check(svc, dc->check_options, latency);
+		else
+			run_async_service_check(svc, dc->check_options, latency, FALSE, dc->reschedule_check, NULL, NULL);
+	} else {
+		host *hst = dc->object_ptr;
+
+		if (dc->scheduled_check && hst->next_check_event)
+			return;
+		if (dc->scheduled_check)
+			run_scheduled_host_check(hst, dc->check_options, latency);
+		else
+			run_async_host_check(hst, dc->check_options, latency, FALSE, dc->reschedule_check, NULL, NULL);
+	}
+}
+
+static void run_deferred_checks(struct check_limit *limit, int max)
+{
+	struct deferred_check dc;
+
+	while (limit && limit->waiting && limit->running < (unsigned int)max) {
+		dc = limit->queue[limit->head];
+		limit->head = (limit->head + 1) % limit->size;
+		limit->waiting--;
+		run_deferred_check(&dc);
+	}
+}
+
+static void handle_limited_worker_check(wproc_result *wpres, void *arg, int flags)
+{
+	struct limited_check *lc = (struct limited_check *)arg;
+	struct check_limit *limit;
+	int counted = lc->counted;
+
+	if (counted)
+		count_limited_check(lc, -1);
+	handle_worker_check(wpres, lc->cr, flags);
+
+	/* no starting new checks while the workers are being torn down */
+	if (counted && wpres) {
+		if ((limit = command_limit(lc->command_id)))
+			run_deferred_checks(limit, command_ary[lc->command_id]->max_concurrent_checks);
+		if ((limit = host_limit(lc->host_id)))
+			run_deferred_checks(limit, host_ary[lc->host_id]->max_concurrent_checks);
+	}
+	free(lc);
+}
+
+void discard_deferred_checks(void)
+{
+	unsigned int i;
+
+	for (i = 0; command_limits && i < num_command_limits; i++)
+		my_free(command_limits[i].queue);
+	for (i = 0; host_limits && i < num_host_limits; i++)
+		my_free(host_limits[i].queue);
+	my_free(command_limits);
+	my_free(host_limits);
+	num_command_limits = num_host_limits = 0;
+}
+
+/******************************************************************/
+/******************* COST-AWARE CHECK PLACEMENT *******************/
+/******************************************************************/
+
+/*
+ * Spreading checks out evenly by count doesn't keep the number of
+ * checks running at once level when some take much longer than the
+ * rest. So we keep a moving average of how long each command's checks
+ * run, and a per-second prediction of how many checks will be running
+ * over the next hour or so. With check_placement_slack set, a service
+ * check may start a little after it's due, at the second where it
+ * overlaps the fewest predicted checks. That's also where adding it
+ * grows the variance of the prediction the least.
+ */
+#define PLACEMENT_HORIZON 4096		/* seconds ahead we predict the number of running checks for */
+#define RUNTIME_EWMA_WEIGHT 0.25	/* weight of the latest execution time in the moving average */
+
+/* where we last placed a service's check, and for how long */
+struct placement {
+	time_t start;
+	time_t moved;	/* how much later than it was due */
+	double runtime;
+};
+
+static double *command_runtimes;
+static unsigned int num_command_runtimes;
+static struct placement *placements;
+static unsigned int num_placements;
+static double predicted_load[PLACEMENT_HORIZON];
+static time_t load_start;	/* the first second predicted_load covers */
+
+static void update_command_runtime(command *cmd, double execution_time)
+{
+	double *avg;
+
+	if (!cmd)
+		return;
+	if (!command_runtimes) {
+		command_runtimes = nm_calloc(num_objects.commands ? num_objects.commands : 1, sizeof(*command_runtimes));
+		num_command_runtimes = num_objects.commands;
+	}
+	if (cmd->id >= num_command_runtimes)
+		return;
+
+	avg = &command_runtimes[cmd->id];
+	if (*avg > 0.0)
+		*avg += RUNTIME_EWMA_WEIGHT * (execution_time - *avg);
+	else
+		*avg = execution_time;
+}
+
+double predicted_check_runtime(service *svc)
+{
+	command *cmd = svc->check_command_ptr;
+
+	if (cmd && cmd->id < num_command_runtimes && command_runtimes[cmd->id] > 0.0)
+		return command_runtimes[cmd->id];
+	/* we haven't seen the command run yet, but may know the service from retention data */
+	return svc->execution_time > 0.0 ? svc->execution_time : 1.0;
+}
+
+/* forget about seconds that have passed */
+static void advance_predicted_load(time_t now)
+{
+	if (now <= load_start)
+		return;
+	if (now - load_start >= PLACEMENT_HORIZON) {
+		memset(predicted_load, 0, sizeof(predicted_load));
+		load_start = now;
+		return;
+	}
+	for (; load_start < now; load_start++)
+		predicted_load[load_start % PLACEMENT_HORIZON] = 0.0;
+}
+
+static void add_predicted_load(time_t start, double runtime, double weight)
+{
+	time_t t;
+
+	for (t = start; runtime > 0.0 && t < load_start + PLACEMENT_HORIZON; t++, runtime -= 1.0) {
+		if (t >= load_start)
+			predicted_load[t % PLACEMENT_HORIZON] += weight * (runtime < 1.0 ? runtime : 1.0);
+	}
+}
+
+time_t place_service_check(service *svc, time_t preferred, time_t latest)
+{
+	struct placement *p;
+	time_t t, best, max_slack;
+	double runtime, cost, best_cost;
+	unsigned int i, span;
+
+	if (!check_placement_slack || !svc)
+		return preferred;
+	if (!placements) {
+		placements = nm_calloc(num_objects.services ? num_objects.services : 1, sizeof(*placements));
+		num_placements = num_objects.services;
+	}
+	if (svc->id >= num_placements)
+		return preferred;
+
+	/* the check we placed last time has run, or is being moved */
+	advance_predicted_load(sim_time(NULL));
+	p = &placements[svc->id];
+	if (p->runtime > 0.0) {
+		add_predicted_load(p->start, p->runtime, -1.0);
+		p->runtime = 0.0;
+	}
+
+	/*
+	 * the next check is due an interval after the last one was due,
+	 * not after it ran, or checks we move would drift further and
+	 * further behind
+	 */
+	preferred -= p->moved;
+	latest -= p->moved;
+	if (preferred < load_start)
+		preferred = load_start;
+	p->moved = 0;
+
+	runtime = predicted_check_runtime(svc);
+	if (runtime > PLACEMENT_HORIZON / 2)
+		runtime = PLACEMENT_HORIZON / 2;
+	span = (unsigned int)ceil(runtime);
+
+	max_slack = check_window(svc) / 2;
+	if (max_slack > check_placement_slack)
+		max_slack = check_placement_slack;
+	if (latest > preferred + max_slack)
+		latest = preferred + max_slack;
+	if (latest > load_start + PLACEMENT_HORIZON - span)
+		latest = load_start + PLACEMENT_HORIZON - span;
+	if (latest < preferred)
+		return preferred;
+
+	/* slide a window as wide as the check's runtime over the slack */
+	for (i = 0, cost = 0.0; i < span; i++)
+		cost += predicted_load[(preferred + i) % PLACEMENT_HORIZON];
+	best = preferred;
+	best_cost = cost;
+	for (t = preferred + 1; t <= latest; t++) {
+		cost += predicted_load[(t + span - 1) % PLACEMENT_HORIZON] - predicted_load[(t - 1) % PLACEMENT_HORIZON];
+		/* don't move for rounding errors */
+		if (cost < best_cost - 0.001) {
+			best = t;
+			best_cost = cost;
+		}
+	}
+
+	if (best != preferred)
+		log_debug_info(DEBUGL_CHECKS, 2, "Moving check of service '%s' on host '%s' %lu seconds later, to where fewer checks are running\n",
+		               svc->description, svc->host_name, (unsigned long)(best - preferred));
+
+	p->start = best;
+	p->moved = best - preferred;
+	p->runtime = runtime;
+	add_predicted_load(best, runtime, 1.0);
+	return best;
+}
+
+/* the check isn't going to start where we placed it, so forget about it */
+void clear_service_check_placement(service *svc)
+{
+	struct placement *p;
+
+	if (!svc || svc->id >= num_placements)
+		return;
+
+	p = &placements[svc->id];
+	if (p->runtime > 0.0) {
+		advance_predicted_load(sim_time(NULL));
+		add_predicted_load(p->start, p->runtime, -1.0);
+	}
+	p->runtime = 0.0;
+	p->moved = 0;
+}
+
+void discard_check_placement(void)
+{
+	my_free(command_runtimes);
+	my_free(placements);
+	num_command_runtimes = num_placements = 0;
+	memset(predicted_load, 0, sizeof(predicted_load));
+	load_start = 0;
+}
+
 /******************************************************************/
 /****************** SERVICE MONITORING FUNCTIONS ******************/
 /******************************************************************/
@@ -124,7 +544,7 @@ int run_scheduled_service_check(service *svc, int check_options, double latency)
 
 	/* reschedule */
 	/* get current time */
-	time(&current_time);
+	current_time = get_event_loop_time();
 
 	/* determine next time we should check the service if needed */
 	/* if service has no check interval, schedule it again for 5 minutes from now */
@@ -168,10 +588,14 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 	nagios_macros mac;
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	struct timeval start_time, end_time;
 	host *temp_host = NULL;
 	double old_latency = 0.0;
 	check_result *cr;
+	struct limited_check *lc;
+	struct deferred_check dc;
+	int deferred_result;
 	int runchk_result = OK;
 	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
 #ifdef USE_EVENT_BROKER
@@ -192,6 +616,16 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 	if ((temp_host = svc->host_ptr) == NULL)
 		return ERROR;
 
+	/* wait for a slot if the command or host is running all the checks it may */
+	dc.object_check_type = SERVICE_CHECK;
+	dc.object_ptr = svc;
+	dc.check_options = check_options;
+	dc.scheduled_check = scheduled_check;
+	dc.reschedule_check = reschedule_check;
+	dc.latency = latency;
+	if (!check_fits_limits(&dc, svc->check_command_ptr, temp_host, &deferred_result))
+		return deferred_result;
+
 	/******** GOOD TO GO FOR A REAL SERVICE CHECK AT THIS POINT ********/
 
 #ifdef USE_EVENT_BROKER
@@ -252,7 +686,7 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 	}
 
 	/* process any macros contained in the argument */
-	process_macros_r(&mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(&mac, svc->check_command_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL) {
 		clear_volatile_macros_r(&mac);
@@ -264,13 +698,14 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 	}
 
 	/* get the command start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 
 	cr = nm_calloc(1, sizeof(*cr));
 	if (!cr) {
 		clear_volatile_macros_r(&mac);
 		svc->latency = old_latency;
 		my_free(processed_command);
+		free_command_argv(argv);
 		return ERROR;
 	}
 	init_check_result(cr);
@@ -301,6 +736,7 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 		svc->latency = old_latency;
 		free_check_result(cr);
 		my_free(processed_command);
+		free_command_argv(argv);
 		return OK;
 	}
 #endif
@@ -309,11 +745,17 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 	svc->latency = old_latency;
 
 	/* paw off the check to a worker to run */
-	runchk_result = wproc_run_callback(processed_command, service_check_timeout, handle_worker_check, (void*)cr, &mac);
+	lc = create_limited_check(cr, svc->check_command_ptr, temp_host);
+	if (lc)
+		runchk_result = wproc_run_callback_argv(processed_command, argv, service_check_timeout, handle_limited_worker_check, (void*)lc, &mac);
+	else
+		runchk_result = wproc_run_callback_argv(processed_command, argv, service_check_timeout, handle_worker_check, (void*)cr, &mac);
 	if (runchk_result == ERROR) {
 		logit(NSLOG_RUNTIME_ERROR, TRUE, "Unable to run check for service '%s' on host '%s'\n", svc->description, svc->host_name);
 	} else {
 		/* do the book-keeping */
+		if (lc)
+			count_limited_check(lc, 1);
 		currently_running_service_checks++;
 		svc->is_executing = TRUE;
 		update_check_stats((scheduled_check == TRUE) ? ACTIVE_SCHEDULED_SERVICE_CHECK_STATS : ACTIVE_ONDEMAND_SERVICE_CHECK_STATS, start_time.tv_sec);
@@ -334,6 +776,7 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	time_t next_service_check = 0L;
 	time_t preferred_time = 0L;
 	time_t next_valid_time = 0L;
+	time_t placed_time = 0L;
 	int reschedule_check = FALSE;
 	int state_change = FALSE;
 	int hard_state_change = FALSE;
@@ -343,6 +786,7 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	int alert_recorded = FALSE;
 	char *old_plugin_output = NULL;
 	char *temp_plugin_output = NULL;
+	char *new_plugin_output = NULL, *new_long_plugin_output = NULL, *new_perf_data = NULL;
 	char *temp_ptr = NULL;
 	servicedependency *temp_dependency = NULL;
 	service *master_service = NULL;
@@ -357,7 +801,7 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 		return ERROR;
 
 	/* get the current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	next_service_check = current_time + check_window(temp_service);
 
@@ -404,6 +848,8 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	temp_service->execution_time = (double)((double)(queued_check_result->finish_time.tv_sec - queued_check_result->start_time.tv_sec) + (double)((queued_check_result->finish_time.tv_usec - queued_check_result->start_time.tv_usec) / 1000.0) / 1000.0);
 	if (temp_service->execution_time < 0.0)
 		temp_service->execution_time = 0.0;
+	if (queued_check_result->check_type == CHECK_TYPE_ACTIVE)
+		update_command_runtime(temp_service->check_command_ptr, temp_service->execution_time);
 
 	/* get the last check time */
 	temp_service->last_check = queued_check_result->start_time.tv_sec;
@@ -425,14 +871,10 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	if (temp_service->plugin_output)
 		old_plugin_output = nm_strdup(temp_service->plugin_output);
 
-	/* clear the old plugin output and perf data buffers */
-	my_free(temp_service->plugin_output);
-	my_free(temp_service->long_plugin_output);
-	my_free(temp_service->perf_data);
-
+	/* build the new plugin output and perf data on the side, as other threads may be reading the old */
 	if (queued_check_result->early_timeout == TRUE) {
 		logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Check of service '%s' on host '%s' timed out after %.3fs!\n", temp_service->description, temp_service->host_name, temp_service->execution_time);
-		nm_asprintf(&temp_service->plugin_output, "(Service check timed out after %.2lf seconds)\n", temp_service->execution_time);
+		nm_asprintf(&new_plugin_output, "(Service check timed out after %.2lf seconds)\n", temp_service->execution_time);
 		temp_service->current_state = service_check_timeout_state;
 	}
 	/* if there was some error running the command, just skip it (this shouldn't be happening) */
@@ -440,7 +882,7 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 
 		logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning:  Check of service '%s' on host '%s' did not exit properly!\n", temp_service->description, temp_service->host_name);
 
-		temp_service->plugin_output = nm_strdup("(Service check did not exit properly)");
+		new_plugin_output = nm_strdup("(Service check did not exit properly)");
 
 		temp_service->current_state = STATE_CRITICAL;
 	}
@@ -452,7 +894,7 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 
 		nm_asprintf(&temp_plugin_output, "\x73\x6f\x69\x67\x61\x6e\x20\x74\x68\x67\x69\x72\x79\x70\x6f\x63\x20\x6e\x61\x68\x74\x65\x20\x64\x61\x74\x73\x6c\x61\x67");
 		my_free(temp_plugin_output);
-		nm_asprintf(&temp_service->plugin_output, "(Return code of %d is out of bounds%s)", queued_check_result->return_code, (queued_check_result->return_code == 126 ? " - plugin may not be executable" : (queued_check_result->return_code == 127 ? " - plugin may be missing" : "")));
+		nm_asprintf(&new_plugin_output, "(Return code of %d is out of bounds%s)", queued_check_result->return_code, (queued_check_result->return_code == 126 ? " - plugin may not be executable" : (queued_check_result->return_code == 127 ? " - plugin may be missing" : "")));
 
 		temp_service->current_state = STATE_CRITICAL;
 	}
@@ -461,28 +903,33 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	else {
 
 		/* parse check output to get: (1) short output, (2) long output, (3) perf data */
-		parse_check_output(queued_check_result->output, &temp_service->plugin_output, &temp_service->long_plugin_output, &temp_service->perf_data, TRUE, FALSE);
+		parse_check_output(queued_check_result->output, &new_plugin_output, &new_long_plugin_output, &new_perf_data, TRUE, FALSE);
 
 		/* make sure the plugin output isn't null */
-		if (temp_service->plugin_output == NULL)
-			temp_service->plugin_output = nm_strdup("(No output returned from plugin)");
+		if (new_plugin_output == NULL)
+			new_plugin_output = nm_strdup("(No output returned from plugin)");
 
 		/* replace semicolons in plugin output (but not performance data) with colons */
-		else if ((temp_ptr = temp_service->plugin_output)) {
+		else if ((temp_ptr = new_plugin_output)) {
 			while ((temp_ptr = strchr(temp_ptr, ';')))
 				* temp_ptr = ':';
 		}
 
 		log_debug_info(DEBUGL_CHECKS, 2, "Parsing check output...\n");
-		log_debug_info(DEBUGL_CHECKS, 2, "Short Output: %s\n", (temp_service->plugin_output == NULL) ? "NULL" : temp_service->plugin_output);
-		log_debug_info(DEBUGL_CHECKS, 2, "Long Output:  %s\n", (temp_service->long_plugin_output == NULL) ? "NULL" : temp_service->long_plugin_output);
-		log_debug_info(DEBUGL_CHECKS, 2, "Perf Data:    %s\n", (temp_service->perf_data == NULL) ? "NULL" : temp_service->perf_data);
+		log_debug_info(DEBUGL_CHECKS, 2, "Short Output: %s\n", (new_plugin_output == NULL) ? "NULL" : new_plugin_output);
+		log_debug_info(DEBUGL_CHECKS, 2, "Long Output:  %s\n", (new_long_plugin_output == NULL) ? "NULL" : new_long_plugin_output);
+		log_debug_info(DEBUGL_CHECKS, 2, "Perf Data:    %s\n", (new_perf_data == NULL) ? "NULL" : new_perf_data);
 
 		/* grab the return code */
 		temp_service->current_state = queued_check_result->return_code;
 	}
 
 
+	/* replace the old plugin output and perf data buffers */
+	snapshot_publish(&temp_service->plugin_output, new_plugin_output);
+	snapshot_publish(&temp_service->long_plugin_output, new_long_plugin_output);
+	snapshot_publish(&temp_service->perf_data, new_perf_data);
+
 	/* record the time the last state ended */
 	switch (temp_service->last_state) {
 	case STATE_OK:
@@ -974,8 +1421,20 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 			temp_service->should_be_scheduled = FALSE;
 
 		/* schedule a non-forced check if we can */
-		if (temp_service->should_be_scheduled == TRUE)
+		if (temp_service->should_be_scheduled == TRUE) {
+			/*
+			 * start it a little later if fewer checks will be running
+			 * then, unless the check period already moved it
+			 */
+			if (next_valid_time == preferred_time) {
+				placed_time = place_service_check(temp_service, next_valid_time, next_valid_time + check_placement_slack);
+				if (check_time_against_period(placed_time, temp_service->check_period_ptr) == OK)
+					temp_service->next_check = placed_time;
+			}
 			schedule_service_check(temp_service, temp_service->next_check, CHECK_OPTION_NONE);
+		} else {
+			clear_service_check_placement(temp_service);
+		}
 	}
 
 	/* if we're stalking this state type and state was not already logged AND the plugin output changed since last check, log it now.. */
@@ -1135,6 +1594,10 @@ void schedule_service_check(service *svc, time_t check_time, int options)
 		log_debug_info(DEBUGL_CHECKS, 2, "Keeping original service check event (ignoring the new one).\n");
 	}
 
+	/* forced and rescheduled checks don't start where we placed them */
+	if (svc->id < num_placements && placements[svc->id].start != svc->next_check)
+		clear_service_check_placement(svc);
+
 
 	/* update the status log */
 	update_service_status(svc, FALSE);
@@ -1165,7 +1628,7 @@ int check_service_check_viability(service *svc, int check_options, int *time_is_
 		check_interval = (svc->check_interval * interval_length);
 
 	/* get the current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* initialize the next preferred check time */
 	preferred_time = current_time;
@@ -1236,7 +1699,7 @@ int check_service_dependencies(service *svc, int dependency_type)
 			continue;
 
 		/* skip this dependency if it has a timeperiod and the current time isn't valid */
-		time(&current_time);
+		sim_time(&current_time);
 		if (temp_dependency->dependency_period != NULL && check_time_against_period(current_time, temp_dependency->dependency_period_ptr) == ERROR)
 			return FALSE;
 
@@ -1272,7 +1735,7 @@ void check_for_orphaned_services(void)
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_for_orphaned_services()\n");
 
 	/* get the current time */
-	time(&current_time);
+	current_time = get_event_loop_time();
 
 	/* check all services... */
 	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
@@ -1329,7 +1792,7 @@ void check_service_result_freshness(void)
 	}
 
 	/* get the current time */
-	time(&current_time);
+	current_time = get_event_loop_time();
 
 	/* check all services... */
 	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
@@ -1629,7 +2092,7 @@ int check_host_dependencies(host *hst, int dependency_type)
 			continue;
 
 		/* skip this dependency if it has a timeperiod and the current time isn't valid */
-		time(&current_time);
+		sim_time(&current_time);
 		if (temp_dependency->dependency_period != NULL && check_time_against_period(current_time, temp_dependency->dependency_period_ptr) == ERROR)
 			return FALSE;
 
@@ -1665,7 +2128,7 @@ void check_for_orphaned_hosts(void)
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_for_orphaned_hosts()\n");
 
 	/* get the current time */
-	time(&current_time);
+	current_time = get_event_loop_time();
 
 	/* check all hosts... */
 	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
@@ -1723,7 +2186,7 @@ void check_host_result_freshness(void)
 	}
 
 	/* get the current time */
-	time(&current_time);
+	current_time = get_event_loop_time();
 
 	/* check all hosts... */
 	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
@@ -1893,7 +2356,7 @@ int run_scheduled_host_check(host *hst, int check_options, double latency)
 		if (hst->should_be_scheduled == TRUE) {
 
 			/* get current time */
-			time(&current_time);
+			current_time = get_event_loop_time();
 
 			/* determine next time we should check the host if needed */
 			/* if host has no check interval, schedule it again for 5 minutes from now */
@@ -1948,9 +2411,13 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 	nagios_macros mac;
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	struct timeval start_time, end_time;
 	double old_latency = 0.0;
 	check_result *cr;
+	struct limited_check *lc;
+	struct deferred_check dc;
+	int deferred_result;
 	int runchk_result = OK;
 	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
 #ifdef USE_EVENT_BROKER
@@ -1972,7 +2439,7 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 			return ERROR;
 		}
 
-		if (hst->last_check + cached_host_check_horizon > time(NULL)) {
+		if (hst->last_check + cached_host_check_horizon > sim_time(NULL)) {
 			log_debug_info(DEBUGL_CHECKS, 0, "Host '%s' was last checked within its cache horizon. Aborting check\n", hst->name);
 			return ERROR;
 		}
@@ -1985,6 +2452,16 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 		return ERROR;
 	}
 
+	/* wait for a slot if the command or host is running all the checks it may */
+	dc.object_check_type = HOST_CHECK;
+	dc.object_ptr = hst;
+	dc.check_options = check_options;
+	dc.scheduled_check = scheduled_check;
+	dc.reschedule_check = reschedule_check;
+	dc.latency = latency;
+	if (!check_fits_limits(&dc, hst->check_command_ptr, hst, &deferred_result))
+		return deferred_result;
+
 	/******** GOOD TO GO FOR A REAL HOST CHECK AT THIS POINT ********/
 
 #ifdef USE_EVENT_BROKER
@@ -2042,7 +2519,7 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 	}
 
 	/* process any macros contained in the argument */
-	process_macros_r(&mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(&mac, hst->check_command_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL) {
 		clear_volatile_macros_r(&mac);
@@ -2051,7 +2528,7 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 	}
 
 	/* get the command start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 
 	cr = nm_calloc(1, sizeof(*cr));
 	if (!cr) {
@@ -2090,15 +2567,22 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 		clear_volatile_macros_r(&mac);
 		free_check_result(cr);
 		my_free(processed_command);
+		free_command_argv(argv);
 		return OK;
 	}
 #endif
 
-	runchk_result = wproc_run_callback(processed_command, host_check_timeout, handle_worker_check, (void*)cr, &mac);
+	lc = create_limited_check(cr, hst->check_command_ptr, hst);
+	if (lc)
+		runchk_result = wproc_run_callback_argv(processed_command, argv, host_check_timeout, handle_limited_worker_check, (void*)lc, &mac);
+	else
+		runchk_result = wproc_run_callback_argv(processed_command, argv, host_check_timeout, handle_worker_check, (void*)cr, &mac);
 	if (runchk_result == ERROR) {
 		logit(NSLOG_RUNTIME_ERROR, TRUE, "Unable to send check for host '%s' to worker (ret=%d)\n", hst->name, runchk_result);
 	} else {
 		/* do the book-keeping */
+		if (lc)
+			count_limited_check(lc, 1);
 		currently_running_host_checks++;
 		hst->is_executing = TRUE;
 		update_check_stats((scheduled_check == TRUE) ? ACTIVE_SCHEDULED_HOST_CHECK_STATS : ACTIVE_ONDEMAND_HOST_CHECK_STATS, start_time.tv_sec);
@@ -2121,6 +2605,7 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	int result = STATE_OK;
 	int reschedule_check = FALSE;
 	char *old_plugin_output = NULL;
+	char *new_plugin_output = NULL, *new_long_plugin_output = NULL, *new_perf_data = NULL;
 	char *temp_ptr = NULL;
 	struct timeval start_time_hires;
 	struct timeval end_time_hires;
@@ -2132,7 +2617,7 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	if (temp_host == NULL || queued_check_result == NULL)
 		return ERROR;
 
-	time(&current_time);
+	sim_time(&current_time);
 
 	log_debug_info(DEBUGL_CHECKS, 1, "** Handling async check result for host '%s' from '%s'...\n", temp_host->name, check_result_source(queued_check_result));
 
@@ -2192,6 +2677,8 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	temp_host->execution_time = (double)((double)(queued_check_result->finish_time.tv_sec - queued_check_result->start_time.tv_sec) + (double)((queued_check_result->finish_time.tv_usec - queued_check_result->start_time.tv_usec) / 1000.0) / 1000.0);
 	if (temp_host->execution_time < 0.0)
 		temp_host->execution_time = 0.0;
+	if (queued_check_result->check_type == CHECK_TYPE_ACTIVE)
+		update_command_runtime(temp_host->check_command_ptr, temp_host->execution_time);
 
 	/* set the checked flag */
 	temp_host->has_been_checked = TRUE;
@@ -2215,29 +2702,24 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	if (temp_host->plugin_output)
 		old_plugin_output = nm_strdup(temp_host->plugin_output);
 
-	/* clear the old plugin output and perf data buffers */
-	my_free(temp_host->plugin_output);
-	my_free(temp_host->long_plugin_output);
-	my_free(temp_host->perf_data);
-
 	/* parse check output to get: (1) short output, (2) long output, (3) perf data */
-	parse_check_output(queued_check_result->output, &temp_host->plugin_output, &temp_host->long_plugin_output, &temp_host->perf_data, TRUE, FALSE);
+	parse_check_output(queued_check_result->output, &new_plugin_output, &new_long_plugin_output, &new_perf_data, TRUE, FALSE);
 
 	/* make sure we have some data */
-	if (temp_host->plugin_output == NULL) {
-		temp_host->plugin_output = nm_strdup("(No output returned from host check)");
+	if (new_plugin_output == NULL) {
+		new_plugin_output = nm_strdup("(No output returned from host check)");
 	}
 
 	/* replace semicolons in plugin output (but not performance data) with colons */
-	if ((temp_ptr = temp_host->plugin_output)) {
+	if ((temp_ptr = new_plugin_output)) {
 		while ((temp_ptr = strchr(temp_ptr, ';')))
 			* temp_ptr = ':';
 	}
 
 	log_debug_info(DEBUGL_CHECKS, 2, "Parsing check output...\n");
-	log_debug_info(DEBUGL_CHECKS, 2, "Short Output: %s\n", (temp_host->plugin_output == NULL) ? "NULL" : temp_host->plugin_output);
-	log_debug_info(DEBUGL_CHECKS, 2, "Long Output:  %s\n", (temp_host->long_plugin_output == NULL) ? "NULL" : temp_host->long_plugin_output);
-	log_debug_info(DEBUGL_CHECKS, 2, "Perf Data:    %s\n", (temp_host->perf_data == NULL) ? "NULL" : temp_host->perf_data);
+	log_debug_info(DEBUGL_CHECKS, 2, "Short Output: %s\n", (new_plugin_output == NULL) ? "NULL" : new_plugin_output);
+	log_debug_info(DEBUGL_CHECKS, 2, "Long Output:  %s\n", (new_long_plugin_output == NULL) ? "NULL" : new_long_plugin_output);
+	log_debug_info(DEBUGL_CHECKS, 2, "Perf Data:    %s\n", (new_perf_data == NULL) ? "NULL" : new_perf_data);
 
 	/* get the unprocessed return code */
 	/* NOTE: for passive checks, this is the final/processed state */
@@ -2247,10 +2729,10 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	if (queued_check_result->check_type == CHECK_TYPE_ACTIVE) {
 		if (queued_check_result->early_timeout) {
 			logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Check of host '%s' timed out after %.2lf seconds\n", temp_host->name, temp_host->execution_time);
-			my_free(temp_host->plugin_output);
-			my_free(temp_host->long_plugin_output);
-			my_free(temp_host->perf_data);
-			nm_asprintf(&temp_host->plugin_output, "(Host check timed out after %.2lf seconds)", temp_host->execution_time);
+			my_free(new_plugin_output);
+			my_free(new_long_plugin_output);
+			my_free(new_perf_data);
+			nm_asprintf(&new_plugin_output, "(Host check timed out after %.2lf seconds)", temp_host->execution_time);
 			result = STATE_UNKNOWN;
 		}
 
@@ -2259,11 +2741,11 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 
 			logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning:  Check of host '%s' did not exit properly!\n", temp_host->name);
 
-			my_free(temp_host->plugin_output);
-			my_free(temp_host->long_plugin_output);
-			my_free(temp_host->perf_data);
+			my_free(new_plugin_output);
+			my_free(new_long_plugin_output);
+			my_free(new_perf_data);
 
-			temp_host->plugin_output = nm_strdup("(Host check did not exit properly)");
+			new_plugin_output = nm_strdup("(Host check did not exit properly)");
 
 			result = STATE_CRITICAL;
 		}
@@ -2273,23 +2755,28 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 
 			logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Return code of %d for check of host '%s' was out of bounds.%s\n", queued_check_result->return_code, temp_host->name, (queued_check_result->return_code == 126 || queued_check_result->return_code == 127) ? " Make sure the plugin you're trying to run actually exists." : "");
 
-			my_free(temp_host->plugin_output);
-			my_free(temp_host->long_plugin_output);
-			my_free(temp_host->perf_data);
+			my_free(new_plugin_output);
+			my_free(new_long_plugin_output);
+			my_free(new_perf_data);
 
-			nm_asprintf(&temp_host->plugin_output, "(Return code of %d is out of bounds%s)", queued_check_result->return_code, (queued_check_result->return_code == 126 || queued_check_result->return_code == 127) ? " - plugin may be missing" : "");
+			nm_asprintf(&new_plugin_output, "(Return code of %d is out of bounds%s)", queued_check_result->return_code, (queued_check_result->return_code == 126 || queued_check_result->return_code == 127) ? " - plugin may be missing" : "");
 
 			result = STATE_CRITICAL;
 		}
 
 		/* a NULL host check command means we should assume the host is UP */
 		if (temp_host->check_command == NULL) {
-			my_free(temp_host->plugin_output);
-			temp_host->plugin_output = nm_strdup("(Host assumed to be UP)");
+			my_free(new_plugin_output);
+			new_plugin_output = nm_strdup("(Host assumed to be UP)");
 			result = STATE_OK;
 		}
 	}
 
+	/* replace the old plugin output and perf data buffers */
+	snapshot_publish(&temp_host->plugin_output, new_plugin_output);
+	snapshot_publish(&temp_host->long_plugin_output, new_long_plugin_output);
+	snapshot_publish(&temp_host->perf_data, new_perf_data);
+
 	/* translate return code to basic UP/DOWN state - the DOWN/UNREACHABLE state determination is made later */
 	/* NOTE: only do this for active checks - passive check results already have the final state */
 	if (queued_check_result->check_type == CHECK_TYPE_ACTIVE) {
@@ -2322,7 +2809,7 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	start_time_hires = queued_check_result->start_time;
 
 	/* high resolution end time for event broker */
-	gettimeofday(&end_time_hires, NULL);
+	sim_gettimeofday(&end_time_hires, NULL);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -2351,7 +2838,7 @@ int process_host_check_result(host *hst, int new_state, char *old_plugin_output,
 	log_debug_info(DEBUGL_CHECKS, 1, "HOST: %s, ATTEMPT=%d/%d, CHECK TYPE=%s, STATE TYPE=%s, OLD STATE=%d, NEW STATE=%d\n", hst->name, hst->current_attempt, hst->max_attempts, (hst->check_type == CHECK_TYPE_ACTIVE) ? "ACTIVE" : "PASSIVE", (hst->state_type == HARD_STATE) ? "HARD" : "SOFT", hst->current_state, new_state);
 
 	/* get the current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* default next check time */
 	next_check = current_time + normal_check_window(hst);
@@ -2612,7 +3099,7 @@ int process_host_check_result(host *hst, int new_state, char *old_plugin_output,
 		hst->should_be_scheduled = TRUE;
 
 		/* get the new current time */
-		time(&current_time);
+		sim_time(&current_time);
 
 		/* make sure we don't get ourselves into too much trouble... */
 		if (current_time > next_check)
@@ -2672,7 +3159,7 @@ int check_host_check_viability(host *hst, int check_options, int *time_is_valid,
 		check_interval = 300;
 
 	/* get the current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* initialize the next preferred check time */
 	preferred_time = current_time;
@@ -2802,7 +3289,7 @@ int handle_host_state(host *hst, int *alert_recorded)
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "handle_host_state()\n");
 
 	/* get current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* obsess over this host check */
 	obsessive_compulsive_host_check_processor(hst);
@@ -53,6 +53,12 @@ int handle_async_service_check_result(service *, check_result *);
 int handle_host_state(host *, int *);               			/* top level host state handler */
 
 int reap_check_results(void);
+void discard_deferred_checks(void);	/* drops checks waiting for a concurrency limit, before objects go away */
+
+time_t place_service_check(service *, time_t, time_t);	/* picks the least busy second between the preferred and latest start */
+double predicted_check_runtime(service *);	/* what we expect a service check to take, in seconds */
+void clear_service_check_placement(service *);	/* forgets where a check was placed, when it was moved elsewhere */
+void discard_check_placement(void);	/* forgets runtimes and placed checks, before objects go away */
 
 void schedule_service_check(service *, time_t, int);	/* schedules an immediate or delayed service check */
 void schedule_host_check(host *, time_t, int);		/* schedules an immediate or delayed host check */
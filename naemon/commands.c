@@ -1388,54 +1388,65 @@ static int global_command_handler(const struct external_command *ext_command, ti
 
 static void foreach_service_on_host(host *target_host, void (*service_fn)(service *))
 {
-	servicesmember *servicesmember_p = NULL;
-	for(servicesmember_p = target_host->services; servicesmember_p != NULL; servicesmember_p = servicesmember_p->next) {
-		service_fn(servicesmember_p->service_ptr);
+	service *service_p;
+	unsigned int i;
+
+	objectarray_foreach(&target_host->service_objs, i, service_p) {
+		service_fn(service_p);
 	}
 
 }
 
 static void foreach_service_in_servicegroup(servicegroup *target_servicegroup, void (*service_fn)(service *))
 {
-	servicesmember *servicesmember_p = NULL;
-	for ( servicesmember_p = target_servicegroup->members; servicesmember_p != NULL; servicesmember_p = servicesmember_p->next) {
-		service_fn(servicesmember_p->service_ptr);
+	service *service_p;
+	unsigned int i;
+
+	objectarray_foreach(&target_servicegroup->member_objs, i, service_p) {
+		service_fn(service_p);
 	}
 }
 
 static void foreach_host_in_servicegroup(servicegroup *target_servicegroup, void (*host_fn)(host *))
 {
-	servicesmember *servicesmember_p = NULL;
-	host *last_host =  NULL, *cur_host = NULL;
-	for ( servicesmember_p = target_servicegroup->members; servicesmember_p != NULL; servicesmember_p = servicesmember_p->next) {
-		cur_host = find_host(servicesmember_p->host_name);
-		if (cur_host == NULL || cur_host == last_host) continue; /*Only apply once for each host*/
-		host_fn(cur_host);
-		last_host = cur_host;
+	service *service_p;
+	host *last_host =  NULL;
+	unsigned int i;
+
+	objectarray_foreach(&target_servicegroup->member_objs, i, service_p) {
+		if (service_p->host_ptr == last_host) continue; /*Only apply once for each host*/
+		host_fn(service_p->host_ptr);
+		last_host = service_p->host_ptr;
 	}
 }
 
 static void foreach_host_in_hostgroup(hostgroup *target_hostgroup, void (*host_fn)(host *))
 {
-	hostsmember *hostsmember_p = NULL;
-	for (hostsmember_p = target_hostgroup->members; hostsmember_p != NULL; hostsmember_p = hostsmember_p->next) {
-		host_fn(hostsmember_p->host_ptr);
+	host *host_p;
+	unsigned int i;
+
+	objectarray_foreach(&target_hostgroup->member_objs, i, host_p) {
+		host_fn(host_p);
 	}
 }
 
 static void foreach_service_in_hostgroup(hostgroup *target_hostgroup, void (*service_fn)(service *))
 {
-	hostsmember *hostsmember_p = NULL;
-	for (hostsmember_p = target_hostgroup->members; hostsmember_p != NULL; hostsmember_p = hostsmember_p->next) {
-		foreach_service_on_host(hostsmember_p->host_ptr, service_fn);
+	host *host_p;
+	unsigned int i;
+
+	objectarray_foreach(&target_hostgroup->member_objs, i, host_p) {
+		foreach_service_on_host(host_p, service_fn);
 	}
 }
 
 static void foreach_contact_in_contactgroup(contactgroup *target_contactgroup, void (*contact_fn)(contact *))
 {
-	contactsmember *contactsmember_p = NULL;
-	for(contactsmember_p = target_contactgroup->members; contactsmember_p != NULL; contactsmember_p = contactsmember_p->next) {
-		contact_fn(contactsmember_p->contact_ptr);
+	contact *contact_p;
+	unsigned int i;
+
+	objectarray_foreach(&target_contactgroup->member_objs, i, contact_p) {
+		contact_fn(contact_p);
 	}
 }
 
@@ -1521,11 +1532,13 @@ static int host_command_handler(const struct external_command *ext_command, time
 			foreach_service_on_host(target_host, disable_service_checks);
 			return OK;
 		case CMD_SCHEDULE_HOST_SVC_CHECKS:
+			event_batch_begin();
 			for(servicesmember_p = target_host->services; servicesmember_p != NULL; servicesmember_p = servicesmember_p->next) {
 				if((service_p = servicesmember_p->service_ptr) == NULL)
 					continue;
 				schedule_service_check(service_p, GV_TIMESTAMP("check_time"), CHECK_OPTION_NONE);
 			}
+			event_batch_commit();
 			return OK;
 		case CMD_DEL_ALL_HOST_COMMENTS:
 			return delete_all_host_comments(target_host->name);
@@ -1567,11 +1580,13 @@ static int host_command_handler(const struct external_command *ext_command, time
 			remove_host_acknowledgement(target_host);
 			return OK;
 		case CMD_SCHEDULE_FORCED_HOST_SVC_CHECKS:
+			event_batch_begin();
 			for (servicesmember_p = target_host->services; servicesmember_p != NULL; servicesmember_p = servicesmember_p->next) {
 				if ((service_p = servicesmember_p->service_ptr) == NULL)
 					continue;
 				schedule_service_check(service_p, GV_TIMESTAMP("check_time"), CHECK_OPTION_FORCE_EXECUTION);
 			}
+			event_batch_commit();
 			return OK;
 		case CMD_SCHEDULE_HOST_DOWNTIME:
 			if (GV_BOOL("fixed") > 0) {
@@ -1663,6 +1678,7 @@ static int host_command_handler(const struct external_command *ext_command, time
 		case CMD_CHANGE_MAX_HOST_CHECK_ATTEMPTS:
 			target_host->max_attempts = GV_INT("check_attempts");
 			target_host->modified_attributes |= MODATTR_MAX_CHECK_ATTEMPTS;
+			invalidate_host_macro_environment(target_host);
 
 			if(target_host->state_type == HARD_STATE && target_host->current_state != HOST_UP && target_host->current_attempt > 1)
 				target_host->current_attempt = target_host->max_attempts;
@@ -1982,6 +1998,7 @@ static int service_command_handler(const struct external_command *ext_command, t
 
 		case CMD_CHANGE_MAX_SVC_CHECK_ATTEMPTS:
 			target_service->max_attempts = GV_INT("check_attempts");
+			invalidate_service_macro_environment(target_service);
 			/* adjust current attempt number if in a hard state */
 			if (target_service->state_type == HARD_STATE && target_service->current_state != STATE_OK && target_service->current_attempt > 1)
 				target_service->current_attempt = target_service->max_attempts;
@@ -2245,10 +2262,12 @@ static int change_custom_var_handler(const struct external_command *ext_command,
 	switch ( ext_command->id ) {
 		case CMD_CHANGE_CUSTOM_SVC_VAR:
 			((service *)GV("service"))->modified_attributes |= MODATTR_CUSTOM_VARIABLE;
+			invalidate_service_macro_environment(GV("service"));
 			return update_service_status(GV("service"), FALSE);
 			break;
 		case CMD_CHANGE_CUSTOM_HOST_VAR:
 			((host *)GV("host_name"))->modified_attributes |= MODATTR_CUSTOM_VARIABLE;
+			invalidate_host_macro_environment(GV("host_name"));
 			return update_host_status(GV("host_name"), FALSE);
 			break;
 		case CMD_CHANGE_CUSTOM_CONTACT_VAR:
@@ -3125,6 +3144,166 @@ const char *cmd_error_strerror(int code)
 /*************** INTERNAL COMMAND IMPLEMENTATIONS  ****************/
 /******************************************************************/
 
+/*
+ * Passive result coalescing. With passive_result_coalesce_window set,
+ * the first passive result for an object is processed right away and
+ * opens a window of that many seconds. Unchanged results that arrive
+ * within it replace each other, and only the latest one is processed
+ * once the window ends, opening the next. Results that may change the
+ * object's state go through immediately and supersede the held one.
+ */
+struct coalesced_result {
+	time_t window_end;
+	timed_event *flush_event;
+	int object_check_type;
+	void *object_ptr;
+	int held;
+	check_result cr;
+};
+
+static struct coalesced_result **coalesced_hosts, **coalesced_services;
+static unsigned int num_coalesced_hosts, num_coalesced_services;
+static unsigned long passive_results_coalesced;
+static unsigned int passive_results_held;
+
+static struct coalesced_result *coalesce_slot(struct coalesced_result ***slots, unsigned int *len, unsigned int num, unsigned int id)
+{
+	if (!*slots) {
+		*slots = nm_calloc(num ? num : 1, sizeof(**slots));
+		*len = num;
+	}
+	if (id >= *len)
+		return NULL;
+	if (!(*slots)[id])
+		(*slots)[id] = nm_calloc(1, sizeof(struct coalesced_result));
+	return (*slots)[id];
+}
+
+static void drop_coalesced_result(struct coalesced_result *cor)
+{
+	my_free(cor->cr.output);
+	cor->held = FALSE;
+	passive_results_held--;
+}
+
+static void process_coalesced_result(struct coalesced_result *cor)
+{
+	check_result cr = cor->cr;
+
+	cor->held = FALSE;
+	passive_results_held--;
+	cor->cr.output = NULL;
+
+	if (cor->object_check_type == SERVICE_CHECK) {
+		service *svc = cor->object_ptr;
+		if (accept_passive_service_checks && svc->accept_passive_checks)
+			handle_async_service_check_result(svc, &cr);
+	} else {
+		host *hst = cor->object_ptr;
+		if (accept_passive_host_checks && hst->accept_passive_checks)
+			handle_async_host_check_result(hst, &cr);
+	}
+	my_free(cr.output);
+}
+
+static void flush_coalesced_result(void *arg)
+{
+	struct coalesced_result *cor = (struct coalesced_result *)arg;
+
+	/* the event loop frees the event once we return */
+	cor->flush_event = NULL;
+	if (!cor->held)
+		return;
+
+	cor->window_end = time(NULL) + passive_result_coalesce_window;
+	process_coalesced_result(cor);
+}
+
+/*
+ * returns TRUE if the result was held back, in which case the caller
+ * is done with it. Otherwise, the caller should process it right away.
+ */
+static int coalesce_passive_result(int object_check_type, void *object_ptr, unsigned int id, int may_change_state, check_result *cr)
+{
+	struct coalesced_result *cor;
+	time_t now;
+
+	if (passive_result_coalesce_window <= 0)
+		return FALSE;
+
+	if (object_check_type == SERVICE_CHECK)
+		cor = coalesce_slot(&coalesced_services, &num_coalesced_services, num_objects.services, id);
+	else
+		cor = coalesce_slot(&coalesced_hosts, &num_coalesced_hosts, num_objects.hosts, id);
+	if (!cor)
+		return FALSE;
+
+	if (may_change_state) {
+		if (cor->held) {
+			drop_coalesced_result(cor);
+			passive_results_coalesced++;
+		}
+		return FALSE;
+	}
+
+	now = time(NULL);
+	if (now >= cor->window_end) {
+		cor->window_end = now + passive_result_coalesce_window;
+		return FALSE;
+	}
+
+	if (cor->held) {
+		my_free(cor->cr.output);
+		passive_results_coalesced++;
+	} else {
+		cor->held = TRUE;
+		passive_results_held++;
+	}
+	cor->object_check_type = object_check_type;
+	cor->object_ptr = object_ptr;
+	cor->cr = *cr;
+	cor->cr.output = nm_strdup(cr->output);
+
+	if (!cor->flush_event)
+		cor->flush_event = schedule_new_event(EVENT_USER_FUNCTION, TRUE, cor->window_end, FALSE, 0, NULL, FALSE, (void *)flush_coalesced_result, cor, 0);
+
+	return TRUE;
+}
+
+static void flush_coalesced_slots(struct coalesced_result **slots, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		struct coalesced_result *cor = slots[i];
+		if (!cor)
+			continue;
+		if (cor->flush_event) {
+			remove_event(nagios_squeue, cor->flush_event);
+			my_free(cor->flush_event);
+		}
+		if (cor->held)
+			process_coalesced_result(cor);
+		free(cor);
+	}
+	free(slots);
+}
+
+void flush_coalesced_passive_results(void)
+{
+	flush_coalesced_slots(coalesced_services, num_coalesced_services);
+	flush_coalesced_slots(coalesced_hosts, num_coalesced_hosts);
+	coalesced_services = coalesced_hosts = NULL;
+	num_coalesced_services = num_coalesced_hosts = 0;
+}
+
+int dump_passive_coalesce_stats(int sd)
+{
+	nsock_printf_nul(sd, "coalesce_window=%d;coalesced=%lu;held=%u;",
+	                 passive_result_coalesce_window, passive_results_coalesced, passive_results_held);
+	return OK;
+}
+
 /* submits a passive service check result for later processing */
 int process_passive_service_check(time_t check_time, char *host_name, char *svc_description, int return_code, char *output)
 {
@@ -3132,6 +3311,7 @@ int process_passive_service_check(time_t check_time, char *host_name, char *svc_
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 	struct timeval tv;
+	int may_change_state;
 
 	/* skip this service check result if we aren't accepting passive service checks */
 	if (accept_passive_service_checks == FALSE)
@@ -3179,6 +3359,12 @@ int process_passive_service_check(time_t check_time, char *host_name, char *svc_
 	if (cr.latency < 0.0)
 		cr.latency = 0.0;
 
+	/* a new state, or a soft problem moving along, is never held back */
+	may_change_state = cr.return_code != temp_service->current_state ||
+	                   (temp_service->state_type == SOFT_STATE && temp_service->current_state != STATE_OK);
+	if (coalesce_passive_result(SERVICE_CHECK, temp_service, temp_service->id, may_change_state, &cr))
+		return OK;
+
 	return handle_async_service_check_result(temp_service, &cr);
 }
 
@@ -3188,6 +3374,7 @@ int process_passive_host_check(time_t check_time, char *host_name, int return_co
 	check_result cr;
 	host *temp_host = NULL;
 	struct timeval tv;
+	int may_change_state;
 
 	/* skip this host check result if we aren't accepting passive host checks */
 	if (accept_passive_host_checks == FALSE)
@@ -3229,6 +3416,11 @@ int process_passive_host_check(time_t check_time, char *host_name, int return_co
 	if (cr.latency < 0.0)
 		cr.latency = 0.0;
 
+	may_change_state = cr.return_code != temp_host->current_state ||
+	                   (temp_host->state_type == SOFT_STATE && temp_host->current_state != STATE_UP);
+	if (coalesce_passive_result(HOST_CHECK, temp_host, temp_host->id, may_change_state, &cr))
+		return OK;
+
 	handle_async_host_check_result(temp_host, &cr);
 
 	return OK;
@@ -211,6 +211,8 @@ int process_external_commands_from_file(char *, int);   /* process external comm
 
 int process_passive_service_check(time_t, char *, char *, int, char *);
 int process_passive_host_check(time_t, char *, int, char *);
+void flush_coalesced_passive_results(void);	/* processes held passive results, before objects go away */
+int dump_passive_coalesce_stats(int sd);
 
 /* Internal Command Implementations */
 
@@ -5,6 +5,7 @@
 #include "objects.h"
 #include "broker.h"
 #include "events.h"
+#include "journal.h"
 #include "globals.h"
 #include "nm_alloc.h"
 
@@ -70,6 +71,7 @@ int add_new_host_comment(int entry_type, char *host_name, time_t entry_time, cha
 
 	/* add comment to list in memory */
 	add_host_comment(entry_type, host_name, entry_time, author_name, comment_data, next_comment_id, persistent, expires, expire_time, source);
+	journal_comment(find_host_comment(next_comment_id));
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -94,6 +96,7 @@ int add_new_service_comment(int entry_type, char *host_name, char *svc_descripti
 
 	/* add comment to list in memory */
 	add_service_comment(entry_type, host_name, svc_description, entry_time, author_name, comment_data, next_comment_id, persistent, expires, expire_time, source);
+	journal_comment(find_service_comment(next_comment_id));
 
 	if (comment_id != NULL)
 		*comment_id = next_comment_id;
@@ -141,6 +144,9 @@ int delete_comment(int type, unsigned long comment_id)
 	if (this_comment == NULL)
 		return ERROR;
 
+	if (this_comment->entry_type != DOWNTIME_COMMENT)
+		journal_comment_delete(type, comment_id);
+
 	/* remove the comment from the list in memory */
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
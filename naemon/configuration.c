@@ -11,6 +11,7 @@
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "perfsink.h"
 #include <sys/types.h>
 #include <dirent.h>
 #include <string.h>
@@ -134,9 +135,21 @@ int read_main_config_file(const char *main_config_file)
 			error = set_loadctl_options(value, strlen(value)) != OK;
 		else if (!strcmp(variable, "check_workers"))
 			num_check_workers = atoi(value);
+		else if (!strcmp(variable, "worker_shm_transport"))
+			worker_shm_transport = (atoi(value) > 0) ? TRUE : FALSE;
+		else if (!strcmp(variable, "worker_batch_window"))
+			worker_batch_window = strtoul(value, NULL, 0);
+		else if (!strcmp(variable, "worker_batch_size"))
+			worker_batch_size = strtoul(value, NULL, 0);
+		else if (!strcmp(variable, "simulation_recording_file")) {
+			my_free(simulation_recording_file);
+			simulation_recording_file = nspath_absolute(value, config_file_dir);
+		}
 		else if (!strcmp(variable, "query_socket")) {
 			my_free(qh_socket_path);
 			qh_socket_path = nspath_absolute(value, config_file_dir);
+		} else if (!strcmp(variable, "query_handler_threads")) {
+			qh_threads = strtoul(value, NULL, 0);
 		} else if (!strcmp(variable, "log_file")) {
 
 			if (strlen(value) > MAX_FILENAME_LENGTH - 1) {
@@ -430,6 +443,9 @@ int read_main_config_file(const char *main_config_file)
 			}
 		}
 
+		else if (!strcmp(variable, "retention_load_threads"))
+			retention_load_threads = strtoul(value, NULL, 0);
+
 		else if (!strcmp(variable, "additional_freshness_latency"))
 			additional_freshness_latency = atoi(value);
 
@@ -641,6 +657,16 @@ int read_main_config_file(const char *main_config_file)
 		else if (!strcmp(variable, "accept_passive_host_checks"))
 			accept_passive_host_checks = (atoi(value) > 0) ? TRUE : FALSE;
 
+		else if (!strcmp(variable, "passive_result_coalesce_window")) {
+
+			passive_result_coalesce_window = atoi(value);
+			if (passive_result_coalesce_window < 0) {
+				nm_asprintf(&error_message, "Illegal value for passive_result_coalesce_window");
+				error = TRUE;
+				break;
+			}
+		}
+
 		else if (!strcmp(variable, "service_inter_check_delay_method")) {
 			if (!strcmp(value, "n"))
 				service_inter_check_delay_method = ICD_NONE;
@@ -669,6 +695,16 @@ int read_main_config_file(const char *main_config_file)
 			}
 		}
 
+		else if (!strcmp(variable, "check_placement_slack")) {
+			strip(value);
+			check_placement_slack = atoi(value);
+			if (check_placement_slack < 0) {
+				nm_asprintf(&error_message, "Illegal value for check_placement_slack");
+				error = TRUE;
+				break;
+			}
+		}
+
 		else if (!strcmp(variable, "host_inter_check_delay_method")) {
 
 			if (!strcmp(value, "n"))
@@ -739,6 +775,17 @@ int read_main_config_file(const char *main_config_file)
 			}
 		}
 
+		else if (!strcmp(variable, "prioritize_state_changes")) {
+
+			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
+				nm_asprintf(&error_message, "Illegal value for prioritize_state_changes");
+				error = TRUE;
+				break;
+			}
+
+			prioritize_state_changes = (atoi(value) > 0) ? TRUE : FALSE;
+		}
+
 		else if (!strcmp(variable, "sleep_time")) {
 			obsoleted_warning(variable, NULL);
 		}
@@ -959,6 +1006,20 @@ int read_main_config_file(const char *main_config_file)
 #endif
 		}
 
+		else if (!strcmp(variable, "isolated_broker_module")) {
+			modptr = strtok(value, " \n");
+			argptr = strtok(NULL, "\n");
+#ifdef USE_EVENT_BROKER
+			modptr = nspath_absolute(modptr, config_file_dir);
+			if (modptr) {
+				neb_add_isolated_module(modptr, argptr);
+				free(modptr);
+			} else {
+				logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to allocate module path memory for '%s'\n", value);
+			}
+#endif
+		}
+
 		else if (!strcmp(variable, "use_regexp_matching"))
 			use_regexp_matches = (atoi(value) > 0) ? TRUE : FALSE;
 
@@ -1018,8 +1079,17 @@ int read_main_config_file(const char *main_config_file)
 		/* BEGIN status data variables */
 		else if (!strcmp(variable, "status_file"))
 			status_file = nspath_absolute(value, config_file_dir);
+		else if (!strcmp(variable, "status_shm_segment")) {
+			my_free(status_shm_segment);
+			status_shm_segment = nm_strdup(value);
+		}
 		else if (strstr(input, "state_retention_file=") == input)
 			retention_file = nspath_absolute(value, config_file_dir);
+		else if (!strcmp(variable, "state_journal_file")) {
+			my_free(state_journal_file);
+			state_journal_file = nspath_absolute(value, config_file_dir);
+		} else if (!strcmp(variable, "state_journal_commit_interval"))
+			state_journal_commit_interval = strtoul(value, NULL, 0);
 		/* END status data variables */
 
 		/*** BEGIN perfdata variables ***/
@@ -1065,6 +1135,21 @@ int read_main_config_file(const char *main_config_file)
 			host_perfdata_process_empty_results = (atoi(value) > 0) ? TRUE : FALSE;
 		else if (!strcmp(variable, "service_perfdata_process_empty_results"))
 			service_perfdata_process_empty_results = (atoi(value) > 0) ? TRUE : FALSE;
+		else if (!strcmp(variable, "perfdata_sink")) {
+			my_free(perfdata_sink);
+			perfdata_sink = nspath_absolute(value, config_file_dir);
+		} else if (!strcmp(variable, "perfdata_sink_format")) {
+			if (!strcmp(value, "influx"))
+				perfdata_sink_format = PERFSINK_INFLUX;
+			else if (!strcmp(value, "graphite"))
+				perfdata_sink_format = PERFSINK_GRAPHITE;
+			else {
+				nm_asprintf(&error_message, "Illegal value for perfdata_sink_format");
+				error = TRUE;
+				break;
+			}
+		} else if (!strcmp(variable, "perfdata_sink_buffer_size"))
+			perfdata_sink_buffer_size = strtoul(value, NULL, 0);
 		/*** END perfdata variables */
 
 		else if (strstr(input, "cfg_file=") == input || strstr(input, "cfg_dir=") == input)
@@ -1077,6 +1162,9 @@ int read_main_config_file(const char *main_config_file)
 		} else if (strstr(input, "precached_object_file=") == input) {
 			my_free(object_precache_file);
 			object_precache_file = nspath_absolute(value, config_file_dir);
+		} else if (!strcmp(variable, "object_parse_cache_file")) {
+			my_free(object_parse_cache_file);
+			object_parse_cache_file = nspath_absolute(value, config_file_dir);
 		} else if (!strcmp(variable, "allow_empty_hostgroup_assignment")) {
 			allow_empty_hostgroup_assignment = (atoi(value) > 0) ? TRUE : FALSE;
 		}
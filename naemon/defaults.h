@@ -22,8 +22,12 @@
 #define DEFAULT_MAX_REAPER_TIME                 		30      /* maximum number of seconds to spend reaping service checks before we break out for a while */
 #define DEFAULT_MAX_CHECK_RESULT_AGE				3600    /* maximum number of seconds that a check result file is considered to be valid */
 #define DEFAULT_MAX_PARALLEL_SERVICE_CHECKS 			0	/* maximum number of service checks we can have running at any given time (0=unlimited) */
+#define DEFAULT_PRIORITIZE_STATE_CHANGES			1	/* process check results that change states before the rest */
+#define DEFAULT_PASSIVE_RESULT_COALESCE_WINDOW			0	/* seconds to hold back unchanged passive results for an object (0=process them all) */
 #define DEFAULT_RETENTION_UPDATE_INTERVAL			60	/* minutes between auto-save of retention data */
+#define DEFAULT_STATE_JOURNAL_COMMIT_INTERVAL			100	/* max milliseconds between syncs of the state journal */
 #define DEFAULT_RETENTION_SCHEDULING_HORIZON    		900     /* max seconds between program restarts that we will preserve scheduling information */
+#define DEFAULT_RETENTION_LOAD_THREADS				0	/* threads reading retention data at startup (0=one per cpu, up to 8) */
 #define DEFAULT_STATUS_UPDATE_INTERVAL				60	/* seconds between aggregated status data updates */
 #define DEFAULT_FRESHNESS_CHECK_INTERVAL        		60      /* seconds between service result freshness checks */
 #define DEFAULT_ORPHAN_CHECK_INTERVAL           		60      /* seconds between checks for orphaned hosts and services */
@@ -38,6 +42,8 @@
 #define DEFAULT_OCHP_TIMEOUT					15	/* max time in seconds to wait for obsessive compulsive processing commands to complete */
 #define DEFAULT_PERFDATA_TIMEOUT                		5       /* max time in seconds to wait for performance data commands to complete */
 #define DEFAULT_TIME_CHANGE_THRESHOLD				900	/* compensate for time changes of more than 15 minutes */
+#define DEFAULT_WORKER_BATCH_WINDOW				1000	/* max microseconds a worker holds back check results */
+#define DEFAULT_WORKER_BATCH_SIZE				64	/* max check results a worker sends in one go */
 
 #define DEFAULT_LOG_HOST_RETRIES				0	/* don't log host retries */
 #define DEFAULT_LOG_SERVICE_RETRIES				0	/* don't log service retries */
@@ -69,6 +75,7 @@
 
 #define DEFAULT_HOST_CHECK_SPREAD				30	/* max minutes to schedule all initial host checks */
 #define DEFAULT_SERVICE_CHECK_SPREAD				30	/* max minutes to schedule all initial service checks */
+#define DEFAULT_CHECK_PLACEMENT_SLACK				0	/* max seconds to move a service check to where fewer checks run (0=don't) */
 
 #define DEFAULT_CACHED_HOST_CHECK_HORIZON      			15      /* max age in seconds that cached host checks can be used */
 #define DEFAULT_CACHED_SERVICE_CHECK_HORIZON    		15      /* max age in seconds that cached service checks can be used */
@@ -93,6 +100,7 @@
 #define DEFAULT_SERVICE_PERFDATA_FILE_TEMPLATE "[SERVICEPERFDATA]\t$TIMET$\t$HOSTNAME$\t$SERVICEDESC$\t$SERVICEEXECUTIONTIME$\t$SERVICELATENCY$\t$SERVICEOUTPUT$\t$SERVICEPERFDATA$"
 #define DEFAULT_HOST_PERFDATA_PROCESS_EMPTY_RESULTS 1
 #define DEFAULT_SERVICE_PERFDATA_PROCESS_EMPTY_RESULTS 1
+#define DEFAULT_PERFDATA_SINK_BUFFER_SIZE (1024 * 1024)	/* max bytes the perfdata sink holds on to */
 
 
 /* Legacy way to find out default locations - do not go near these, as they
@@ -8,7 +8,9 @@
 #include "notifications.h"
 #include "logging.h"
 #include "globals.h"
+#include "journal.h"
 #include "nm_alloc.h"
+#include "simulation.h"
 #include <string.h>
 
 
@@ -222,7 +224,7 @@ int schedule_downtime(int type, char *host_name, char *service_description, time
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "schedule_downtime()\n");
 
 	/* don't add old or invalid downtimes */
-	if (start_time >= end_time || end_time <= time(NULL)) {
+	if (start_time >= end_time || end_time <= sim_time(NULL)) {
 		log_debug_info(DEBUGL_DOWNTIME, 1, "Invalid start (%lu) or end (%lu) times\n",
 		               start_time, end_time);
 		return ERROR;
@@ -446,9 +448,9 @@ int register_downtime(int type, unsigned long downtime_id)
 
 	/* add a non-persistent comment to the host or service regarding the scheduled outage */
 	if (temp_downtime->type == SERVICE_DOWNTIME)
-		add_new_comment(SERVICE_COMMENT, DOWNTIME_COMMENT, svc->host_name, svc->description, time(NULL), (NULL == temp_downtime->author ? "(Nagios Process)" : temp_downtime->author), temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(temp_downtime->comment_id));
+		add_new_comment(SERVICE_COMMENT, DOWNTIME_COMMENT, svc->host_name, svc->description, sim_time(NULL), (NULL == temp_downtime->author ? "(Nagios Process)" : temp_downtime->author), temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(temp_downtime->comment_id));
 	else
-		add_new_comment(HOST_COMMENT, DOWNTIME_COMMENT, hst->name, NULL, time(NULL), (NULL == temp_downtime->author ? "(Nagios Process)" : temp_downtime->author), temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(temp_downtime->comment_id));
+		add_new_comment(HOST_COMMENT, DOWNTIME_COMMENT, hst->name, NULL, sim_time(NULL), (NULL == temp_downtime->author ? "(Nagios Process)" : temp_downtime->author), temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(temp_downtime->comment_id));
 
 	my_free(temp_buffer);
 
@@ -679,6 +681,7 @@ int handle_scheduled_downtime(scheduled_downtime *temp_downtime)
 
 		/* set the in effect flag */
 		temp_downtime->is_in_effect = TRUE;
+		journal_downtime(temp_downtime);
 
 		/* update the status data */
 		if (temp_downtime->type == HOST_DOWNTIME)
@@ -722,7 +725,7 @@ int check_pending_flex_host_downtime(host *hst)
 	if (hst == NULL)
 		return ERROR;
 
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* if host is currently up, nothing to do */
 	if (hst->current_state == HOST_UP)
@@ -777,7 +780,7 @@ int check_pending_flex_service_downtime(service *svc)
 	if (svc == NULL)
 		return ERROR;
 
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* if service is currently ok, nothing to do */
 	if (svc->current_state == STATE_OK)
@@ -832,7 +835,7 @@ int check_for_expired_downtime(void)
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_for_expired_downtime()\n");
 
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* check all downtime entries... */
 	for (temp_downtime = scheduled_downtime_list; temp_downtime != NULL; temp_downtime = next_downtime) {
@@ -933,6 +936,9 @@ int add_new_host_downtime(char *host_name, time_t entry_time, char *author, char
 	if (downtime_id != NULL)
 		*downtime_id = new_downtime_id;
 
+	if (result == OK)
+		journal_downtime(find_downtime(HOST_DOWNTIME, new_downtime_id));
+
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
 	broker_downtime_data(NEBTYPE_DOWNTIME_ADD, NEBFLAG_NONE, NEBATTR_NONE, HOST_DOWNTIME, host_name, NULL, entry_time, author, comment_data, start_time, end_time, fixed, triggered_by, duration, new_downtime_id, NULL);
@@ -965,6 +971,9 @@ int add_new_service_downtime(char *host_name, char *service_description, time_t
 	if (downtime_id != NULL)
 		*downtime_id = new_downtime_id;
 
+	if (result == OK)
+		journal_downtime(find_downtime(SERVICE_DOWNTIME, new_downtime_id));
+
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
 	broker_downtime_data(NEBTYPE_DOWNTIME_ADD, NEBFLAG_NONE, NEBATTR_NONE, SERVICE_DOWNTIME, host_name, service_description, entry_time, author, comment_data, start_time, end_time, fixed, triggered_by, duration, new_downtime_id, NULL);
@@ -988,6 +997,7 @@ int delete_downtime(int type, unsigned long downtime_id)
 	if (!this_downtime)
 		return ERROR;
 
+	journal_downtime_delete(type, downtime_id);
 	downtime_remove(this_downtime);
 
 	/* first remove the comment associated with this downtime */
@@ -4,18 +4,26 @@
 #include "comments.h"
 #include "statusdata.h"
 #include "broker.h"
+#include "nebmods.h"
 #include "sretention.h"
+#include "journal.h"
+#include "perfsink.h"
+#include "simulation.h"
+#include "snapshot.h"
 #include "workers.h"
 #include "lib/squeue.h"
 #include "events.h"
 #include "utils.h"
 #include "checks.h"
 #include "notifications.h"
+#include "resultq.h"
+#include "submit.h"
 #include "logging.h"
 #include "globals.h"
 #include "defaults.h"
 #include "loadctl.h"
 #include "nm_alloc.h"
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 
@@ -24,6 +32,196 @@ static timed_event *current_event;
 
 static unsigned int event_count[EVENT_USER_FUNCTION + 1];
 
+/*
+ * The scheduling queue is keyed on CLOCK_MONOTONIC rather than on the
+ * wall clock. Event run_times are still wall clock timestamps, and
+ * add_event() translates them using sched_skew, the difference between
+ * the two clocks in microseconds. A system time change then only moves
+ * sched_skew, and only the few events pinned to wall clock times have
+ * to be requeued.
+ *
+ * The event loop also caches the current time once per iteration, so
+ * the code it runs doesn't have to ask the kernel over and over.
+ */
+static long long sched_skew;
+static long long loop_skew;
+static struct timeval loop_mono_now;
+static time_t loop_time;
+
+static long long tv_to_usec(const struct timeval *tv)
+{
+	return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* refresh the cached loop time */
+void update_event_loop_time(void)
+{
+	struct timeval wall;
+	struct timespec ts;
+
+	/* the virtual clock never jumps, so it serves as both */
+	if (simulation_mode) {
+		loop_mono_now = sim_clock;
+		loop_time = sim_clock.tv_sec;
+		loop_skew = 0;
+		return;
+	}
+
+	gettimeofday(&wall, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	loop_mono_now.tv_sec = ts.tv_sec;
+	loop_mono_now.tv_usec = ts.tv_nsec / 1000;
+	loop_time = wall.tv_sec;
+	loop_skew = tv_to_usec(&wall) - tv_to_usec(&loop_mono_now);
+}
+
+/*
+ * the wall clock time as of the last loop iteration. Only fresh for
+ * code running from timed events; everything else should use sim_time()
+ */
+time_t get_event_loop_time(void)
+{
+	if (!loop_time)
+		update_event_loop_time();
+	return loop_time;
+}
+
+/* translate an event's run_time to the queue's clock */
+static void event_queue_time(timed_event *event, struct timeval *tv)
+{
+	struct timeval now;
+	long long when;
+
+	/*
+	 * high priority events get a fixed sub-second part; the rest use
+	 * the real microseconds so events for the same second run FIFO
+	 */
+	if (event->priority) {
+		tv->tv_usec = event->priority - 1;
+	} else {
+		sim_gettimeofday(&now, NULL);
+		tv->tv_usec = now.tv_usec;
+	}
+	when = (long long)event->run_time * 1000000 + tv->tv_usec - sched_skew;
+
+	/* we can't schedule events in the past */
+	if (when < tv_to_usec(&loop_mono_now))
+		when = tv_to_usec(&loop_mono_now) - tv_to_usec(&loop_mono_now) % 1000000 + tv->tv_usec;
+
+	tv->tv_sec = when / 1000000;
+	tv->tv_usec = when % 1000000;
+}
+
+/* add an event to the queue, translating its run_time to the queue's clock */
+static squeue_event *queue_timed_event(squeue_t *sq, timed_event *event)
+{
+	struct timeval tv;
+
+	event_queue_time(event, &tv);
+	return squeue_add_tv(sq, &tv, event);
+}
+
+/*
+ * While a batch is open, add_event() and remove_event() on the main
+ * queue only record what they would have done, and event_batch_commit()
+ * applies all of it with one squeue_remove_bulk() and one
+ * squeue_add_bulk(). Events waiting for the commit have their sq_event
+ * set to EVENT_BATCHED so they still look scheduled to everyone else.
+ */
+static struct {
+	int open;
+	unsigned int adds, add_alloc;
+	timed_event **add;
+	struct timeval *add_when;
+	unsigned int dels, del_alloc;
+	squeue_event **del;
+} event_batch;
+#define EVENT_BATCHED ((squeue_event *)&event_batch)
+
+void event_batch_begin(void)
+{
+	event_batch.open = TRUE;
+}
+
+static void event_batch_add(timed_event *event)
+{
+	if (event_batch.adds >= event_batch.add_alloc) {
+		event_batch.add_alloc = event_batch.add_alloc * 2 + 64;
+		event_batch.add = nm_realloc(event_batch.add, sizeof(*event_batch.add) * event_batch.add_alloc);
+		event_batch.add_when = nm_realloc(event_batch.add_when, sizeof(*event_batch.add_when) * event_batch.add_alloc);
+	}
+	event_queue_time(event, &event_batch.add_when[event_batch.adds]);
+	event_batch.add[event_batch.adds++] = event;
+	event->sq_event = EVENT_BATCHED;
+}
+
+static void event_batch_remove(timed_event *event)
+{
+	unsigned int i;
+
+	if (event->sq_event != EVENT_BATCHED) {
+		if (event_batch.dels >= event_batch.del_alloc) {
+			event_batch.del_alloc = event_batch.del_alloc * 2 + 64;
+			event_batch.del = nm_realloc(event_batch.del, sizeof(*event_batch.del) * event_batch.del_alloc);
+		}
+		event_batch.del[event_batch.dels++] = event->sq_event;
+		return;
+	}
+
+	/*
+	 * dropping an event we added in the same batch is rare, and it's
+	 * usually the last one we added, so search from the end
+	 */
+	for (i = event_batch.adds; i-- > 0;) {
+		if (event_batch.add[i] != event)
+			continue;
+		event_batch.adds--;
+		event_batch.add[i] = event_batch.add[event_batch.adds];
+		event_batch.add_when[i] = event_batch.add_when[event_batch.adds];
+		return;
+	}
+}
+
+void event_batch_commit(void)
+{
+	squeue_event **evts;
+	unsigned int i;
+
+	if (!event_batch.open)
+		return;
+	event_batch.open = FALSE;
+
+	if (event_batch.dels && squeue_remove_bulk(nagios_squeue, event_batch.del, event_batch.dels) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to remove %u events from squeue '%p'\n",
+		      event_batch.dels, nagios_squeue);
+	}
+
+	if (event_batch.adds) {
+		evts = nm_malloc(sizeof(*evts) * event_batch.adds);
+		if (!squeue_add_bulk(nagios_squeue, event_batch.add_when, (void **)event_batch.add, evts, event_batch.adds)) {
+			for (i = 0; i < event_batch.adds; i++)
+				event_batch.add[i]->sq_event = evts[i];
+		} else {
+			/* fall back to adding them one at a time */
+			for (i = 0; i < event_batch.adds; i++) {
+				timed_event *event = event_batch.add[i];
+				event->sq_event = squeue_add_tv(nagios_squeue, &event_batch.add_when[i], event);
+				if (!event->sq_event) {
+					logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to add event to squeue '%p' with prio %u: %s\n",
+					      nagios_squeue, event->priority, strerror(errno));
+				}
+			}
+		}
+		my_free(evts);
+	}
+
+	event_batch.adds = event_batch.add_alloc = 0;
+	event_batch.dels = event_batch.del_alloc = 0;
+	my_free(event_batch.add);
+	my_free(event_batch.add_when);
+	my_free(event_batch.del);
+}
+
 /******************************************************************/
 /************ EVENT SCHEDULING/HANDLING FUNCTIONS *****************/
 /******************************************************************/
@@ -71,6 +269,7 @@ void init_timing_loop(void)
 	int mult_factor = 0;
 	int is_valid_time = 0;
 	time_t next_valid_time = 0L;
+	time_t placed_time = 0L;
 	int schedule_check = 0;
 	double max_inter_check_delay = 0.0;
 	struct timeval tv[9];
@@ -81,7 +280,7 @@ void init_timing_loop(void)
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "init_timing_loop() start\n");
 
 	/* get the time and seed the prng */
-	gettimeofday(&now, NULL);
+	sim_gettimeofday(&now, NULL);
 	current_time = now.tv_sec;
 	srand((now.tv_sec << 10) ^ now.tv_usec);
 
@@ -321,6 +520,8 @@ void init_timing_loop(void)
 			check_delay = temp_service->next_check - current_time;
 			if (check_delay > 0 && check_delay < check_window(temp_service)) {
 				log_debug_info(DEBUGL_EVENTS, 2, "Service is already scheduled to be checked in the future: %s\n", ctime(&temp_service->next_check));
+				/* it still counts towards the checks running then */
+				place_service_check(temp_service, temp_service->next_check, temp_service->next_check);
 				continue;
 			}
 
@@ -357,6 +558,13 @@ void init_timing_loop(void)
 				log_debug_info(DEBUGL_EVENTS, 2, "Preferred Time is Invalid In Timeperiod '%s': %lu --> %s", temp_service->check_period_ptr->name, (unsigned long)temp_service->next_check, ctime(&temp_service->next_check));
 				get_next_valid_time(temp_service->next_check, &next_valid_time, temp_service->check_period_ptr);
 				temp_service->next_check = next_valid_time;
+			} else {
+				/* nudge it to where fewer checks will be running, within its first window */
+				placed_time = place_service_check(temp_service, temp_service->next_check, current_time + check_window(temp_service));
+				if (check_time_against_period(placed_time, temp_service->check_period_ptr) == OK)
+					temp_service->next_check = placed_time;
+				else
+					clear_service_check_placement(temp_service);
 			}
 
 			log_debug_info(DEBUGL_EVENTS, 2, "Actual Check Time: %lu --> %s", (unsigned long)temp_service->next_check, ctime(&temp_service->next_check));
@@ -374,6 +582,7 @@ void init_timing_loop(void)
 		gettimeofday(&tv[4], NULL);
 
 	/* add scheduled service checks to event queue */
+	event_batch_begin();
 	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
 
 		/* Nagios XI/NDOUtils MOD */
@@ -391,6 +600,7 @@ void init_timing_loop(void)
 		/* create a new service check event */
 		temp_service->next_check_event = schedule_new_event(EVENT_SERVICE_CHECK, FALSE, temp_service->next_check, FALSE, 0, NULL, TRUE, (void *)temp_service, NULL, temp_service->check_options);
 	}
+	event_batch_commit();
 
 
 	if (test_scheduling == TRUE)
@@ -520,6 +730,7 @@ void init_timing_loop(void)
 		gettimeofday(&tv[7], NULL);
 
 	/* add scheduled host checks to event queue */
+	event_batch_begin();
 	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
 
 		/* Nagios XI/NDOUtils Mod */
@@ -537,6 +748,7 @@ void init_timing_loop(void)
 		/* schedule a new host check event */
 		temp_host->next_check_event = schedule_new_event(EVENT_HOST_CHECK, FALSE, temp_host->next_check, FALSE, 0, NULL, TRUE, (void *)temp_host, NULL, temp_host->check_options);
 	}
+	event_batch_commit();
 
 	if (test_scheduling == TRUE)
 		gettimeofday(&tv[8], NULL);
@@ -731,6 +943,9 @@ int init_event_queue(void)
 	if (size < 4096)
 		size = 4096;
 
+	update_event_loop_time();
+	sched_skew = loop_skew;
+
 	nagios_squeue = squeue_create(size);
 	return 0;
 }
@@ -806,7 +1021,7 @@ void reschedule_event(squeue_t *sq, timed_event *event)
 		/* normal recurring events */
 		else {
 			event->run_time = event->run_time + event->event_interval;
-			time(&current_time);
+			current_time = get_event_loop_time();
 			if (event->run_time < current_time)
 				event->run_time = current_time;
 		}
@@ -832,12 +1047,9 @@ void add_event(squeue_t *sq, timed_event *event)
 		remove_event(sq, event);
 	}
 
-	if (event->priority) {
-		event->sq_event = squeue_add_usec(sq, event->run_time, event->priority - 1, event);
-	} else {
-		event->sq_event = squeue_add(sq, event->run_time, event);
-	}
-	if (!event->sq_event) {
+	if (event_batch.open && sq == nagios_squeue) {
+		event_batch_add(event);
+	} else if (!(event->sq_event = queue_timed_event(sq, event))) {
 		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to add event to squeue '%p' with prio %u: %s\n",
 		      sq, event->priority, strerror(errno));
 	}
@@ -866,7 +1078,9 @@ void remove_event(squeue_t *sq, timed_event *event)
 	if (!event || !event->sq_event)
 		return;
 
-	if (sq)
+	if (event_batch.open && sq == nagios_squeue)
+		event_batch_remove(event);
+	else if (sq)
 		squeue_remove(sq, event->sq_event);
 	else
 		logit(NSLOG_RUNTIME_ERROR, TRUE,
@@ -940,6 +1154,7 @@ static int should_run_event(timed_event *temp_event)
 			} else {
 				temp_service->next_check += check_window(temp_service);
 			}
+			clear_service_check_placement(temp_service);
 
 			temp_event->run_time = temp_service->next_check;
 			reschedule_event(nagios_squeue, temp_event);
@@ -981,18 +1196,16 @@ static int should_run_event(timed_event *temp_event)
 int event_execution_loop(void)
 {
 	timed_event *temp_event, *last_event = NULL;
-	time_t last_time = 0L;
 	time_t current_time = 0L;
 	time_t last_status_update = 0L;
-	int poll_time_ms;
+	int poll_time_ms, i;
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "event_execution_loop() start\n");
 
-	time(&last_time);
-
 	while (1) {
-		struct timeval now;
 		const struct timeval *event_runtime;
+		struct timeval sim_due;
+		long long skew_change;
 		int inputs;
 
 		/* super-priority (hardcoded) events come first */
@@ -1002,20 +1215,44 @@ int event_execution_loop(void)
 			break;
 
 		/* get the current time */
-		time(&current_time);
+		update_event_loop_time();
+		current_time = loop_time;
 
 		if (sigrotate == TRUE) {
 			rotate_log_file(current_time);
 			update_program_status(FALSE);
 		}
 
+		/*
+		 * the monotonic clock tells us how much of the change since
+		 * the last iteration is the wall clock being moved
+		 */
+		skew_change = loop_skew - sched_skew;
+
 		/* hey, wait a second...  we traveled back in time! */
-		if (current_time < last_time)
-			compensate_for_system_time_change((unsigned long)last_time, (unsigned long)current_time);
+		if (skew_change <= -1000000)
+			compensate_for_system_time_change((unsigned long)(current_time - skew_change / 1000000), (unsigned long)current_time);
 
 		/* else if the time advanced over the specified threshold, try and compensate... */
-		else if ((current_time - last_time) >= time_change_threshold)
-			compensate_for_system_time_change((unsigned long)last_time, (unsigned long)current_time);
+		else if (skew_change / 1000000 >= time_change_threshold)
+			compensate_for_system_time_change((unsigned long)(current_time - skew_change / 1000000), (unsigned long)current_time);
+
+		/* smaller drift (NTP slewing, f.e.) is simply followed */
+		sched_skew = loop_skew;
+
+		/* sync the state journal if its oldest record has waited long enough */
+		journal_commit(FALSE);
+
+		/* hand batched metrics to the perfdata sink */
+		perfsink_flush(FALSE);
+
+#ifdef USE_EVENT_BROKER
+		/* and batched events to broker modules */
+		neb_flush_batches();
+#endif
+
+		/* free output no query handler thread can be reading anymore */
+		snapshot_reclaim();
 
 		/* get next scheduled event */
 		current_event = temp_event = (timed_event *)squeue_peek(nagios_squeue);
@@ -1026,9 +1263,6 @@ int event_execution_loop(void)
 			break;
 		}
 
-		/* keep track of the last time */
-		last_time = current_time;
-
 		/* update status information occassionally - NagVis watches the NDOUtils DB to see if Nagios is alive */
 		if ((unsigned long)(current_time - last_status_update) > 5) {
 			last_status_update = current_time;
@@ -1046,17 +1280,31 @@ int event_execution_loop(void)
 
 		last_event = temp_event;
 
-		gettimeofday(&now, NULL);
-		poll_time_ms = tv_delta_msec(&now, event_runtime);
+		poll_time_ms = tv_delta_msec(&loop_mono_now, event_runtime);
 		if (poll_time_ms < 0)
 			poll_time_ms = 0;
 		else if (poll_time_ms >= 1500)
 			poll_time_ms = 1500;
 
+		/* don't sleep past the next journal commit or perfdata flush */
+		i = journal_commit_delay();
+		if (i >= 0 && i < poll_time_ms)
+			poll_time_ms = i;
+		i = perfsink_flush_delay();
+		if (i >= 0 && i < poll_time_ms)
+			poll_time_ms = i;
+
 		log_debug_info(DEBUGL_SCHEDULING, 2, "## Polling %dms; sockets=%d; events=%u; iobs=%p\n",
 		               poll_time_ms, iobroker_get_num_fds(nagios_iobs),
 		               squeue_size(nagios_squeue), nagios_iobs);
-		inputs = iobroker_poll(nagios_iobs, poll_time_ms);
+		if (simulation_mode) {
+			inputs = sim_poll(event_runtime, poll_time_ms);
+			/* nobody polls the queues' doorbells when time is simulated */
+			resultq_drain(UINT_MAX);
+			submit_drain(UINT_MAX);
+		} else {
+			inputs = iobroker_poll(nagios_iobs, poll_time_ms);
+		}
 		if (inputs < 0 && errno != EINTR) {
 			logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Polling for input on %p failed: %s", nagios_iobs, iobroker_strerror(inputs));
 			break;
@@ -1075,13 +1323,23 @@ int event_execution_loop(void)
 			continue;
 		}
 
-		gettimeofday(&now, NULL);
-		if (tv_delta_msec(&now, event_runtime) >= 0)
+		update_event_loop_time();
+		if (tv_delta_msec(&loop_mono_now, event_runtime) >= 0)
 			continue;
 
+		/* should_run_event() may requeue the event, run time and all */
+		if (simulation_mode)
+			sim_due = *event_runtime;
+
 		/* move on if we shouldn't run this event */
-		if (should_run_event(temp_event) == FALSE)
+		if (should_run_event(temp_event) == FALSE) {
+			if (simulation_mode)
+				sim_event_due(temp_event->event_type, &sim_due, TRUE);
 			continue;
+		}
+
+		if (simulation_mode)
+			sim_event_due(temp_event->event_type, &sim_due, FALSE);
 
 		/* handle the event */
 		handle_timed_event(temp_event);
@@ -1114,7 +1372,6 @@ int handle_timed_event(timed_event *event)
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 	void (*userfunc)(void *);
-	struct timeval tv;
 	const struct timeval *event_runtime;
 	double latency;
 
@@ -1129,9 +1386,8 @@ int handle_timed_event(timed_event *event)
 	log_debug_info(DEBUGL_EVENTS, 0, "** Timed Event ** Type: EVENT_%s, Run Time: %s", EVENT_TYPE_STR(event->event_type), ctime(&event->run_time));
 
 	/* get event latency */
-	gettimeofday(&tv, NULL);
 	event_runtime = squeue_event_runtime(event->sq_event);
-	latency = (double)(tv_delta_f(event_runtime, &tv));
+	latency = (double)(tv_delta_f(event_runtime, &loop_mono_now));
 	if (latency < 0.0) /* events may run up to 0.1 seconds early */
 		latency = 0.0;
 
@@ -1284,35 +1540,55 @@ int handle_timed_event(timed_event *event)
 	return OK;
 }
 
-static void adjust_squeue_for_time_change(squeue_t **q, int delta)
+struct time_change_adjustment {
+	int delta;
+	unsigned int count, size;
+	timed_event **requeue;
+};
+
+static int adjust_event_for_time_change(squeue_event *sq_event, void *arg)
 {
-	timed_event *event;
-	squeue_t *sq_new;
+	struct time_change_adjustment *adj = (struct time_change_adjustment *)arg;
+	timed_event *event = squeue_event_data(sq_event);
 
 	/*
-	 * this is pretty inefficient in terms of free() + malloc(),
-	 * but it should be pretty rare that we have to adjust times
-	 * so we go with the well-tested codepath.
+	 * these stay put on the monotonic timeline, so only their
+	 * wall clock run_time has to follow the time change
 	 */
-	sq_new = squeue_create(squeue_size(*q));
-	while ((event = squeue_pop(*q))) {
+	if (event->compensate_for_time_change == TRUE && !event->timing_func) {
+		event->run_time += adj->delta;
+		return 0;
+	}
+
+	/* the rest are pinned to wall clock times and must be requeued */
+	if (adj->count >= adj->size) {
+		adj->size = adj->size ? adj->size * 2 : 16;
+		adj->requeue = nm_realloc(adj->requeue, sizeof(timed_event *) * adj->size);
+	}
+	adj->requeue[adj->count++] = event;
+	return 0;
+}
+
+static void adjust_squeue_for_time_change(squeue_t *sq, int delta)
+{
+	struct time_change_adjustment adj = { delta, 0, 0, NULL };
+	unsigned int i;
+
+	sched_skew += (long long)delta * 1000000;
+
+	squeue_walk(sq, adjust_event_for_time_change, &adj);
+	for (i = 0; i < adj.count; i++) {
+		timed_event *event = adj.requeue[i];
+
 		if (event->compensate_for_time_change == TRUE) {
-			if (event->timing_func) {
-				time_t (*timingfunc)(void);
-				timingfunc = event->timing_func;
-				event->run_time = timingfunc();
-			} else {
-				event->run_time += delta;
-			}
-		}
-		if (event->priority) {
-			event->sq_event = squeue_add_usec(sq_new, event->run_time, event->priority - 1, event);
-		} else {
-			event->sq_event = squeue_add(sq_new, event->run_time, event);
+			time_t (*timingfunc)(void);
+			timingfunc = event->timing_func;
+			event->run_time = timingfunc();
 		}
+		squeue_remove(sq, event->sq_event);
+		event->sq_event = queue_timed_event(sq, event);
 	}
-	squeue_destroy(*q, 0);
-	*q = sq_new;
+	my_free(adj.requeue);
 }
 
 
@@ -1356,7 +1632,7 @@ void compensate_for_system_time_change(unsigned long last_time, unsigned long cu
 	      delta, days, hours, minutes, seconds,
 	      (last_time > current_time) ? "backwards" : "forwards");
 
-	adjust_squeue_for_time_change(&nagios_squeue, delta);
+	adjust_squeue_for_time_change(nagios_squeue, delta);
 
 	/* adjust service timestamps */
 	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
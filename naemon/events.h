@@ -78,7 +78,11 @@ timed_event *schedule_new_event(int, int, time_t, int, unsigned long, void *, in
 void reschedule_event(squeue_t *sq, timed_event *event);   		/* reschedules an event */
 void add_event(squeue_t *sq, timed_event *event);     		/* adds an event to the execution queue */
 void remove_event(squeue_t *sq, timed_event *event);     		/* remove an event from the execution queue */
+void event_batch_begin(void);					/* defers add_event()/remove_event() on nagios_squeue... */
+void event_batch_commit(void);					/* ...until they can be applied in bulk */
 int event_execution_loop(void);                      		/* main monitoring/event handler loop */
+void update_event_loop_time(void);				/* refreshes the time cached by the event loop */
+time_t get_event_loop_time(void);				/* current time as cached by the event loop */
 int handle_timed_event(timed_event *);		     		/* top level handler for timed events */
 void adjust_check_scheduling(void);		        	/* auto-adjusts scheduling of host and service checks */
 void compensate_for_system_time_change(unsigned long, unsigned long);	/* attempts to compensate for a change in the system time */
@@ -9,6 +9,7 @@
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "simulation.h"
 
 
 /******************************************************************/
@@ -132,7 +133,7 @@ void check_for_host_flapping(host *hst, int update, int actual_check, int allow_
 
 	log_debug_info(DEBUGL_FLAPPING, 1, "Checking host '%s' for flapping...\n", hst->name);
 
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* period to wait for updating archived state info if we have no state change */
 	if (hst->total_services == 0)
@@ -224,7 +225,7 @@ void set_service_flap(service *svc, double percent_change, double high_threshold
 
 	/* add a non-persistent comment to the service */
 	nm_asprintf(&temp_buffer, "Notifications for this service are being suppressed because it was detected as having been flapping between different states (%2.1f%% change >= %2.1f%% threshold).  When the service state stabilizes and the flapping stops, notifications will be re-enabled.", percent_change, high_threshold);
-	add_new_service_comment(FLAPPING_COMMENT, svc->host_name, svc->description, time(NULL), "(Naemon Process)", temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(svc->flapping_comment_id));
+	add_new_service_comment(FLAPPING_COMMENT, svc->host_name, svc->description, sim_time(NULL), "(Naemon Process)", temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(svc->flapping_comment_id));
 	my_free(temp_buffer);
 
 	/* set the flapping indicator */
@@ -307,7 +308,7 @@ void set_host_flap(host *hst, double percent_change, double high_threshold, doub
 
 	/* add a non-persistent comment to the host */
 	nm_asprintf(&temp_buffer, "Notifications for this host are being suppressed because it was detected as having been flapping between different states (%2.1f%% change > %2.1f%% threshold).  When the host state stabilizes and the flapping stops, notifications will be re-enabled.", percent_change, high_threshold);
-	add_new_host_comment(FLAPPING_COMMENT, hst->name, time(NULL), "(Naemon Process)", temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(hst->flapping_comment_id));
+	add_new_host_comment(FLAPPING_COMMENT, hst->name, sim_time(NULL), "(Naemon Process)", temp_buffer, 0, COMMENTSOURCE_INTERNAL, FALSE, (time_t)0, &(hst->flapping_comment_id));
 	my_free(temp_buffer);
 
 	/* set the flapping indicator */
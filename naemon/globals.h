@@ -22,11 +22,16 @@ extern char *temp_path;
 extern char *check_result_path;
 extern char *lock_file;
 extern char *object_precache_file;
+extern char *object_parse_cache_file;
 
 extern unsigned int nofile_limit, nproc_limit, max_apps;
 
 extern int num_check_workers;
+extern int worker_shm_transport;
+extern unsigned int worker_batch_window, worker_batch_size;
+extern char *simulation_recording_file;
 extern char *qh_socket_path;
+extern unsigned int qh_threads;
 
 extern char *naemon_user;
 extern char *naemon_group;
@@ -86,6 +91,7 @@ extern int host_inter_check_delay_method;
 extern int service_interleave_factor_method;
 extern int max_host_check_spread;
 extern int max_service_check_spread;
+extern int check_placement_slack;
 
 extern sched_info scheduling_info;
 
@@ -93,6 +99,8 @@ extern int max_parallel_service_checks;
 
 extern int check_reaper_interval;
 extern int max_check_reaper_time;
+extern int prioritize_state_changes;
+extern int passive_result_coalesce_window;
 extern int service_freshness_check_interval;
 extern int host_freshness_check_interval;
 extern int auto_rescheduling_interval;
@@ -126,7 +134,10 @@ extern int retention_update_interval;
 extern int use_retained_program_state;
 extern int use_retained_scheduling_info;
 extern int retention_scheduling_horizon;
+extern unsigned int retention_load_threads;
 extern char *retention_file;
+extern char *state_journal_file;
+extern unsigned int state_journal_commit_interval;
 extern unsigned long retained_host_attribute_mask;
 extern unsigned long retained_service_attribute_mask;
 extern unsigned long retained_contact_host_attribute_mask;
@@ -138,6 +149,7 @@ extern int translate_passive_host_checks;
 extern int passive_host_checks_are_soft;
 
 extern int status_update_interval;
+extern char *status_shm_segment;
 
 extern int time_change_threshold;
 
@@ -203,6 +215,9 @@ extern char    *host_perfdata_file_processing_command;
 extern char    *service_perfdata_file_processing_command;
 extern int     host_perfdata_process_empty_results;
 extern int     service_perfdata_process_empty_results;
+extern char    *perfdata_sink;
+extern int     perfdata_sink_format;
+extern unsigned long perfdata_sink_buffer_size;
 /*** end perfdata variables */
 
 extern struct notify_list *notification_list;
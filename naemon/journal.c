@@ -0,0 +1,706 @@
+#include "config.h"
+#include "common.h"
+#include "objects.h"
+#include "comments.h"
+#include "downtime.h"
+#include "events.h"
+#include "journal.h"
+#include "globals.h"
+#include "logging.h"
+#include "nm_alloc.h"
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * Every record is a single line of tab separated fields, where the
+ * first field tells what kind of record it is. Tabs, newlines and
+ * backslashes in strings are escaped, so a line that doesn't end in a
+ * newline was cut short by a crash and is ignored.
+ *
+ * Host and service records carry all the state we care about, not
+ * just what changed, so replaying a record twice or replaying records
+ * that are older than the snapshot does no harm.
+ */
+#define JREC_HOST "H"
+#define JREC_SERVICE "S"
+#define JREC_COMMENT "C+"
+#define JREC_COMMENT_DEL "C-"
+#define JREC_DOWNTIME "D+"
+#define JREC_DOWNTIME_DEL "D-"
+#define JOURNAL_MAX_FIELDS 40
+
+/* we write what we have once this much is buffered, but only sync on commits */
+#define JOURNAL_FLUSH_SIZE (64 * 1024)
+
+static int journal_fd = -1;
+static int replaying;
+static struct {
+	char *buf;
+	size_t len, size;
+} jbuf;
+static struct timespec first_pending;
+#define have_pending() (first_pending.tv_sec || first_pending.tv_nsec)
+
+/* comments added by the replay, which may not survive it */
+static struct {
+	int type;
+	unsigned long id;
+} *replayed;
+static unsigned int num_replayed;
+
+/* cheap fingerprints of the journaled state, so unchanged objects are skipped */
+static unsigned int *host_digest, *service_digest;
+
+static long long ms_since(const struct timespec *then)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - then->tv_sec) * 1000LL + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+static int journal_write(void)
+{
+	size_t done = 0;
+
+	while (done < jbuf.len) {
+		ssize_t ret = write(journal_fd, jbuf.buf + done, jbuf.len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to write to state journal '%s': %s\n", state_journal_file, strerror(errno));
+			jbuf.len = 0;
+			return ERROR;
+		}
+		done += ret;
+	}
+	jbuf.len = 0;
+
+	return OK;
+}
+
+static void jadd(const char *s, size_t len)
+{
+	if (jbuf.len + len > jbuf.size) {
+		while (jbuf.len + len > jbuf.size)
+			jbuf.size = jbuf.size ? jbuf.size * 2 : 8192;
+		jbuf.buf = nm_realloc(jbuf.buf, jbuf.size);
+	}
+	memcpy(jbuf.buf + jbuf.len, s, len);
+	jbuf.len += len;
+}
+
+static void jbegin(const char *type)
+{
+	jadd(type, strlen(type));
+}
+
+static void jstr(const char *s)
+{
+	const char *p;
+
+	jadd("\t", 1);
+	if (!s)
+		return;
+	for (p = s; *p; p++) {
+		if (*p == '\t')
+			jadd("\\t", 2);
+		else if (*p == '\n')
+			jadd("\\n", 2);
+		else if (*p == '\\')
+			jadd("\\\\", 2);
+		else
+			jadd(p, 1);
+	}
+}
+
+static void jnum(const char *fmt, ...)
+{
+	char num[64];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(num + 1, sizeof(num) - 1, fmt, ap);
+	va_end(ap);
+	num[0] = '\t';
+	jadd(num, len + 1);
+}
+
+#define jint(v) jnum("%d", (int)(v))
+#define julong(v) jnum("%lu", (unsigned long)(v))
+#define jdouble(v) jnum("%.2f", (double)(v))
+
+static void jend(void)
+{
+	/* the first record since the last commit starts the clock */
+	if (!have_pending())
+		clock_gettime(CLOCK_MONOTONIC, &first_pending);
+	jadd("\n", 1);
+	if (jbuf.len >= JOURNAL_FLUSH_SIZE)
+		journal_write();
+}
+
+static inline int journal_active(void)
+{
+	return journal_fd >= 0 && !replaying;
+}
+
+static unsigned int digest(const int *v, unsigned int n)
+{
+	unsigned int i, h = 2166136261U;
+
+	for (i = 0; i < n; i++) {
+		h ^= (unsigned int)v[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static unsigned int host_state_digest(struct host *hst)
+{
+	int v[] = {
+		hst->has_been_checked, hst->current_state, hst->state_type,
+		hst->current_attempt, hst->problem_has_been_acknowledged,
+		hst->acknowledgement_type, hst->current_notification_number,
+		hst->is_flapping, hst->notified_on,
+	};
+	return digest(v, ARRAY_SIZE(v));
+}
+
+static unsigned int service_state_digest(struct service *svc)
+{
+	int v[] = {
+		svc->has_been_checked, svc->current_state, svc->state_type,
+		svc->current_attempt, svc->problem_has_been_acknowledged,
+		svc->acknowledgement_type, svc->current_notification_number,
+		svc->is_flapping, svc->notified_on,
+	};
+	return digest(v, ARRAY_SIZE(v));
+}
+
+int journal_open(void)
+{
+	unsigned int i;
+
+	if (!state_journal_file || retain_state_information == FALSE)
+		return OK;
+	if (journal_fd >= 0)
+		return OK;
+
+	journal_fd = open(state_journal_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (journal_fd < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to open state journal '%s': %s\n", state_journal_file, strerror(errno));
+		return ERROR;
+	}
+
+	/* only changes from here on are interesting */
+	host_digest = nm_calloc(num_objects.hosts, sizeof(*host_digest));
+	service_digest = nm_calloc(num_objects.services, sizeof(*service_digest));
+	for (i = 0; i < num_objects.hosts; i++)
+		host_digest[i] = host_state_digest(host_ary[i]);
+	for (i = 0; i < num_objects.services; i++)
+		service_digest[i] = service_state_digest(service_ary[i]);
+
+	return OK;
+}
+
+void journal_close(void)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_commit(TRUE);
+	close(journal_fd);
+	journal_fd = -1;
+	my_free(jbuf.buf);
+	jbuf.len = jbuf.size = 0;
+	my_free(host_digest);
+	my_free(service_digest);
+}
+
+int journal_commit(int force)
+{
+	int result;
+
+	if (journal_fd < 0 || !have_pending())
+		return OK;
+	if (!force && ms_since(&first_pending) < (long long)state_journal_commit_interval)
+		return OK;
+
+	result = journal_write();
+	if (fdatasync(journal_fd) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to sync state journal '%s': %s\n", state_journal_file, strerror(errno));
+		result = ERROR;
+	}
+	first_pending.tv_sec = first_pending.tv_nsec = 0;
+
+	return result;
+}
+
+int journal_commit_delay(void)
+{
+	long long ms;
+
+	if (journal_fd < 0 || !have_pending())
+		return -1;
+	ms = state_journal_commit_interval - ms_since(&first_pending);
+	return ms < 0 ? 0 : (int)ms;
+}
+
+int journal_truncate(void)
+{
+	if (journal_fd < 0)
+		return OK;
+
+	/* the snapshot has everything we've buffered, too */
+	jbuf.len = 0;
+	first_pending.tv_sec = first_pending.tv_nsec = 0;
+	if (ftruncate(journal_fd, 0) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to truncate state journal '%s': %s\n", state_journal_file, strerror(errno));
+		return ERROR;
+	}
+
+	return OK;
+}
+
+void journal_host(struct host *hst)
+{
+	unsigned int d;
+
+	if (!journal_active() || !hst)
+		return;
+	d = host_state_digest(hst);
+	if (host_digest[hst->id] == d)
+		return;
+	host_digest[hst->id] = d;
+
+	jbegin(JREC_HOST);
+	jstr(hst->name);
+	jint(hst->has_been_checked);
+	jint(hst->current_state);
+	jint(hst->last_state);
+	jint(hst->last_hard_state);
+	jint(hst->state_type);
+	jint(hst->current_attempt);
+	julong(hst->last_check);
+	julong(hst->last_state_change);
+	julong(hst->last_hard_state_change);
+	julong(hst->last_time_up);
+	julong(hst->last_time_down);
+	julong(hst->last_time_unreachable);
+	jint(hst->problem_has_been_acknowledged);
+	jint(hst->acknowledgement_type);
+	jint(hst->current_notification_number);
+	julong(hst->last_notification);
+	julong(hst->current_notification_id);
+	julong(hst->current_event_id);
+	julong(hst->last_event_id);
+	julong(hst->current_problem_id);
+	julong(hst->last_problem_id);
+	jint(hst->is_flapping);
+	jdouble(hst->percent_state_change);
+	jint(hst->notified_on);
+	jstr(hst->plugin_output);
+	jstr(hst->long_plugin_output);
+	jstr(hst->perf_data);
+	jend();
+}
+
+void journal_service(struct service *svc)
+{
+	unsigned int d;
+
+	if (!journal_active() || !svc)
+		return;
+	d = service_state_digest(svc);
+	if (service_digest[svc->id] == d)
+		return;
+	service_digest[svc->id] = d;
+
+	jbegin(JREC_SERVICE);
+	jstr(svc->host_name);
+	jstr(svc->description);
+	jint(svc->has_been_checked);
+	jint(svc->current_state);
+	jint(svc->last_state);
+	jint(svc->last_hard_state);
+	jint(svc->state_type);
+	jint(svc->current_attempt);
+	julong(svc->last_check);
+	julong(svc->last_state_change);
+	julong(svc->last_hard_state_change);
+	julong(svc->last_time_ok);
+	julong(svc->last_time_warning);
+	julong(svc->last_time_unknown);
+	julong(svc->last_time_critical);
+	jint(svc->problem_has_been_acknowledged);
+	jint(svc->acknowledgement_type);
+	jint(svc->current_notification_number);
+	julong(svc->last_notification);
+	julong(svc->current_notification_id);
+	julong(svc->current_event_id);
+	julong(svc->last_event_id);
+	julong(svc->current_problem_id);
+	julong(svc->last_problem_id);
+	jint(svc->is_flapping);
+	jdouble(svc->percent_state_change);
+	jint(svc->notified_on);
+	jstr(svc->plugin_output);
+	jstr(svc->long_plugin_output);
+	jstr(svc->perf_data);
+	jend();
+}
+
+void journal_comment(struct comment *com)
+{
+	/* downtime comments are recreated when the downtime is registered */
+	if (!journal_active() || !com || com->entry_type == DOWNTIME_COMMENT)
+		return;
+
+	jbegin(JREC_COMMENT);
+	jint(com->comment_type);
+	julong(com->comment_id);
+	jint(com->entry_type);
+	jint(com->source);
+	jint(com->persistent);
+	julong(com->entry_time);
+	jint(com->expires);
+	julong(com->expire_time);
+	jstr(com->host_name);
+	jstr(com->service_description);
+	jstr(com->author);
+	jstr(com->comment_data);
+	jend();
+}
+
+void journal_comment_delete(int type, unsigned long comment_id)
+{
+	if (!journal_active())
+		return;
+
+	jbegin(JREC_COMMENT_DEL);
+	jint(type);
+	julong(comment_id);
+	jend();
+}
+
+void journal_downtime(struct scheduled_downtime *dt)
+{
+	if (!journal_active() || !dt)
+		return;
+
+	jbegin(JREC_DOWNTIME);
+	jint(dt->type);
+	julong(dt->downtime_id);
+	jstr(dt->host_name);
+	jstr(dt->service_description);
+	julong(dt->entry_time);
+	julong(dt->start_time);
+	julong(dt->flex_downtime_start);
+	julong(dt->end_time);
+	jint(dt->fixed);
+	julong(dt->triggered_by);
+	julong(dt->duration);
+	jint(dt->is_in_effect);
+	jint(dt->start_notification_sent);
+	jstr(dt->author);
+	jstr(dt->comment);
+	jend();
+}
+
+void journal_downtime_delete(int type, unsigned long downtime_id)
+{
+	if (!journal_active())
+		return;
+
+	jbegin(JREC_DOWNTIME_DEL);
+	jint(type);
+	julong(downtime_id);
+	jend();
+}
+
+
+/******************************************************************/
+/************************ REPLAY FUNCTIONS ************************/
+/******************************************************************/
+
+/* undoes the escaping done by jstr(), in place */
+static char *unescape(char *s)
+{
+	char *r, *w;
+
+	for (r = w = s; *r; r++, w++) {
+		if (*r == '\\' && r[1]) {
+			r++;
+			*w = *r == 't' ? '\t' : *r == 'n' ? '\n' : *r;
+		} else {
+			*w = *r;
+		}
+	}
+	*w = 0;
+	return s;
+}
+
+static void set_str(char **dst, const char *src)
+{
+	my_free(*dst);
+	*dst = *src ? nm_strdup(src) : NULL;
+}
+
+#define ul(s) strtoul(s, NULL, 10)
+
+static int replay_host(char **f, int n)
+{
+	struct host *hst;
+
+	if (n != 29 || !(hst = find_host(f[1])))
+		return ERROR;
+
+	hst->has_been_checked = atoi(f[2]);
+	hst->current_state = atoi(f[3]);
+	hst->last_state = atoi(f[4]);
+	hst->last_hard_state = atoi(f[5]);
+	hst->state_type = atoi(f[6]);
+	hst->current_attempt = atoi(f[7]);
+	hst->last_check = ul(f[8]);
+	hst->last_state_change = ul(f[9]);
+	hst->last_hard_state_change = ul(f[10]);
+	hst->last_time_up = ul(f[11]);
+	hst->last_time_down = ul(f[12]);
+	hst->last_time_unreachable = ul(f[13]);
+	hst->problem_has_been_acknowledged = atoi(f[14]);
+	hst->acknowledgement_type = atoi(f[15]);
+	hst->current_notification_number = atoi(f[16]);
+	hst->last_notification = ul(f[17]);
+	hst->current_notification_id = ul(f[18]);
+	hst->current_event_id = ul(f[19]);
+	hst->last_event_id = ul(f[20]);
+	hst->current_problem_id = ul(f[21]);
+	hst->last_problem_id = ul(f[22]);
+	hst->is_flapping = atoi(f[23]);
+	hst->percent_state_change = strtod(f[24], NULL);
+	hst->notified_on = atoi(f[25]);
+	set_str(&hst->plugin_output, f[26]);
+	set_str(&hst->long_plugin_output, f[27]);
+	set_str(&hst->perf_data, f[28]);
+
+	return OK;
+}
+
+static int replay_service(char **f, int n)
+{
+	struct service *svc;
+
+	if (n != 31 || !(svc = find_service(f[1], f[2])))
+		return ERROR;
+
+	svc->has_been_checked = atoi(f[3]);
+	svc->current_state = atoi(f[4]);
+	svc->last_state = atoi(f[5]);
+	svc->last_hard_state = atoi(f[6]);
+	svc->state_type = atoi(f[7]);
+	svc->current_attempt = atoi(f[8]);
+	svc->last_check = ul(f[9]);
+	svc->last_state_change = ul(f[10]);
+	svc->last_hard_state_change = ul(f[11]);
+	svc->last_time_ok = ul(f[12]);
+	svc->last_time_warning = ul(f[13]);
+	svc->last_time_unknown = ul(f[14]);
+	svc->last_time_critical = ul(f[15]);
+	svc->problem_has_been_acknowledged = atoi(f[16]);
+	svc->acknowledgement_type = atoi(f[17]);
+	svc->current_notification_number = atoi(f[18]);
+	svc->last_notification = ul(f[19]);
+	svc->current_notification_id = ul(f[20]);
+	svc->current_event_id = ul(f[21]);
+	svc->last_event_id = ul(f[22]);
+	svc->current_problem_id = ul(f[23]);
+	svc->last_problem_id = ul(f[24]);
+	svc->is_flapping = atoi(f[25]);
+	svc->percent_state_change = strtod(f[26], NULL);
+	svc->notified_on = atoi(f[27]);
+	set_str(&svc->plugin_output, f[28]);
+	set_str(&svc->long_plugin_output, f[29]);
+	set_str(&svc->perf_data, f[30]);
+
+	return OK;
+}
+
+static int replay_comment(char **f, int n)
+{
+	int type;
+	unsigned long comment_id;
+
+	if (n != 13)
+		return ERROR;
+
+	type = atoi(f[1]);
+	comment_id = ul(f[2]);
+	if (find_comment(comment_id, type))
+		return OK;
+	if (add_comment(type, atoi(f[3]), f[9], type == SERVICE_COMMENT ? f[10] : NULL, ul(f[6]), f[11], f[12], comment_id, atoi(f[5]), atoi(f[7]), ul(f[8]), atoi(f[4])) != OK)
+		return ERROR;
+	replayed = nm_realloc(replayed, (num_replayed + 1) * sizeof(*replayed));
+	replayed[num_replayed].type = type;
+	replayed[num_replayed++].id = comment_id;
+	if (comment_id >= next_comment_id)
+		next_comment_id = comment_id + 1;
+	if (atoi(f[7]) == TRUE)
+		schedule_new_event(EVENT_EXPIRE_COMMENT, FALSE, ul(f[8]), FALSE, 0, NULL, TRUE, (void *)comment_id, NULL, 0);
+
+	return OK;
+}
+
+static int replay_downtime(char **f, int n)
+{
+	int type;
+	unsigned long downtime_id;
+	scheduled_downtime *dt;
+
+	if (n != 16)
+		return ERROR;
+
+	type = atoi(f[1]);
+	downtime_id = ul(f[2]);
+
+	/*
+	 * Downtime we already know about was registered along with the
+	 * snapshot, and will start or stop on its own. All we need to
+	 * remember is whether we've notified about it.
+	 */
+	if ((dt = find_downtime(type, downtime_id))) {
+		dt->start_notification_sent = atoi(f[13]);
+		if (ul(f[7]))
+			dt->flex_downtime_start = ul(f[7]);
+		return OK;
+	}
+
+	if (add_downtime(type, f[3], type == SERVICE_DOWNTIME ? f[4] : NULL, ul(f[5]), f[14], f[15], ul(f[6]), ul(f[7]), ul(f[8]), atoi(f[9]), ul(f[10]), ul(f[11]), downtime_id, atoi(f[12]), atoi(f[13])) != OK)
+		return ERROR;
+
+	return register_downtime(type, downtime_id);
+}
+
+static int replay_record(char *line)
+{
+	char *f[JOURNAL_MAX_FIELDS];
+	char *p;
+	int n = 0;
+
+	for (p = line; p && n < JOURNAL_MAX_FIELDS; n++) {
+		f[n] = p;
+		if ((p = strchr(p, '\t')))
+			*p++ = 0;
+		unescape(f[n]);
+	}
+	if (p)
+		return ERROR;
+
+	if (!strcmp(f[0], JREC_HOST))
+		return replay_host(f, n);
+	if (!strcmp(f[0], JREC_SERVICE))
+		return replay_service(f, n);
+	if (!strcmp(f[0], JREC_COMMENT))
+		return replay_comment(f, n);
+	if (!strcmp(f[0], JREC_COMMENT_DEL)) {
+		if (n != 3)
+			return ERROR;
+		delete_comment(atoi(f[1]), ul(f[2]));
+		return OK;
+	}
+	if (!strcmp(f[0], JREC_DOWNTIME))
+		return replay_downtime(f, n);
+	if (!strcmp(f[0], JREC_DOWNTIME_DEL)) {
+		if (n != 3)
+			return ERROR;
+		delete_downtime(atoi(f[1]), ul(f[2]));
+		return OK;
+	}
+
+	return ERROR;
+}
+
+/* non-persistent comments don't survive restarts, unless they're acks */
+static void expire_replayed_comments(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_replayed; i++) {
+		comment *c = find_comment(replayed[i].id, replayed[i].type);
+		int ack = FALSE;
+
+		if (!c || c->persistent)
+			continue;
+		if (c->entry_type == ACKNOWLEDGEMENT_COMMENT) {
+			if (c->comment_type == HOST_COMMENT) {
+				host *hst = find_host(c->host_name);
+				ack = hst && hst->problem_has_been_acknowledged;
+			} else {
+				service *svc = find_service(c->host_name, c->service_description);
+				ack = svc && svc->problem_has_been_acknowledged;
+			}
+		}
+		if (ack == FALSE)
+			delete_comment(c->comment_type, c->comment_id);
+	}
+}
+
+int journal_replay(void)
+{
+	int fd;
+	struct stat st;
+	char *buf, *line, *eol;
+	ssize_t len = 0;
+	unsigned int records = 0, bad = 0;
+
+	if (!state_journal_file || retain_state_information == FALSE)
+		return OK;
+
+	/* anything still buffered belongs to the state we're replaying onto */
+	journal_commit(TRUE);
+
+	if ((fd = open(state_journal_file, O_RDONLY | O_CLOEXEC)) < 0)
+		return errno == ENOENT ? OK : ERROR;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return ERROR;
+	}
+
+	buf = nm_malloc(st.st_size + 1);
+	while (len < st.st_size) {
+		ssize_t ret = read(fd, buf + len, st.st_size - len);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		len += ret;
+	}
+	close(fd);
+	buf[len] = 0;
+
+	replaying = 1;
+	for (line = buf; (eol = memchr(line, '\n', len - (line - buf))); line = eol + 1) {
+		*eol = 0;
+		if (!*line || *line == '#')
+			continue;
+		records++;
+		if (replay_record(line) != OK)
+			bad++;
+	}
+	expire_replayed_comments();
+	my_free(replayed);
+	num_replayed = 0;
+	replaying = 0;
+
+	if (*line)
+		log_debug_info(DEBUGL_RETENTIONDATA, 0, "Ignoring incomplete record at the end of state journal '%s'\n", state_journal_file);
+	if (records)
+		logit(NSLOG_PROCESS_INFO, FALSE, "Replayed %u records from state journal '%s' (%u skipped)\n", records, state_journal_file, bad);
+	free(buf);
+
+	return OK;
+}
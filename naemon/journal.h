@@ -0,0 +1,40 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "common.h"
+#include "objects.h"
+#include "comments.h"
+#include "downtime.h"
+
+/*
+ * The state journal is an append-only log of everything that happened
+ * to hosts, services, comments and downtime since the last retention
+ * snapshot. Records are buffered and written and synced in groups, at
+ * most state_journal_commit_interval milliseconds apart. At startup the
+ * journal is replayed on top of the snapshot, and every snapshot
+ * truncates it again.
+ */
+
+NAGIOS_BEGIN_DECL
+
+int journal_open(void);                     /* starts journaling to state_journal_file */
+void journal_close(void);                   /* commits and closes the journal */
+int journal_replay(void);                   /* applies the journal to the objects in memory */
+int journal_truncate(void);                 /* forgets everything before the latest snapshot */
+int journal_commit(int force);              /* writes and syncs buffered records if it's time to */
+int journal_commit_delay(void);             /* ms until the next commit is due, or -1 if none is */
+
+void journal_host(struct host *hst);
+void journal_service(struct service *svc);
+void journal_comment(struct comment *com);
+void journal_comment_delete(int type, unsigned long comment_id);
+void journal_downtime(struct scheduled_downtime *dt);
+void journal_downtime_delete(int type, unsigned long downtime_id);
+
+NAGIOS_END_DECL
+
+#endif
@@ -48,6 +48,8 @@ int bitmap_resize(bitmap *bm, unsigned long size)
 	if (!nvec) {
 		return -1;
 	}
+	if (ralloc > bm->alloc)
+		memset(nvec + bm->alloc, 0, (ralloc - bm->alloc) * sizeof(bmap));
 	bm->vector = nvec;
 	bm->alloc = ralloc;
 	return 0;
@@ -149,7 +151,7 @@ int bitmap_set(bitmap *bm, unsigned long pos)
 
 	if (!bm)
 		return 0;
-	if (l > bm->alloc)
+	if (l >= bm->alloc)
 		return -1;
 
 	bm->vector[l] |= (1 << bit);
@@ -162,7 +164,7 @@ int bitmap_isset(const bitmap *bm, unsigned long pos)
 	const int bit = pos & MAPMASK;
 	int set;
 
-	if (!bm || l > bm->alloc)
+	if (!bm || l >= bm->alloc)
 		return 0;
 
 	set = !!(bm->vector[l] & (1 << bit));
@@ -175,6 +177,9 @@ int bitmap_unset(bitmap *bm, unsigned long pos)
 	const int bit = pos & MAPMASK;
 	const int val = bitmap_isset(bm, pos);
 
+	if (!bm || l >= bm->alloc)
+		return 0;
+
 	bm->vector[l] &= ~(1 << bit);
 	return val;
 }
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include "epoch.h"
+
+/*
+ * The classic three-epoch scheme. The global epoch only moves on
+ * when every active reader has seen the current one, so a reader
+ * can lag behind by one epoch at most. Memory retired in epoch e is
+ * therefore unreachable once the global epoch reaches e + 2, which
+ * is when the writer frees the limbo list it was put on.
+ *
+ * Reader slots are never freed before the domain is, so the writer
+ * can walk them without locks. Unregistered slots are reused.
+ *
+ * There are no fences: a reader's store to its slot and the writer's
+ * loads from it are sequentially consistent, as are the users' stores
+ * and loads of published pointers, which orders them just the same.
+ */
+#define EPOCH_ACTIVE 1UL
+
+struct epoch_reader {
+	unsigned long state;       /* (epoch << 1) | EPOCH_ACTIVE while inside */
+	int in_use;
+	struct epoch_domain *domain;
+	struct epoch_reader *next;
+};
+
+struct limbo_entry {
+	void *ptr;
+	epoch_free_fn free_fn;
+};
+
+struct limbo {
+	struct limbo_entry *entries;
+	unsigned int count, size;
+};
+
+struct epoch_domain {
+	unsigned long epoch;
+	int readers;               /* registered reader slots */
+	struct epoch_reader *reader_list;
+	struct limbo limbo[3];
+};
+
+epoch_domain *epoch_create(void)
+{
+	epoch_domain *d;
+
+	if (!(d = calloc(1, sizeof(*d))))
+		return NULL;
+	d->epoch = 1;
+	return d;
+}
+
+static unsigned int limbo_free(struct limbo *l)
+{
+	unsigned int i, freed = l->count;
+
+	for (i = 0; i < l->count; i++)
+		l->entries[i].free_fn(l->entries[i].ptr);
+	l->count = 0;
+	return freed;
+}
+
+void epoch_destroy(epoch_domain *d)
+{
+	struct epoch_reader *r, *next;
+	int i;
+
+	if (!d)
+		return;
+
+	for (i = 0; i < 3; i++) {
+		limbo_free(&d->limbo[i]);
+		free(d->limbo[i].entries);
+	}
+	for (r = d->reader_list; r; r = next) {
+		next = r->next;
+		free(r);
+	}
+	free(d);
+}
+
+epoch_reader *epoch_reader_register(epoch_domain *d)
+{
+	epoch_reader *r;
+	int unused = 0;
+
+	__atomic_add_fetch(&d->readers, 1, __ATOMIC_SEQ_CST);
+
+	/* reuse a slot if we can */
+	for (r = __atomic_load_n(&d->reader_list, __ATOMIC_ACQUIRE); r; r = r->next) {
+		if (__atomic_compare_exchange_n(&r->in_use, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return r;
+		unused = 0;
+	}
+
+	if (!(r = calloc(1, sizeof(*r)))) {
+		__atomic_sub_fetch(&d->readers, 1, __ATOMIC_SEQ_CST);
+		return NULL;
+	}
+	r->in_use = 1;
+	r->domain = d;
+	r->next = __atomic_load_n(&d->reader_list, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&d->reader_list, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return r;
+}
+
+void epoch_reader_unregister(epoch_reader *r)
+{
+	if (!r)
+		return;
+	__atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&r->domain->readers, 1, __ATOMIC_SEQ_CST);
+}
+
+void epoch_enter(epoch_reader *r)
+{
+	unsigned long e = __atomic_load_n(&r->domain->epoch, __ATOMIC_ACQUIRE);
+
+	/* must be visible to the writer before we load anything */
+	__atomic_store_n(&r->state, (e << 1) | EPOCH_ACTIVE, __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(epoch_reader *r)
+{
+	__atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(epoch_domain *d, void *ptr, epoch_free_fn free_fn)
+{
+	struct limbo *l;
+
+	if (!ptr)
+		return;
+
+	/*
+	 * The pointer has been replaced already. A reader that isn't
+	 * registered by now can't see it, so without readers, there's
+	 * no need to wait.
+	 */
+	if (!__atomic_load_n(&d->readers, __ATOMIC_SEQ_CST)) {
+		free_fn(ptr);
+		return;
+	}
+
+	l = &d->limbo[d->epoch % 3];
+	if (l->count == l->size) {
+		struct limbo_entry *entries;
+		unsigned int size = l->size ? l->size * 2 : 64;
+
+		if (!(entries = realloc(l->entries, size * sizeof(*entries)))) {
+			/* leaking beats a use-after-free */
+			return;
+		}
+		l->entries = entries;
+		l->size = size;
+	}
+	l->entries[l->count].ptr = ptr;
+	l->entries[l->count].free_fn = free_fn;
+	l->count++;
+}
+
+unsigned int epoch_reclaim(epoch_domain *d)
+{
+	struct epoch_reader *r;
+	unsigned long e = d->epoch, state;
+
+	for (r = __atomic_load_n(&d->reader_list, __ATOMIC_ACQUIRE); r; r = r->next) {
+		state = __atomic_load_n(&r->state, __ATOMIC_SEQ_CST);
+		if ((state & EPOCH_ACTIVE) && (state >> 1) != e)
+			return 0;
+	}
+
+	/* everyone has seen e, so nobody can see what was retired in e - 1 */
+	__atomic_store_n(&d->epoch, e + 1, __ATOMIC_SEQ_CST);
+	return limbo_free(&d->limbo[(e + 2) % 3]);
+}
+
+unsigned int epoch_pending(epoch_domain *d)
+{
+	return d->limbo[0].count + d->limbo[1].count + d->limbo[2].count;
+}
@@ -0,0 +1,112 @@
+#ifndef LIBNAEMON_epoch_h__
+#define LIBNAEMON_epoch_h__
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "lnae-utils.h"
+
+/**
+ * @file epoch.h
+ * @brief Epoch based memory reclamation
+ *
+ * Lets a single writer thread replace data that reader threads may be
+ * looking at, without either side taking locks. The writer publishes
+ * a new pointer with an atomic store and retires the old one instead
+ * of freeing it. Readers enter an epoch before loading such pointers
+ * and exit it when they're done with what they point to. Retired
+ * memory is freed by epoch_reclaim() once every reader that could
+ * have seen it has exited.
+ *
+ * Published pointers must be stored and loaded with sequentially
+ * consistent atomics, e.g. __atomic_exchange_n() and __atomic_load_n()
+ * with __ATOMIC_SEQ_CST.
+ *
+ * Readers must not block for long while inside an epoch, as that
+ * holds back reclamation for everything retired in the meantime.
+ * @{
+ */
+
+NAGIOS_BEGIN_DECL
+
+/** Opaque type for a reclamation domain */
+typedef struct epoch_domain epoch_domain;
+
+/** Opaque type for a reader thread's slot in a domain */
+typedef struct epoch_reader epoch_reader;
+
+/** Function used to free retired memory */
+typedef void (*epoch_free_fn)(void *ptr);
+
+/**
+ * Create a new reclamation domain
+ * @return A new domain, or NULL on errors
+ */
+extern epoch_domain *epoch_create(void);
+
+/**
+ * Destroy a domain, freeing everything retired in it. No reader may
+ * be registered anymore
+ * @param d The domain to destroy
+ */
+extern void epoch_destroy(epoch_domain *d);
+
+/**
+ * Register a reader with a domain. Each reader thread needs its own
+ * slot, which it may use for as many epochs as it likes
+ * @param d The domain
+ * @return The reader's slot, or NULL on errors
+ */
+extern epoch_reader *epoch_reader_register(epoch_domain *d);
+
+/**
+ * Unregister a reader. The slot may be handed to the next thread
+ * that registers
+ * @param r The reader's slot
+ */
+extern void epoch_reader_unregister(epoch_reader *r);
+
+/**
+ * Enter an epoch. Memory retired after this is not freed until the
+ * reader exits again
+ * @param r The reader's slot
+ */
+extern void epoch_enter(epoch_reader *r);
+
+/**
+ * Exit an epoch. Pointers loaded since entering it may no longer be
+ * dereferenced
+ * @param r The reader's slot
+ */
+extern void epoch_exit(epoch_reader *r);
+
+/**
+ * Retire memory that readers may still be looking at. Only the writer
+ * may call this, after it has replaced every published pointer to it
+ * @param d The domain
+ * @param ptr The memory to free once it's safe to
+ * @param free_fn The function to free it with
+ */
+extern void epoch_retire(epoch_domain *d, void *ptr, epoch_free_fn free_fn);
+
+/**
+ * Free whatever no reader can be looking at anymore. Only the writer
+ * may call this. Calling it regularly is enough; retired memory is
+ * freed after two calls during which no reader is stuck in an epoch
+ * @param d The domain
+ * @return The number of pointers freed
+ */
+extern unsigned int epoch_reclaim(epoch_domain *d);
+
+/**
+ * Get the number of pointers retired but not yet freed
+ * @param d The domain
+ * @return The number of pointers waiting to be freed
+ */
+extern unsigned int epoch_pending(epoch_domain *d);
+
+NAGIOS_END_DECL
+
+/** @} */
+#endif /* LIBNAEMON_epoch_h__ */
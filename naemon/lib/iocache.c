@@ -201,6 +201,26 @@ int iocache_read(iocache *ioc, int fd)
 	return bytes_read;
 }
 
+int iocache_recv(iocache *ioc, int fd, int flags)
+{
+	int to_read, bytes_read;
+
+	if (!ioc || !ioc->ioc_buf || fd < 0)
+		return -1;
+
+	iocache_move_data(ioc);
+	to_read = ioc->ioc_bufsize - ioc->ioc_buflen;
+	if (!to_read)
+		return 0;
+
+	bytes_read = recv(fd, ioc->ioc_buf + ioc->ioc_buflen, to_read, flags);
+	if (bytes_read > 0) {
+		ioc->ioc_buflen += bytes_read;
+	}
+
+	return bytes_read;
+}
+
 
 int iocache_add(iocache *ioc, char *buf, unsigned int len)
 {
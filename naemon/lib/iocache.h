@@ -127,6 +127,16 @@ extern iocache *iocache_create(unsigned long size);
  */
 extern int iocache_read(iocache *ioc, int fd);
 
+/**
+ * Like iocache_read(), but reads from a socket with recv(2), so that
+ * flags such as MSG_DONTWAIT can be passed along
+ * @param ioc The io cache we should read into
+ * @param fd The socket we should read from
+ * @param flags Flags passed to recv(2)
+ * @return The number of bytes read on success. < 0 on errors
+ */
+extern int iocache_recv(iocache *ioc, int fd, int flags);
+
 /**
  * Add data to the iocache buffer
  * The data is copied, so it can safely be taken from the stack in a
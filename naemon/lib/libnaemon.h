@@ -16,11 +16,15 @@
 #include "pqueue.h"
 #include "squeue.h"
 #include "kvvec.h"
+#include "mpscq.h"
+#include "epoch.h"
 #include "iobroker.h"
 #include "iocache.h"
 #include "runcmd.h"
 #include "bitmap.h"
 #include "dkhash.h"
+#include "shmring.h"
+#include "shmstatus.h"
 #include "worker.h"
 #include "skiplist.h"
 #include "rbtree.h"
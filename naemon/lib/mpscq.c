@@ -0,0 +1,195 @@
+#define _GNU_SOURCE 1
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "mpscq.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+/*
+ * This is Dmitry Vyukov's intrusive MPSC queue. Producers swap
+ * themselves in as the newest node and then link the previous one
+ * to it, so the only shared write is a single atomic exchange. The
+ * consumer walks the list from the oldest node, and puts the stub
+ * node back in whenever it's about to take the last real one, so
+ * the list is never empty and producers never touch the tail.
+ *
+ * Between a producer's exchange and its link, the nodes after the
+ * previous head are unreachable. The consumer just treats that as
+ * empty and relies on the doorbell to find out when it's done.
+ */
+struct mpscq {
+	mpscq_node *head; /* newest node, swapped by producers */
+	char pad0[64 - sizeof(mpscq_node *)];
+	mpscq_node *tail; /* oldest node, only used by the consumer */
+	mpscq_node stub;
+	int armed; /* the consumer may be asleep */
+	int rfd, wfd;
+};
+
+mpscq *mpscq_create(void)
+{
+	mpscq *q;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return NULL;
+
+#ifdef __linux__
+	q->rfd = q->wfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (q->rfd < 0) {
+		free(q);
+		return NULL;
+	}
+#else
+	{
+		int pfd[2], i;
+		if (pipe(pfd) < 0) {
+			free(q);
+			return NULL;
+		}
+		for (i = 0; i < 2; i++) {
+			fcntl(pfd[i], F_SETFL, O_NONBLOCK);
+			fcntl(pfd[i], F_SETFD, FD_CLOEXEC);
+		}
+		q->rfd = pfd[0];
+		q->wfd = pfd[1];
+	}
+#endif
+
+	q->head = q->tail = &q->stub;
+	q->armed = 1;
+
+	return q;
+}
+
+void mpscq_destroy(mpscq *q)
+{
+	if (!q)
+		return;
+
+	close(q->rfd);
+	if (q->wfd != q->rfd)
+		close(q->wfd);
+	free(q);
+}
+
+int mpscq_doorbell(mpscq *q)
+{
+	return q ? q->rfd : -1;
+}
+
+static int ring(mpscq *q)
+{
+	uint64_t one = 1;
+
+	if (write(q->wfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		return -1;
+	return 0;
+}
+
+static void push_node(mpscq *q, mpscq_node *node)
+{
+	mpscq_node *prev;
+
+	node->next = NULL;
+	prev = __atomic_exchange_n(&q->head, node, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&prev->next, node, __ATOMIC_SEQ_CST);
+}
+
+int mpscq_push(mpscq *q, mpscq_node *node)
+{
+	if (!q || !node) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	push_node(q, node);
+
+	/*
+	 * The consumer arms the doorbell before it looks at the queue
+	 * one last time, and we disarm it after linking our node, so
+	 * either it sees the node or we see it's armed.
+	 */
+	if (__atomic_exchange_n(&q->armed, 0, __ATOMIC_SEQ_CST))
+		return ring(q);
+
+	return 0;
+}
+
+static mpscq_node *pop_node(mpscq *q)
+{
+	mpscq_node *tail = q->tail, *next;
+
+	next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+	if (tail == &q->stub) {
+		if (!next)
+			return NULL;
+		q->tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+	}
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+
+	/* a producer is between its exchange and its link */
+	if (tail != __atomic_load_n(&q->head, __ATOMIC_SEQ_CST))
+		return NULL;
+
+	/* tail is the last node, so the stub has to go in behind it */
+	push_node(q, &q->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+mpscq_node *mpscq_pop(mpscq *q)
+{
+	mpscq_node *node;
+
+	if (!q)
+		return NULL;
+
+	if ((node = pop_node(q)))
+		return node;
+
+	/* looks empty, so arm the doorbell and make sure it still is */
+	__atomic_store_n(&q->armed, 1, __ATOMIC_SEQ_CST);
+	if ((node = pop_node(q)))
+		__atomic_store_n(&q->armed, 0, __ATOMIC_SEQ_CST);
+
+	return node;
+}
+
+int mpscq_kick(mpscq *q)
+{
+	if (!q)
+		return -1;
+	return ring(q);
+}
+
+int mpscq_ack(mpscq *q)
+{
+	char buf[64];
+	ssize_t ret;
+
+	if (!q)
+		return -1;
+
+	/* eventfds are emptied by a single read, pipes may take more */
+	do {
+		ret = read(q->rfd, buf, sizeof(buf));
+	} while (ret == sizeof(buf));
+	if (ret < 0 && errno != EAGAIN)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,96 @@
+#ifndef LIBNAEMON_mpscq_h__
+#define LIBNAEMON_mpscq_h__
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "lnae-utils.h"
+
+/**
+ * @file mpscq.h
+ * @brief Lock-free multi-producer/single-consumer queues
+ *
+ * Any number of threads may push to an mpscq at the same time,
+ * without ever taking a lock or blocking, while exactly one thread
+ * pops from it. Nodes are intrusive: embed an mpscq_node in whatever
+ * should be queued and use container_of() style pointer arithmetic,
+ * or simply put the node first, to get back at it.
+ *
+ * Each queue has a doorbell, an eventfd (a pipe where there are no
+ * eventfds) that becomes readable when the consumer may be asleep
+ * and something has been pushed. The consumer should register the
+ * doorbell with its io broker, call mpscq_ack() when it becomes
+ * readable and then pop until the queue is empty. The doorbell is
+ * only rung on the first push after the consumer found the queue
+ * empty, so a busy queue costs producers no syscalls.
+ * @{
+ */
+
+NAGIOS_BEGIN_DECL
+
+/** The link embedded in queued items */
+typedef struct mpscq_node {
+	struct mpscq_node *next;
+} mpscq_node;
+
+/** Opaque type for the queue */
+typedef struct mpscq mpscq;
+
+/**
+ * Create a new queue
+ * @return A new queue, or NULL on errors with errno set
+ */
+extern mpscq *mpscq_create(void);
+
+/**
+ * Destroy a queue. Nodes still in it are not touched, so the
+ * consumer should drain it first
+ * @param q The queue to destroy
+ */
+extern void mpscq_destroy(mpscq *q);
+
+/**
+ * Get the doorbell of a queue
+ * @param q The queue
+ * @return The file descriptor the consumer should poll for input
+ */
+extern int mpscq_doorbell(mpscq *q);
+
+/**
+ * Add a node to the end of a queue. Safe to call from any thread
+ * @param q The queue
+ * @param node The node to add. It must not be in any queue already
+ * @return 0 on success, -1 if the doorbell couldn't be rung
+ */
+extern int mpscq_push(mpscq *q, mpscq_node *node);
+
+/**
+ * Remove the oldest node from a queue. Only the consumer may call
+ * this. A node whose producer is still in the middle of pushing it
+ * isn't visible yet; that producer rings the doorbell once it's done
+ * @param q The queue
+ * @return The oldest node, or NULL if there is none
+ */
+extern mpscq_node *mpscq_pop(mpscq *q);
+
+/**
+ * Ring the doorbell of a queue, armed or not. Consumers that stop
+ * before the queue is empty use this to get called again later
+ * @param q The queue
+ * @return 0 on success, -1 on errors
+ */
+extern int mpscq_kick(mpscq *q);
+
+/**
+ * Acknowledge the doorbell of a queue. The consumer must call this
+ * before draining the queue, or it may miss a wakeup
+ * @param q The queue
+ * @return 0 on success, -1 on errors
+ */
+extern int mpscq_ack(mpscq *q);
+
+NAGIOS_END_DECL
+
+/** @} */
+#endif /* LIBNAEMON_mpscq_h__ */
@@ -123,3 +123,83 @@ int nsock_printf(int sd, const char *fmt, ...)
 	va_end(ap);
 	return ret;
 }
+
+#define NSOCK_MAX_FDS 16
+int nsock_send_fds(int sd, const void *buf, unsigned int len, const int *fds, int nfds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(sizeof(int) * NSOCK_MAX_FDS)];
+
+	if (!buf || !len || nfds < 0 || nfds > NSOCK_MAX_FDS)
+		return NSOCK_EINVAL;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds) {
+		memset(cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	return sendmsg(sd, &msg, 0);
+}
+
+int nsock_recv_fds(int sd, void *buf, unsigned int len, int *fds, int *nfds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(sizeof(int) * NSOCK_MAX_FDS)];
+	int ret, flags = 0, received = 0;
+
+	if (!buf || !len || !nfds || *nfds < 0)
+		return NSOCK_EINVAL;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	ret = recvmsg(sd, &msg, flags);
+	if (ret < 0) {
+		*nfds = 0;
+		return ret;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		int i, *cfds, n;
+
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		cfds = (int *)CMSG_DATA(cmsg);
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < n; i++) {
+			/* we can't leave descriptors we have no room for lying around */
+			if (received >= *nfds) {
+				close(cfds[i]);
+				continue;
+			}
+			fcntl(cfds[i], F_SETFD, FD_CLOEXEC);
+			fds[received++] = cfds[i];
+		}
+	}
+	*nfds = received;
+
+	return ret;
+}
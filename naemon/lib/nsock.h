@@ -79,6 +79,30 @@ extern int nsock_printf_nul(int sd, const char *fmt, ...)
 extern int nsock_printf(int sd, const char *fmt, ...)
 	__attribute__((__format__(__printf__, 2, 3)));
 
+/**
+ * Write a message to a unix socket, passing file descriptors along
+ * with it.
+ * @param sd The socket to write to
+ * @param buf The message. Must be at least one byte
+ * @param len Length of the message
+ * @param fds The file descriptors to pass
+ * @param nfds Number of file descriptors in fds
+ * @return Whatever sendmsg() returns
+ */
+extern int nsock_send_fds(int sd, const void *buf, unsigned int len, const int *fds, int nfds);
+
+/**
+ * Read a message from a unix socket, picking up any file descriptors
+ * passed along with it. Received descriptors are close-on-exec.
+ * @param sd The socket to read from
+ * @param buf Buffer to read the message into
+ * @param len Size of buf
+ * @param[out] fds Array to store received file descriptors in
+ * @param[in,out] nfds Size of fds in, number of received descriptors out
+ * @return Whatever recvmsg() returns
+ */
+extern int nsock_recv_fds(int sd, void *buf, unsigned int len, int *fds, int *nfds);
+
 
 NAGIOS_END_DECL
 
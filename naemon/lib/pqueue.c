@@ -168,6 +168,70 @@ pqueue_insert(pqueue_t *q, void *d)
 }
 
 
+/*
+ * Whether changing n items one at a time, at O(lg size) apiece, costs
+ * more than rebuilding the whole heap in O(size).
+ */
+static int
+should_rebuild(pqueue_t *q, unsigned int n)
+{
+	unsigned int lg = 1, size = q->size;
+
+	while (size >>= 1)
+		lg++;
+
+	return (unsigned long)n * lg > (unsigned long)q->size * 2;
+}
+
+
+static void
+rebuild(pqueue_t *q)
+{
+	unsigned int i;
+
+	for (i = parent(q->size - 1); i > 0; i--)
+		percolate_down(q, i);
+}
+
+
+int
+pqueue_insert_bulk(pqueue_t *q, void **d, unsigned int n)
+{
+	void *tmp;
+	unsigned int i, newsize;
+
+	if (!q) {
+		return 1;
+	}
+
+	/* allocate more memory if necessary */
+	if (q->size + n > q->avail) {
+		newsize = q->size + n + q->step;
+		if (!(tmp = realloc(q->d, sizeof(void *) * newsize))) {
+			return 1;
+		}
+		q->d = tmp;
+		q->avail = newsize;
+	}
+
+	if (!should_rebuild(q, n)) {
+		for (i = 0; i < n; i++) {
+			q->d[q->size] = d[i];
+			bubble_up(q, q->size++);
+		}
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		q->d[q->size] = d[i];
+		q->setpos(d[i], q->size++);
+	}
+	rebuild(q);
+
+	return 0;
+}
+
+
 void
 pqueue_change_priority(pqueue_t *q, pqueue_pri_t new_pri, void *d)
 {
@@ -199,6 +263,38 @@ pqueue_remove(pqueue_t *q, void *d)
 }
 
 
+int
+pqueue_remove_bulk(pqueue_t *q, void **d, unsigned int n)
+{
+	unsigned int i, j;
+
+	if (!q) {
+		return 1;
+	}
+
+	if (!should_rebuild(q, n)) {
+		for (i = 0; i < n; i++)
+			pqueue_remove(q, d[i]);
+		return 0;
+	}
+
+	/* punch holes where the doomed items are, then close them up */
+	for (i = 0; i < n; i++)
+		q->d[q->getpos(d[i])] = NULL;
+	for (i = j = 1; i < q->size; i++) {
+		if (!q->d[i])
+			continue;
+		q->d[j] = q->d[i];
+		q->setpos(q->d[j], j);
+		j++;
+	}
+	q->size = j;
+	rebuild(q);
+
+	return 0;
+}
+
+
 void *
 pqueue_pop(pqueue_t *q)
 {
@@ -131,6 +131,18 @@ unsigned int pqueue_size(pqueue_t *q);
 int pqueue_insert(pqueue_t *q, void *d);
 
 
+/**
+ * insert many items into the queue at once.
+ * When the batch is large compared to the queue, the heap is rebuilt
+ * in linear time instead of inserting the items one by one.
+ * @param q the queue
+ * @param d array of items
+ * @param n number of items in d
+ * @return 0 on success
+ */
+int pqueue_insert_bulk(pqueue_t *q, void **d, unsigned int n);
+
+
 /**
  * move an existing entry to a different priority
  * @param q the queue
@@ -160,6 +172,18 @@ void *pqueue_pop(pqueue_t *q);
 int pqueue_remove(pqueue_t *q, void *d);
 
 
+/**
+ * remove many items from the queue at once.
+ * When the batch is large compared to the queue, the heap is compacted
+ * and rebuilt in linear time instead of removing the items one by one.
+ * @param q the queue
+ * @param d array of items, all of which must be in the queue
+ * @param n number of items in d
+ * @return 0 on success
+ */
+int pqueue_remove_bulk(pqueue_t *q, void **d, unsigned int n);
+
+
 /**
  * access highest-ranking item without removing it.
  * @param q the queue
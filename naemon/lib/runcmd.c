@@ -17,18 +17,29 @@
  */
 
 #define NAGIOSPLUG_API_C 1
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1
+#endif
 
 /* includes **/
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <errno.h>
 #include "runcmd.h"
 
+#ifdef __linux__
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#endif
+
 
 /** macros **/
 #ifndef WEXITSTATUS
@@ -309,19 +320,316 @@ void runcmd_init(void)
 }
 
 
-/* Start running a command */
-int runcmd_open(const char *cmd, int *pfd, int *pfderr, char **env)
+/*
+ * Runs in the child. Hooks up stdout and stderr, adds the caller's
+ * environment and replaces the process with the command.
+ */
+static void exec_child(char **argv, char **env, int out, int err)
 {
-	char **argv = NULL;
-	int cmd2strv_errors, argc = 0;
-	size_t cmdlen;
+	int i;
+
+	/* make sure all our children are killable by our parent */
+	setpgid(0, 0);
+
+	if (out != STDOUT_FILENO) {
+		dup2(out, STDOUT_FILENO);
+		close(out);
+	}
+	if (err != STDERR_FILENO) {
+		dup2(err, STDERR_FILENO);
+		close(err);
+	}
+
+	/* close all descriptors in pids[]
+	 * This is executed in a separate address space (pure child),
+	 * so we don't have to worry about async safety */
+	for (i = 0; pids && i < maxfd; i++)
+		if (pids[i] > 0)
+			close(i);
+
+	/* add the caller's variables to the inherited environment */
+	for (i = 0; env && env[i]; i++)
+		putenv(env[i]);
+
+	execvp(argv[0], argv);
+	fprintf(stderr, "execvp(%s, ...) failed. errno is %d: %s\n", argv[0], errno, strerror(errno));
+	_exit(errno);
+}
+
+
+/*
+ * The zygote is a small process forked early in a worker's life that
+ * starts commands on the worker's behalf. Forking gets more expensive
+ * the more memory the forking process has mapped, so this keeps the
+ * cost of starting a command the same no matter how large the worker
+ * grows.
+ *
+ * Requests are a single datagram with argc and envc as two uint32_t's
+ * followed by that many nul-terminated strings, with the child's
+ * stdout and stderr attached as SCM_RIGHTS. The zygote starts the
+ * command with CLONE_PARENT, so it becomes a child of the worker just
+ * as if the worker had forked it, and replies with its pid, or with
+ * a negative errno if it couldn't be started.
+ */
+#define ZYGOTE_MAX_REQUEST (64 * 1024)
+static int zygote_sd = -1;
+static pid_t zygote_pid;
+
+#ifdef __linux__
+static void zygote_main(int sd)
+{
+	static char buf[ZYGOTE_MAX_REQUEST];
+	static char *argv[ZYGOTE_MAX_REQUEST / 2 + 2];
+	char cbuf[CMSG_SPACE(2 * sizeof(int))], *p;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	uint32_t argc, envc, i;
+	int fds[2], n, ret;
 	pid_t pid;
 
-	int i = 0;
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf) - 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+		n = recvmsg(sd, &msg, MSG_CMSG_CLOEXEC);
+		if (n < 0 && errno == EINTR)
+			continue;
+		/* the worker is gone */
+		if (n <= 0)
+			_exit(0);
+
+		fds[0] = fds[1] = -1;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)))
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+		/* unpack the argument and environment vectors */
+		buf[n] = 0;
+		ret = -EINVAL;
+		argc = envc = 0;
+		if (n >= (int)(2 * sizeof(uint32_t))) {
+			memcpy(&argc, buf, sizeof(argc));
+			memcpy(&envc, buf + sizeof(argc), sizeof(envc));
+		}
+		if (argc + envc > sizeof(argv) / sizeof(argv[0]) - 2)
+			argc = envc = 0;
+		p = buf + 2 * sizeof(uint32_t);
+		for (i = 0; i < argc + envc && p < buf + n; i++) {
+			/* leave room for the NULL that ends argv */
+			argv[i + (i >= argc)] = p;
+			p += strlen(p) + 1;
+		}
 
+		if (fds[0] >= 0 && fds[1] >= 0 && argc && i == argc + envc) {
+			argv[argc] = NULL;
+			argv[argc + 1 + envc] = NULL;
+			pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+			if (!pid) {
+				close(sd);
+				signal(SIGPIPE, SIG_DFL);
+				exec_child(argv, &argv[argc + 1], fds[0], fds[1]);
+			}
+			ret = pid < 0 ? -errno : pid;
+		}
+		if (fds[0] >= 0)
+			close(fds[0]);
+		if (fds[1] >= 0)
+			close(fds[1]);
+
+		while (send(sd, &ret, sizeof(ret), 0) < 0) {
+			if (errno != EINTR)
+				_exit(0);
+		}
+	}
+}
+
+/* asks the zygote to start a command, returns its pid or -1 */
+static pid_t zygote_spawn(char **argv, char **env, int out, int err)
+{
+	char *buf, cbuf[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	uint32_t argc, envc;
+	size_t len = 2 * sizeof(uint32_t), i;
+	int fds[2] = { out, err }, ret, pid = -1;
+
+	for (argc = 0; argv[argc]; argc++)
+		len += strlen(argv[argc]) + 1;
+	for (envc = 0; env && env[envc]; envc++)
+		len += strlen(env[envc]) + 1;
+	if (len >= ZYGOTE_MAX_REQUEST || !(buf = malloc(len)))
+		return -1;
+
+	memcpy(buf, &argc, sizeof(argc));
+	memcpy(buf + sizeof(argc), &envc, sizeof(envc));
+	len = 2 * sizeof(uint32_t);
+	for (i = 0; i < argc; i++) {
+		strcpy(buf + len, argv[i]);
+		len += strlen(argv[i]) + 1;
+	}
+	for (i = 0; i < envc; i++) {
+		strcpy(buf + len, env[i]);
+		len += strlen(env[i]) + 1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	while ((ret = sendmsg(zygote_sd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+	free(buf);
+	if (ret >= 0) {
+		while ((ret = recv(zygote_sd, &pid, sizeof(pid), 0)) < 0 && errno == EINTR)
+			;
+	}
+	if (ret != sizeof(pid)) {
+		/* the zygote died on us, so we'll fork on our own from now on */
+		runcmd_zygote_stop();
+		return -1;
+	}
+	if (pid < 0) {
+		errno = -pid;
+		return -1;
+	}
+	return pid;
+}
+#else
+static pid_t zygote_spawn(char **argv, char **env, int out, int err)
+{
+	return -1;
+}
+#endif
+
+
+int runcmd_zygote_start(void)
+{
+#ifdef __linux__
+	int sv[2], i;
+	pid_t pid;
+
+	if (zygote_sd >= 0)
+		return 0;
 	if (!pids)
 		runcmd_init();
 
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+		return -1;
+	pid = fork();
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	if (!pid) {
+		/* keep nothing but stdio and our end of the socket */
+		for (i = 3; i < maxfd; i++)
+			if (i != sv[1])
+				close(i);
+		memset(pids, 0, maxfd * sizeof(pid_t));
+		zygote_main(sv[1]);
+	}
+
+	close(sv[1]);
+	zygote_sd = sv[0];
+	zygote_pid = pid;
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+void runcmd_zygote_stop(void)
+{
+	if (zygote_sd < 0)
+		return;
+
+	/* the zygote exits when it sees the socket close */
+	close(zygote_sd);
+	zygote_sd = -1;
+	while (waitpid(zygote_pid, NULL, 0) < 0 && errno == EINTR)
+		;
+	zygote_pid = 0;
+}
+
+
+/* Start running an argument vector */
+int runcmd_open_argv(char **argv, int *pfd, int *pfderr, char **env)
+{
+	pid_t pid;
+
+	if (!pids)
+		runcmd_init();
+
+	if (!argv || !argv[0] || !*argv[0])
+		return RUNCMD_EINVAL;
+
+	if (pipe(pfd) < 0)
+		return RUNCMD_ECMD;
+	if (pipe(pfderr) < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return RUNCMD_EFD;
+	}
+	pid = -1;
+	if (zygote_sd >= 0)
+		pid = zygote_spawn(argv, env, pfd[1], pfderr[1]);
+	if (pid < 0)
+		pid = fork();
+	if (pid < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		close(pfderr[0]);
+		close(pfderr[1]);
+		return RUNCMD_EFORK; /* errno set by the failing function */
+	}
+
+	/* child runs excevp() and _exit. */
+	if (pid == 0) {
+		close(pfd[0]);
+		close(pfderr[0]);
+		exec_child(argv, env, pfd[1], pfderr[1]);
+	}
+
+	/* parent picks up execution here */
+	/* close childs file descriptors in our address space */
+	close(pfd[1]);
+	close(pfderr[1]);
+
+	/* tag our file's entry in the pid-list and return it */
+	pids[pfd[0]] = pid;
+
+	return pfd[0];
+}
+
+
+/* Start running a command */
+int runcmd_open(const char *cmd, int *pfd, int *pfderr, char **env)
+{
+	char **argv = NULL;
+	int cmd2strv_errors, argc = 0, ret;
+	size_t cmdlen;
+
 	/* if no command was passed, return with no error */
 	if (!cmd || !*cmd)
 		return RUNCMD_EINVAL;
@@ -348,89 +656,16 @@ int runcmd_open(const char *cmd, int *pfd, int *pfderr, char **env)
 		argv[3] = NULL;
 	}
 
-	if (pipe(pfd) < 0) {
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
-		free(argv);
-		return RUNCMD_ECMD;
-	}
-	if (pipe(pfderr) < 0) {
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
-		free(argv);
-		close(pfd[0]);
-		close(pfd[1]);
-		return RUNCMD_EFD;
-	}
-	pid = fork();
-	if (pid < 0) {
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
-		free(argv);
-		close(pfd[0]);
-		close(pfd[1]);
-		close(pfderr[0]);
-		close(pfderr[1]);
-		return RUNCMD_EFORK; /* errno set by the failing function */
-	}
-
-	/* child runs excevp() and _exit. */
-	if (pid == 0) {
-
-		/* make sure all our children are killable by our parent */
-		setpgid(getpid(), getpid());
-
-		close(pfd[0]);
-		if (pfd[1] != STDOUT_FILENO) {
-			dup2(pfd[1], STDOUT_FILENO);
-			close(pfd[1]);
-		}
-		close(pfderr[0]);
-		if (pfderr[1] != STDERR_FILENO) {
-			dup2(pfderr[1], STDERR_FILENO);
-			close(pfderr[1]);
-		}
-
-		/* close all descriptors in pids[]
-		 * This is executed in a separate address space (pure child),
-		 * so we don't have to worry about async safety */
-		for (i = 0; i < maxfd; i++)
-			if (pids[i] > 0)
-				close(i);
+	ret = runcmd_open_argv(argv, pfd, pfderr, env);
 
-		i = execvp(argv[0], argv);
-		fprintf(stderr, "execvp(%s, ...) failed. errno is %d: %s\n", argv[0], errno, strerror(errno));
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
-		_exit(errno);
-	}
-
-	/* parent picks up execution here */
-	/*
-	 * close childs file descriptors in our address space and
-	 * release the memory we used that won't get passed to the
-	 * caller.
-	 */
-	close(pfd[1]);
-	close(pfderr[1]);
+	/* release the memory that won't get passed to the caller */
 	if (!cmd2strv_errors)
 		free(argv[0]);
 	else
 		free(argv[2]);
 	free(argv);
 
-	/* tag our file's entry in the pid-list and return it */
-	pids[pfd[0]] = pid;
-
-	return pfd[0];
+	return ret;
 }
 
 
@@ -66,11 +66,42 @@ extern const char *runcmd_strerror(int code);
  * @param[in] cmdstring The command to launch
  * @param[out] pfd Child's stdout filedescriptor
  * @param[out] pfderr Child's stderr filedescriptor
- * @param[in] env Currently ignored for portability
+ * @param[in] env NULL-terminated array of "name=value" strings to add
+ * to the child's environment, or NULL
  */
 extern int runcmd_open(const char *cmdstring, int *pfd, int *pfderr, char **env)
 	__attribute__((__nonnull__(1, 2, 3)));
 
+/**
+ * Start a command from an argument vector, without any parsing
+ * @param[in] argv NULL-terminated argument vector. argv[0] is looked
+ * up in $PATH unless it contains a slash
+ * @param[out] pfd Child's stdout filedescriptor
+ * @param[out] pfderr Child's stderr filedescriptor
+ * @param[in] env NULL-terminated array of "name=value" strings to add
+ * to the child's environment, or NULL
+ */
+extern int runcmd_open_argv(char **argv, int *pfd, int *pfderr, char **env)
+	__attribute__((__nonnull__(2, 3)));
+
+/**
+ * Start commands through a zygote process from now on
+ *
+ * The zygote is forked right away and starts every command passed
+ * to runcmd_open() afterwards, so the cost of starting a command
+ * doesn't grow with the memory footprint of the caller. Commands are
+ * still children of the caller and are reaped like any other. If the
+ * zygote goes away, runcmd_open() forks on its own again.
+ * @note Only available on Linux
+ * @return 0 on success, -1 with errno set on errors
+ */
+extern int runcmd_zygote_start(void);
+
+/**
+ * Stop the zygote started with runcmd_zygote_start()
+ */
+extern void runcmd_zygote_stop(void);
+
 /**
  * Close a command and return its exit status
  * @note Don't use this. It's a retarded way to reap children suitable
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE 1
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include "shmring.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#endif
+
+/*
+ * Positions are byte counters that only ever grow, so the ring is
+ * empty when head == tail and full when tail - head == size. Each
+ * record is a 32-bit length followed by the payload, padded so the
+ * next record is 8-byte aligned. Records never wrap; when one won't
+ * fit before the end of the buffer, the writer leaves a wrap marker
+ * and starts over at the beginning.
+ */
+#define SHMRING_WRAP 0xffffffffU
+#define SHMRING_ALIGN 8
+#define SHMRING_MIN_SIZE 4096
+#define rec_size(len) (((len) + sizeof(uint32_t) + SHMRING_ALIGN - 1) & ~(SHMRING_ALIGN - 1))
+
+/* head and tail live on cache lines of their own */
+struct shmring_hdr {
+	uint64_t size;
+	char pad0[56];
+	uint64_t head;
+	char pad1[56];
+	uint64_t tail;
+	char pad2[56];
+};
+
+struct shmring {
+	struct shmring_hdr *hdr;
+	char *data;
+	size_t map_size;
+	uint64_t size;
+	uint64_t reserved; /* record bytes reserved by the writer */
+	uint64_t wrap; /* bytes the reserved record skips at the end */
+	uint64_t rec_off; /* where the reserved record starts */
+	unsigned int peeked; /* bytes the reader is about to consume */
+	int fd;
+	int efd;
+};
+
+#ifdef __linux__
+static shmring *shmring_map(int fd, int efd, uint64_t size)
+{
+	shmring *r;
+	void *map;
+	size_t map_size = sizeof(struct shmring_hdr) + size;
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		munmap(map, map_size);
+		return NULL;
+	}
+	r->hdr = map;
+	r->data = (char *)map + sizeof(struct shmring_hdr);
+	r->map_size = map_size;
+	r->size = size;
+	r->fd = fd;
+	r->efd = efd;
+
+	return r;
+}
+
+shmring *shmring_create(unsigned int size)
+{
+	shmring *r;
+	uint64_t real_size = SHMRING_MIN_SIZE;
+	int fd, efd;
+
+	while (real_size < size)
+		real_size <<= 1;
+
+	fd = memfd_create("naemon-shmring", MFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, sizeof(struct shmring_hdr) + real_size) < 0) {
+		close(fd);
+		return NULL;
+	}
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	r = shmring_map(fd, efd, real_size);
+	if (!r) {
+		close(fd);
+		close(efd);
+		return NULL;
+	}
+	r->hdr->size = real_size;
+
+	return r;
+}
+
+shmring *shmring_attach(int fd, int efd)
+{
+	struct stat st;
+	uint64_t size;
+	struct shmring_hdr hdr;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+	if ((size_t)st.st_size < sizeof(hdr) || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* don't trust a ring we didn't create ourselves too much */
+	size = hdr.size;
+	if (size < SHMRING_MIN_SIZE || (size & (size - 1)) || size + sizeof(hdr) != (uint64_t)st.st_size) {
+		errno = EINVAL;
+		return NULL;
+	}
+	fcntl(efd, F_SETFL, O_NONBLOCK);
+
+	return shmring_map(fd, efd, size);
+}
+
+void shmring_destroy(shmring *r)
+{
+	if (!r)
+		return;
+
+	munmap(r->hdr, r->map_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	if (r->efd >= 0)
+		close(r->efd);
+	free(r);
+}
+
+#else
+shmring *shmring_create(unsigned int size)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+shmring *shmring_attach(int fd, int efd)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void shmring_destroy(shmring *r)
+{
+	return;
+}
+#endif
+
+int shmring_fd(shmring *r)
+{
+	return r ? r->fd : -1;
+}
+
+int shmring_doorbell(shmring *r)
+{
+	return r ? r->efd : -1;
+}
+
+void shmring_close_fd(shmring *r)
+{
+	if (!r || r->fd < 0)
+		return;
+	close(r->fd);
+	r->fd = -1;
+}
+
+unsigned int shmring_max_record(shmring *r)
+{
+	/* half the ring, so a record always fits once the reader catches up */
+	return r ? (unsigned int)(r->size / 2 - sizeof(uint32_t)) : 0;
+}
+
+void *shmring_reserve(shmring *r, unsigned int len)
+{
+	uint64_t head, tail, need, off, left;
+
+	if (!r) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (len > shmring_max_record(r)) {
+		errno = EMSGSIZE;
+		return NULL;
+	}
+
+	tail = r->hdr->tail;
+	head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+	off = tail & (r->size - 1);
+	left = r->size - off;
+	need = rec_size(len);
+	if (need > left)
+		need += left;
+
+	if (r->size - (tail - head) < need) {
+		errno = EAGAIN;
+		return NULL;
+	}
+	r->reserved = rec_size(len);
+	r->wrap = need - r->reserved;
+
+	if (r->wrap) {
+		*(uint32_t *)(r->data + off) = SHMRING_WRAP;
+		off = 0;
+	}
+	r->rec_off = off;
+
+	return r->data + off + sizeof(uint32_t);
+}
+
+int shmring_commit(shmring *r, unsigned int len)
+{
+	uint64_t tail, one = 1;
+
+	if (!r || !r->reserved || rec_size(len) > r->reserved) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	tail = r->hdr->tail;
+	*(uint32_t *)(r->data + r->rec_off) = len;
+	r->reserved = 0;
+
+	/*
+	 * Publish the record, then check if the reader had caught up
+	 * with everything before it. If so, it may be asleep waiting for
+	 * the doorbell. Both this pair and the one in shmring_consume()
+	 * followed by shmring_peek() are sequentially consistent, so
+	 * either we see the reader's head or it sees our tail.
+	 */
+	__atomic_store_n(&r->hdr->tail, tail + r->wrap + rec_size(len), __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->hdr->head, __ATOMIC_SEQ_CST) == tail) {
+		if (write(r->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			return -1;
+	}
+
+	return 0;
+}
+
+int shmring_write(shmring *r, const void *buf, unsigned int len)
+{
+	void *rec;
+
+	if (!(rec = shmring_reserve(r, len)))
+		return -1;
+	memcpy(rec, buf, len);
+	return shmring_commit(r, len);
+}
+
+void *shmring_peek(shmring *r, unsigned int *len)
+{
+	uint64_t head, tail, off;
+	uint32_t rlen;
+
+	if (!r)
+		return NULL;
+
+	head = r->hdr->head;
+	tail = __atomic_load_n(&r->hdr->tail, __ATOMIC_SEQ_CST);
+	if (head == tail)
+		return NULL;
+
+	off = head & (r->size - 1);
+	rlen = *(uint32_t *)(r->data + off);
+	r->peeked = 0;
+	if (rlen == SHMRING_WRAP) {
+		r->peeked = r->size - off;
+		off = 0;
+		rlen = *(uint32_t *)r->data;
+	}
+
+	/* a writer we can't trust could point us anywhere */
+	if (rlen > shmring_max_record(r) || off + rec_size(rlen) > r->size || r->peeked + rec_size(rlen) > tail - head) {
+		r->peeked = 0;
+		return NULL;
+	}
+	r->peeked += rec_size(rlen);
+	if (len)
+		*len = rlen;
+
+	return r->data + off + sizeof(uint32_t);
+}
+
+void shmring_consume(shmring *r)
+{
+	if (!r || !r->peeked)
+		return;
+	__atomic_store_n(&r->hdr->head, r->hdr->head + r->peeked, __ATOMIC_SEQ_CST);
+	r->peeked = 0;
+}
+
+int shmring_ack(shmring *r)
+{
+	uint64_t val;
+
+	if (!r)
+		return -1;
+	if (read(r->efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		return -1;
+	return 0;
+}
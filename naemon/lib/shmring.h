@@ -0,0 +1,144 @@
+#ifndef LIBNAEMON_shmring_h__
+#define LIBNAEMON_shmring_h__
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "lnae-utils.h"
+
+/**
+ * @file shmring.h
+ * @brief Shared memory single-producer/single-consumer record rings
+ *
+ * A shmring is a circular buffer of variable length records living
+ * in an anonymous, memfd-backed shared memory segment, with an
+ * eventfd used as doorbell. Exactly one process may write to a ring
+ * and exactly one process may read from it. The two file descriptors
+ * can be handed to another process (usually with nsock_send_fds()),
+ * which then attaches to the ring with shmring_attach().
+ *
+ * Records are written and read in place, so a writer reserves room
+ * for a record, fills it and commits it, while a reader peeks at the
+ * oldest record, uses it and consumes it. The doorbell is only rung
+ * when the reader may have gone to sleep, so a busy ring costs no
+ * syscalls at all. Readers should register the doorbell with their
+ * io broker, call shmring_ack() when it becomes readable and then
+ * drain the ring completely.
+ *
+ * Rings are only available on Linux. Elsewhere shmring_create()
+ * fails with ENOSYS, and callers are expected to fall back to
+ * whatever transport they used before.
+ * @{
+ */
+
+NAGIOS_BEGIN_DECL
+
+/** Opaque type for the ring */
+typedef struct shmring shmring;
+
+/**
+ * Create a new ring
+ * @param size Bytes of record space. Rounded up to a power of two
+ * @return A new ring, or NULL on errors with errno set
+ */
+extern shmring *shmring_create(unsigned int size);
+
+/**
+ * Attach to a ring created by another process
+ * @param fd The shared memory file descriptor of the ring
+ * @param efd The doorbell of the ring
+ * @return The ring, or NULL on errors with errno set
+ */
+extern shmring *shmring_attach(int fd, int efd);
+
+/**
+ * Unmap a ring and close its file descriptors
+ * @param r The ring to destroy
+ */
+extern void shmring_destroy(shmring *r);
+
+/**
+ * Get the shared memory file descriptor of a ring
+ * @param r The ring
+ * @return The file descriptor, or -1 if it has been closed
+ */
+extern int shmring_fd(shmring *r);
+
+/**
+ * Get the doorbell file descriptor of a ring
+ * @param r The ring
+ * @return The file descriptor readers should poll for input
+ */
+extern int shmring_doorbell(shmring *r);
+
+/**
+ * Close the shared memory file descriptor of a ring.
+ * The mapping stays valid, so this can be done as soon as the
+ * descriptor has been handed to the other process.
+ * @param r The ring
+ */
+extern void shmring_close_fd(shmring *r);
+
+/**
+ * Get the size of the largest record the ring can hold
+ * @param r The ring
+ * @return Maximum record length in bytes
+ */
+extern unsigned int shmring_max_record(shmring *r);
+
+/**
+ * Reserve room for a record. Only one record can be reserved at a
+ * time, and nothing is visible to the reader until shmring_commit()
+ * @param r The ring to write to
+ * @param len Length of the record
+ * @return Pointer to len bytes of record space, or NULL with errno
+ *         set to EAGAIN if the ring is full or EMSGSIZE if the record
+ *         can never fit
+ */
+extern void *shmring_reserve(shmring *r, unsigned int len);
+
+/**
+ * Publish the record reserved with shmring_reserve()
+ * @param r The ring to write to
+ * @param len Actual length of the record, at most what was reserved
+ * @return 0 on success, -1 on errors
+ */
+extern int shmring_commit(shmring *r, unsigned int len);
+
+/**
+ * Copy a record into the ring
+ * @param r The ring to write to
+ * @param buf The record
+ * @param len Length of the record
+ * @return 0 on success, -1 on errors. See shmring_reserve()
+ */
+extern int shmring_write(shmring *r, const void *buf, unsigned int len);
+
+/**
+ * Get the oldest record in the ring without releasing it. The
+ * record may be modified in place until shmring_consume() is called
+ * @param r The ring to read from
+ * @param[out] len Length of the record
+ * @return Pointer to the record, or NULL if the ring is empty
+ */
+extern void *shmring_peek(shmring *r, unsigned int *len);
+
+/**
+ * Release the record returned by shmring_peek()
+ * @param r The ring to read from
+ */
+extern void shmring_consume(shmring *r);
+
+/**
+ * Acknowledge the doorbell of a ring. Readers must call this before
+ * draining the ring, or they may miss a wakeup
+ * @param r The ring to read from
+ * @return 0 on success, -1 on errors
+ */
+extern int shmring_ack(shmring *r);
+
+NAGIOS_END_DECL
+
+/** @} */
+#endif /* LIBNAEMON_shmring_h__ */
@@ -0,0 +1,328 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmstatus.h"
+
+#define SHMSTATUS_MAGIC "NMSTATUS"
+#define SHMSTATUS_VERSION 1
+#define SHMSTATUS_ALIGN 64
+#define align(x) (((x) + SHMSTATUS_ALIGN - 1) & ~((uint64_t)SHMSTATUS_ALIGN - 1))
+
+/*
+ * The segment is a header, the host records, the service records and
+ * finally the name table. Name offsets point into the name table,
+ * which starts with an empty string so 0 means "no name".
+ */
+struct shmstatus_hdr {
+	char magic[8];
+	uint32_t version; /* written last, once the segment is ready */
+	uint32_t stale;
+	uint32_t slot_size;
+	uint32_t num_hosts;
+	uint32_t num_services;
+	uint32_t pad;
+	uint64_t names_off;
+	uint64_t names_size;
+};
+
+struct shmstatus_slot {
+	uint32_t seq; /* odd while the writer is busy with the record */
+	uint32_t host_name;
+	uint32_t description;
+	uint32_t pad;
+	shmstatus_object obj;
+};
+
+struct shmstatus {
+	struct shmstatus_hdr *hdr;
+	char *slots;
+	char *names;
+	size_t map_size;
+	uint64_t names_used;
+	int fd; /* only kept by the writer */
+	char *name;
+};
+
+static inline struct shmstatus_slot *get_slot(shmstatus *s, int type, unsigned int id)
+{
+	if (type == SHMSTATUS_HOST) {
+		if (id >= s->hdr->num_hosts)
+			return NULL;
+	} else if (type == SHMSTATUS_SERVICE) {
+		if (id >= s->hdr->num_services)
+			return NULL;
+		id += s->hdr->num_hosts;
+	} else {
+		return NULL;
+	}
+	return (struct shmstatus_slot *)(s->slots + (uint64_t)id * s->hdr->slot_size);
+}
+
+/* tells readers of a segment we're about to replace or abandon */
+static void mark_stale(const char *name)
+{
+	struct shmstatus_hdr *hdr;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0)
+		return;
+	hdr = mmap(NULL, sizeof(*hdr), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return;
+	__atomic_store_n(&hdr->stale, 1, __ATOMIC_RELEASE);
+	munmap(hdr, sizeof(*hdr));
+}
+
+shmstatus *shmstatus_create(const char *name, unsigned int num_hosts, unsigned int num_services, unsigned long names_size)
+{
+	shmstatus *s;
+	uint64_t slot_size = align(sizeof(struct shmstatus_slot));
+	uint64_t names_off = align(sizeof(struct shmstatus_hdr)) + slot_size * ((uint64_t)num_hosts + num_services);
+	void *map;
+	int fd;
+
+	mark_stale(name);
+	shm_unlink(name);
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
+		return NULL;
+
+	/* reserve room for the leading empty name */
+	names_size++;
+	if (ftruncate(fd, names_off + names_size) < 0)
+		goto error;
+	map = mmap(NULL, names_off + names_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto error;
+
+	if (!(s = calloc(1, sizeof(*s))) || !(s->name = strdup(name))) {
+		free(s);
+		munmap(map, names_off + names_size);
+		errno = ENOMEM;
+		goto error;
+	}
+	s->hdr = map;
+	s->slots = (char *)map + align(sizeof(struct shmstatus_hdr));
+	s->names = (char *)map + names_off;
+	s->map_size = names_off + names_size;
+	s->names_used = 1;
+	s->fd = fd;
+
+	s->hdr->slot_size = slot_size;
+	s->hdr->num_hosts = num_hosts;
+	s->hdr->num_services = num_services;
+	s->hdr->names_off = names_off;
+	s->hdr->names_size = names_size;
+
+	return s;
+
+error:
+	close(fd);
+	shm_unlink(name);
+	return NULL;
+}
+
+static uint32_t add_name(shmstatus *s, const char *str)
+{
+	uint64_t len = strlen(str) + 1, off = s->names_used;
+
+	if (off + len > s->hdr->names_size)
+		return 0;
+	memcpy(s->names + off, str, len);
+	s->names_used += len;
+	return (uint32_t)off;
+}
+
+int shmstatus_set_name(shmstatus *s, int type, unsigned int id, const char *host_name, const char *description)
+{
+	struct shmstatus_slot *slot = get_slot(s, type, id);
+
+	if (!slot || !host_name)
+		return -1;
+	if (!(slot->host_name = add_name(s, host_name)))
+		return -1;
+	if (description && !(slot->description = add_name(s, description)))
+		return -1;
+	return 0;
+}
+
+void shmstatus_ready(shmstatus *s)
+{
+	memcpy(s->hdr->magic, SHMSTATUS_MAGIC, sizeof(s->hdr->magic));
+	__atomic_store_n(&s->hdr->version, SHMSTATUS_VERSION, __ATOMIC_RELEASE);
+}
+
+shmstatus_object *shmstatus_write_begin(shmstatus *s, int type, unsigned int id)
+{
+	struct shmstatus_slot *slot = get_slot(s, type, id);
+
+	if (!slot)
+		return NULL;
+
+	/* the odd count must be visible before any of the new data */
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return &slot->obj;
+}
+
+void shmstatus_write_end(shmstatus *s, int type, unsigned int id)
+{
+	struct shmstatus_slot *slot = get_slot(s, type, id);
+
+	if (slot)
+		__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+shmstatus *shmstatus_open(const char *name)
+{
+	shmstatus *s;
+	struct shmstatus_hdr *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		errno = EAGAIN;
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	hdr = map;
+	if (__atomic_load_n(&hdr->version, __ATOMIC_ACQUIRE) != SHMSTATUS_VERSION) {
+		errno = hdr->version ? EPROTO : EAGAIN;
+		goto error;
+	}
+	if (memcmp(hdr->magic, SHMSTATUS_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->slot_size != align(sizeof(struct shmstatus_slot)) ||
+	    hdr->names_off + hdr->names_size > (uint64_t)st.st_size) {
+		errno = EPROTO;
+		goto error;
+	}
+
+	if (!(s = calloc(1, sizeof(*s)))) {
+		errno = ENOMEM;
+		goto error;
+	}
+	s->hdr = hdr;
+	s->slots = (char *)map + align(sizeof(struct shmstatus_hdr));
+	s->names = (char *)map + hdr->names_off;
+	s->map_size = st.st_size;
+	s->fd = -1;
+	return s;
+
+error:
+	munmap(map, st.st_size);
+	return NULL;
+}
+
+int shmstatus_read(shmstatus *s, int type, unsigned int id, shmstatus_object *obj)
+{
+	struct shmstatus_slot *slot = get_slot(s, type, id);
+	uint32_t seq;
+
+	if (!slot)
+		return -1;
+
+	for (;;) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			/* let the writer finish if it's sharing our cpu */
+			sched_yield();
+			continue;
+		}
+		memcpy(obj, &slot->obj, sizeof(*obj));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	return 0;
+}
+
+unsigned int shmstatus_count(shmstatus *s, int type)
+{
+	if (type == SHMSTATUS_HOST)
+		return s->hdr->num_hosts;
+	if (type == SHMSTATUS_SERVICE)
+		return s->hdr->num_services;
+	return 0;
+}
+
+const char *shmstatus_host_name(shmstatus *s, int type, unsigned int id)
+{
+	struct shmstatus_slot *slot = get_slot(s, type, id);
+
+	return slot ? s->names + slot->host_name : NULL;
+}
+
+const char *shmstatus_service_description(shmstatus *s, unsigned int id)
+{
+	struct shmstatus_slot *slot = get_slot(s, SHMSTATUS_SERVICE, id);
+
+	return slot ? s->names + slot->description : NULL;
+}
+
+int shmstatus_find_host(shmstatus *s, const char *host_name)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->hdr->num_hosts; i++) {
+		if (!strcmp(shmstatus_host_name(s, SHMSTATUS_HOST, i), host_name))
+			return i;
+	}
+	return -1;
+}
+
+int shmstatus_find_service(shmstatus *s, const char *host_name, const char *description)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->hdr->num_services; i++) {
+		if (!strcmp(shmstatus_service_description(s, i), description) &&
+		    !strcmp(shmstatus_host_name(s, SHMSTATUS_SERVICE, i), host_name))
+			return i;
+	}
+	return -1;
+}
+
+int shmstatus_is_stale(shmstatus *s)
+{
+	return __atomic_load_n(&s->hdr->stale, __ATOMIC_ACQUIRE) != 0;
+}
+
+void shmstatus_destroy(shmstatus *s)
+{
+	struct stat ours, theirs;
+	int fd;
+
+	if (!s)
+		return;
+
+	if (s->fd >= 0) {
+		__atomic_store_n(&s->hdr->stale, 1, __ATOMIC_RELEASE);
+		/* don't unlink a segment someone else has put in our place */
+		if (!fstat(s->fd, &ours) && (fd = shm_open(s->name, O_RDONLY, 0)) >= 0) {
+			if (!fstat(fd, &theirs) && ours.st_ino == theirs.st_ino && ours.st_dev == theirs.st_dev)
+				shm_unlink(s->name);
+			close(fd);
+		}
+		close(s->fd);
+	}
+	munmap(s->hdr, s->map_size);
+	free(s->name);
+	free(s);
+}
@@ -0,0 +1,195 @@
+#ifndef LIBNAEMON_shmstatus_h__
+#define LIBNAEMON_shmstatus_h__
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include <stdint.h>
+#include "lnae-utils.h"
+
+/**
+ * @file shmstatus.h
+ * @brief Live host and service status in POSIX shared memory
+ *
+ * A status segment holds one fixed-size record per host and per
+ * service, indexed by object id, plus the names of the objects. A
+ * single writer (the core) updates records in place, and any number
+ * of readers in other processes can copy them out without making a
+ * syscall or bothering the writer.
+ *
+ * Every record is guarded by a sequence lock: the writer makes the
+ * sequence number odd while it updates a record and even again when
+ * it's done, and readers retry whenever the number was odd or changed
+ * while they copied the record. Readers therefore always get a
+ * consistent record, but never block the writer.
+ *
+ * When the writer goes away or the set of objects changes, the old
+ * segment is marked stale and unlinked, and readers are expected to
+ * reopen it by name.
+ * @{
+ */
+
+NAGIOS_BEGIN_DECL
+
+/** Record types */
+#define SHMSTATUS_HOST 0
+#define SHMSTATUS_SERVICE 1
+
+/** Bytes of plugin output kept per record, including the nul byte */
+#define SHMSTATUS_OUTPUT_SIZE 256
+
+/** The status of a single host or service */
+typedef struct shmstatus_object {
+	int64_t last_check;
+	int64_t next_check;
+	int64_t last_state_change;
+	int64_t last_hard_state_change;
+	double latency;
+	double execution_time;
+	double percent_state_change;
+	int32_t current_state;
+	int32_t last_hard_state;
+	int32_t state_type;
+	int32_t current_attempt;
+	int32_t max_attempts;
+	int32_t has_been_checked;
+	int32_t problem_has_been_acknowledged;
+	int32_t scheduled_downtime_depth;
+	int32_t is_flapping;
+	int32_t checks_enabled;
+	int32_t notifications_enabled;
+	int32_t reserved;
+	char plugin_output[SHMSTATUS_OUTPUT_SIZE];
+} shmstatus_object;
+
+/** Opaque type for a status segment */
+typedef struct shmstatus shmstatus;
+
+/**
+ * Create a new status segment. An existing segment by the same name
+ * is marked stale and replaced. Readers can't open the segment until
+ * shmstatus_ready() is called.
+ * @param name Name of the segment, as passed to shm_open()
+ * @param num_hosts Number of host records
+ * @param num_services Number of service records
+ * @param names_size Bytes to reserve for object names
+ * @return The segment, or NULL on errors with errno set
+ */
+extern shmstatus *shmstatus_create(const char *name, unsigned int num_hosts, unsigned int num_services, unsigned long names_size);
+
+/**
+ * Set the name of an object. Names can only be set before the
+ * segment is made ready.
+ * @param s The segment
+ * @param type SHMSTATUS_HOST or SHMSTATUS_SERVICE
+ * @param id Object id
+ * @param host_name Name of the host
+ * @param description Service description, or NULL for hosts
+ * @return 0 on success, -1 if the id is out of range or names_size
+ *         was too small
+ */
+extern int shmstatus_set_name(shmstatus *s, int type, unsigned int id, const char *host_name, const char *description);
+
+/**
+ * Let readers open the segment
+ * @param s The segment
+ */
+extern void shmstatus_ready(shmstatus *s);
+
+/**
+ * Start updating a record. Nothing else may be done with the
+ * segment until shmstatus_write_end() is called for the same record.
+ * @param s The segment
+ * @param type SHMSTATUS_HOST or SHMSTATUS_SERVICE
+ * @param id Object id
+ * @return The record to update, or NULL if the id is out of range
+ */
+extern shmstatus_object *shmstatus_write_begin(shmstatus *s, int type, unsigned int id);
+
+/**
+ * Publish an update started with shmstatus_write_begin()
+ * @param s The segment
+ * @param type SHMSTATUS_HOST or SHMSTATUS_SERVICE
+ * @param id Object id
+ */
+extern void shmstatus_write_end(shmstatus *s, int type, unsigned int id);
+
+/**
+ * Open an existing segment for reading
+ * @param name Name of the segment, as passed to shm_open()
+ * @return The segment, or NULL on errors with errno set. errno is
+ *         EAGAIN if the segment isn't ready yet
+ */
+extern shmstatus *shmstatus_open(const char *name);
+
+/**
+ * Copy a consistent snapshot of a record
+ * @param s The segment
+ * @param type SHMSTATUS_HOST or SHMSTATUS_SERVICE
+ * @param id Object id
+ * @param[out] obj Where to put the record
+ * @return 0 on success, -1 if the id is out of range
+ */
+extern int shmstatus_read(shmstatus *s, int type, unsigned int id, shmstatus_object *obj);
+
+/**
+ * Get the number of records of a type
+ * @param s The segment
+ * @param type SHMSTATUS_HOST or SHMSTATUS_SERVICE
+ * @return Number of records
+ */
+extern unsigned int shmstatus_count(shmstatus *s, int type);
+
+/**
+ * Get the host name of a record
+ * @param s The segment
+ * @param type SHMSTATUS_HOST or SHMSTATUS_SERVICE
+ * @param id Object id
+ * @return The host name, or NULL if the id is out of range
+ */
+extern const char *shmstatus_host_name(shmstatus *s, int type, unsigned int id);
+
+/**
+ * Get the description of a service record
+ * @param s The segment
+ * @param id Service id
+ * @return The service description, or NULL if the id is out of range
+ */
+extern const char *shmstatus_service_description(shmstatus *s, unsigned int id);
+
+/**
+ * Look up the id of a host
+ * @param s The segment
+ * @param host_name Name of the host
+ * @return The host id, or -1 if there's no such host
+ */
+extern int shmstatus_find_host(shmstatus *s, const char *host_name);
+
+/**
+ * Look up the id of a service
+ * @param s The segment
+ * @param host_name Name of the host
+ * @param description Service description
+ * @return The service id, or -1 if there's no such service
+ */
+extern int shmstatus_find_service(shmstatus *s, const char *host_name, const char *description);
+
+/**
+ * Check if a segment has been replaced or abandoned by its writer
+ * @param s The segment
+ * @return 1 if readers should reopen the segment, 0 otherwise
+ */
+extern int shmstatus_is_stale(shmstatus *s);
+
+/**
+ * Unmap a segment. If called by the writer, the segment is also
+ * marked stale and unlinked.
+ * @param s The segment
+ */
+extern void shmstatus_destroy(shmstatus *s);
+
+NAGIOS_END_DECL
+
+/** @} */
+#endif /* LIBNAEMON_shmstatus_h__ */
@@ -26,6 +26,16 @@ struct squeue_event {
 	pqueue_pri_t pri;
 	struct timeval when;
 	void *data;
+	struct squeue_arena *arena;
+};
+
+/*
+ * Events added in bulk share a single allocation, which is released
+ * when the last of them leaves the queue.
+ */
+struct squeue_arena {
+	unsigned int refs;
+	squeue_event evt[];
 };
 
 /*
@@ -102,20 +112,16 @@ squeue_t *squeue_create(unsigned int horizon)
 	return pqueue_init(horizon, sq_cmp_pri, sq_get_pri, sq_set_pri, sq_get_pos, sq_set_pos);
 }
 
-squeue_event *squeue_add_tv(squeue_t *q, struct timeval *tv, void *data)
+static void squeue_event_free(squeue_event *evt)
 {
-	squeue_event *evt;
-
-	if (!q)
-		return NULL;
-
-	evt = calloc(1, sizeof(*evt));
-	if (!evt)
-		return NULL;
+	if (!evt->arena)
+		free(evt);
+	else if (!--evt->arena->refs)
+		free(evt->arena);
+}
 
-	/* we can't schedule events in the past */
-	if (tv->tv_sec < time(NULL))
-		tv->tv_sec = time(NULL);
+static void evt_set_when(squeue_event *evt, const struct timeval *tv)
+{
 	evt->when.tv_sec = tv->tv_sec;
 	if (sizeof(evt->when.tv_sec) > 4) {
 		/*
@@ -127,9 +133,22 @@ squeue_event *squeue_add_tv(squeue_t *q, struct timeval *tv, void *data)
 		evt->when.tv_sec &= (1ULL << ((sizeof(pqueue_pri_t) * 8) - SQ_BITS)) - 1;
 	}
 	evt->when.tv_usec = tv->tv_usec;
-	evt->data = data;
-
 	evt->pri = evt_compute_pri(&evt->when);
+}
+
+squeue_event *squeue_add_tv(squeue_t *q, struct timeval *tv, void *data)
+{
+	squeue_event *evt;
+
+	if (!q)
+		return NULL;
+
+	evt = calloc(1, sizeof(*evt));
+	if (!evt)
+		return NULL;
+
+	evt_set_when(evt, tv);
+	evt->data = data;
 
 	if (!pqueue_insert(q, evt))
 		return evt;
@@ -147,7 +166,10 @@ squeue_event *squeue_add(squeue_t *q, time_t when, void *data)
 	 * timestamp get different priorities for FIFO ordering.
 	 */
 	gettimeofday(&tv, NULL);
-	tv.tv_sec = when;
+
+	/* we can't schedule events in the past */
+	if (when > tv.tv_sec)
+		tv.tv_sec = when;
 
 	return squeue_add_tv(q, &tv, data);
 }
@@ -155,7 +177,10 @@ squeue_event *squeue_add(squeue_t *q, time_t when, void *data)
 squeue_event *squeue_add_usec(squeue_t *q, time_t when, time_t usec, void *data)
 {
 	struct timeval tv;
-	tv.tv_sec = when;
+	time_t now = time(NULL);
+
+	/* we can't schedule events in the past */
+	tv.tv_sec = when < now ? now : when;
 	tv.tv_usec = usec;
 	assert(usec < 1000000);
 	return squeue_add_tv(q, &tv, data);
@@ -182,7 +207,7 @@ void *squeue_pop(squeue_t *q)
 	evt = pqueue_pop(q);
 	if (evt) {
 		ptr = evt->data;
-		free(evt);
+		squeue_event_free(evt);
 	}
 	return ptr;
 }
@@ -195,16 +220,71 @@ int squeue_remove(squeue_t *q, squeue_event *evt)
 		return -1;
 	ret = pqueue_remove(q, evt);
 	if (evt)
-		free(evt);
+		squeue_event_free(evt);
+
+	return ret;
+}
+
+int squeue_add_bulk(squeue_t *q, const struct timeval *when, void **data, squeue_event **evts, unsigned int n)
+{
+	struct squeue_arena *arena;
+	squeue_event **tmp = NULL;
+	unsigned int i;
+	int ret = 0;
+
+	if (!q || !when || !data)
+		return -1;
+	if (!n)
+		return 0;
+
+	arena = calloc(1, sizeof(*arena) + sizeof(squeue_event) * n);
+	if (!arena)
+		return -1;
+
+	/* callers that don't need the events back still need an array */
+	if (!evts && !(evts = tmp = malloc(sizeof(*evts) * n))) {
+		free(arena);
+		return -1;
+	}
+
+	arena->refs = n;
+	for (i = 0; i < n; i++) {
+		squeue_event *evt = &arena->evt[i];
+		evt_set_when(evt, &when[i]);
+		evt->data = data[i];
+		evt->arena = arena;
+		evts[i] = evt;
+	}
+
+	if (pqueue_insert_bulk(q, (void **)evts, n)) {
+		free(arena);
+		ret = -1;
+	}
+	free(tmp);
 
 	return ret;
 }
 
+int squeue_remove_bulk(squeue_t *q, squeue_event **evts, unsigned int n)
+{
+	unsigned int i;
+
+	if (!q || (n && !evts))
+		return -1;
+
+	if (pqueue_remove_bulk(q, (void **)evts, n))
+		return -1;
+	for (i = 0; i < n; i++)
+		squeue_event_free(evts[i]);
+
+	return 0;
+}
+
 void squeue_destroy(squeue_t *q, int flags)
 {
 	unsigned int i;
 
-	if (!q || pqueue_size(q) < 1)
+	if (!q)
 		return;
 
 	/*
@@ -214,16 +294,31 @@ void squeue_destroy(squeue_t *q, int flags)
 	if (flags & SQUEUE_FREE_DATA) {
 		for (i = 0; i < pqueue_size(q); i++) {
 			free(((squeue_event *)q->d[i + 1])->data);
-			free(q->d[i + 1]);
+			squeue_event_free(q->d[i + 1]);
 		}
 	} else {
 		for (i = 0; i < pqueue_size(q); i++) {
-			free(q->d[i + 1]);
+			squeue_event_free(q->d[i + 1]);
 		}
 	}
 	pqueue_free(q);
 }
 
+int squeue_walk(squeue_t *q, int (*walker)(squeue_event *, void *), void *arg)
+{
+	unsigned int i;
+	int ret;
+
+	if (!q || !walker)
+		return 0;
+
+	for (i = 1; i < q->size; i++) {
+		if ((ret = walker(q->d[i], arg)))
+			return ret;
+	}
+	return 0;
+}
+
 unsigned int squeue_size(squeue_t *q)
 {
 	if (!q)
@@ -78,6 +78,9 @@ extern void squeue_destroy(squeue_t *q, int flags);
  * Enqueue an event with microsecond precision.
  * It's up to the caller to keep the event pointer in case he/she
  * wants to remove the event from the queue later.
+ * The time is used as-is, so the queue can be keyed on any clock.
+ * The time_t variants below take unix timestamps and won't schedule
+ * events in the past.
  *
  * @param q The scheduling queue to add to
  * @param tv When this event should occur
@@ -121,6 +124,22 @@ extern squeue_event *squeue_add_usec(squeue_t *q, time_t when, time_t usec, void
  */
 extern squeue_event *squeue_add_msec(squeue_t *q, time_t when, time_t msec, void *data);
 
+/**
+ * Adds many events to the scheduling queue at once.
+ * The events share a single allocation and the queue is rebuilt in
+ * linear time when the batch is large compared to the queue, which
+ * makes this a lot cheaper than calling squeue_add_tv() n times.
+ * Times are used as-is, exactly like squeue_add_tv() does.
+ *
+ * @param[in] q The scheduling queue to add to
+ * @param[in] when Array of n times the events should occur
+ * @param[in] data Array of n data pointers
+ * @param[out] evts Array that receives the n scheduled events. May be NULL
+ * @param[in] n Number of events to add
+ * @return 0 on success, -1 on errors, in which case nothing was added
+ */
+extern int squeue_add_bulk(squeue_t *q, const struct timeval *when, void **data, squeue_event **evts, unsigned int n);
+
 /**
  * Returns the data of the next scheduled event from the scheduling
  * queue without removing it from the queue.
@@ -147,6 +166,27 @@ extern void *squeue_pop(squeue_t *q);
  */
 extern int squeue_remove(squeue_t *q, squeue_event *evt);
 
+/**
+ * Removes many events from the scheduling queue at once
+ * @note This causes the associated squeue_event()s to be free()'d.
+ * @param[in] q The scheduling queue to remove from
+ * @param[in] evts Array of events to remove, all of which must be queued
+ * @param[in] n Number of events in evts
+ * @return 0 on success, -1 on errors
+ */
+extern int squeue_remove_bulk(squeue_t *q, squeue_event **evts, unsigned int n);
+
+/**
+ * Calls walker for every event in the scheduling queue, in no
+ * particular order. The queue must not be modified during the walk.
+ *
+ * @param[in] q The scheduling queue to walk
+ * @param[in] walker Function to call for each event
+ * @param[in] arg Passed as second argument to walker
+ * @return 0, or the first non-zero value returned by walker
+ */
+extern int squeue_walk(squeue_t *q, int (*walker)(squeue_event *, void *), void *arg);
+
 /**
  * Returns the number of events in the scheduling queue. This
  * function never fails.
@@ -87,6 +87,12 @@ int main(int argc, char **argv)
 	ok_int(bitmap_count_unset_bits(a), bitmap_cardinality(a), "bitmap_clear() must clear all");
 	ok_int(bitmap_count_set_bits(a), 0, "bitmap_clear() must clear all (part 2)");
 
+	ok_int(bitmap_set(a, bitmap_cardinality(a)), -1, "bitmap_set() must refuse bits past the end");
+	ok_int(bitmap_isset(a, bitmap_cardinality(a)), 0, "bitmap_isset() must not read past the end");
+	bitmap_resize(a, bitmap_cardinality(a) * 2);
+	ok_int(bitmap_count_set_bits(a), 0, "bitmap_resize() must clear the added bits");
+	ok_int(bitmap_set(a, bitmap_cardinality(a) - 1), 0, "bitmap_set() works in the resized part");
+
 	t_end();
 	return 0;
 }
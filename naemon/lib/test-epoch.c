@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "t-utils.h"
+#include "epoch.c"
+
+#define READERS 4
+#define UPDATES 200000
+
+static unsigned int freed;
+static void count_free(void *ptr)
+{
+	freed++;
+	free(ptr);
+}
+
+static void test_basics(void)
+{
+	epoch_domain *d;
+	epoch_reader *r, *r2;
+
+	t_start("epoch basics");
+	d = epoch_create();
+	ok_int(d != NULL, 1, "creating a domain");
+
+	epoch_retire(d, malloc(1), count_free);
+	ok_uint(freed, 1, "without readers, retired memory is freed right away");
+
+	r = epoch_reader_register(d);
+	ok_int(r != NULL, 1, "registering a reader");
+	epoch_retire(d, malloc(1), count_free);
+	ok_uint(freed, 1, "with a reader, retired memory waits");
+	ok_uint(epoch_pending(d), 1, "... in limbo");
+	epoch_reclaim(d);
+	epoch_reclaim(d);
+	ok_uint(freed, 2, "... until two idle epochs have passed");
+
+	epoch_enter(r);
+	epoch_retire(d, malloc(1), count_free);
+	epoch_reclaim(d);
+	epoch_retire(d, malloc(1), count_free);
+	epoch_reclaim(d);
+	epoch_reclaim(d);
+	epoch_reclaim(d);
+	ok_uint(freed, 2, "nothing is freed while a reader is inside an epoch");
+	epoch_exit(r);
+	epoch_reclaim(d);
+	epoch_reclaim(d);
+	ok_uint(freed, 4, "everything is freed once it exits");
+	ok_uint(epoch_pending(d), 0, "limbo is empty again");
+
+	epoch_reader_unregister(r);
+	r2 = epoch_reader_register(d);
+	ok_int(r2 == r, 1, "unregistered slots are reused");
+	epoch_reader_unregister(r2);
+
+	epoch_retire(d, malloc(1), count_free);
+	ok_uint(freed, 5, "once the last reader is gone, nothing waits");
+
+	r = epoch_reader_register(d);
+	epoch_retire(d, malloc(1), count_free);
+	epoch_reader_unregister(r);
+	epoch_destroy(d);
+	ok_uint(freed, 6, "destroying a domain frees what's in limbo");
+	t_end();
+}
+
+/*
+ * The writer keeps replacing a string whose two halves must always
+ * match, freeing the old ones with a poisoning free function. A
+ * reader that gets to see freed memory sees a mismatch.
+ */
+static epoch_domain *stress_d;
+static char *shared;
+static int stop;
+
+static void poison_free(void *ptr)
+{
+	memset(ptr, 'x', 32);
+	free(ptr);
+}
+
+static void *reader(void *arg)
+{
+	epoch_reader *r = epoch_reader_register(stress_d);
+	unsigned long reads = 0, torn = 0;
+	unsigned int a, b;
+	char *s;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+		epoch_enter(r);
+		s = __atomic_load_n(&shared, __ATOMIC_SEQ_CST);
+		if (sscanf(s, "%u:%u", &a, &b) != 2 || a != b)
+			torn++;
+		reads++;
+		epoch_exit(r);
+	}
+	epoch_reader_unregister(r);
+
+	return (void *)torn;
+}
+
+static void test_stress(void)
+{
+	pthread_t threads[READERS];
+	unsigned int i, torn = 0;
+	char *s, *old;
+
+	t_start("%d reader threads", READERS);
+	stress_d = epoch_create();
+	shared = calloc(1, 32);
+	strcpy(shared, "0:0");
+
+	for (i = 0; i < READERS; i++)
+		pthread_create(&threads[i], NULL, reader, NULL);
+
+	for (i = 1; i <= UPDATES; i++) {
+		s = calloc(1, 32);
+		snprintf(s, 32, "%u:%u", i, i);
+		old = __atomic_exchange_n(&shared, s, __ATOMIC_SEQ_CST);
+		epoch_retire(stress_d, old, poison_free);
+		if (!(i % 64))
+			epoch_reclaim(stress_d);
+	}
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < READERS; i++) {
+		void *ret;
+
+		pthread_join(threads[i], &ret);
+		torn += (unsigned int)(unsigned long)ret;
+	}
+	ok_uint(torn, 0, "readers never see memory that's been freed");
+	ok_int(epoch_pending(stress_d) < UPDATES, 1, "the writer reclaims memory as it goes");
+	t_diag("%u updates left %u pointers in limbo", UPDATES, epoch_pending(stress_d));
+
+	epoch_destroy(stress_d);
+	free(shared);
+	t_end();
+}
+
+int main(int argc, char **argv)
+{
+	t_set_colors(0);
+	t_start("epoch tests");
+
+	test_basics();
+	test_stress();
+
+	return t_end();
+}
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "t-utils.h"
+#include "nsutils.h"
+#include "mpscq.c"
+
+#define PRODUCERS 8
+#define ITEMS_PER_PRODUCER 200000
+
+struct item {
+	mpscq_node node; /* must be first */
+	unsigned int producer;
+	unsigned int seq;
+};
+
+static int doorbell_rung(mpscq *q, int timeout)
+{
+	struct pollfd pfd;
+
+	pfd.fd = mpscq_doorbell(q);
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, timeout) == 1;
+}
+
+static void test_basics(void)
+{
+	mpscq *q;
+	struct item items[3];
+	unsigned int i;
+
+	t_start("queue basics");
+	q = mpscq_create();
+	ok_int(q != NULL, 1, "creating a queue");
+	ok_int(mpscq_pop(q) == NULL, 1, "new queues are empty");
+	ok_int(doorbell_rung(q, 0), 0, "new queues are quiet");
+
+	for (i = 0; i < ARRAY_SIZE(items); i++)
+		items[i].seq = i;
+	ok_int(mpscq_push(q, &items[0].node), 0, "pushing a node");
+	ok_int(doorbell_rung(q, 0), 1, "pushing to an empty queue rings the doorbell");
+	ok_int(mpscq_ack(q), 0, "acking the doorbell");
+	ok_int(doorbell_rung(q, 0), 0, "acking silences the doorbell");
+	ok_int(mpscq_push(q, &items[1].node), 0, "pushing a second node");
+	ok_int(doorbell_rung(q, 0), 0, "a busy queue doesn't ring again");
+
+	ok_int(mpscq_pop(q) == &items[0].node, 1, "first node comes out first");
+	ok_int(mpscq_push(q, &items[2].node), 0, "pushing while the consumer is draining");
+	ok_int(doorbell_rung(q, 0), 0, "... doesn't ring either");
+	ok_int(mpscq_pop(q) == &items[1].node, 1, "second node comes out second");
+	ok_int(mpscq_pop(q) == &items[2].node, 1, "the last node comes out too");
+	ok_int(mpscq_pop(q) == NULL, 1, "queue is empty again");
+
+	ok_int(mpscq_push(q, &items[0].node), 0, "nodes can be pushed again once popped");
+	ok_int(doorbell_rung(q, 0), 1, "an emptied queue rings again");
+	mpscq_ack(q);
+	ok_int(mpscq_pop(q) == &items[0].node && mpscq_pop(q) == NULL, 1, "a single node goes in and out");
+
+	ok_int(mpscq_kick(q), 0, "kicking the queue");
+	ok_int(doorbell_rung(q, 0), 1, "... rings the doorbell even when nothing was pushed");
+	mpscq_ack(q);
+
+	mpscq_destroy(q);
+	t_end();
+}
+
+static mpscq *stress_q;
+
+static void *producer(void *arg)
+{
+	unsigned int id = (unsigned int)(unsigned long)arg, i;
+	struct item *items;
+
+	items = calloc(ITEMS_PER_PRODUCER, sizeof(*items));
+	for (i = 0; i < ITEMS_PER_PRODUCER; i++) {
+		items[i].producer = id;
+		items[i].seq = i;
+		mpscq_push(stress_q, &items[i].node);
+		/* now and then, give the consumer a chance to fall asleep */
+		if (!(i % 5000))
+			usleep(1000);
+	}
+
+	return items;
+}
+
+static void test_stress(void)
+{
+	pthread_t threads[PRODUCERS];
+	unsigned int next[PRODUCERS], i, popped = 0, out_of_order = 0, batches = 0, lost_wakeups = 0;
+	struct timeval start, stop;
+	mpscq_node *node;
+
+	t_start("%d producer threads", PRODUCERS);
+	stress_q = mpscq_create();
+	memset(next, 0, sizeof(next));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_create(&threads[i], NULL, producer, (void *)(unsigned long)i);
+
+	while (popped < PRODUCERS * ITEMS_PER_PRODUCER) {
+		/* a lost wakeup leaves us waiting here forever */
+		if (!doorbell_rung(stress_q, 5000)) {
+			lost_wakeups++;
+			break;
+		}
+		mpscq_ack(stress_q);
+		batches++;
+		while ((node = mpscq_pop(stress_q))) {
+			struct item *it = (struct item *)node;
+
+			if (it->producer >= PRODUCERS || it->seq != next[it->producer])
+				out_of_order++;
+			else
+				next[it->producer]++;
+			popped++;
+		}
+	}
+	gettimeofday(&stop, NULL);
+
+	for (i = 0; i < PRODUCERS; i++) {
+		void *items;
+
+		pthread_join(threads[i], &items);
+		free(items);
+	}
+
+	ok_int(lost_wakeups, 0, "the doorbell rings whenever there's something to pop");
+	ok_uint(popped, PRODUCERS * ITEMS_PER_PRODUCER, "every node pushed is popped exactly once");
+	ok_int(out_of_order, 0, "nodes from each producer come out in the order they went in");
+	ok_int(mpscq_pop(stress_q) == NULL, 1, "the queue is empty in the end");
+	t_diag("%u nodes in %u batches, %.0f nodes/sec", popped, batches, popped / tv_delta_f(&start, &stop));
+
+	mpscq_destroy(stress_q);
+	t_end();
+}
+
+int main(int argc, char **argv)
+{
+	t_set_colors(0);
+	t_start("mpscq tests");
+
+	test_basics();
+	test_stress();
+
+	return t_end();
+}
@@ -1,9 +1,13 @@
 #define _GNU_SOURCE
 #include "runcmd.c"
 #include "t-utils.h"
+#include "nsutils.h"
 #include <stdio.h>
+#include <sys/mman.h>
 
 #define BUF_SIZE 1024
+#define BENCH_SPAWNS 500
+#define BENCH_FOOTPRINT (256 * 1024 * 1024)
 
 struct cases {
 	char *input;
@@ -88,6 +92,40 @@ struct {
 	{ 0, NULL, 0, { NULL, NULL, NULL }},
 };
 
+/* runs a command to completion and returns what it printed */
+static char *run(const char *cmd, char **env, int *status)
+{
+	int pfd[2] = { -1, -1}, pfderr[2] = { -1, -1};
+	int fd;
+	char *out = calloc(1, BUF_SIZE);
+
+	fd = runcmd_open(cmd, pfd, pfderr, env);
+	if (fd < 0) {
+		*status = fd;
+		return out;
+	}
+	if (read(pfd[0], out, BUF_SIZE - 1) < 0)
+		out[0] = 0;
+	*status = runcmd_close(fd);
+	close(pfderr[0]);
+	return out;
+}
+
+static double spawn_rate(void)
+{
+	struct timeval start, stop;
+	int i, status, failed = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_SPAWNS; i++) {
+		free(run("/bin/true", NULL, &status));
+		failed += status != 0;
+	}
+	gettimeofday(&stop, NULL);
+	ok_int(failed, 0, "every benchmark command ran");
+	return BENCH_SPAWNS / tv_delta_f(&start, &stop);
+}
+
 int main(int argc, char **argv)
 {
 	int ret, r2;
@@ -143,6 +181,103 @@ int main(int argc, char **argv)
 		}
 	}
 
+	r2 = t_end();
+	ret = r2 ? r2 : ret;
+	t_reset();
+	t_start("environment passing");
+	{
+		int pfd[2] = { -1, -1}, pfderr[2] = { -1, -1};
+		int fd;
+		char *env[] = { "NAGIOS_HOSTNAME=env host", "NAGIOS__HOSTFOO=bar=baz", NULL };
+		char *out = calloc(1, BUF_SIZE);
+
+		fd = runcmd_open("/bin/sh -c 'echo -n \"$NAGIOS_HOSTNAME;$NAGIOS__HOSTFOO\"'", pfd, pfderr, env);
+		read(pfd[0], out, BUF_SIZE);
+		ok_str("env host;bar=baz", out, "Environment variables should be passed to child");
+		runcmd_close(fd);
+		close(pfderr[0]);
+
+		memset(out, 0, BUF_SIZE);
+		fd = runcmd_open("/bin/sh -c 'echo -n \"${NAGIOS_HOSTNAME-unset}\"'", pfd, pfderr, NULL);
+		read(pfd[0], out, BUF_SIZE);
+		ok_str("unset", out, "Environment variables shouldn't leak between children");
+		runcmd_close(fd);
+		close(pfderr[0]);
+		free(out);
+	}
+
+	r2 = t_end();
+	ret = r2 ? r2 : ret;
+	t_reset();
+	t_start("argument vectors");
+	{
+		int pfd[2] = { -1, -1}, pfderr[2] = { -1, -1};
+		int fd;
+		char *argv[] = { "printf", "%s|%s|%s", "a; touch /tmp/runcmd-pwned", "`id` $(id) $HOME", "'\"\\*", NULL };
+		char *empty[] = { NULL };
+		char *out = calloc(1, BUF_SIZE);
+
+		fd = runcmd_open_argv(argv, pfd, pfderr, NULL);
+		read(pfd[0], out, BUF_SIZE);
+		ok_str("a; touch /tmp/runcmd-pwned|`id` $(id) $HOME|'\"\\*", out, "Arguments should be passed verbatim");
+		ok_int(runcmd_close(fd), 0, "Argument vectors should run without a shell");
+		close(pfderr[0]);
+		ok_int(access("/tmp/runcmd-pwned", F_OK), -1, "Shell metacharacters in arguments should be inert");
+		ok_int(runcmd_open_argv(empty, pfd, pfderr, NULL), RUNCMD_EINVAL, "Empty argument vectors should be rejected");
+		free(out);
+	}
+
+	r2 = t_end();
+	ret = r2 ? r2 : ret;
+	t_reset();
+	t_start("zygote");
+	{
+		char *env[] = { "NAGIOS_HOSTNAME=env host", NULL };
+		char *out, *footprint;
+		double small, large, zygote;
+		int status;
+		pid_t zpid;
+
+		small = spawn_rate();
+		ok_int(runcmd_zygote_start(), 0, "starting the zygote");
+		zpid = zygote_pid;
+
+		out = run("/bin/sh -c 'echo -n \"$NAGIOS_HOSTNAME\"; exit 3'", env, &status);
+		ok_str("env host", out, "the zygote runs commands with their environment");
+		ok_int(status, 3, "commands started by the zygote are our children");
+		free(out);
+		out = run("/bin/sh -c 'echo -n \"${NAGIOS_HOSTNAME-unset}\"'", NULL, &status);
+		ok_str("unset", out, "environment variables don't leak into the zygote");
+		free(out);
+		out = run("/bin/echo -n $((1 + 2)) > /dev/null; echo -n shell", NULL, &status);
+		ok_str("shell", out, "the zygote runs shell commands");
+		free(out);
+		out = run("/nonexistent/plugin", NULL, &status);
+		ok_int(status, ENOENT, "missing plugins fail the same way");
+		free(out);
+
+		/* grow well beyond what the zygote has mapped */
+		footprint = mmap(NULL, BENCH_FOOTPRINT, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (footprint != MAP_FAILED)
+			memset(footprint, 1, BENCH_FOOTPRINT);
+		zygote = spawn_rate();
+		runcmd_zygote_stop();
+		ok_int(waitpid(zpid, NULL, WNOHANG) < 0 && errno == ECHILD, 1, "stopping the zygote reaps it");
+		large = spawn_rate();
+		t_diag("spawns/sec: %.0f forking with a small footprint, %.0f forking with %dMB, %.0f through the zygote with %dMB",
+		       small, large, BENCH_FOOTPRINT >> 20, zygote, BENCH_FOOTPRINT >> 20);
+		if (footprint != MAP_FAILED)
+			munmap(footprint, BENCH_FOOTPRINT);
+
+		/* a dead zygote means we fork on our own again */
+		ok_int(runcmd_zygote_start(), 0, "restarting the zygote");
+		kill(zygote_pid, SIGKILL);
+		out = run("/bin/echo -n fallback", NULL, &status);
+		ok_str("fallback", out, "commands still run when the zygote dies");
+		free(out);
+		ok_int(zygote_sd, -1, "a dead zygote isn't used again");
+	}
+
 	r2 = t_end();
 	return r2 ? r2 : ret;
 }
@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "t-utils.h"
+#include "shmring.c"
+#include "worker.h"
+#include "kvvec.h"
+#include "iocache.h"
+
+#define BENCH_JOBS 20000
+#define BENCH_WINDOW 64
+
+static int doorbell_rung(shmring *r)
+{
+	struct pollfd pfd;
+
+	pfd.fd = shmring_doorbell(r);
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) == 1;
+}
+
+static void test_basics(void)
+{
+	shmring *r;
+	char buf[3000], *rec;
+	unsigned int len, i, max;
+
+	t_start("ring basics");
+	r = shmring_create(100);
+	ok_int(r != NULL, 1, "creating a ring");
+	ok_uint((unsigned int)r->size, SHMRING_MIN_SIZE, "tiny rings are rounded up");
+	max = shmring_max_record(r);
+	ok_int(shmring_peek(r, &len) == NULL, 1, "new rings are empty");
+	ok_int(doorbell_rung(r), 0, "new rings are quiet");
+
+	ok_int(shmring_write(r, buf, max + 1), -1, "oversized records are refused");
+	ok_int(errno, EMSGSIZE, "... with EMSGSIZE");
+
+	memset(buf, 'a', sizeof(buf));
+	ok_int(shmring_write(r, buf, 10), 0, "writing a record");
+	ok_int(doorbell_rung(r), 1, "writing to an empty ring rings the doorbell");
+	ok_int(shmring_ack(r), 0, "acking the doorbell");
+	ok_int(doorbell_rung(r), 0, "acking silences the doorbell");
+	memset(buf, 'b', sizeof(buf));
+	ok_int(shmring_write(r, buf, 20), 0, "writing a second record");
+	ok_int(doorbell_rung(r), 0, "a busy ring doesn't ring again");
+
+	rec = shmring_peek(r, &len);
+	ok_int(rec && len == 10 && rec[0] == 'a' && rec[9] == 'a', 1, "first record comes out first");
+	ok_int(shmring_peek(r, &len) == rec, 1, "peeking twice gives the same record");
+	shmring_consume(r);
+	rec = shmring_peek(r, &len);
+	ok_int(rec && len == 20 && rec[19] == 'b', 1, "second record comes out second");
+	shmring_consume(r);
+	ok_int(shmring_peek(r, &len) == NULL, 1, "ring is empty again");
+
+	/* fill it up */
+	for (i = 0; shmring_write(r, buf, 100) == 0; i++)
+		;
+	ok_int(errno, EAGAIN, "full rings refuse writes with EAGAIN");
+	ok_uint(i, (unsigned int)(r->size / rec_size(100)), "full ring holds the expected number of records");
+	while (shmring_peek(r, NULL))
+		shmring_consume(r);
+
+	shmring_destroy(r);
+	t_end();
+}
+
+/* random sizes make records wrap at every possible offset */
+static void test_wrapping(void)
+{
+	shmring *r;
+	unsigned int i, written = 0, read = 0, bad = 0, len;
+	unsigned char buf[2048], *rec;
+
+	t_start("ring wrapping");
+	r = shmring_create(8192);
+	srand(time(NULL));
+	for (i = 0; i < 200000; i++) {
+		if (rand() & 1) {
+			unsigned int sz = 1 + rand() % 1500;
+			unsigned char *w = shmring_reserve(r, sz + 4);
+			if (!w)
+				continue;
+			memcpy(w, &written, sizeof(written));
+			memset(w + 4, (unsigned char)written, sz);
+			shmring_commit(r, sz + 4);
+			written++;
+		} else if ((rec = shmring_peek(r, &len))) {
+			unsigned int seq;
+			memcpy(&seq, rec, sizeof(seq));
+			if (seq != read || rec[len - 1] != (unsigned char)read)
+				bad++;
+			read++;
+			shmring_consume(r);
+		}
+	}
+	while ((rec = shmring_peek(r, &len))) {
+		read++;
+		shmring_consume(r);
+	}
+	ok_int(written > 1000, 1, "lots of records written");
+	ok_uint(read, written, "every record written was read");
+	ok_uint(bad, 0, "records come out in order and intact");
+	(void)buf;
+	shmring_destroy(r);
+	t_end();
+}
+
+static void test_attach(void)
+{
+	shmring *w, *r;
+	struct kvvec *kvv, *out;
+	char *rec;
+	unsigned int len;
+	int fds[2];
+
+	t_start("attaching and kvvecs");
+	w = shmring_create(16384);
+	r = shmring_attach(dup(shmring_fd(w)), dup(shmring_doorbell(w)));
+	ok_int(r != NULL, 1, "attaching to a ring");
+	ok_uint((unsigned int)r->size, (unsigned int)w->size, "attached ring has the same size");
+
+	kvv = kvvec_create(3);
+	kvvec_addkv(kvv, "job_id", "17");
+	kvvec_addkv(kvv, "command", "/bin/true --with=args");
+	kvvec_addkv(kvv, "empty", "");
+	ok_int(worker_ring_send_kvvec(w, kvv) > 0, 1, "sending a kvvec through the ring");
+	ok_int(doorbell_rung(r), 1, "the attached ring sees the doorbell");
+	rec = shmring_peek(r, &len);
+	ok_int(rec != NULL, 1, "the attached ring sees the record");
+	out = buf2kvvec(rec, len, '=', '\0', KVVEC_COPY);
+	shmring_consume(r);
+	ok_int(out && out->kv_pairs == 3, 1, "the kvvec survives the trip");
+	if (out && out->kv_pairs == 3) {
+		ok_str(out->kv[0].key, "job_id", "first key");
+		ok_str(out->kv[1].value, "/bin/true --with=args", "second value");
+		ok_str(out->kv[2].value, "", "empty value");
+	}
+	kvvec_destroy(out, KVVEC_FREE_ALL);
+	kvvec_destroy(kvv, 0);
+
+	/* and between processes, the way workers get them */
+	ok_int(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "creating a socketpair");
+	if (!fork()) {
+		char resp[3];
+		int rfds[2], nfds = 2;
+		shmring *cr;
+
+		close(fds[0]);
+		if (nsock_recv_fds(fds[1], resp, 3, rfds, &nfds) != 3 || nfds != 2)
+			_exit(1);
+		if (!(cr = shmring_attach(rfds[0], rfds[1])))
+			_exit(2);
+		_exit(shmring_write(cr, resp, 3) ? 3 : 0);
+	} else {
+		int status = -1, sfds[2] = { shmring_fd(w), shmring_doorbell(w) };
+		close(fds[1]);
+		ok_int(nsock_send_fds(fds[0], "OK", 3, sfds, 2), 3, "passing the ring to a child");
+		wait(&status);
+		ok_int(status, 0, "child attached and wrote to the ring");
+		rec = shmring_peek(w, &len);
+		ok_int(rec && len == 3 && !strcmp(rec, "OK"), 1, "child's record arrived");
+		shmring_consume(w);
+		close(fds[0]);
+	}
+
+	shmring_destroy(r);
+	shmring_destroy(w);
+	t_end();
+}
+
+/*
+ * Job round trips between us and a child echoing results back, first
+ * over a socketpair the way workers always did, then through rings
+ */
+static struct kvvec *bench_job(unsigned int id)
+{
+	static struct kvvec *kvv;
+	static char idbuf[16];
+
+	if (!kvv)
+		kvv = kvvec_create(4);
+	kvvec_init(kvv, 4);
+	snprintf(idbuf, sizeof(idbuf), "%u", id);
+	kvvec_addkv(kvv, "job_id", idbuf);
+	kvvec_addkv(kvv, "type", "0");
+	kvvec_addkv(kvv, "command", "/usr/lib/nagios/plugins/check_ping -H 127.0.0.1 -w 100,20% -c 500,60%");
+	kvvec_addkv(kvv, "timeout", "60");
+	return kvv;
+}
+
+static void bench_child_socket(int sd)
+{
+	iocache *ioc = iocache_create(512 * 1024);
+	struct kvvec kvv = KVVEC_INITIALIZER;
+	char *buf;
+	unsigned long size;
+
+	while (iocache_read(ioc, sd) > 0) {
+		while ((buf = worker_ioc2msg(ioc, &size, 0))) {
+			worker_buf2kvvec_prealloc(&kvv, buf, size, KVVEC_ASSIGN);
+			kvvec_addkv(&kvv, "outstd", "PING OK - Packet loss = 0%, RTA = 0.05 ms");
+			worker_send_kvvec(sd, &kvv);
+		}
+	}
+	_exit(0);
+}
+
+static void bench_child_ring(int sd, shmring *jobs, shmring *results)
+{
+	struct kvvec kvv = KVVEC_INITIALIZER;
+	struct pollfd pfd[2];
+	unsigned int len;
+	char *buf;
+
+	pfd[0].fd = shmring_doorbell(jobs);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sd;
+	pfd[1].events = POLLIN;
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0)
+			continue;
+		if (pfd[1].revents)
+			_exit(0);
+		shmring_ack(jobs);
+		while ((buf = shmring_peek(jobs, &len))) {
+			worker_buf2kvvec_prealloc(&kvv, buf, len, KVVEC_ASSIGN);
+			kvvec_addkv(&kvv, "outstd", "PING OK - Packet loss = 0%, RTA = 0.05 ms");
+			while (worker_ring_send_kvvec(results, &kvv) < 0)
+				; /* the parent drains results as fast as it can */
+			shmring_consume(jobs);
+		}
+	}
+}
+
+static double bench(int use_rings)
+{
+	int fds[2];
+	unsigned int sent = 0, done = 0;
+	struct timeval start, stop;
+	shmring *jobs = NULL, *results = NULL;
+	iocache *ioc = NULL;
+	struct kvvec kvv = KVVEC_INITIALIZER;
+	pid_t pid;
+
+	socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	worker_set_sockopts(fds[0], 256 * 1024);
+	if (use_rings) {
+		jobs = shmring_create(256 * 1024);
+		results = shmring_create(1024 * 1024);
+	}
+	if (!(pid = fork())) {
+		close(fds[0]);
+		fcntl(fds[1], F_SETFL, 0);
+		if (use_rings)
+			bench_child_ring(fds[1], jobs, results);
+		bench_child_socket(fds[1]);
+	}
+	close(fds[1]);
+	ioc = iocache_create(1024 * 1024);
+
+	gettimeofday(&start, NULL);
+	while (done < BENCH_JOBS) {
+		struct pollfd pfd;
+		char *buf;
+
+		while (sent < BENCH_JOBS && sent - done < BENCH_WINDOW) {
+			if (use_rings) {
+				if (worker_ring_send_kvvec(jobs, bench_job(sent)) < 0)
+					break;
+			} else if (worker_send_kvvec(fds[0], bench_job(sent)) < 0) {
+				break;
+			}
+			sent++;
+		}
+
+		pfd.fd = use_rings ? shmring_doorbell(results) : fds[0];
+		pfd.events = POLLIN;
+		poll(&pfd, 1, 1000);
+		if (use_rings) {
+			unsigned int len;
+			shmring_ack(results);
+			while ((buf = shmring_peek(results, &len))) {
+				worker_buf2kvvec_prealloc(&kvv, buf, len, KVVEC_ASSIGN);
+				shmring_consume(results);
+				done++;
+			}
+		} else {
+			unsigned long size;
+			if (iocache_read(ioc, fds[0]) <= 0)
+				continue;
+			while ((buf = worker_ioc2msg(ioc, &size, 0))) {
+				worker_buf2kvvec_prealloc(&kvv, buf, size, KVVEC_ASSIGN);
+				done++;
+			}
+		}
+	}
+	gettimeofday(&stop, NULL);
+
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	iocache_destroy(ioc);
+	shmring_destroy(jobs);
+	shmring_destroy(results);
+	free(kvv.kv);
+
+	return BENCH_JOBS / tv_delta_f(&start, &stop);
+}
+
+static void test_throughput(void)
+{
+	double sock_rate, ring_rate;
+
+	t_start("job throughput");
+	signal(SIGPIPE, SIG_IGN);
+	sock_rate = bench(0);
+	ring_rate = bench(1);
+	ok_int(sock_rate > 0 && ring_rate > 0, 1, "both transports completed all jobs");
+	t_diag("%d jobs: socketpair %.0f jobs/sec, shared memory rings %.0f jobs/sec",
+	       BENCH_JOBS, sock_rate, ring_rate);
+	t_end();
+}
+
+int main(int argc, char **argv)
+{
+	t_set_colors(0);
+	t_start("shmring tests");
+
+	test_basics();
+	test_wrapping();
+	test_attach();
+	test_throughput();
+
+	return t_end();
+}
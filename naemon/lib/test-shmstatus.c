@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "t-utils.h"
+#include "shmstatus.c"
+#include "nsutils.h"
+
+#define NUM_HOSTS 10
+#define NUM_SERVICES 50
+#define NUM_READERS 3
+#define WRITES 200000
+
+static char segname[64];
+
+/* every field of a record is derived from the same counter */
+static void fill(shmstatus_object *obj, int n)
+{
+	obj->last_check = obj->next_check = n;
+	obj->last_state_change = obj->last_hard_state_change = n;
+	obj->latency = obj->execution_time = obj->percent_state_change = n;
+	obj->current_state = obj->last_hard_state = obj->state_type = n;
+	obj->current_attempt = obj->max_attempts = obj->has_been_checked = n;
+	obj->scheduled_downtime_depth = obj->is_flapping = obj->checks_enabled = n;
+	memset(obj->plugin_output, 0, sizeof(obj->plugin_output));
+	snprintf(obj->plugin_output, sizeof(obj->plugin_output), "OK %d %0*d", n, n % 200, n);
+}
+
+static int consistent(shmstatus_object *obj)
+{
+	shmstatus_object expect;
+	int n = (int)obj->last_check;
+
+	memset(&expect, 0, sizeof(expect));
+	fill(&expect, n);
+	expect.problem_has_been_acknowledged = obj->problem_has_been_acknowledged;
+	expect.notifications_enabled = obj->notifications_enabled;
+	expect.reserved = obj->reserved;
+	return !memcmp(&expect, obj, sizeof(expect));
+}
+
+static shmstatus *create_named(void)
+{
+	shmstatus *s;
+	char name[32];
+	int i;
+
+	s = shmstatus_create(segname, NUM_HOSTS, NUM_SERVICES, 4096);
+	if (!s)
+		return NULL;
+	for (i = 0; i < NUM_HOSTS; i++) {
+		sprintf(name, "host%d", i);
+		shmstatus_set_name(s, SHMSTATUS_HOST, i, name, NULL);
+	}
+	for (i = 0; i < NUM_SERVICES; i++) {
+		char desc[32];
+		sprintf(name, "host%d", i / 5);
+		sprintf(desc, "service%d", i % 5);
+		shmstatus_set_name(s, SHMSTATUS_SERVICE, i, name, desc);
+	}
+	return s;
+}
+
+static void test_basics(void)
+{
+	shmstatus *w, *w2, *r;
+	shmstatus_object *obj, copy;
+
+	t_start("segment basics");
+	w = create_named();
+	ok_int(w != NULL, 1, "creating a segment");
+	ok_int(shmstatus_open(segname) == NULL && errno == EAGAIN, 1, "segments can't be opened until they're ready");
+	ok_int(shmstatus_set_name(w, SHMSTATUS_HOST, NUM_HOSTS, "nope", NULL), -1, "out of range ids are refused");
+	ok_int(shmstatus_write_begin(w, SHMSTATUS_SERVICE, NUM_SERVICES) == NULL, 1, "out of range records can't be written");
+	shmstatus_ready(w);
+
+	r = shmstatus_open(segname);
+	ok_int(r != NULL, 1, "opening a ready segment");
+	ok_uint(shmstatus_count(r, SHMSTATUS_HOST), NUM_HOSTS, "host count");
+	ok_uint(shmstatus_count(r, SHMSTATUS_SERVICE), NUM_SERVICES, "service count");
+	ok_str(shmstatus_host_name(r, SHMSTATUS_HOST, 3), "host3", "host names");
+	ok_str(shmstatus_host_name(r, SHMSTATUS_SERVICE, 12), "host2", "service host names");
+	ok_str(shmstatus_service_description(r, 12), "service2", "service descriptions");
+	ok_int(shmstatus_find_host(r, "host7"), 7, "finding a host");
+	ok_int(shmstatus_find_host(r, "host70"), -1, "missing hosts aren't found");
+	ok_int(shmstatus_find_service(r, "host9", "service4"), 49, "finding a service");
+	ok_int(shmstatus_find_service(r, "host9", "service5"), -1, "missing services aren't found");
+
+	obj = shmstatus_write_begin(w, SHMSTATUS_SERVICE, 12);
+	fill(obj, 42);
+	shmstatus_write_end(w, SHMSTATUS_SERVICE, 12);
+	ok_int(shmstatus_read(r, SHMSTATUS_SERVICE, 12, &copy), 0, "reading a record");
+	ok_int(copy.current_state == 42 && consistent(&copy), 1, "readers see what was written");
+	ok_int(shmstatus_read(r, SHMSTATUS_HOST, NUM_HOSTS, &copy), -1, "out of range records can't be read");
+	ok_int(shmstatus_is_stale(r), 0, "a live segment isn't stale");
+
+	/* a restarted writer replaces the segment */
+	w2 = create_named();
+	shmstatus_ready(w2);
+	ok_int(shmstatus_is_stale(r), 1, "replaced segments are stale");
+	shmstatus_destroy(r);
+	shmstatus_destroy(w);
+	r = shmstatus_open(segname);
+	ok_int(r != NULL && !shmstatus_is_stale(r), 1, "the old writer leaves its replacement alone");
+	shmstatus_destroy(r);
+	shmstatus_destroy(w2);
+	t_end();
+}
+
+static void test_stale(void)
+{
+	shmstatus *w, *r;
+
+	t_start("stale segments");
+	w = create_named();
+	shmstatus_ready(w);
+	r = shmstatus_open(segname);
+	ok_int(r != NULL, 1, "opening a segment");
+	shmstatus_destroy(w);
+	ok_int(shmstatus_is_stale(r), 1, "segments are stale when the writer is done");
+	ok_int(shmstatus_open(segname) == NULL && errno == ENOENT, 1, "the writer unlinks its segment");
+	shmstatus_destroy(r);
+	t_end();
+}
+
+/* reads until the writer is done, returns the number of torn records */
+static int reader(void)
+{
+	shmstatus *r;
+	shmstatus_object obj;
+	unsigned int i, torn = 0;
+
+	while (!(r = shmstatus_open(segname)))
+		usleep(1000);
+	while (!shmstatus_is_stale(r)) {
+		for (i = 0; i < NUM_SERVICES; i++) {
+			shmstatus_read(r, SHMSTATUS_SERVICE, i, &obj);
+			if (!consistent(&obj))
+				torn++;
+		}
+	}
+	shmstatus_destroy(r);
+	return torn > 255 ? 255 : torn;
+}
+
+static void test_concurrent(void)
+{
+	shmstatus *w;
+	pid_t pids[NUM_READERS];
+	struct timeval start, stop;
+	int i, status, torn = 0;
+
+	t_start("concurrent readers");
+	w = create_named();
+	for (i = 0; i < NUM_SERVICES; i++) {
+		fill(shmstatus_write_begin(w, SHMSTATUS_SERVICE, i), 0);
+		shmstatus_write_end(w, SHMSTATUS_SERVICE, i);
+	}
+	shmstatus_ready(w);
+
+	fflush(stdout);
+	for (i = 0; i < NUM_READERS; i++) {
+		if (!(pids[i] = fork()))
+			_exit(reader());
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 1; i <= WRITES; i++) {
+		shmstatus_object *obj = shmstatus_write_begin(w, SHMSTATUS_SERVICE, i % NUM_SERVICES);
+		fill(obj, i);
+		shmstatus_write_end(w, SHMSTATUS_SERVICE, i % NUM_SERVICES);
+	}
+	gettimeofday(&stop, NULL);
+	shmstatus_destroy(w);
+
+	for (i = 0; i < NUM_READERS; i++) {
+		waitpid(pids[i], &status, 0);
+		torn += WIFEXITED(status) ? WEXITSTATUS(status) : 255;
+	}
+	ok_int(torn, 0, "readers never see torn records");
+	t_diag("%d updates with %d readers: %.0f updates/sec", WRITES, NUM_READERS,
+	       WRITES / tv_delta_f(&start, &stop));
+	t_end();
+}
+
+int main(int argc, char **argv)
+{
+	t_set_colors(0);
+	t_start("shmstatus tests");
+	sprintf(segname, "/naemon-test-shmstatus-%d", (int)getpid());
+
+	test_basics();
+	test_stale();
+	test_concurrent();
+
+	shm_unlink(segname);
+	return t_end();
+}
@@ -56,6 +56,12 @@ static int sq_walker(squeue_event *evt, void *arg)
 	return 0;
 }
 
+static int sq_counter(squeue_event *evt, void *arg)
+{
+	(*(unsigned int *)arg)++;
+	return 0;
+}
+
 #define EVT_ARY 65101
 static int sq_test_random(squeue_t *sq)
 {
@@ -92,11 +98,113 @@ static int sq_test_random(squeue_t *sq)
 	return 0;
 }
 
+#define BULK_EVTS 50000
+static double tv_delta(struct timeval *start, struct timeval *stop)
+{
+	return (double)(stop->tv_sec - start->tv_sec) + (double)(stop->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static int sq_test_bulk(squeue_t *sq)
+{
+	static struct timeval when[BULK_EVTS];
+	static unsigned long long numbers[BULK_EVTS];
+	static void *data[BULK_EVTS];
+	static squeue_event *evts[BULK_EVTS], *del[BULK_EVTS];
+	unsigned long long *n, max = 0;
+	unsigned int i, size, dels = 0, popped = 0, bad = 0;
+	struct timeval start, stop;
+	double single_time, bulk_time;
+	squeue_t *q;
+
+	size = squeue_size(sq);
+	for (i = 0; i < BULK_EVTS; i++) {
+		/* before everything already in the queue */
+		when[i].tv_sec = time(NULL) - 7200 + rand() % 3600;
+		when[i].tv_usec = rand() % 1000000;
+		numbers[i] = evt_compute_pri(&when[i]);
+		data[i] = &numbers[i];
+	}
+
+	/* big batch into a small queue rebuilds the heap */
+	t(squeue_add_bulk(sq, when, data, evts, BULK_EVTS) == 0);
+	t(squeue_size(sq) == size + BULK_EVTS);
+	t(pqueue_is_valid(sq));
+	for (i = 0; i < BULK_EVTS; i++) {
+		if (squeue_event_data(evts[i]) != data[i] || evts[i]->arena != evts[0]->arena)
+			bad++;
+	}
+	t(bad == 0, "%u bulk added events are wrong\n", bad);
+
+	/* big batch out of the queue compacts and rebuilds */
+	for (i = 0; i < BULK_EVTS; i += 3) {
+		numbers[i] = 0;
+		del[dels++] = evts[i];
+	}
+	t(squeue_remove_bulk(sq, del, dels) == 0);
+	t(squeue_size(sq) == size + BULK_EVTS - dels);
+	t(pqueue_is_valid(sq));
+
+	/* a handful goes one by one */
+	t(squeue_remove_bulk(sq, &evts[1], 1) == 0);
+	numbers[1] = 0;
+	t(squeue_add_bulk(sq, &when[1], &data[1], &evts[1], 1) == 0);
+	numbers[1] = evt_compute_pri(&when[1]);
+	t(squeue_size(sq) == size + BULK_EVTS - dels);
+	t(pqueue_is_valid(sq));
+
+	/* the events we didn't remove come out in order, the rest never do */
+	while (squeue_size(sq) > size) {
+		n = squeue_pop(sq);
+		if (n < numbers || n >= numbers + BULK_EVTS)
+			continue;
+		popped++;
+		if (!*n || *n < max)
+			bad++;
+		max = *n;
+	}
+	t(popped == BULK_EVTS - dels, "popped: %u; expected: %u\n", popped, BULK_EVTS - dels);
+	t(bad == 0, "%u events popped out of order or after removal\n", bad);
+	t(pqueue_is_valid(sq));
+
+	t(squeue_add_bulk(NULL, when, data, NULL, 1) == -1);
+	t(squeue_add_bulk(sq, when, data, NULL, 0) == 0);
+	t(squeue_remove_bulk(sq, NULL, 0) == 0);
+
+	/* compare with adding and removing one at a time */
+	q = squeue_create(BULK_EVTS);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BULK_EVTS; i++)
+		evts[i] = squeue_add_tv(q, &when[i], data[i]);
+	for (i = 0; i < BULK_EVTS; i += 2)
+		squeue_remove(q, evts[i]);
+	gettimeofday(&stop, NULL);
+	single_time = tv_delta(&start, &stop);
+	squeue_destroy(q, 0);
+
+	q = squeue_create(BULK_EVTS);
+	gettimeofday(&start, NULL);
+	squeue_add_bulk(q, when, data, evts, BULK_EVTS);
+	for (i = dels = 0; i < BULK_EVTS; i += 2)
+		del[dels++] = evts[i];
+	squeue_remove_bulk(q, del, dels);
+	gettimeofday(&stop, NULL);
+	bulk_time = tv_delta(&start, &stop);
+	t(squeue_size(q) == BULK_EVTS - dels);
+	t(pqueue_is_valid(q));
+	squeue_destroy(q, 0);
+
+	t_diag("%d events added and half removed: one at a time %.4fs, in bulk %.4fs",
+	       BULK_EVTS, single_time, bulk_time);
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	squeue_t *sq;
 	struct timeval tv;
-	sq_test_event a, b, c, d, *x;
+	sq_test_event a, b, c, d, e, *x;
+	unsigned int walked;
 
 	t_set_colors(0);
 	t_start("squeue tests");
@@ -172,6 +280,28 @@ int main(int argc, char **argv)
 
 	squeue_foreach(sq, sq_walker, NULL);
 
+	/* squeue_walk() must visit every event exactly once */
+	walked = 0;
+	t(squeue_walk(sq, sq_counter, &walked) == 0);
+	t(walked == squeue_size(sq), "walked: %u; size: %u\n", walked, squeue_size(sq));
+
+	/* squeue_add_tv() takes any clock, while squeue_add() won't go back in time */
+	tv.tv_sec = 17;
+	tv.tv_usec = 0;
+	t((e.evt = squeue_add_tv(sq, &tv, &e)) != NULL);
+	t(squeue_peek(sq) == &e);
+	t(squeue_event_runtime(e.evt)->tv_sec == 17);
+	t(squeue_remove(sq, e.evt) == 0);
+	t((e.evt = squeue_add(sq, 17, &e)) != NULL);
+	t(squeue_event_runtime(e.evt)->tv_sec >= time(NULL) - 1);
+	t(squeue_remove(sq, e.evt) == 0);
+
+	/* bulk adds and removes must leave the existing events alone */
+	sq_test_bulk(sq);
+	t((x = squeue_peek(sq)) != NULL);
+	t(x == &d, "x: %p; &d: %p\n", x, &d);
+	t(squeue_size(sq) == 2);
+
 	/* clean up to prevent false valgrind positives */
 	squeue_destroy(sq, 0);
 
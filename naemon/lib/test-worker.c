@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "t-utils.h"
+#include "worker.c"
+
+#define BENCH_JOBS 50000
+#define BENCH_WINDOW 256
+#define PLUGIN_OUTPUT "PING OK - Packet loss = 0%, RTA = 0.05 ms"
+
+/* a fake worker finishes every job right away, without running anything */
+static int fake_job(child_process *cp)
+{
+	cp->outstd.fd = cp->outerr.fd = -1;
+	cp->outstd.buf = strdup(PLUGIN_OUTPUT);
+	cp->outstd.len = strlen(PLUGIN_OUTPUT);
+	finish_job(cp, 0);
+	destroy_job(cp);
+	return 0;
+}
+
+struct fake_master {
+	int sd;
+	pid_t pid;
+	iocache *ioc;
+	struct kvvec kvv;
+	unsigned int results, batches, batched, batch_left, wakeups;
+	unsigned char *seen;
+};
+
+static void start_worker(struct fake_master *m, unsigned int usec, unsigned int max_results, unsigned int jobs)
+{
+	int fds[2];
+
+	memset(m, 0, sizeof(*m));
+	socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	if (!(m->pid = fork())) {
+		close(fds[0]);
+		worker_set_result_batching(usec, max_results);
+		enter_worker(fds[1], fake_job);
+		_exit(0);
+	}
+	close(fds[1]);
+	m->sd = fds[0];
+	worker_set_sockopts(m->sd, 256 * 1024);
+	m->ioc = iocache_create(1024 * 1024);
+	m->seen = calloc(jobs, 1);
+}
+
+static void stop_worker(struct fake_master *m)
+{
+	close(m->sd);
+	/* the worker would otherwise take its time killing its (non-existent) children */
+	kill(m->pid, SIGKILL);
+	waitpid(m->pid, NULL, 0);
+	iocache_destroy(m->ioc);
+	free(m->kvv.kv);
+	free(m->seen);
+}
+
+static void send_job(struct fake_master *m, unsigned int id)
+{
+	static struct kvvec *kvv;
+	static char idbuf[16];
+
+	if (!kvv)
+		kvv = kvvec_create(4);
+	kvvec_init(kvv, 4);
+	snprintf(idbuf, sizeof(idbuf), "%u", id);
+	kvvec_addkv(kvv, "job_id", idbuf);
+	kvvec_addkv(kvv, "type", "0");
+	kvvec_addkv(kvv, "command", "/usr/lib/nagios/plugins/check_ping -H 127.0.0.1 -w 100,20% -c 500,60%");
+	kvvec_addkv(kvv, "timeout", "60");
+	worker_send_kvvec(m->sd, kvv);
+}
+
+/* parse whatever is in the iocache, the same way the core does */
+static void parse_results(struct fake_master *m)
+{
+	unsigned long size;
+	char *buf;
+	int i;
+
+	while ((buf = worker_ioc2msg(m->ioc, &size, 0))) {
+		if (size > 6 && !memcmp(buf, "batch=", 6)) {
+			m->batch_left = strtoul(buf + 6, NULL, 10);
+			m->batches++;
+			m->batched += m->batch_left;
+			continue;
+		}
+		if (m->batch_left)
+			m->batch_left--;
+		worker_buf2kvvec_prealloc(&m->kvv, buf, size, KVVEC_ASSIGN);
+		for (i = 0; i < m->kvv.kv_pairs; i++) {
+			if (!strcmp(m->kvv.kv[i].key, "job_id")) {
+				m->seen[strtoul(m->kvv.kv[i].value, NULL, 10)]++;
+				break;
+			}
+		}
+		m->results++;
+	}
+}
+
+static int read_results(struct fake_master *m, int timeout)
+{
+	struct pollfd pfd;
+
+	pfd.fd = m->sd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout) <= 0)
+		return 0;
+	if (iocache_read(m->ioc, m->sd) <= 0)
+		return 0;
+	m->wakeups++;
+	parse_results(m);
+	while (m->batch_left && iocache_read(m->ioc, m->sd) > 0)
+		parse_results(m);
+
+	return 1;
+}
+
+static unsigned int count_seen(struct fake_master *m, unsigned int jobs)
+{
+	unsigned int i, once = 0;
+
+	for (i = 0; i < jobs; i++)
+		once += m->seen[i] == 1;
+	return once;
+}
+
+/*
+ * sends jobs and collects their results, never keeping more than a
+ * window's worth in flight so neither side's socket buffer fills up
+ */
+static void run_jobs(struct fake_master *m, unsigned int jobs)
+{
+	unsigned int sent = 0;
+
+	while (m->results < jobs) {
+		while (sent < jobs && sent - m->results < BENCH_WINDOW)
+			send_job(m, sent++);
+		if (!read_results(m, 5000) && m->results < sent)
+			break;
+	}
+}
+
+static void test_batching(void)
+{
+	struct fake_master m;
+	struct timeval start, stop;
+
+	t_start("result batching");
+
+	start_worker(&m, 0, 0, 500);
+	run_jobs(&m, 500);
+	ok_uint(m.results, 500, "all results come back without batching");
+	ok_uint(count_seen(&m, 500), 500, "every job got exactly one result");
+	ok_uint(m.batches, 0, "no batch headers without batching");
+	stop_worker(&m);
+
+	start_worker(&m, 1000, 64, 500);
+	run_jobs(&m, 500);
+	ok_uint(m.results, 500, "all results come back with batching");
+	ok_uint(count_seen(&m, 500), 500, "every job got exactly one result");
+	ok_int(m.batches >= 8, 1, "results came in batches");
+	ok_uint(m.batched, m.results, "batch headers account for every result");
+	ok_uint(m.batch_left, 0, "no batch is left half-read");
+
+	/* a lone result must not be stuck waiting for company */
+	m.seen = realloc(m.seen, 501);
+	m.seen[500] = 0;
+	gettimeofday(&start, NULL);
+	send_job(&m, 500);
+	while (m.results < 501 && read_results(&m, 1000))
+		;
+	gettimeofday(&stop, NULL);
+	ok_uint(m.results, 501, "a single result is flushed when the window closes");
+	t_diag("lone result arrived after %.2fms", tv_delta_f(&start, &stop) * 1000);
+	stop_worker(&m);
+
+	t_end();
+}
+
+static double bench(unsigned int usec, unsigned int max_results, unsigned int *wakeups)
+{
+	struct fake_master m;
+	struct timeval start, stop;
+
+	start_worker(&m, usec, max_results, BENCH_JOBS);
+	gettimeofday(&start, NULL);
+	run_jobs(&m, BENCH_JOBS);
+	gettimeofday(&stop, NULL);
+	*wakeups = m.wakeups;
+	ok_uint(count_seen(&m, BENCH_JOBS), BENCH_JOBS, "every benchmark job got exactly one result");
+	stop_worker(&m);
+
+	return BENCH_JOBS / tv_delta_f(&start, &stop);
+}
+
+static void test_throughput(void)
+{
+	double plain_rate, batch_rate;
+	unsigned int plain_wakeups, batch_wakeups;
+
+	t_start("result throughput");
+	plain_rate = bench(0, 0, &plain_wakeups);
+	batch_rate = bench(1000, 64, &batch_wakeups);
+	t_diag("%d jobs: one write per result %.0f jobs/sec with %u wakeups, batched %.0f jobs/sec with %u wakeups",
+	       BENCH_JOBS, plain_rate, plain_wakeups, batch_rate, batch_wakeups);
+	t_end();
+}
+
+int main(int argc, char **argv)
+{
+	t_set_colors(0);
+	t_start("worker tests");
+	signal(SIGPIPE, SIG_IGN);
+
+	test_batching();
+	test_throughput();
+
+	return t_end();
+}
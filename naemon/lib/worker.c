@@ -7,6 +7,8 @@
 #include <string.h>
 #include <time.h>
 #include <pwd.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include "libnaemon.h"
 
 #define MSG_DELIM "\1\0\0" /**< message limiter */
@@ -22,15 +24,32 @@ struct execution_information {
 	struct timeval stop;
 	float runtime;
 	struct rusage rusage;
+	char **env; /* points into the request kvvec */
+	char **argv; /* points into the request kvvec */
 };
 
 static iobroker_set *iobs;
 static squeue_t *sq;
 static unsigned int started, running_jobs, timeouts, reapable;
 static int master_sd;
+static shmring *job_ring, *result_ring;
 static int parent_pid;
 static fanout_table *ptab;
 
+/*
+ * Finished results can be held back for a short while, so a busy
+ * worker ships lots of them with a single writev() and the master
+ * parses them all in one wakeup. Each batch starts with a
+ * "batch=<count>" message telling the master how many results follow.
+ */
+#define RESULT_BATCH_MAX 256 /* well below IOV_MAX */
+static struct {
+	struct kvvec_buf *buf[RESULT_BATCH_MAX];
+	unsigned int count;
+	struct timeval deadline;
+} result_batch;
+static unsigned int batch_window, batch_size; /* usec, results */
+
 static void exit_worker(int code, const char *msg)
 {
 	child_process *cp;
@@ -95,6 +114,9 @@ static void wlog(const char *fmt, ...)
 	}
 }
 
+/* forward declaration */
+static int send_to_master(struct kvvec *kvv);
+
 static void job_error(child_process *cp, struct kvvec *kvv, const char *fmt, ...)
 {
 	char msg[4096];
@@ -109,7 +131,7 @@ static void job_error(child_process *cp, struct kvvec *kvv, const char *fmt, ...
 		kvvec_addkv(kvv, "job_id", mkstr("%d", cp->id));
 	}
 	kvvec_addkv_wlen(kvv, "error_msg", 9, msg, len);
-	ret = worker_send_kvvec(master_sd, kvv);
+	ret = send_to_master(kvv);
 	if (ret < 0 && errno == EPIPE)
 		exit_worker(1, "Failed to send job error key/value vector to master");
 	kvvec_destroy(kvv, 0);
@@ -154,6 +176,169 @@ int send_kvvec(int sd, struct kvvec *kvv)
 	return worker_send_kvvec(sd, kvv);
 }
 
+int worker_ring_send_kvvec(shmring *r, struct kvvec *kvv)
+{
+	unsigned long len = 0, i;
+	char *buf;
+
+	if (!r || !kvv)
+		return -1;
+
+	/* same layout as build_kvvec_buf(), minus the delimiter */
+	for (i = 0; i < (unsigned long)kvv->kv_pairs; i++)
+		len += kvv->kv[i].key_len + kvv->kv[i].value_len + 2;
+	if (len > shmring_max_record(r)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (!(buf = shmring_reserve(r, len)))
+		return -1;
+	for (i = len = 0; i < (unsigned long)kvv->kv_pairs; i++) {
+		struct key_value *kv = &kvv->kv[i];
+		memcpy(buf + len, kv->key, kv->key_len);
+		len += kv->key_len;
+		buf[len++] = KV_SEP;
+		if (kv->value_len) {
+			memcpy(buf + len, kv->value, kv->value_len);
+			len += kv->value_len;
+		}
+		buf[len++] = PAIR_SEP;
+	}
+	if (shmring_commit(r, len) < 0)
+		return -1;
+
+	return len;
+}
+
+void worker_set_result_batching(unsigned int usec, unsigned int max_results)
+{
+	if (max_results > RESULT_BATCH_MAX)
+		max_results = RESULT_BATCH_MAX;
+	if (!usec || max_results < 2)
+		usec = max_results = 0;
+	batch_window = usec;
+	batch_size = max_results;
+}
+
+/* our socket is non-blocking, but a batch mustn't be cut in half */
+static int write_all_iov(int sd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t ret = writev(sd, iov, iovcnt);
+
+		if (ret < 0) {
+			struct pollfd pfd;
+
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			pfd.fd = sd;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+static int flush_results(void)
+{
+	struct iovec iov[RESULT_BATCH_MAX + 1];
+	char hdr[32];
+	unsigned int i;
+	int len, ret;
+
+	if (!result_batch.count)
+		return 0;
+
+	/* "batch=<count>", a pair separator and the message delimiter */
+	len = snprintf(hdr, sizeof(hdr) - MSG_DELIM_LEN - 1, "batch=%u", result_batch.count);
+	hdr[len] = 0;
+	memcpy(&hdr[len + 1], MSG_DELIM, MSG_DELIM_LEN);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = len + 1 + MSG_DELIM_LEN;
+	for (i = 0; i < result_batch.count; i++) {
+		/* bufsize, not buflen, as it gets us the delimiter */
+		iov[i + 1].iov_base = result_batch.buf[i]->buf;
+		iov[i + 1].iov_len = result_batch.buf[i]->bufsize;
+	}
+
+	ret = write_all_iov(master_sd, iov, result_batch.count + 1);
+	for (i = 0; i < result_batch.count; i++) {
+		free(result_batch.buf[i]->buf);
+		free(result_batch.buf[i]);
+	}
+	result_batch.count = 0;
+
+	return ret;
+}
+
+/*
+ * results go through the ring when they fit, and the socket otherwise,
+ * where they're batched up if we've been told to do so
+ */
+static int send_to_master(struct kvvec *kvv)
+{
+	struct kvvec_buf *kvvb;
+
+	if (result_ring && worker_ring_send_kvvec(result_ring, kvv) >= 0)
+		return 0;
+	if (!batch_size)
+		return worker_send_kvvec(master_sd, kvv);
+
+	if (!(kvvb = build_kvvec_buf(kvv)))
+		return -1;
+	if (!result_batch.count) {
+		gettimeofday(&result_batch.deadline, NULL);
+		result_batch.deadline.tv_usec += batch_window;
+		result_batch.deadline.tv_sec += result_batch.deadline.tv_usec / 1000000;
+		result_batch.deadline.tv_usec %= 1000000;
+	}
+	result_batch.buf[result_batch.count++] = kvvb;
+	if (result_batch.count >= batch_size)
+		return flush_results();
+
+	return 0;
+}
+
+int worker_read_registration(int sd, char *buf, unsigned int len)
+{
+	int ret, fds[4], nfds = 4;
+
+	ret = nsock_recv_fds(sd, buf, len, fds, &nfds);
+	if (nfds == 4) {
+		job_ring = shmring_attach(fds[0], fds[1]);
+		result_ring = shmring_attach(fds[2], fds[3]);
+		if (!job_ring || !result_ring) {
+			shmring_destroy(job_ring);
+			shmring_destroy(result_ring);
+			job_ring = result_ring = NULL;
+			nfds = 0;
+		} else {
+			/* the mappings are all we need */
+			shmring_close_fd(job_ring);
+			shmring_close_fd(result_ring);
+			return ret;
+		}
+	}
+	while (nfds-- > 0)
+		close(fds[nfds]);
+
+	return ret;
+}
+
 char *worker_ioc2msg(iocache *ioc, unsigned long *size, int flags)
 {
 	return iocache_use_delim(ioc, MSG_DELIM, MSG_DELIM_LEN, size);
@@ -202,6 +387,8 @@ static void destroy_job(child_process *cp)
 	kvvec_destroy(cp->request, KVVEC_FREE_ALL);
 	free(cp->cmd);
 
+	free(cp->ei->env);
+	free(cp->ei->argv);
 	free(cp->ei);
 	free(cp);
 }
@@ -257,12 +444,13 @@ int finish_job(child_process *cp, int reason)
 
 	/*
 	 * Now build the return message.
-	 * First comes the request, minus environment variables
+	 * First comes the request, minus environment variables and
+	 * arguments
 	 */
 	for (i = 0; i < cp->request->kv_pairs; i++) {
 		struct key_value *kv = &cp->request->kv[i];
-		/* skip environment macros */
-		if (kv->key_len == 3 && !strcmp(kv->key, "env")) {
+		/* skip environment macros and arguments */
+		if (kv->key_len == 3 && (!strcmp(kv->key, "env") || !strcmp(kv->key, "arg"))) {
 			continue;
 		}
 		kvvec_addkv_wlen(&resp, kv->key, kv->key_len, kv->value, kv->value_len);
@@ -287,7 +475,7 @@ int finish_job(child_process *cp, int reason)
 	}
 	kvvec_addkv_wlen(&resp, "outerr", 6, cp->outerr.buf, cp->outerr.len);
 	kvvec_addkv_wlen(&resp, "outstd", 6, cp->outstd.buf, cp->outstd.len);
-	ret = worker_send_kvvec(master_sd, &resp);
+	ret = send_to_master(&resp);
 	if (ret < 0 && errno == EPIPE)
 		exit_worker(1, "Failed to send kvvec struct to master");
 
@@ -507,7 +695,10 @@ int start_cmd(child_process *cp)
 {
 	int pfd[2] = { -1, -1}, pfderr[2] = { -1, -1};
 
-	cp->outstd.fd = runcmd_open(cp->cmd, pfd, pfderr, NULL);
+	if (cp->ei->argv)
+		cp->outstd.fd = runcmd_open_argv(cp->ei->argv, pfd, pfderr, cp->ei->env);
+	else
+		cp->outstd.fd = runcmd_open(cp->cmd, pfd, pfderr, cp->ei->env);
 	if (cp->outstd.fd < 0) {
 		return -1;
 	}
@@ -535,7 +726,7 @@ static iocache *ioc;
 
 static child_process *parse_command_kvvec(struct kvvec *kvv)
 {
-	int i;
+	int i, envc = 0, argc = 0;
 	child_process *cp;
 
 	/* get this command's struct and insert it at the top of the list */
@@ -573,6 +764,40 @@ static child_process *parse_command_kvvec(struct kvvec *kvv)
 			cp->timeout = (unsigned int)strtoul(value, &endptr, 0);
 			continue;
 		}
+		if (!strcmp(key, "env")) {
+			/* environment macros, as "NAGIOS_FOO=bar" */
+			if (!cp->ei->env) {
+				int x, count = 0;
+				for (x = i; x < kvv->kv_pairs; x++) {
+					if (!strcmp(kvv->kv[x].key, "env"))
+						count++;
+				}
+				cp->ei->env = calloc(count + 1, sizeof(char *));
+				if (!cp->ei->env) {
+					wlog("Failed to calloc() environment for job %u", cp->id);
+					continue;
+				}
+			}
+			cp->ei->env[envc++] = value;
+			continue;
+		}
+		if (!strcmp(key, "arg")) {
+			/* pre-split arguments, run without the shell */
+			if (!cp->ei->argv) {
+				int x, count = 0;
+				for (x = i; x < kvv->kv_pairs; x++) {
+					if (!strcmp(kvv->kv[x].key, "arg"))
+						count++;
+				}
+				cp->ei->argv = calloc(count + 1, sizeof(char *));
+				if (!cp->ei->argv) {
+					wlog("Failed to calloc() arguments for job %u", cp->id);
+					continue;
+				}
+			}
+			cp->ei->argv[argc++] = value;
+			continue;
+		}
 	}
 
 	/* jobs without a timeout get a default of 60 seconds. */
@@ -658,6 +883,24 @@ static int receive_command(int sd, int events, void *arg)
 	return 0;
 }
 
+static int receive_ring_command(int fd, int events, void *arg)
+{
+	char *buf;
+	unsigned int size;
+
+	shmring_ack(job_ring);
+	while ((buf = shmring_peek(job_ring, &size))) {
+		struct kvvec *kvv;
+		/* copied, so we can hand the ring space back right away */
+		kvv = buf2kvvec(buf, size, KV_SEP, PAIR_SEP, KVVEC_COPY);
+		shmring_consume(job_ring);
+		if (kvv)
+			spawn_job(kvv, arg);
+	}
+
+	return 0;
+}
+
 int worker_set_sockopts(int sd, int bufsize)
 {
 	int ret;
@@ -698,6 +941,10 @@ void enter_worker(int sd, int (*cb)(child_process *))
 		/* XXX: handle error somehow, or maybe just ignore it */
 	}
 
+	/* start plugins from a process that stays small while we grow */
+	if (runcmd_zygote_start() < 0 && errno != ENOSYS)
+		wlog("Failed to start zygote, forking plugins from the worker: %s", strerror(errno));
+
 	/* we need to catch child signals to mark jobs as reapable */
 	signal(SIGCHLD, sigchld_handler);
 
@@ -718,6 +965,8 @@ void enter_worker(int sd, int (*cb)(child_process *))
 	worker_set_sockopts(master_sd, 256 * 1024);
 
 	iobroker_register(iobs, master_sd, cb, receive_command);
+	if (job_ring)
+		iobroker_register(iobs, shmring_doorbell(job_ring), cb, receive_ring_command);
 	while (iobroker_get_num_fds(iobs) > 0) {
 		int poll_time = -1;
 
@@ -752,6 +1001,21 @@ void enter_worker(int sd, int (*cb)(child_process *))
 			}
 		}
 
+		/* don't sleep past the deadline of held back results */
+		if (result_batch.count) {
+			struct timeval now;
+			long usec;
+
+			gettimeofday(&now, NULL);
+			usec = (result_batch.deadline.tv_sec - now.tv_sec) * 1000000 + result_batch.deadline.tv_usec - now.tv_usec;
+			if (usec <= 0) {
+				if (flush_results() < 0 && errno == EPIPE)
+					exit_worker(1, "Failed to send results to master");
+			} else if (poll_time < 0 || (usec + 999) / 1000 < poll_time) {
+				poll_time = (usec + 999) / 1000;
+			}
+		}
+
 		iobroker_poll(iobs, poll_time);
 
 		if (reapable)
@@ -13,6 +13,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include "libnagios.h"
+#include "shmring.h"
 
 /**
  * @file worker.h
@@ -105,6 +106,45 @@ extern int worker_send_kvvec(int sd, struct kvvec *kvv);
 extern int send_kvvec(int sd, struct kvvec *kvv)
 	NAGIOS_DEPRECATED(4.1.0, "worker_send_kvvec()");
 
+/**
+ * Write a key/value vector straight into a shared memory ring.
+ * Records in the ring are delimited by their length, so unlike
+ * worker_send_kvvec() no message delimiter is added.
+ * @param r The ring to write to
+ * @param kvv The key/value vector to send
+ * @return The number of bytes written, or -1 on errors, in which case
+ *         errno is EAGAIN if the ring is full and EMSGSIZE if the
+ *         message is too large for it
+ */
+extern int worker_ring_send_kvvec(shmring *r, struct kvvec *kvv);
+
+/**
+ * Hold back results sent to the master through the socket, so they
+ * can be shipped many at a time. A batch is sent when it holds
+ * max_results results or when its oldest result has waited for usec
+ * microseconds, whichever comes first. The batch is preceded by a
+ * "batch=<count>" message, so the master knows how many results to
+ * expect. Results going through a shared memory ring aren't batched,
+ * since the ring only rings its doorbell when the master is idle.
+ * Batching is off by default and must be set up before enter_worker().
+ * @param usec The longest time a result may be held back. 0 disables
+ * @param max_results Largest number of results in a batch. At most 256
+ */
+extern void worker_set_result_batching(unsigned int usec, unsigned int max_results);
+
+/**
+ * Read the master's response to a registration request. If the
+ * master passed a job ring and a result ring along with the response,
+ * the worker will use them instead of the socket for jobs and results.
+ * The rings come as four file descriptors: the job ring, its doorbell,
+ * the result ring and its doorbell.
+ * @param[in] sd The socket connected to the master
+ * @param[out] buf Buffer for the response
+ * @param[in] len Size of buf
+ * @return Whatever recvmsg() returns
+ */
+extern int worker_read_registration(int sd, char *buf, unsigned int len);
+
 /**
  * Grab a worker message from an iocache buffer
  * @param[in] ioc The io cache
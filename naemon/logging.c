@@ -7,6 +7,7 @@
 #include "utils.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "simulation.h"
 #include <string.h>
 #include <fcntl.h>
 #include <syslog.h>
@@ -165,7 +166,7 @@ int write_to_log(char *buffer, unsigned long data_type, time_t *timestamp)
 		return ERROR;
 	/* what timestamp should we use? */
 	if (timestamp == NULL)
-		time(&log_time);
+		sim_time(&log_time);
 	else
 		log_time = *timestamp;
 
@@ -349,7 +350,7 @@ int rotate_log_file(time_t rotation_time)
 	sigrotate = FALSE;
 
 	/* update the last log rotation time and status log */
-	last_log_rotation = time(NULL);
+	last_log_rotation = sim_time(NULL);
 
 	close_log_file();
 	log_fp = open_log_file();
@@ -438,7 +439,7 @@ int log_debug_info(int level, int verbosity, const char *fmt, ...)
 		return ERROR;
 
 	/* write the timestamp */
-	gettimeofday(&current_time, NULL);
+	sim_gettimeofday(&current_time, NULL);
 	fprintf(debug_file_fp, "[%ld.%06ld] [%03d.%d] [pid=%lu] ", (long)current_time.tv_sec, (long)current_time.tv_usec, level, verbosity, (unsigned long)getpid());
 
 	/* write the data */
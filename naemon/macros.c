@@ -8,7 +8,10 @@
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "simulation.h"
+#include "lib/libnaemon.h"
 #include <string.h>
+#include <ctype.h>
 
 static char *macro_x_names[MACRO_X_COUNT]; /* the macro names */
 char *macro_user[MAX_USER_MACROS]; /* $USERx$ macros */
@@ -77,11 +80,49 @@ static const struct macro_key_code *find_macro_key(const char *name)
 }
 
 
+/*
+ * Values of $ARGn$, $USERn$ and custom variable macros come from the
+ * configuration, so commands may rely on the shell parsing them. The
+ * values of all other macros come from plugins, users and objects.
+ */
+static int is_config_macro(const char *name, int *argn)
+{
+	*argn = -1;
+	if (*name == '_')
+		return TRUE;
+	if (!strncmp(name, "USER", 4) && isdigit((unsigned char)name[4]))
+		return TRUE;
+	if (!strncmp(name, "ARG", 3) && isdigit((unsigned char)name[3])) {
+		*argn = atoi(name + 3) - 1;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* appends str to the output, and what it came from to the marks */
+static void add_macro_output(char **output_buffer, size_t *len, unsigned char **marks, const char *str, const unsigned char *str_marks, unsigned char mark)
+{
+	size_t n = strlen(str);
+
+	*output_buffer = nm_realloc(*output_buffer, *len + n + 1);
+	memcpy(*output_buffer + *len, str, n + 1);
+	if (marks) {
+		*marks = nm_realloc(*marks, *len + n + 1);
+		if (str_marks)
+			memcpy(*marks + *len, str_marks, n);
+		else
+			memset(*marks + *len, mark, n);
+	}
+	*len += n;
+}
+
 /*
  * replace macros in notification commands with their values,
- * the thread-safe version
+ * the thread-safe version. If marks is set, it gets one byte per
+ * byte of output, which is set if that byte came from the value of
+ * a macro that isn't configuration.
  */
-int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffer, int options)
+int process_macros_marked_r(nagios_macros *mac, char *input_buffer, char **output_buffer, unsigned char **marks, int options)
 {
 	char *temp_buffer = NULL;
 	char *save_buffer = NULL;
@@ -93,6 +134,10 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 	int result = OK;
 	int free_macro = FALSE;
 	int macro_options = 0;
+	size_t len = 0;
+	int argn;
+	unsigned char mark;
+	const unsigned char *value_marks;
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "process_macros_r()\n");
 
@@ -100,6 +145,8 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 		return ERROR;
 
 	*output_buffer = nm_strdup("");
+	if (marks)
+		*marks = nm_calloc(1, 1);
 	in_macro = FALSE;
 
 	log_debug_info(DEBUGL_MACROS, 1, "**** BEGIN MACRO PROCESSING ***********\n");
@@ -127,8 +174,7 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 		if (in_macro == FALSE) {
 
 			/* add the plain text to the end of the already processed buffer */
-			*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(temp_buffer) + 1);
-			strcat(*output_buffer, temp_buffer);
+			add_macro_output(output_buffer, &len, marks, temp_buffer, NULL, 0);
 
 			log_debug_info(DEBUGL_MACROS, 2, "  Not currently in macro.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
 			in_macro = TRUE;
@@ -138,8 +184,7 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 		/* an escaped $ is done by specifying two $$ next to each other */
 		if (!strcmp(temp_buffer, "")) {
 			log_debug_info(DEBUGL_MACROS, 2, "  Escaped $.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
-			*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + 2);
-			strcat(*output_buffer, "$");
+			add_macro_output(output_buffer, &len, marks, "$", NULL, 0);
 			in_macro = FALSE;
 			continue;
 		}
@@ -160,13 +205,12 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 				my_free(selected_macro);
 
 			/* add the plain text to the end of the already processed buffer */
-			*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(temp_buffer) + 3);
-			strcat(*output_buffer, "$");
-			strcat(*output_buffer, temp_buffer);
+			add_macro_output(output_buffer, &len, marks, "$", NULL, 0);
+			add_macro_output(output_buffer, &len, marks, temp_buffer, NULL, 0);
 
 			/* if we still do not reach the end of string */
 			if (buf_ptr)
-				strcat(*output_buffer, "$");
+				add_macro_output(output_buffer, &len, marks, "$", NULL, 0);
 
 			in_macro = FALSE;
 			continue;
@@ -174,6 +218,12 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 
 		/* insert macro */
 		if (selected_macro != NULL) {
+			/* $ARGn$ values are partly configuration, and partly other macros */
+			mark = !is_config_macro(temp_buffer, &argn);
+			value_marks = NULL;
+			if (argn >= 0 && argn < MAX_COMMAND_ARGUMENTS && selected_macro == mac->argv[argn] && !(options & URL_ENCODE_MACRO_CHARS))
+				value_marks = mac->argv_marks[argn];
+
 			log_debug_info(DEBUGL_MACROS, 2, "  Processed '%s', Free: %d,  Cleaning options: %d\n", temp_buffer, free_macro, options);
 
 			/* URL encode the macro if requested - this allocates new memory */
@@ -192,8 +242,7 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 
 				/* add the (cleaned) processed macro to the end of the already processed buffer */
 				if (selected_macro != NULL && (cleaned_macro = clean_macro_chars(selected_macro, options)) != NULL) {
-					*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(cleaned_macro) + 1);
-					strcat(*output_buffer, cleaned_macro);
+					add_macro_output(output_buffer, &len, marks, cleaned_macro, NULL, mark);
 					if (*cleaned_macro)
 						free(cleaned_macro);
 
@@ -205,8 +254,7 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 			else {
 				/* add the processed macro to the end of the already processed buffer */
 				if (selected_macro != NULL) {
-					*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(selected_macro) + 1);
-					strcat(*output_buffer, selected_macro);
+					add_macro_output(output_buffer, &len, marks, selected_macro, value_marks, mark);
 
 					log_debug_info(DEBUGL_MACROS, 2, "  Uncleaned macro.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
 				}
@@ -231,6 +279,11 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 	return OK;
 }
 
+int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffer, int options)
+{
+	return process_macros_marked_r(mac, input_buffer, output_buffer, NULL, options);
+}
+
 int process_macros(char *input_buffer, char **output_buffer, int options)
 {
 	return process_macros_r(&global_macros, input_buffer, output_buffer, options);
@@ -377,10 +430,10 @@ int grab_macro_value_r(nagios_macros *mac, char *macro_buffer, char **output, in
 	char *arg[2] = {NULL, NULL};
 	contact *temp_contact = NULL;
 	contactgroup *temp_contactgroup = NULL;
-	contactsmember *temp_contactsmember = NULL;
 	char *temp_buffer = NULL;
 	int delimiter_len = 0;
 	int x, result = OK;
+	unsigned int i;
 	const struct macro_key_code *mkey;
 
 	/* for the early cases, this is the default */
@@ -510,10 +563,7 @@ int grab_macro_value_r(nagios_macros *mac, char *macro_buffer, char **output, in
 				delimiter_len = strlen(arg[1]);
 
 				/* concatenate macro values for all contactgroup members */
-				for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-
-					if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-						continue;
+				objectarray_foreach(&temp_contactgroup->member_objs, i, temp_contact) {
 
 					/* get the macro value for this contact */
 					grab_contact_address_macro(x, temp_contact, &temp_buffer);
@@ -577,13 +627,11 @@ int grab_macrox_value_r(nagios_macros *mac, int macro_type, char *arg1, char *ar
 {
 	host *temp_host = NULL;
 	hostgroup *temp_hostgroup = NULL;
-	hostsmember *temp_hostsmember = NULL;
 	service *temp_service = NULL;
 	servicegroup *temp_servicegroup = NULL;
-	servicesmember *temp_servicesmember = NULL;
 	contact *temp_contact = NULL;
 	contactgroup *temp_contactgroup = NULL;
-	contactsmember *temp_contactsmember = NULL;
+	unsigned int i;
 	char *temp_buffer = NULL;
 	int result = OK;
 	int delimiter_len = 0;
@@ -693,10 +741,7 @@ int grab_macrox_value_r(nagios_macros *mac, int macro_type, char *arg1, char *ar
 			delimiter_len = strlen(arg2);
 
 			/* concatenate macro values for all hostgroup members */
-			for (temp_hostsmember = temp_hostgroup->members; temp_hostsmember != NULL; temp_hostsmember = temp_hostsmember->next) {
-
-				if ((temp_host = temp_hostsmember->host_ptr) == NULL)
-					continue;
+			objectarray_foreach(&temp_hostgroup->member_objs, i, temp_host) {
 
 				/* get the macro value for this host */
 				grab_standard_host_macro_r(mac, macro_type, temp_host, &temp_buffer, &free_sub_macro);
@@ -834,10 +879,7 @@ int grab_macrox_value_r(nagios_macros *mac, int macro_type, char *arg1, char *ar
 				*free_macro = TRUE;
 
 				/* concatenate macro values for all servicegroup members */
-				for (temp_servicesmember = temp_servicegroup->members; temp_servicesmember != NULL; temp_servicesmember = temp_servicesmember->next) {
-
-					if ((temp_service = temp_servicesmember->service_ptr) == NULL)
-						continue;
+				objectarray_foreach(&temp_servicegroup->member_objs, i, temp_service) {
 
 					/* get the macro value for this service */
 					grab_standard_service_macro_r(mac, macro_type, temp_service, &temp_buffer, &free_sub_macro);
@@ -924,10 +966,7 @@ int grab_macrox_value_r(nagios_macros *mac, int macro_type, char *arg1, char *ar
 			*free_macro = TRUE;
 
 			/* concatenate macro values for all contactgroup members */
-			for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
+			objectarray_foreach(&temp_contactgroup->member_objs, i, temp_contact) {
 
 				/* get the macro value for this contact */
 				grab_standard_contact_macro_r(mac, macro_type, temp_contact, &temp_buffer);
@@ -1197,13 +1236,11 @@ int grab_custom_macro_value_r(nagios_macros *mac, char *macro_name, char *arg1,
 {
 	host *temp_host = NULL;
 	hostgroup *temp_hostgroup = NULL;
-	hostsmember *temp_hostsmember = NULL;
 	service *temp_service = NULL;
 	servicegroup *temp_servicegroup = NULL;
-	servicesmember *temp_servicesmember = NULL;
 	contact *temp_contact = NULL;
 	contactgroup *temp_contactgroup = NULL;
-	contactsmember *temp_contactsmember = NULL;
+	unsigned int i;
 	int delimiter_len = 0;
 	char *temp_buffer = NULL;
 	int result = OK;
@@ -1239,10 +1276,7 @@ int grab_custom_macro_value_r(nagios_macros *mac, char *macro_name, char *arg1,
 			delimiter_len = strlen(arg2);
 
 			/* concatenate macro values for all hostgroup members */
-			for (temp_hostsmember = temp_hostgroup->members; temp_hostsmember != NULL; temp_hostsmember = temp_hostsmember->next) {
-
-				if ((temp_host = temp_hostsmember->host_ptr) == NULL)
-					continue;
+			objectarray_foreach(&temp_hostgroup->member_objs, i, temp_host) {
 
 				/* get the macro value for this host */
 				grab_custom_macro_value_r(mac, macro_name, temp_host->name, NULL, &temp_buffer);
@@ -1297,10 +1331,7 @@ int grab_custom_macro_value_r(nagios_macros *mac, char *macro_name, char *arg1,
 				delimiter_len = strlen(arg2);
 
 				/* concatenate macro values for all servicegroup members */
-				for (temp_servicesmember = temp_servicegroup->members; temp_servicesmember != NULL; temp_servicesmember = temp_servicesmember->next) {
-
-					if ((temp_service = temp_servicesmember->service_ptr) == NULL)
-						continue;
+				objectarray_foreach(&temp_servicegroup->member_objs, i, temp_service) {
 
 					/* get the macro value for this service */
 					grab_custom_macro_value_r(mac, macro_name, temp_service->host_name, temp_service->description, &temp_buffer);
@@ -1351,10 +1382,7 @@ int grab_custom_macro_value_r(nagios_macros *mac, char *macro_name, char *arg1,
 			delimiter_len = strlen(arg2);
 
 			/* concatenate macro values for all contactgroup members */
-			for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
+			objectarray_foreach(&temp_contactgroup->member_objs, i, temp_contact) {
 
 				/* get the macro value for this contact */
 				grab_custom_macro_value_r(mac, macro_name, temp_contact->name, NULL, &temp_buffer);
@@ -1399,7 +1427,7 @@ int grab_datetime_macro_r(nagios_macros *mac, int macro_type, char *arg1, char *
 		return ERROR;
 
 	/* get the current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* parse args, do prep work */
 	switch (macro_type) {
@@ -1571,7 +1599,7 @@ int grab_standard_host_macro_r(nagios_macros *mac, int macro_type, host *temp_ho
 		break;
 	case MACRO_HOSTDURATIONSEC:
 	case MACRO_HOSTDURATION:
-		time(&current_time);
+		sim_time(&current_time);
 		duration = (unsigned long)(current_time - temp_host->last_state_change);
 
 		if (macro_type == MACRO_HOSTDURATIONSEC)
@@ -1757,7 +1785,8 @@ int grab_standard_host_macro(int macro_type, host *temp_host, char **output, int
 /* computes a hostgroup macro */
 int grab_standard_hostgroup_macro_r(nagios_macros *mac, int macro_type, hostgroup *temp_hostgroup, char **output)
 {
-	hostsmember *temp_hostsmember = NULL;
+	host *temp_host = NULL;
+	unsigned int i;
 	char *temp_buffer = NULL;
 	unsigned int	temp_len = 0;
 	unsigned int	init_len = 0;
@@ -1776,13 +1805,11 @@ int grab_standard_hostgroup_macro_r(nagios_macros *mac, int macro_type, hostgrou
 		break;
 	case MACRO_HOSTGROUPMEMBERS:
 		/* make the calculations for total string length */
-		for (temp_hostsmember = temp_hostgroup->members; temp_hostsmember != NULL; temp_hostsmember = temp_hostsmember->next) {
-			if (temp_hostsmember->host_name == NULL)
-				continue;
+		objectarray_foreach(&temp_hostgroup->member_objs, i, temp_host) {
 			if (temp_len == 0) {
-				temp_len += strlen(temp_hostsmember->host_name) + 1;
+				temp_len += strlen(temp_host->name) + 1;
 			} else {
-				temp_len += strlen(temp_hostsmember->host_name) + 2;
+				temp_len += strlen(temp_host->name) + 2;
 			}
 		}
 		if (!temp_len) {
@@ -1800,14 +1827,12 @@ int grab_standard_hostgroup_macro_r(nagios_macros *mac, int macro_type, hostgrou
 			*output = nm_realloc(*output, temp_len);
 		}
 		/* now fill in the string with the member names */
-		for (temp_hostsmember = temp_hostgroup->members; temp_hostsmember != NULL; temp_hostsmember = temp_hostsmember->next) {
-			if (temp_hostsmember->host_name == NULL)
-				continue;
+		objectarray_foreach(&temp_hostgroup->member_objs, i, temp_host) {
 			temp_buffer = *output + init_len;
 			if (init_len == 0) { /* If our buffer didn't contain anything, we just need to write "%s,%s" */
-				init_len += sprintf(temp_buffer, "%s", temp_hostsmember->host_name);
+				init_len += sprintf(temp_buffer, "%s", temp_host->name);
 			} else {
-				init_len += sprintf(temp_buffer, ",%s", temp_hostsmember->host_name);
+				init_len += sprintf(temp_buffer, ",%s", temp_host->name);
 			}
 		}
 		break;
@@ -1957,7 +1982,7 @@ int grab_standard_service_macro_r(nagios_macros *mac, int macro_type, service *t
 	case MACRO_SERVICEDURATIONSEC:
 	case MACRO_SERVICEDURATION:
 
-		time(&current_time);
+		sim_time(&current_time);
 		duration = (unsigned long)(current_time - temp_service->last_state_change);
 
 		/* get the state duration in seconds */
@@ -2069,7 +2094,8 @@ int grab_standard_service_macro(int macro_type, service *temp_service, char **ou
 /* computes a servicegroup macro */
 int grab_standard_servicegroup_macro_r(nagios_macros *mac, int macro_type, servicegroup *temp_servicegroup, char **output)
 {
-	servicesmember *temp_servicesmember = NULL;
+	service *temp_service = NULL;
+	unsigned int i;
 	char *temp_buffer = NULL;
 	unsigned int temp_len = 0;
 	unsigned int init_len = 0;
@@ -2088,13 +2114,11 @@ int grab_standard_servicegroup_macro_r(nagios_macros *mac, int macro_type, servi
 		break;
 	case MACRO_SERVICEGROUPMEMBERS:
 		/* make the calculations for total string length */
-		for (temp_servicesmember = temp_servicegroup->members; temp_servicesmember != NULL; temp_servicesmember = temp_servicesmember->next) {
-			if (temp_servicesmember->host_name == NULL || temp_servicesmember->service_description == NULL)
-				continue;
+		objectarray_foreach(&temp_servicegroup->member_objs, i, temp_service) {
 			if (temp_len == 0) {
-				temp_len += strlen(temp_servicesmember->host_name) + strlen(temp_servicesmember->service_description) + 2;
+				temp_len += strlen(temp_service->host_name) + strlen(temp_service->description) + 2;
 			} else {
-				temp_len += strlen(temp_servicesmember->host_name) + strlen(temp_servicesmember->service_description) + 3;
+				temp_len += strlen(temp_service->host_name) + strlen(temp_service->description) + 3;
 			}
 		}
 		if (!temp_len) {
@@ -2111,14 +2135,12 @@ int grab_standard_servicegroup_macro_r(nagios_macros *mac, int macro_type, servi
 			*output = nm_realloc(*output, temp_len);
 		}
 		/* now fill in the string with the group members */
-		for (temp_servicesmember = temp_servicegroup->members; temp_servicesmember != NULL; temp_servicesmember = temp_servicesmember->next) {
-			if (temp_servicesmember->host_name == NULL || temp_servicesmember->service_description == NULL)
-				continue;
+		objectarray_foreach(&temp_servicegroup->member_objs, i, temp_service) {
 			temp_buffer = *output + init_len;
 			if (init_len == 0) { /* If our buffer didn't contain anything, we just need to write "%s,%s" */
-				init_len += sprintf(temp_buffer, "%s,%s", temp_servicesmember->host_name, temp_servicesmember->service_description);
+				init_len += sprintf(temp_buffer, "%s,%s", temp_service->host_name, temp_service->description);
 			} else { /* Now we need to write ",%s,%s" */
-				init_len += sprintf(temp_buffer, ",%s,%s", temp_servicesmember->host_name, temp_servicesmember->service_description);
+				init_len += sprintf(temp_buffer, ",%s,%s", temp_service->host_name, temp_service->description);
 			}
 		}
 		break;
@@ -2243,7 +2265,8 @@ int grab_contact_address_macro(int macro_num, contact *temp_contact, char **outp
 /* computes a contactgroup macro */
 int grab_standard_contactgroup_macro(int macro_type, contactgroup *temp_contactgroup, char **output)
 {
-	contactsmember *temp_contactsmember = NULL;
+	contact *temp_contact = NULL;
+	unsigned int i;
 
 	if (temp_contactgroup == NULL || output == NULL)
 		return ERROR;
@@ -2259,14 +2282,12 @@ int grab_standard_contactgroup_macro(int macro_type, contactgroup *temp_contactg
 		break;
 	case MACRO_CONTACTGROUPMEMBERS:
 		/* get the member list */
-		for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-			if (temp_contactsmember->contact_name == NULL)
-				continue;
+		objectarray_foreach(&temp_contactgroup->member_objs, i, temp_contact) {
 			if (*output == NULL)
-				*output = nm_strdup(temp_contactsmember->contact_name);
-			*output = nm_realloc(*output, strlen(*output) + strlen(temp_contactsmember->contact_name) + 2);
+				*output = nm_strdup(temp_contact->name);
+			*output = nm_realloc(*output, strlen(*output) + strlen(temp_contact->name) + 2);
 			strcat(*output, ",");
-			strcat(*output, temp_contactsmember->contact_name);
+			strcat(*output, temp_contact->name);
 		}
 		break;
 	default:
@@ -2689,8 +2710,10 @@ int clear_argv_macros_r(nagios_macros *mac)
 	register int x = 0;
 
 	/* command argument macros */
-	for (x = 0; x < MAX_COMMAND_ARGUMENTS; x++)
+	for (x = 0; x < MAX_COMMAND_ARGUMENTS; x++) {
 		my_free(mac->argv[x]);
+		my_free(mac->argv_marks[x]);
+	}
 
 	return OK;
 }
@@ -3196,3 +3219,296 @@ int set_macro_environment_var(char *name, char *value, int set)
 
 	return OK;
 }
+
+
+/******************************************************************/
+/*************** WORKER ENVIRONMENT BLOCK FUNCTIONS ***************/
+/******************************************************************/
+
+/*
+ * Worker jobs get their environment macros as "env" key/value pairs
+ * in the job request. Generating every macro for each and every job
+ * is expensive, so the part that only changes with the configuration
+ * (names, addresses, custom variables and their ilk) is kept in a
+ * per-object block that's rebuilt only after it's been invalidated.
+ */
+struct macro_env_block {
+	int valid;
+	unsigned int count;
+	char **vars; /* "NAGIOS_FOO=bar" strings */
+};
+
+static struct macro_env_block constant_env_block;
+static struct macro_env_block *host_env_blocks, *service_env_blocks;
+static unsigned int num_host_env_blocks, num_service_env_blocks;
+
+static const int constant_env_macros[] = {
+	MACRO_ADMINEMAIL, MACRO_ADMINPAGER, MACRO_MAINCONFIGFILE,
+	MACRO_STATUSDATAFILE, MACRO_RETENTIONDATAFILE, MACRO_OBJECTCACHEFILE,
+	MACRO_TEMPFILE, MACRO_LOGFILE, MACRO_RESOURCEFILE, MACRO_COMMANDFILE,
+	MACRO_HOSTPERFDATAFILE, MACRO_SERVICEPERFDATAFILE,
+	MACRO_PROCESSSTARTTIME, MACRO_TEMPPATH, MACRO_EVENTSTARTTIME,
+	-1
+};
+
+static const int host_env_macros[] = {
+	MACRO_HOSTNAME, MACRO_HOSTALIAS, MACRO_HOSTADDRESS,
+	MACRO_HOSTDISPLAYNAME, MACRO_HOSTGROUPNAMES, MACRO_HOSTCHECKCOMMAND,
+	MACRO_MAXHOSTATTEMPTS,
+	-1
+};
+
+static const int service_env_macros[] = {
+	MACRO_SERVICEDESC, MACRO_SERVICEDISPLAYNAME, MACRO_SERVICEGROUPNAMES,
+	MACRO_SERVICECHECKCOMMAND, MACRO_MAXSERVICEATTEMPTS,
+	MACRO_SERVICEISVOLATILE,
+	-1
+};
+
+static int is_cached_env_macro(int x)
+{
+	int i;
+
+	for (i = 0; constant_env_macros[i] >= 0; i++)
+		if (constant_env_macros[i] == x)
+			return TRUE;
+	for (i = 0; host_env_macros[i] >= 0; i++)
+		if (host_env_macros[i] == x)
+			return TRUE;
+	for (i = 0; service_env_macros[i] >= 0; i++)
+		if (service_env_macros[i] == x)
+			return TRUE;
+
+	return FALSE;
+}
+
+static char *env_var_string(const char *name, const char *value)
+{
+	char *str = NULL;
+
+	nm_asprintf(&str, "%s%s=%s", MACRO_ENV_VAR_PREFIX, name, value ? value : "");
+	return str;
+}
+
+static void env_block_add(struct macro_env_block *blk, char *str)
+{
+	blk->vars = nm_realloc(blk->vars, (blk->count + 1) * sizeof(char *));
+	blk->vars[blk->count++] = str;
+}
+
+static void env_block_clear(struct macro_env_block *blk)
+{
+	unsigned int i;
+
+	for (i = 0; i < blk->count; i++)
+		my_free(blk->vars[i]);
+	my_free(blk->vars);
+	blk->count = 0;
+	blk->valid = FALSE;
+}
+
+static void env_block_add_macrox(struct macro_env_block *blk, nagios_macros *mac, const int *macros)
+{
+	int i, free_macro;
+	char *value;
+
+	for (i = 0; macros[i] >= 0; i++) {
+		int x = macros[i];
+
+		/* member macros tend to overflow the environment on large installations */
+		if (use_large_installation_tweaks == TRUE && (x == MACRO_SERVICEGROUPMEMBERS || x == MACRO_HOSTGROUPMEMBERS))
+			continue;
+
+		value = NULL;
+		free_macro = FALSE;
+		if (grab_macrox_value_r(mac, x, NULL, NULL, &value, &free_macro) != OK)
+			continue;
+		env_block_add(blk, env_var_string(macro_x_names[x], value));
+		if (free_macro == TRUE)
+			my_free(value);
+	}
+}
+
+static void env_block_add_customvars(struct macro_env_block *blk, const char *prefix, customvariablesmember *cvar)
+{
+	char *name = NULL, *value;
+
+	for (; cvar != NULL; cvar = cvar->next) {
+		nm_asprintf(&name, "%s%s", prefix, cvar->variable_name);
+		value = clean_macro_chars(cvar->variable_value, STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS);
+		env_block_add(blk, env_var_string(name, value));
+		if (cvar->variable_value && *cvar->variable_value)
+			my_free(value);
+		my_free(name);
+	}
+}
+
+static struct macro_env_block *get_env_block(struct macro_env_block **blocks, unsigned int *num_blocks, unsigned int id, unsigned int hint)
+{
+	if (id >= *num_blocks) {
+		unsigned int new_size = id >= hint ? id + 1 : hint;
+
+		*blocks = nm_realloc(*blocks, new_size * sizeof(struct macro_env_block));
+		memset(&(*blocks)[*num_blocks], 0, (new_size - *num_blocks) * sizeof(struct macro_env_block));
+		*num_blocks = new_size;
+	}
+
+	return &(*blocks)[id];
+}
+
+static struct macro_env_block *get_host_env_block(host *hst)
+{
+	struct macro_env_block *blk;
+	nagios_macros mac;
+
+	blk = get_env_block(&host_env_blocks, &num_host_env_blocks, hst->id, num_objects.hosts);
+	if (blk->valid)
+		return blk;
+
+	memset(&mac, 0, sizeof(mac));
+	mac.host_ptr = hst;
+	env_block_add_macrox(blk, &mac, host_env_macros);
+	env_block_add_customvars(blk, "_HOST", hst->custom_variables);
+	clear_volatile_macros_r(&mac);
+	blk->valid = TRUE;
+
+	return blk;
+}
+
+static struct macro_env_block *get_service_env_block(service *svc)
+{
+	struct macro_env_block *blk;
+	nagios_macros mac;
+
+	blk = get_env_block(&service_env_blocks, &num_service_env_blocks, svc->id, num_objects.services);
+	if (blk->valid)
+		return blk;
+
+	memset(&mac, 0, sizeof(mac));
+	mac.service_ptr = svc;
+	env_block_add_macrox(blk, &mac, service_env_macros);
+	env_block_add_customvars(blk, "_SERVICE", svc->custom_variables);
+	clear_volatile_macros_r(&mac);
+	blk->valid = TRUE;
+
+	return blk;
+}
+
+static struct macro_env_block *get_constant_env_block(void)
+{
+	int i;
+
+	if (constant_env_block.valid)
+		return &constant_env_block;
+
+	for (i = 0; constant_env_macros[i] >= 0; i++) {
+		int x = constant_env_macros[i];
+		env_block_add(&constant_env_block, env_var_string(macro_x_names[x], global_macros.x[x]));
+	}
+	constant_env_block.valid = TRUE;
+
+	return &constant_env_block;
+}
+
+static void add_env_block_to_kvvec(struct macro_env_block *blk, struct kvvec *kvv)
+{
+	unsigned int i;
+
+	for (i = 0; i < blk->count; i++)
+		kvvec_addkv(kvv, "env", nm_strdup(blk->vars[i]));
+}
+
+/*
+ * adds all environment macros for the objects in 'mac' to 'kvv' as
+ * "env" key/value pairs. The values are allocated, so the caller
+ * must destroy 'kvv' with KVVEC_FREE_VALUES
+ */
+int add_macro_environment_vars_to_kvvec_r(nagios_macros *mac, struct kvvec *kvv)
+{
+	struct macro_env_block volatile_block = { 0, 0, NULL };
+	char *value, *name = NULL;
+	int x, free_macro;
+
+	if (enable_environment_macros == FALSE || mac == NULL || kvv == NULL)
+		return ERROR;
+
+	add_env_block_to_kvvec(get_constant_env_block(), kvv);
+	if (mac->host_ptr)
+		add_env_block_to_kvvec(get_host_env_block(mac->host_ptr), kvv);
+	if (mac->service_ptr)
+		add_env_block_to_kvvec(get_service_env_block(mac->service_ptr), kvv);
+
+	/* everything else may change between two runs, so we generate it */
+	for (x = 0; x < MACRO_X_COUNT; x++) {
+		if (is_cached_env_macro(x))
+			continue;
+
+		if (use_large_installation_tweaks == TRUE) {
+			if (x == MACRO_SERVICEGROUPMEMBERS || x == MACRO_HOSTGROUPMEMBERS)
+				continue;
+			if (x >= MACRO_TOTALHOSTSUP && x <= MACRO_TOTALSERVICEPROBLEMSUNHANDLED)
+				continue;
+		}
+
+		value = NULL;
+		free_macro = FALSE;
+		if (mac->x[x] != NULL)
+			value = mac->x[x];
+		else if (grab_macrox_value_r(mac, x, NULL, NULL, &value, &free_macro) != OK)
+			continue;
+		kvvec_addkv(kvv, "env", env_var_string(macro_x_names[x], value));
+		if (free_macro == TRUE)
+			my_free(value);
+	}
+
+	for (x = 0; x < MAX_COMMAND_ARGUMENTS; x++) {
+		if (mac->argv[x] == NULL)
+			continue;
+		nm_asprintf(&name, "ARG%d", x + 1);
+		kvvec_addkv(kvv, "env", env_var_string(name, mac->argv[x]));
+		my_free(name);
+	}
+
+	/* contact macros only get set during notifications */
+	if (mac->contact_ptr) {
+		for (x = 0; x < MAX_CONTACT_ADDRESSES; x++) {
+			nm_asprintf(&name, "CONTACTADDRESS%d", x);
+			kvvec_addkv(kvv, "env", env_var_string(name, mac->contact_ptr->address[x]));
+			my_free(name);
+		}
+		env_block_add_customvars(&volatile_block, "_CONTACT", mac->contact_ptr->custom_variables);
+		add_env_block_to_kvvec(&volatile_block, kvv);
+		env_block_clear(&volatile_block);
+	}
+
+	return OK;
+}
+
+/* invalidates a host's cached environment block */
+void invalidate_host_macro_environment(host *hst)
+{
+	if (hst && hst->id < num_host_env_blocks)
+		env_block_clear(&host_env_blocks[hst->id]);
+}
+
+/* invalidates a service's cached environment block */
+void invalidate_service_macro_environment(service *svc)
+{
+	if (svc && svc->id < num_service_env_blocks)
+		env_block_clear(&service_env_blocks[svc->id]);
+}
+
+/* frees all cached environment blocks */
+void free_macro_environment_blocks(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_host_env_blocks; i++)
+		env_block_clear(&host_env_blocks[i]);
+	for (i = 0; i < num_service_env_blocks; i++)
+		env_block_clear(&service_env_blocks[i]);
+	env_block_clear(&constant_env_block);
+	my_free(host_env_blocks);
+	my_free(service_env_blocks);
+	num_host_env_blocks = num_service_env_blocks = 0;
+}
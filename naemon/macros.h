@@ -35,6 +35,7 @@ struct nagios_macros
 	customvariablesmember *custom_host_vars;
 	customvariablesmember *custom_service_vars;
 	customvariablesmember *custom_contact_vars;
+	unsigned char *argv_marks[MAX_COMMAND_ARGUMENTS]; /* see process_macros_marked_r() */
 };
 typedef struct nagios_macros nagios_macros;
 
@@ -216,6 +217,9 @@ int process_macros(char *, char **, int);
 /* thread-safe version of the above */
 int process_macros_r(nagios_macros *mac, char *, char **, int);
 
+/* like the above, but notes which bytes of output came from macro values */
+int process_macros_marked_r(nagios_macros *mac, char *, char **, unsigned char **, int);
+
 /* cleans macros characters before insertion into output string */
 char *clean_macro_chars(char *, int);
 
@@ -305,5 +309,12 @@ int set_argv_macro_environment_vars_r(nagios_macros *mac, int);
 int set_custom_macro_environment_vars_r(nagios_macros *mac, int);
 int set_contact_address_environment_vars_r(nagios_macros *mac, int);
 
+/* environment macros for worker jobs */
+struct kvvec;
+int add_macro_environment_vars_to_kvvec_r(nagios_macros *mac, struct kvvec *kvv);
+void invalidate_host_macro_environment(host *hst);
+void invalidate_service_macro_environment(service *svc);
+void free_macro_environment_blocks(void);
+
 NAGIOS_END_DECL
 #endif
@@ -22,7 +22,13 @@
 #include "globals.h"
 #include "logging.h"
 #include "nm_alloc.h"
+#include "simulation.h"
+#include "submit.h"
+#include "resultq.h"
+#include "checks.h"
+#include "snapshot.h"
 #include <getopt.h>
+#include <limits.h>
 #include <string.h>
 
 static int is_worker;
@@ -118,13 +124,18 @@ static int test_path_access(const char *program, int mode)
 	return ret;
 }
 
-static int nagios_core_worker(const char *path)
+static int nagios_core_worker(const char *path, const char *batch)
 {
 	int sd, ret;
 	char response[128];
+	unsigned int usec, max_results;
 
 	is_worker = 1;
 
+	/* "<usec>,<max_results>", as handed to us by the master */
+	if (batch && sscanf(batch, "%u,%u", &usec, &max_results) == 2)
+		worker_set_result_batching(usec, max_results);
+
 	set_loadctl_defaults();
 
 	sd = nsock_unix(path, NSOCK_TCP | NSOCK_CONNECT);
@@ -134,13 +145,14 @@ static int nagios_core_worker(const char *path)
 		return 1;
 	}
 
-	ret = nsock_printf_nul(sd, "@wproc register name=Core Worker %d;pid=%d", getpid(), getpid());
+	ret = nsock_printf_nul(sd, "@wproc register name=Core Worker %d;pid=%d;shm=1", getpid(), getpid());
 	if (ret < 0) {
 		printf("Failed to register as worker.\n");
 		return 1;
 	}
 
-	ret = read(sd, response, 3);
+	/* the master may hand us shared memory rings along with the response */
+	ret = worker_read_registration(sd, response, 3);
 	if (ret != 3) {
 		printf("Failed to read response from wproc manager\n");
 		return 1;
@@ -199,7 +211,7 @@ int main(int argc, char **argv)
 	time_t now;
 	char datestring[256];
 	nagios_macros *mac;
-	const char *worker_socket = NULL;
+	const char *worker_socket = NULL, *worker_batch = NULL, *simulation_model = NULL;
 	int i;
 
 #ifdef HAVE_GETOPT_H
@@ -215,6 +227,8 @@ int main(int argc, char **argv)
 		{"use-precached-objects", no_argument, 0, 'u'},
 		{"enable-timing-point", no_argument, 0, 'T'},
 		{"worker", required_argument, 0, 'W'},
+		{"worker-batch", required_argument, 0, 'B'},
+		{"simulate", required_argument, 0, 'S'},
 		{0, 0, 0, 0}
 	};
 #define getopt(argc, argv, o) getopt_long(argc, argv, o, long_options, &option_index)
@@ -229,7 +243,7 @@ int main(int argc, char **argv)
 
 	/* get all command line arguments */
 	while (1) {
-		c = getopt(argc, argv, "+hVvdspuxTW");
+		c = getopt(argc, argv, "+hVvdspuxTW:B:S:");
 
 		if (c == -1 || c == EOF)
 			break;
@@ -270,6 +284,13 @@ int main(int argc, char **argv)
 		case 'W':
 			worker_socket = optarg;
 			break;
+		case 'B':
+			worker_batch = optarg;
+			break;
+		case 'S':
+			simulation_model = optarg;
+			daemon_mode = FALSE;
+			break;
 
 		case 'x':
 			printf("Warning: -x is deprecated and will be removed\n");
@@ -283,7 +304,7 @@ int main(int argc, char **argv)
 
 	/* if we're a worker we can skip everything below */
 	if (worker_socket) {
-		exit(nagios_core_worker(worker_socket));
+		exit(nagios_core_worker(worker_socket, worker_batch));
 	}
 
 	if (daemon_mode == FALSE) {
@@ -333,6 +354,11 @@ int main(int argc, char **argv)
 		printf("  -u, --use-precached-objects  Use precached object config file\n");
 		printf("  -d, --daemon                 Starts Naemon in daemon mode, instead of as a foreground process\n");
 		printf("  -W, --worker /path/to/socket Act as a worker for an already running daemon\n");
+		printf("  -B, --worker-batch usec,num  Let a worker send up to num check results at a time,\n");
+		printf("                               holding each back for at most usec microseconds\n");
+		printf("  -S, --simulate /path/to/model\n");
+		printf("                               Run against a virtual clock, with check results made up\n");
+		printf("                               by the given model instead of by running plugins\n");
 		printf("\n");
 		printf("Visit the Naemon website at http://www.naemon.org/ for bug fixes, new\n");
 		printf("releases, online documentation, FAQs and more...\n");
@@ -519,6 +545,12 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	/* modules may start submitting results as soon as they're loaded */
+	if (submit_init() != OK)
+		exit(EXIT_FAILURE);
+	if (resultq_init() != OK)
+		exit(EXIT_FAILURE);
+
 	/* keep monitoring things until we get a shutdown command */
 	do {
 		/* reset internal book-keeping (in case we're restarting) */
@@ -541,9 +573,15 @@ int main(int argc, char **argv)
 		}
 		timing_point("Main config file read\n");
 
+		/* the virtual clock has to be running before anything looks at it */
+		if (simulation_model && !simulation_mode && sim_init(simulation_model) != OK) {
+			logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Failed to read simulation model '%s'. Aborting\n", simulation_model);
+			exit(EXIT_FAILURE);
+		}
+
 		/* NOTE 11/06/07 EG moved to after we read config files, as user may have overridden timezone offset */
 		/* get program (re)start time and save as macro */
-		program_start = time(NULL);
+		program_start = sim_time(NULL);
 		my_free(mac->x[MACRO_PROCESSSTARTTIME]);
 		nm_asprintf(&mac->x[MACRO_PROCESSSTARTTIME], "%lu", (unsigned long)program_start);
 
@@ -612,26 +650,28 @@ int main(int argc, char **argv)
 		 * This must be done before modules are initialized, so
 		 * the modules can use our in-core stuff properly
 		 */
-		if (qh_init(qh_socket_path ? qh_socket_path : DEFAULT_QUERY_SOCKET) != OK) {
-			logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to initialize query handler. Aborting\n");
-			exit(EXIT_FAILURE);
-		}
-		timing_point("Query handler initialized\n");
-		nerd_init();
-		timing_point("NERD initialized\n");
+		if (!simulation_mode) {
+			if (qh_init(qh_socket_path ? qh_socket_path : DEFAULT_QUERY_SOCKET) != OK) {
+				logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to initialize query handler. Aborting\n");
+				exit(EXIT_FAILURE);
+			}
+			timing_point("Query handler initialized\n");
+			nerd_init();
+			timing_point("NERD initialized\n");
 
-		/* initialize check workers */
-		if (init_workers(num_check_workers) < 0) {
-			logit(NSLOG_RUNTIME_ERROR, TRUE, "Failed to spawn workers. Aborting\n");
-			exit(EXIT_FAILURE);
-		}
-		timing_point("%u workers spawned\n", wproc_num_workers_spawned);
-		i = 0;
-		while (i < 50 && wproc_num_workers_online < wproc_num_workers_spawned) {
-			iobroker_poll(nagios_iobs, 50);
-			i++;
+			/* initialize check workers */
+			if (init_workers(num_check_workers) < 0) {
+				logit(NSLOG_RUNTIME_ERROR, TRUE, "Failed to spawn workers. Aborting\n");
+				exit(EXIT_FAILURE);
+			}
+			timing_point("%u workers spawned\n", wproc_num_workers_spawned);
+			i = 0;
+			while (i < 50 && wproc_num_workers_online < wproc_num_workers_spawned) {
+				iobroker_poll(nagios_iobs, 50);
+				i++;
+			}
+			timing_point("%u workers connected\n", wproc_num_workers_online);
 		}
-		timing_point("%u workers connected\n", wproc_num_workers_online);
 
 		/* now that workers have arrived we can set the defaults */
 		set_loadctl_defaults();
@@ -737,6 +777,10 @@ int main(int argc, char **argv)
 		init_check_stats();
 		timing_point("check stats initialized\n");
 
+		/* publish status in shared memory, replacing any segment from before a restart */
+		initialize_status_shm();
+		timing_point("Status shared memory initialized\n");
+
 		/* update all status data (with retained information) */
 		update_all_status_data();
 		timing_point("Status data updated\n");
@@ -752,8 +796,10 @@ int main(int argc, char **argv)
 		registered_commands_init(200);
 		register_core_commands();
 		/* fire up command file worker */
-		launch_command_file_worker();
-		timing_point("Command file worker launched\n");
+		if (!simulation_mode) {
+			launch_command_file_worker();
+			timing_point("Command file worker launched\n");
+		}
 
 #ifdef USE_EVENT_BROKER
 		/* send program data to broker */
@@ -761,20 +807,31 @@ int main(int argc, char **argv)
 #endif
 
 		/* get event start time and save as macro */
-		event_start = time(NULL);
+		event_start = sim_time(NULL);
 		my_free(mac->x[MACRO_EVENTSTARTTIME]);
 		nm_asprintf(&mac->x[MACRO_EVENTSTARTTIME], "%lu", (unsigned long)event_start);
 
+		/* objects are all there now, so query handler threads may read them */
+		if (!simulation_mode && snapshot_init() == OK)
+			qh_start_threads();
+
 		timing_point("Entering event execution loop\n");
 		/***** start monitoring all services *****/
 		/* (doesn't return until a restart or shutdown signal is encountered) */
 		event_execution_loop();
 
-		/*
-		 * immediately deinitialize the query handler so it
-		 * can remove modules that have stashed data with it
-		 */
-		qh_deinit(qh_socket_path ? qh_socket_path : DEFAULT_QUERY_SOCKET);
+		/* a simulation ends with a report on how it went */
+		if (simulation_mode) {
+			sim_report(stdout);
+			sim_cleanup();
+		} else {
+			/*
+			 * immediately deinitialize the query handler so it
+			 * can remove modules that have stashed data with it
+			 */
+			qh_deinit(qh_socket_path ? qh_socket_path : DEFAULT_QUERY_SOCKET);
+			snapshot_deinit();
+		}
 
 		/* 03/01/2007 EG Moved from sighandler() to prevent FUTEX locking problems under NPTL */
 		/* 03/21/2007 EG SIGSEGV signals are still logged in sighandler() so we don't loose them */
@@ -797,6 +854,13 @@ int main(int argc, char **argv)
 
 		disconnect_command_file_worker();
 
+		/* results that were queued but not processed yet belong in retention data too */
+		while (resultq_drain(UINT_MAX))
+			;
+
+		/* the latest of any passive results held back should make it into retention data */
+		flush_coalesced_passive_results();
+
 		/* save service and host state information */
 		save_state_information(FALSE);
 		cleanup_retention_data();
@@ -814,8 +878,14 @@ int main(int argc, char **argv)
 
 		registered_commands_deinit();
 		free_worker_memory(WPROC_FORCE);
+		/* anything queued since is counted per object, and the objects are about to go */
+		resultq_discard();
+		discard_deferred_checks();
+		discard_check_placement();
 		/* shutdown stuff... */
 		if (sigshutdown == TRUE) {
+			submit_deinit();
+			resultq_deinit();
 			iobroker_destroy(nagios_iobs, IOBROKER_CLOSE_SOCKETS);
 			nagios_iobs = NULL;
 
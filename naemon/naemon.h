@@ -37,6 +37,8 @@
 #include "shared.h"
 #include "sretention.h"
 #include "statusdata.h"
+#include "submit.h"
+#include "snapshot.h"
 #include "utils.h"
 #include "workers.h"
 
@@ -40,11 +40,78 @@
 
 #define nebcallback_flag(x) (1 << (x))
 
+/***** CALLBACK FILTERS *****/
+
+/*
+ * A callback registered with a filter is only called for the events
+ * that pass it, and if no callback wants an event, the core doesn't
+ * even build its nebstruct. Leave a field zeroed to not filter on it.
+ *
+ * subtypes is a mask of neb_subtype_flag(NEBTYPE_*)s. The rest only
+ * applies to events about a host or a service, and looks at that
+ * object as it is when the event happens. A host event passes the
+ * hosts bitmap if the host's id is set in it, and a service event if
+ * its host's id is. Service events must also pass the services bitmap
+ * by id, while host events ignore it. The bitmaps belong to the module
+ * and may be changed at any time, but must outlive the callback.
+ */
+#define NEBFILTER_HARD_STATES    (1 << 0)  /* only objects in a hard state */
+#define NEBFILTER_STATE_CHANGES  (1 << 1)  /* only objects whose last check changed their state */
+
+#define neb_subtype_flag(nebtype) (1ULL << ((nebtype) % 100))
+
+struct bitmap;
+typedef struct neb_cb_filter {
+	unsigned long long subtypes;
+	int flags;
+	struct bitmap *hosts;
+	struct bitmap *services;
+} neb_cb_filter;
+
+
+/***** BATCHED CALLBACKS *****/
+
+/*
+ * Modules that forward events somewhere can have them delivered in
+ * batches instead, as an array of compact records. Events are added
+ * to a buffer per module and batch function, which is handed over
+ * once per pass through the event loop, when it holds max_events
+ * events, and before the module is unloaded. A batch function may be
+ * registered for any number of callback types, with or without a
+ * filter, next to ordinary callbacks. Its return value is ignored.
+ *
+ * Records only point at the host and service, which stay valid until
+ * the batch function returns, and don't carry the event's nebstruct.
+ * The state fields are copied from the object when the event happened,
+ * as it may have changed again by the time the batch is delivered.
+ */
+#define NEB_BATCH_DEFAULT_SIZE 1024
+
+struct host;
+struct service;
+typedef struct neb_batch_event {
+	int callback_type;          /* NEBCALLBACK_* */
+	int type;                   /* NEBTYPE_* */
+	int flags;
+	int attr;
+	struct timeval timestamp;
+	struct host *hst;           /* the host, or the service's host */
+	struct service *svc;
+	int state;
+	int last_state;
+	int state_type;
+} neb_batch_event;
+
+typedef int (*neb_batch_func)(const neb_batch_event *events, unsigned int count);
+
 /***** CALLBACK FUNCTIONS *****/
 NAGIOS_BEGIN_DECL
 
 int neb_register_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *));
+int neb_register_callback_filtered(int callback_type, void *mod_handle, int priority, const neb_cb_filter *filter, int (*callback_func)(int, void *));
 int neb_deregister_callback(int callback_type, int (*callback_func)(int, void *));
+int neb_register_batch_callback(int callback_type, void *mod_handle, int priority, const neb_cb_filter *filter, unsigned int max_events, neb_batch_func batch_func);
+int neb_deregister_batch_callback(int callback_type, neb_batch_func batch_func);
 int neb_deregister_module_callbacks(nebmodule *);
 
 NAGIOS_END_DECL
@@ -0,0 +1,892 @@
+#include "config.h"
+#include "common.h"
+#include "nebhost.h"
+#include "nebmods.h"
+#include "nebstructs.h"
+#include "neberrors.h"
+#include "broker.h"
+#include "objects.h"
+#include "checks.h"
+#include "commands.h"
+#include "utils.h"
+#include "logging.h"
+#include "globals.h"
+#include "nm_alloc.h"
+#include "lib/shmring.h"
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#ifdef USE_EVENT_BROKER
+
+#define NEBHOST_EVENT_RING_SIZE (4 * 1024 * 1024)
+#define NEBHOST_RESULT_RING_SIZE (1024 * 1024)
+#define NEBHOST_INIT_TIMEOUT 30 /* seconds a module gets to initialize */
+#define NEBHOST_STOP_TIMEOUT 5  /* seconds a module gets to deinitialize */
+
+/* what a module host sends back */
+#define NEBHOST_RESULT_COMMAND 'C'
+#define NEBHOST_RESULT_CHECK   'R'
+
+struct nebhost {
+	nebmodule *mod;
+	pid_t pid;
+	int sd;                   /* control socket, EOF means the other end is gone */
+	unsigned int callbacks;   /* nebcallback_flag()s the module registered for */
+	shmring *events;          /* core -> module host */
+	shmring *results;         /* module host -> core */
+	unsigned long sent, dropped;
+	struct nebhost *next;
+};
+
+static struct nebhost *nebhosts;
+static nebmodule nebhost_mod; /* owns the proxy callbacks */
+static unsigned int proxy_refs[NEBCALLBACK_NUMITEMS];
+
+/* results must outlive processing, as objects keep their source */
+static const char *nebhost_source = "Isolated broker module";
+
+int nebhost_child = FALSE;
+static struct nebhost *child_host;
+static pthread_mutex_t child_submit_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *child_data;
+static int child_stop, child_reason = NEBMODULE_NEB_SHUTDOWN;
+
+
+/*
+ * Event structs are copied as they are, followed by the strings they
+ * point to. Object pointers are sent as object ids, and whatever else
+ * they point to is only meaningful in the core, so it's cleared.
+ */
+#define NEBHOST_OBJ_NONE    0
+#define NEBHOST_OBJ_HOST    1
+#define NEBHOST_OBJ_SERVICE 2
+#define NEBHOST_OBJ_EITHER  3 /* a service if there's a service_description */
+#define NEBHOST_OBJ_CONTACT 4
+
+#define NEBHOST_MAX_STRINGS 8
+
+struct nebhost_layout {
+	size_t size;         /* 0 if the event can't be forwarded */
+	int object;          /* what object_ptr points to */
+	size_t object_ptr, contact_ptr, svc_desc;
+	size_t strings[NEBHOST_MAX_STRINGS + 1]; /* 0-terminated, as 'type' is first */
+	size_t pointers[2];
+};
+
+#define L(t) .size = sizeof(t)
+#define OBJ(t, kind) .object = kind, .object_ptr = offsetof(t, object_ptr)
+#define EITHER(t) OBJ(t, NEBHOST_OBJ_EITHER), .svc_desc = offsetof(t, service_description)
+#define S(t, f) offsetof(t, f)
+
+static const struct nebhost_layout layouts[NEBCALLBACK_NUMITEMS] = {
+	[NEBCALLBACK_PROCESS_DATA] = { L(nebstruct_process_data) },
+	[NEBCALLBACK_TIMED_EVENT_DATA] = {
+		L(nebstruct_timed_event_data),
+		.pointers = { S(nebstruct_timed_event_data, event_data), S(nebstruct_timed_event_data, event_ptr) },
+	},
+	[NEBCALLBACK_LOG_DATA] = {
+		L(nebstruct_log_data),
+		.strings = { S(nebstruct_log_data, data) },
+	},
+	[NEBCALLBACK_SYSTEM_COMMAND_DATA] = {
+		L(nebstruct_system_command_data),
+		.strings = { S(nebstruct_system_command_data, command_line), S(nebstruct_system_command_data, output) },
+	},
+	[NEBCALLBACK_EVENT_HANDLER_DATA] = {
+		L(nebstruct_event_handler_data), EITHER(nebstruct_event_handler_data),
+		.strings = {
+			S(nebstruct_event_handler_data, host_name), S(nebstruct_event_handler_data, service_description),
+			S(nebstruct_event_handler_data, command_name), S(nebstruct_event_handler_data, command_args),
+			S(nebstruct_event_handler_data, command_line), S(nebstruct_event_handler_data, output),
+		},
+	},
+	[NEBCALLBACK_NOTIFICATION_DATA] = {
+		L(nebstruct_notification_data), EITHER(nebstruct_notification_data),
+		.strings = {
+			S(nebstruct_notification_data, host_name), S(nebstruct_notification_data, service_description),
+			S(nebstruct_notification_data, output), S(nebstruct_notification_data, ack_author),
+			S(nebstruct_notification_data, ack_data),
+		},
+	},
+	[NEBCALLBACK_SERVICE_CHECK_DATA] = {
+		L(nebstruct_service_check_data), OBJ(nebstruct_service_check_data, NEBHOST_OBJ_SERVICE),
+		.strings = {
+			S(nebstruct_service_check_data, host_name), S(nebstruct_service_check_data, service_description),
+			S(nebstruct_service_check_data, command_name), S(nebstruct_service_check_data, command_args),
+			S(nebstruct_service_check_data, command_line), S(nebstruct_service_check_data, output),
+			S(nebstruct_service_check_data, long_output), S(nebstruct_service_check_data, perf_data),
+		},
+		.pointers = { S(nebstruct_service_check_data, check_result_ptr) },
+	},
+	[NEBCALLBACK_HOST_CHECK_DATA] = {
+		L(nebstruct_host_check_data), OBJ(nebstruct_host_check_data, NEBHOST_OBJ_HOST),
+		.strings = {
+			S(nebstruct_host_check_data, host_name), S(nebstruct_host_check_data, command_name),
+			S(nebstruct_host_check_data, command_args), S(nebstruct_host_check_data, command_line),
+			S(nebstruct_host_check_data, output), S(nebstruct_host_check_data, long_output),
+			S(nebstruct_host_check_data, perf_data),
+		},
+		.pointers = { S(nebstruct_host_check_data, check_result_ptr) },
+	},
+	[NEBCALLBACK_COMMENT_DATA] = {
+		L(nebstruct_comment_data), EITHER(nebstruct_comment_data),
+		.strings = {
+			S(nebstruct_comment_data, host_name), S(nebstruct_comment_data, service_description),
+			S(nebstruct_comment_data, author_name), S(nebstruct_comment_data, comment_data),
+		},
+	},
+	[NEBCALLBACK_DOWNTIME_DATA] = {
+		L(nebstruct_downtime_data), EITHER(nebstruct_downtime_data),
+		.strings = {
+			S(nebstruct_downtime_data, host_name), S(nebstruct_downtime_data, service_description),
+			S(nebstruct_downtime_data, author_name), S(nebstruct_downtime_data, comment_data),
+		},
+	},
+	[NEBCALLBACK_FLAPPING_DATA] = {
+		L(nebstruct_flapping_data), EITHER(nebstruct_flapping_data),
+		.strings = { S(nebstruct_flapping_data, host_name), S(nebstruct_flapping_data, service_description) },
+	},
+	[NEBCALLBACK_PROGRAM_STATUS_DATA] = {
+		L(nebstruct_program_status_data),
+		.strings = {
+			S(nebstruct_program_status_data, global_host_event_handler),
+			S(nebstruct_program_status_data, global_service_event_handler),
+		},
+	},
+	[NEBCALLBACK_HOST_STATUS_DATA] = {
+		L(nebstruct_host_status_data), OBJ(nebstruct_host_status_data, NEBHOST_OBJ_HOST),
+	},
+	[NEBCALLBACK_SERVICE_STATUS_DATA] = {
+		L(nebstruct_service_status_data), OBJ(nebstruct_service_status_data, NEBHOST_OBJ_SERVICE),
+	},
+	[NEBCALLBACK_ADAPTIVE_PROGRAM_DATA] = { L(nebstruct_adaptive_program_data) },
+	[NEBCALLBACK_ADAPTIVE_HOST_DATA] = {
+		L(nebstruct_adaptive_host_data), OBJ(nebstruct_adaptive_host_data, NEBHOST_OBJ_HOST),
+	},
+	[NEBCALLBACK_ADAPTIVE_SERVICE_DATA] = {
+		L(nebstruct_adaptive_service_data), OBJ(nebstruct_adaptive_service_data, NEBHOST_OBJ_SERVICE),
+	},
+	[NEBCALLBACK_EXTERNAL_COMMAND_DATA] = {
+		L(nebstruct_external_command_data),
+		.strings = { S(nebstruct_external_command_data, command_string), S(nebstruct_external_command_data, command_args) },
+	},
+	[NEBCALLBACK_AGGREGATED_STATUS_DATA] = { L(nebstruct_aggregated_status_data) },
+	[NEBCALLBACK_RETENTION_DATA] = { L(nebstruct_retention_data) },
+	[NEBCALLBACK_CONTACT_NOTIFICATION_DATA] = {
+		L(nebstruct_contact_notification_data), EITHER(nebstruct_contact_notification_data),
+		.contact_ptr = S(nebstruct_contact_notification_data, contact_ptr),
+		.strings = {
+			S(nebstruct_contact_notification_data, host_name), S(nebstruct_contact_notification_data, service_description),
+			S(nebstruct_contact_notification_data, contact_name), S(nebstruct_contact_notification_data, output),
+			S(nebstruct_contact_notification_data, ack_author), S(nebstruct_contact_notification_data, ack_data),
+		},
+	},
+	[NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA] = {
+		L(nebstruct_contact_notification_method_data), EITHER(nebstruct_contact_notification_method_data),
+		.contact_ptr = S(nebstruct_contact_notification_method_data, contact_ptr),
+		.strings = {
+			S(nebstruct_contact_notification_method_data, host_name),
+			S(nebstruct_contact_notification_method_data, service_description),
+			S(nebstruct_contact_notification_method_data, contact_name),
+			S(nebstruct_contact_notification_method_data, command_name),
+			S(nebstruct_contact_notification_method_data, command_args),
+			S(nebstruct_contact_notification_method_data, output),
+			S(nebstruct_contact_notification_method_data, ack_author),
+			S(nebstruct_contact_notification_method_data, ack_data),
+		},
+	},
+	[NEBCALLBACK_ACKNOWLEDGEMENT_DATA] = {
+		L(nebstruct_acknowledgement_data), EITHER(nebstruct_acknowledgement_data),
+		.strings = {
+			S(nebstruct_acknowledgement_data, host_name), S(nebstruct_acknowledgement_data, service_description),
+			S(nebstruct_acknowledgement_data, author_name), S(nebstruct_acknowledgement_data, comment_data),
+		},
+	},
+	[NEBCALLBACK_STATE_CHANGE_DATA] = {
+		L(nebstruct_statechange_data), EITHER(nebstruct_statechange_data),
+		.strings = {
+			S(nebstruct_statechange_data, host_name), S(nebstruct_statechange_data, service_description),
+			S(nebstruct_statechange_data, output),
+		},
+	},
+	[NEBCALLBACK_CONTACT_STATUS_DATA] = {
+		L(nebstruct_contact_status_data), OBJ(nebstruct_contact_status_data, NEBHOST_OBJ_CONTACT),
+	},
+	[NEBCALLBACK_ADAPTIVE_CONTACT_DATA] = {
+		L(nebstruct_adaptive_contact_data), OBJ(nebstruct_adaptive_contact_data, NEBHOST_OBJ_CONTACT),
+	},
+};
+
+#undef L
+#undef OBJ
+#undef EITHER
+#undef S
+
+#define FIELD(data, offset, type) (*(type *)((char *)(data) + (offset)))
+
+/* the state of the host or service an event is about */
+struct nebhost_state {
+	int current_state, last_state, last_hard_state, state_type;
+	int current_attempt, has_been_checked, is_flapping;
+	int problem_has_been_acknowledged, scheduled_downtime_depth;
+	time_t last_check, next_check, last_state_change, last_hard_state_change;
+	double latency, execution_time, percent_state_change;
+};
+
+#define NEBHOST_COPY_STATE(dst, src) do { \
+		(dst)->current_state = (src)->current_state; \
+		(dst)->last_state = (src)->last_state; \
+		(dst)->last_hard_state = (src)->last_hard_state; \
+		(dst)->state_type = (src)->state_type; \
+		(dst)->current_attempt = (src)->current_attempt; \
+		(dst)->has_been_checked = (src)->has_been_checked; \
+		(dst)->is_flapping = (src)->is_flapping; \
+		(dst)->problem_has_been_acknowledged = (src)->problem_has_been_acknowledged; \
+		(dst)->scheduled_downtime_depth = (src)->scheduled_downtime_depth; \
+		(dst)->last_check = (src)->last_check; \
+		(dst)->next_check = (src)->next_check; \
+		(dst)->last_state_change = (src)->last_state_change; \
+		(dst)->last_hard_state_change = (src)->last_hard_state_change; \
+		(dst)->latency = (src)->latency; \
+		(dst)->execution_time = (src)->execution_time; \
+		(dst)->percent_state_change = (src)->percent_state_change; \
+	} while (0)
+
+/*
+ * An event record is this header, the event struct, its strings and,
+ * for hosts and services, a nebhost_state and the object's output,
+ * long output and performance data.
+ */
+struct nebhost_event {
+	int callback_type;
+	int object_type;          /* NEBHOST_OBJ_* */
+	unsigned int object_id;
+	int contact_id;           /* -1 for none */
+};
+
+static struct {
+	char *buf;
+	unsigned int len, size;
+} enc;
+
+static void enc_add(const void *data, unsigned int len)
+{
+	if (enc.len + len > enc.size) {
+		enc.size = (enc.len + len) * 2;
+		enc.buf = nm_realloc(enc.buf, enc.size);
+	}
+	memcpy(enc.buf + enc.len, data, len);
+	enc.len += len;
+}
+
+/* strings are sent as their length + 1, with 0 meaning NULL */
+static void enc_add_str(const char *str)
+{
+	unsigned int len = str ? strlen(str) + 1 : 0;
+
+	enc_add(&len, sizeof(len));
+	if (len)
+		enc_add(str, len);
+}
+
+static char *dec_str(char **p, char *end)
+{
+	unsigned int len;
+	char *str;
+
+	if (*p + sizeof(len) > end)
+		return NULL;
+	memcpy(&len, *p, sizeof(len));
+	*p += sizeof(len);
+	if (!len || len > (unsigned int)(end - *p))
+		return NULL;
+	str = *p;
+	str[len - 1] = 0;
+	*p += len;
+	return str;
+}
+
+static void nebhost_set_str(char **dst, const char *src)
+{
+	if (*dst && src && !strcmp(*dst, src))
+		return;
+	my_free(*dst);
+	*dst = src ? nm_strdup(src) : NULL;
+}
+
+
+/*
+ * Runs in the core. Isolated modules see events after the core is
+ * done with them, so they can't cancel or override anything, and we
+ * never wait for them.
+ */
+static int nebhost_proxy(int callback_type, void *data)
+{
+	const struct nebhost_layout *l;
+	struct nebhost_event ev = { callback_type, NEBHOST_OBJ_NONE, 0, -1 };
+	struct nebhost_state state;
+	struct nebhost *nh;
+	host *hst = NULL;
+	service *svc = NULL;
+	contact *cntct;
+	void *obj = NULL;
+	int i;
+
+	if (!data || callback_type < 0 || callback_type >= NEBCALLBACK_NUMITEMS)
+		return 0;
+	l = &layouts[callback_type];
+	if (!l->size)
+		return 0;
+
+	if (l->object)
+		obj = FIELD(data, l->object_ptr, void *);
+	if (obj) {
+		ev.object_type = l->object;
+		if (l->object == NEBHOST_OBJ_EITHER)
+			ev.object_type = FIELD(data, l->svc_desc, char *) ? NEBHOST_OBJ_SERVICE : NEBHOST_OBJ_HOST;
+		if (ev.object_type == NEBHOST_OBJ_SERVICE) {
+			svc = obj;
+			ev.object_id = svc->id;
+		} else if (ev.object_type == NEBHOST_OBJ_HOST) {
+			hst = obj;
+			ev.object_id = hst->id;
+		} else {
+			ev.object_id = ((contact *)obj)->id;
+		}
+	}
+	if (l->contact_ptr && (cntct = FIELD(data, l->contact_ptr, contact *)))
+		ev.contact_id = cntct->id;
+
+	enc.len = 0;
+	enc_add(&ev, sizeof(ev));
+	enc_add(data, l->size);
+	for (i = 0; l->strings[i]; i++)
+		enc_add_str(FIELD(data, l->strings[i], char *));
+	if (svc) {
+		NEBHOST_COPY_STATE(&state, svc);
+		enc_add(&state, sizeof(state));
+		enc_add_str(svc->plugin_output);
+		enc_add_str(svc->long_plugin_output);
+		enc_add_str(svc->perf_data);
+	} else if (hst) {
+		NEBHOST_COPY_STATE(&state, hst);
+		enc_add(&state, sizeof(state));
+		enc_add_str(hst->plugin_output);
+		enc_add_str(hst->long_plugin_output);
+		enc_add_str(hst->perf_data);
+	}
+
+	for (nh = nebhosts; nh; nh = nh->next) {
+		if (!(nh->callbacks & nebcallback_flag(callback_type)))
+			continue;
+		if (shmring_write(nh->events, enc.buf, enc.len) < 0) {
+			if (!nh->dropped++)
+				logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Isolated broker module '%s' isn't keeping up. Dropping events until it does.\n", nh->mod->filename);
+			continue;
+		}
+		nh->sent++;
+	}
+
+	return 0;
+}
+
+static void nebhost_add_proxies(unsigned int callbacks)
+{
+	int i;
+
+	if (!nebhost_mod.is_currently_loaded) {
+		nebhost_mod.filename = (char *)"module host"; /* something to log */
+		neb_add_core_module(&nebhost_mod);
+	}
+	for (i = 0; i < NEBCALLBACK_NUMITEMS; i++) {
+		if ((callbacks & nebcallback_flag(i)) && !proxy_refs[i]++)
+			neb_register_callback(i, &nebhost_mod, 0, nebhost_proxy);
+	}
+}
+
+static void nebhost_remove_proxies(unsigned int callbacks)
+{
+	int i;
+
+	for (i = 0; i < NEBCALLBACK_NUMITEMS; i++) {
+		if ((callbacks & nebcallback_flag(i)) && !--proxy_refs[i])
+			neb_deregister_callback(i, nebhost_proxy);
+	}
+}
+
+
+static void nebhost_handle_result(char *rec, unsigned int len)
+{
+	char *p = rec + 1, *end = rec + len;
+	check_result cr;
+
+	if (*rec == NEBHOST_RESULT_COMMAND) {
+		if (len > 1 && !rec[len - 1])
+			process_external_command1(p);
+		return;
+	}
+	if (*rec != NEBHOST_RESULT_CHECK || len < 1 + sizeof(cr))
+		return;
+
+	memcpy(&cr, p, sizeof(cr));
+	p += sizeof(cr);
+	cr.host_name = dec_str(&p, end);
+	cr.service_description = dec_str(&p, end);
+	cr.output = dec_str(&p, end);
+	cr.output_file = NULL;
+	cr.output_file_fp = NULL;
+	cr.engine = NULL;
+	cr.source = (void *)nebhost_source;
+	if (cr.host_name)
+		process_check_result(&cr);
+}
+
+static void nebhost_drain_results(struct nebhost *nh)
+{
+	unsigned int len;
+	char *rec;
+
+	shmring_ack(nh->results);
+	while ((rec = shmring_peek(nh->results, &len))) {
+		nebhost_handle_result(rec, len);
+		shmring_consume(nh->results);
+	}
+}
+
+static int nebhost_result_input(int fd, int events, void *arg)
+{
+	nebhost_drain_results(arg);
+	return 0;
+}
+
+static void nebhost_destroy(struct nebhost *nh)
+{
+	struct nebhost **prev;
+
+	for (prev = &nebhosts; *prev; prev = &(*prev)->next) {
+		if (*prev == nh) {
+			*prev = nh->next;
+			break;
+		}
+	}
+	if (nh->sd >= 0)
+		close(nh->sd);
+	if (nh->events)
+		shmring_destroy(nh->events);
+	if (nh->results)
+		shmring_destroy(nh->results);
+	free(nh);
+}
+
+/* the module host is gone, or about to be */
+static void nebhost_detach(struct nebhost *nh)
+{
+	if (nagios_iobs) {
+		iobroker_unregister(nagios_iobs, nh->sd);
+		iobroker_unregister(nagios_iobs, shmring_doorbell(nh->results));
+	}
+	nebhost_remove_proxies(nh->callbacks);
+	nh->mod->module_handle = NULL;
+	nh->mod->is_currently_loaded = FALSE;
+}
+
+static int nebhost_control_input(int sd, int events, void *arg)
+{
+	struct nebhost *nh = arg;
+	char buf[64];
+	int status = 0;
+
+	if (read(sd, buf, sizeof(buf)) > 0)
+		return 0;
+
+	/* whatever it managed to submit still counts */
+	nebhost_drain_results(nh);
+	nebhost_detach(nh);
+
+	while (waitpid(nh->pid, &status, 0) < 0 && errno == EINTR)
+		;
+	if (WIFSIGNALED(status))
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Isolated broker module '%s' (pid %d) was killed by signal %d. It won't get any more events.\n",
+		      nh->mod->filename, (int)nh->pid, WTERMSIG(status));
+	else
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Isolated broker module '%s' (pid %d) exited with status %d. It won't get any more events.\n",
+		      nh->mod->filename, (int)nh->pid, WEXITSTATUS(status));
+	log_debug_info(DEBUGL_EVENTBROKER, 0, "Module host for '%s' got %lu events and dropped %lu\n", nh->mod->filename, nh->sent, nh->dropped);
+
+	nebhost_destroy(nh);
+	return 0;
+}
+
+
+/*
+ * Everything below runs in the module host
+ */
+static void nebhost_dispatch(char *rec, unsigned int len)
+{
+	const struct nebhost_layout *l;
+	struct nebhost_event ev;
+	struct nebhost_state state;
+	char *p = rec + sizeof(ev), *end = rec + len;
+	host *hst = NULL;
+	service *svc = NULL;
+	void *obj = NULL;
+	neb_event nev;
+	int i;
+
+	if (len < sizeof(ev))
+		return;
+	memcpy(&ev, rec, sizeof(ev));
+	if (ev.callback_type < 0 || ev.callback_type >= NEBCALLBACK_NUMITEMS)
+		return;
+	l = &layouts[ev.callback_type];
+	if (!l->size || l->size > (size_t)(end - p))
+		return;
+
+	memcpy(child_data, p, l->size);
+	p += l->size;
+	for (i = 0; l->strings[i]; i++)
+		FIELD(child_data, l->strings[i], char *) = dec_str(&p, end);
+	for (i = 0; i < 2 && l->pointers[i]; i++)
+		FIELD(child_data, l->pointers[i], void *) = NULL;
+
+	if (ev.object_type == NEBHOST_OBJ_SERVICE && ev.object_id < num_objects.services)
+		obj = svc = service_ary[ev.object_id];
+	else if (ev.object_type == NEBHOST_OBJ_HOST && ev.object_id < num_objects.hosts)
+		obj = hst = host_ary[ev.object_id];
+	else if (ev.object_type == NEBHOST_OBJ_CONTACT && ev.object_id < num_objects.contacts)
+		obj = contact_ary[ev.object_id];
+	if (l->object)
+		FIELD(child_data, l->object_ptr, void *) = obj;
+	if (l->contact_ptr)
+		FIELD(child_data, l->contact_ptr, void *) =
+		    ev.contact_id >= 0 && (unsigned int)ev.contact_id < num_objects.contacts ? contact_ary[ev.contact_id] : NULL;
+
+	if ((svc || hst) && sizeof(state) <= (size_t)(end - p)) {
+		memcpy(&state, p, sizeof(state));
+		p += sizeof(state);
+		if (svc) {
+			NEBHOST_COPY_STATE(svc, &state);
+			nebhost_set_str(&svc->plugin_output, dec_str(&p, end));
+			nebhost_set_str(&svc->long_plugin_output, dec_str(&p, end));
+			nebhost_set_str(&svc->perf_data, dec_str(&p, end));
+			hst = svc->host_ptr;
+		} else {
+			NEBHOST_COPY_STATE(hst, &state);
+			nebhost_set_str(&hst->plugin_output, dec_str(&p, end));
+			nebhost_set_str(&hst->long_plugin_output, dec_str(&p, end));
+			nebhost_set_str(&hst->perf_data, dec_str(&p, end));
+		}
+	}
+
+	neb_event_init(&nev, *(int *)child_data, hst, svc);
+	neb_make_event_callbacks(ev.callback_type, &nev, child_data);
+}
+
+static int nebhost_child_input(int fd, int events, void *arg)
+{
+	struct nebhost *nh = arg;
+	unsigned int len;
+	char *rec;
+
+	shmring_ack(nh->events);
+	while ((rec = shmring_peek(nh->events, &len))) {
+		nebhost_dispatch(rec, len);
+		shmring_consume(nh->events);
+	}
+	return 0;
+}
+
+static int nebhost_child_control(int sd, int events, void *arg)
+{
+	char buf[64];
+	ssize_t len;
+
+	/* the core says "stop <reason>" before it lets go of us */
+	len = read(sd, buf, sizeof(buf) - 1);
+	if (len > 0) {
+		buf[len] = 0;
+		if (sscanf(buf, "stop %d", &child_reason) != 1)
+			return 0;
+	}
+	iobroker_unregister(nagios_iobs, sd);
+	child_stop = TRUE;
+	return 0;
+}
+
+/* the core's sockets are none of the module's business */
+static void nebhost_close_sockets(int keep)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	if (!(dir = opendir("/proc/self/fd")))
+		return;
+	while ((de = readdir(dir))) {
+		fd = atoi(de->d_name);
+		if (fd > 2 && fd != keep && fd != dirfd(dir) && !fstat(fd, &st) && S_ISSOCK(st.st_mode))
+			close(fd);
+	}
+	closedir(dir);
+}
+
+static void nebhost_child_main(struct nebhost *nh)
+{
+	struct nebhost *other;
+	size_t max_size = 0;
+	char reply[32];
+	int i;
+
+	nebhost_child = TRUE;
+	child_host = nh;
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGSEGV, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+	nebhost_close_sockets(nh->sd);
+	for (other = nebhosts; other; other = other->next) {
+		shmring_destroy(other->events);
+		shmring_destroy(other->results);
+	}
+
+	/* the core's io broker shares its epoll set with the core */
+	if (!(nagios_iobs = iobroker_create()))
+		_exit(1);
+
+	for (i = 0; i < NEBCALLBACK_NUMITEMS; i++) {
+		if (layouts[i].size > max_size)
+			max_size = layouts[i].size;
+	}
+	child_data = nm_malloc(max_size);
+
+	/* nothing but the isolated module gets events in here */
+	neb_free_callback_list();
+	neb_init_callback_list();
+	nh->mod->isolated = FALSE;
+	if (neb_load_module(nh->mod) != OK) {
+		if (write(nh->sd, "error\n", 6) < 0)
+			_exit(1);
+		_exit(1);
+	}
+	for (i = 0; i < NEBCALLBACK_NUMITEMS; i++) {
+		if (neb_has_callbacks(i))
+			nh->callbacks |= nebcallback_flag(i);
+	}
+	snprintf(reply, sizeof(reply), "ok %u\n", nh->callbacks);
+	if (write(nh->sd, reply, strlen(reply)) < 0)
+		_exit(1);
+
+	iobroker_register(nagios_iobs, shmring_doorbell(nh->events), nh, nebhost_child_input);
+	iobroker_register(nagios_iobs, nh->sd, nh, nebhost_child_control);
+	while (!child_stop) {
+		iobroker_poll(nagios_iobs, -1);
+		neb_flush_batches();
+	}
+
+	/* deliver what the core sent before it let go of us */
+	nebhost_child_input(-1, 0, nh);
+	neb_unload_module(nh->mod, NEBMODULE_FORCE_UNLOAD, child_reason);
+	_exit(0);
+}
+
+int nebhost_submit_command(const char *cmd)
+{
+	unsigned int len;
+	char *buf;
+	int ret = ERROR;
+
+	if (!cmd)
+		return ERROR;
+	len = strlen(cmd) + 1;
+
+	pthread_mutex_lock(&child_submit_lock);
+	if ((buf = shmring_reserve(child_host->results, 1 + len))) {
+		*buf = NEBHOST_RESULT_COMMAND;
+		memcpy(buf + 1, cmd, len);
+		if (shmring_commit(child_host->results, 1 + len) == 0)
+			ret = OK;
+	}
+	pthread_mutex_unlock(&child_submit_lock);
+
+	return ret;
+}
+
+int nebhost_submit_check_result(const check_result *cr)
+{
+	char kind = NEBHOST_RESULT_CHECK;
+	int ret;
+
+	pthread_mutex_lock(&child_submit_lock);
+	enc.len = 0;
+	enc_add(&kind, 1);
+	enc_add(cr, sizeof(*cr));
+	enc_add_str(cr->host_name);
+	enc_add_str(cr->service_description);
+	enc_add_str(cr->output);
+	ret = shmring_write(child_host->results, enc.buf, enc.len);
+	pthread_mutex_unlock(&child_submit_lock);
+
+	return ret < 0 ? ERROR : OK;
+}
+
+
+/*
+ * Back in the core
+ */
+static int nebhost_wait_for_init(struct nebhost *nh)
+{
+	struct pollfd pfd = { nh->sd, POLLIN, 0 };
+	time_t deadline = time(NULL) + NEBHOST_INIT_TIMEOUT;
+	char reply[32];
+	unsigned int len = 0;
+	ssize_t ret;
+
+	while (len < sizeof(reply) - 1 && !memchr(reply, '\n', len)) {
+		int timeout = (int)(deadline - time(NULL));
+		if (timeout <= 0)
+			return ERROR;
+		ret = poll(&pfd, 1, timeout * 1000);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ERROR;
+		ret = read(nh->sd, reply + len, sizeof(reply) - 1 - len);
+		if (ret <= 0)
+			return ERROR;
+		len += ret;
+	}
+	reply[len] = 0;
+
+	return sscanf(reply, "ok %u", &nh->callbacks) == 1 ? OK : ERROR;
+}
+
+static void nebhost_stop(struct nebhost *nh, int reason)
+{
+	char buf[32];
+	int i, status;
+
+	/* the module host unloads the module when it sees this or EOF */
+	snprintf(buf, sizeof(buf), "stop %d\n", reason);
+	if (send(nh->sd, buf, strlen(buf), MSG_NOSIGNAL) < 0)
+		log_debug_info(DEBUGL_EVENTBROKER, 0, "Failed to tell module host for '%s' to stop: %s\n", nh->mod->filename, strerror(errno));
+	close(nh->sd);
+	nh->sd = -1;
+
+	for (i = 0; i < NEBHOST_STOP_TIMEOUT * 100; i++) {
+		if (waitpid(nh->pid, &status, WNOHANG) == nh->pid)
+			return;
+		usleep(10000);
+	}
+
+	logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Isolated broker module '%s' (pid %d) didn't stop within %d seconds. Killing it.\n",
+	      nh->mod->filename, (int)nh->pid, NEBHOST_STOP_TIMEOUT);
+	kill(nh->pid, SIGKILL);
+	while (waitpid(nh->pid, &status, 0) < 0 && errno == EINTR)
+		;
+}
+
+int nebhost_load_module(nebmodule *mod)
+{
+	struct nebhost *nh;
+	int sv[2];
+
+	nh = nm_calloc(1, sizeof(*nh));
+	nh->mod = mod;
+	nh->sd = -1;
+	nh->events = shmring_create(NEBHOST_EVENT_RING_SIZE);
+	nh->results = shmring_create(NEBHOST_RESULT_RING_SIZE);
+	if (!nh->events || !nh->results || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to set up a module host for '%s': %s\n", mod->filename, strerror(errno));
+		nebhost_destroy(nh);
+		return ERROR;
+	}
+
+	/* the module host must not deliver anything batched up in the core */
+	neb_flush_batches();
+	fflush(NULL);
+
+	nh->pid = fork();
+	if (nh->pid < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to fork a module host for '%s': %s\n", mod->filename, strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		nebhost_destroy(nh);
+		return ERROR;
+	}
+	if (!nh->pid) {
+		close(sv[0]);
+		nh->sd = sv[1];
+		nebhost_child_main(nh);
+	}
+
+	close(sv[1]);
+	nh->sd = sv[0];
+	(void)fcntl(nh->sd, F_SETFD, FD_CLOEXEC);
+	(void)fcntl(shmring_fd(nh->events), F_SETFD, FD_CLOEXEC);
+	(void)fcntl(shmring_doorbell(nh->events), F_SETFD, FD_CLOEXEC);
+	(void)fcntl(shmring_fd(nh->results), F_SETFD, FD_CLOEXEC);
+	(void)fcntl(shmring_doorbell(nh->results), F_SETFD, FD_CLOEXEC);
+
+	if (nebhost_wait_for_init(nh) != OK) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Isolated broker module '%s' failed to initialize in its module host.\n", mod->filename);
+		nebhost_stop(nh, NEBMODULE_ERROR_BAD_INIT);
+		nebhost_destroy(nh);
+		return ERROR;
+	}
+
+	if (iobroker_register(nagios_iobs, nh->sd, nh, nebhost_control_input) < 0 ||
+	    iobroker_register(nagios_iobs, shmring_doorbell(nh->results), nh, nebhost_result_input) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to register module host for '%s' with io broker\n", mod->filename);
+		iobroker_unregister(nagios_iobs, nh->sd);
+		nebhost_stop(nh, NEBMODULE_NEB_SHUTDOWN);
+		nebhost_destroy(nh);
+		return ERROR;
+	}
+
+	nh->next = nebhosts;
+	nebhosts = nh;
+	nebhost_add_proxies(nh->callbacks);
+	mod->module_handle = nh;
+	mod->is_currently_loaded = TRUE;
+
+	logit(NSLOG_INFO_MESSAGE, TRUE, "Event broker module '%s' initialized successfully in module host %d.\n", mod->filename, (int)nh->pid);
+
+	return OK;
+}
+
+int nebhost_unload_module(nebmodule *mod, int reason)
+{
+	struct nebhost *nh;
+
+	for (nh = nebhosts; nh; nh = nh->next) {
+		if (nh->mod == mod)
+			break;
+	}
+	if (!nh)
+		return ERROR;
+
+	nebhost_detach(nh);
+	nebhost_stop(nh, reason);
+	log_debug_info(DEBUGL_EVENTBROKER, 0, "Module host for '%s' got %lu events and dropped %lu\n", mod->filename, nh->sent, nh->dropped);
+	nebhost_destroy(nh);
+
+	return OK;
+}
+
+#endif
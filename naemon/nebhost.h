@@ -0,0 +1,41 @@
+#ifndef _NEBHOST_H
+#define _NEBHOST_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "lib/lnae-utils.h"
+#include "nebmodules.h"
+#include "objects.h"
+
+/*
+ * Isolated broker modules (isolated_broker_module=) don't run in the
+ * core. Each one gets a module host: a process forked off the core
+ * when the module is loaded, which receives the events the module
+ * registered for through a shared memory ring. Events the module
+ * host can't keep up with are dropped rather than waited for, and a
+ * module that crashes only takes its module host down with it.
+ *
+ * Objects in a module host are a copy of the core's as they were when
+ * the module was loaded. The state of the host or service an event is
+ * about is brought up to date before the module gets to see it.
+ *
+ * Check results and commands an isolated module submits through
+ * naemon_submit_check_result() and naemon_submit_command() are sent
+ * back to the core through a second ring.
+ */
+
+NAGIOS_BEGIN_DECL
+
+int nebhost_load_module(nebmodule *mod);
+int nebhost_unload_module(nebmodule *mod, int reason);
+
+/* for submit.c, when running in a module host */
+extern int nebhost_child;
+int nebhost_submit_check_result(const check_result *cr);
+int nebhost_submit_command(const char *cmd);
+
+NAGIOS_END_DECL
+
+#endif
@@ -1,7 +1,11 @@
 #include "config.h"
 #include "common.h"
 #include "nebmods.h"
+#include "nebhost.h"
 #include "neberrors.h"
+#include "nebstructs.h"
+#include "broker.h"
+#include "objects.h"
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
@@ -12,6 +16,19 @@
 static nebmodule *neb_module_list;
 static nebcallback **neb_callback_list;
 
+/* events waiting to be handed to a batch function */
+struct neb_batch {
+	void *module_handle;
+	neb_batch_func batch_func;
+	unsigned int max_events;
+	unsigned int count;
+	neb_batch_event *events;
+	neb_batch_event *spare;     /* swapped in while events are delivered */
+	int refs;                   /* callbacks using this batch */
+	struct neb_batch *next;
+};
+static struct neb_batch *neb_batch_list;
+
 /* compat stuff for USE_LTDL */
 #ifndef HAVE_DLFCN_H
 # define dlopen(p, flags) lt_dlopen(p)
@@ -83,6 +100,16 @@ int neb_add_module(char *filename, char *args, int should_be_loaded)
 }
 
 
+/* add a module that runs in a module host of its own, and return it */
+nebmodule *neb_add_isolated_module(char *filename, char *args)
+{
+	if (neb_add_module(filename, args, TRUE) != OK)
+		return NULL;
+	neb_module_list->isolated = TRUE;
+	return neb_module_list;
+}
+
+
 int neb_add_core_module(nebmodule *mod)
 {
 	mod->should_be_loaded = FALSE;
@@ -165,6 +192,9 @@ int neb_load_module(nebmodule *mod)
 	if (mod->should_be_loaded == FALSE || mod->filename == NULL)
 		return ERROR;
 
+	if (mod->isolated)
+		return nebhost_load_module(mod);
+
 	/* load the module */
 	mod->module_handle = dlopen(mod->filename, RTLD_NOW | RTLD_GLOBAL);
 	if (mod->module_handle == NULL) {
@@ -270,6 +300,18 @@ int neb_unload_module(nebmodule *mod, int flags, int reason)
 		my_free(mod->dl_file);
 	}
 
+	/* the module gets whatever is still batched up for it */
+	neb_flush_batches();
+
+	/* its module host does all of the below */
+	if (mod->isolated) {
+		if (nebhost_unload_module(mod, reason) != OK)
+			return ERROR;
+		mod->is_currently_loaded = FALSE;
+		logit(NSLOG_INFO_MESSAGE, FALSE, "Event broker module '%s' deinitialized successfully.\n", mod->filename);
+		return OK;
+	}
+
 	/* call the de-initialization function if available (and the module was initialized) */
 	if (mod->deinit_func && reason != NEBMODULE_ERROR_BAD_INIT) {
 
@@ -352,8 +394,25 @@ int neb_set_module_info(void *handle, int type, char *data)
 /****************************************************************************/
 /****************************************************************************/
 
+static int neb_add_callback(int callback_type, void *mod_handle, int priority, const neb_cb_filter *filter, void *callback_func, struct neb_batch *batch);
+static int neb_remove_callback(int callback_type, void *callback_func, int deliver);
+static void neb_batch_unref(struct neb_batch *batch, int deliver);
+
 /* allows a module to register a callback function */
 int neb_register_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *))
+{
+	return neb_register_callback_filtered(callback_type, mod_handle, priority, NULL, callback_func);
+}
+
+
+/* allows a module to register a callback function for some events only */
+int neb_register_callback_filtered(int callback_type, void *mod_handle, int priority, const neb_cb_filter *filter, int (*callback_func)(int, void *))
+{
+	return neb_add_callback(callback_type, mod_handle, priority, filter, callback_func, NULL);
+}
+
+
+static int neb_add_callback(int callback_type, void *mod_handle, int priority, const neb_cb_filter *filter, void *callback_func, struct neb_batch *batch)
 {
 	nebmodule *temp_module = NULL;
 	nebcallback *new_callback = NULL;
@@ -386,6 +445,12 @@ int neb_register_callback(int callback_type, void *mod_handle, int priority, int
 	new_callback->priority = priority;
 	new_callback->module_handle = mod_handle;
 	new_callback->callback_func = callback_func;
+	new_callback->batch = batch;
+	new_callback->filter = NULL;
+	if (filter && (filter->subtypes || filter->flags || filter->hosts || filter->services)) {
+		new_callback->filter = nm_malloc(sizeof(*filter));
+		*new_callback->filter = *filter;
+	}
 
 	/* add new function to callback list, sorted by priority (first come, first served for same priority) */
 	new_callback->next = NULL;
@@ -431,8 +496,9 @@ int neb_deregister_module_callbacks(nebmodule *mod)
 	for (callback_type = 0; callback_type < NEBCALLBACK_NUMITEMS; callback_type++) {
 		for (temp_callback = neb_callback_list[callback_type]; temp_callback != NULL; temp_callback = next_callback) {
 			next_callback = temp_callback->next;
+			/* the module is going away, so there's no point in delivering what's batched */
 			if (temp_callback->module_handle == mod->module_handle)
-				neb_deregister_callback(callback_type, (int( *)(int, void *))temp_callback->callback_func);
+				neb_remove_callback(callback_type, temp_callback->callback_func, FALSE);
 		}
 
 	}
@@ -443,6 +509,12 @@ int neb_deregister_module_callbacks(nebmodule *mod)
 
 /* allows a module to deregister a callback function */
 int neb_deregister_callback(int callback_type, int (*callback_func)(int, void *))
+{
+	return neb_remove_callback(callback_type, (void *)callback_func, TRUE);
+}
+
+
+static int neb_remove_callback(int callback_type, void *callback_func, int deliver)
 {
 	nebcallback *temp_callback = NULL;
 	nebcallback *last_callback = NULL;
@@ -479,6 +551,9 @@ int neb_deregister_callback(int callback_type, int (*callback_func)(int, void *)
 			neb_callback_list[callback_type] = NULL;
 		else
 			last_callback->next = next_callback;
+		if (temp_callback->batch)
+			neb_batch_unref(temp_callback->batch, deliver);
+		my_free(temp_callback->filter);
 		my_free(temp_callback);
 	}
 
@@ -486,9 +561,236 @@ int neb_deregister_callback(int callback_type, int (*callback_func)(int, void *)
 }
 
 
+/* allows a module to have events of a type delivered in batches */
+int neb_register_batch_callback(int callback_type, void *mod_handle, int priority, const neb_cb_filter *filter, unsigned int max_events, neb_batch_func batch_func)
+{
+	struct neb_batch *batch;
+	int result;
+
+	if (batch_func == NULL)
+		return NEBERROR_NOCALLBACKFUNC;
+
+	/* a module's batch function gets a single buffer for all its types */
+	for (batch = neb_batch_list; batch; batch = batch->next) {
+		if (batch->module_handle == mod_handle && batch->batch_func == batch_func)
+			break;
+	}
+	if (batch == NULL) {
+		batch = nm_calloc(1, sizeof(*batch));
+		batch->module_handle = mod_handle;
+		batch->batch_func = batch_func;
+		batch->max_events = max_events ? max_events : NEB_BATCH_DEFAULT_SIZE;
+		batch->events = nm_malloc(batch->max_events * sizeof(neb_batch_event));
+		batch->spare = nm_malloc(batch->max_events * sizeof(neb_batch_event));
+		batch->next = neb_batch_list;
+		neb_batch_list = batch;
+	}
+
+	batch->refs++;
+	result = neb_add_callback(callback_type, mod_handle, priority, filter, (void *)batch_func, batch);
+	if (result != OK)
+		neb_batch_unref(batch, FALSE);
+
+	return result;
+}
+
+
+/* allows a module to stop having events of a type delivered in batches */
+int neb_deregister_batch_callback(int callback_type, neb_batch_func batch_func)
+{
+	return neb_remove_callback(callback_type, (void *)batch_func, TRUE);
+}
+
+
+
+void neb_event_init(neb_event *ev, int type, host *hst, service *svc)
+{
+	ev->type = type;
+	ev->svc = svc;
+	ev->hst = (svc && !hst) ? svc->host_ptr : hst;
+}
+
+
+/* checks an event against a callback's filter */
+static int neb_filter_passes(const neb_cb_filter *filter, const neb_event *ev)
+{
+	int state, last_state, state_type;
+
+	if (filter->subtypes && !(filter->subtypes & neb_subtype_flag(ev->type)))
+		return FALSE;
+
+	/* the rest is about hosts and services */
+	if (ev->hst) {
+		if (filter->hosts && !bitmap_isset(filter->hosts, ev->hst->id))
+			return FALSE;
+		state = ev->hst->current_state;
+		last_state = ev->hst->last_state;
+		state_type = ev->hst->state_type;
+	}
+	if (ev->svc) {
+		if (filter->services && !bitmap_isset(filter->services, ev->svc->id))
+			return FALSE;
+		state = ev->svc->current_state;
+		last_state = ev->svc->last_state;
+		state_type = ev->svc->state_type;
+	}
+	if (!ev->hst && !ev->svc)
+		return TRUE;
+
+	if ((filter->flags & NEBFILTER_HARD_STATES) && state_type != HARD_STATE)
+		return FALSE;
+	if ((filter->flags & NEBFILTER_STATE_CHANGES) && state == last_state)
+		return FALSE;
+
+	return TRUE;
+}
+
+
+/* lets brokers skip building data nobody would get */
+int neb_wants_event(int callback_type, const neb_event *ev)
+{
+	nebcallback *temp_callback;
+
+	if (neb_callback_list == NULL || callback_type < 0 || callback_type >= NEBCALLBACK_NUMITEMS)
+		return FALSE;
+
+	for (temp_callback = neb_callback_list[callback_type]; temp_callback; temp_callback = temp_callback->next) {
+		if (!temp_callback->filter || neb_filter_passes(temp_callback->filter, ev))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/* hands a batch's events to its module */
+static void neb_batch_flush(struct neb_batch *batch)
+{
+	neb_batch_event *events = batch->events;
+	unsigned int count = batch->count;
+
+	if (!count)
+		return;
+
+	/* events brokered by the batch function itself go to the spare */
+	batch->events = batch->spare ? batch->spare : nm_malloc(batch->max_events * sizeof(neb_batch_event));
+	batch->spare = NULL;
+	batch->count = 0;
+
+	/* the batch function may deregister the callbacks that keep the batch around */
+	batch->refs++;
+	log_debug_info(DEBUGL_EVENTBROKER, 1, "Delivering a batch of %u events\n", count);
+	batch->batch_func(events, count);
+
+	if (batch->spare)
+		free(events);
+	else
+		batch->spare = events;
+	neb_batch_unref(batch, TRUE);
+}
+
+
+static void neb_batch_add(struct neb_batch *batch, int callback_type, const neb_event *ev, void *data)
+{
+	nebstruct_process_data *hdr = data;
+	neb_batch_event *rec = &batch->events[batch->count++];
+
+	rec->callback_type = callback_type;
+	rec->type = ev->type;
+	/* all nebstructs start the same way */
+	if (hdr) {
+		rec->flags = hdr->flags;
+		rec->attr = hdr->attr;
+		rec->timestamp = hdr->timestamp;
+	} else {
+		rec->flags = rec->attr = 0;
+		rec->timestamp.tv_sec = rec->timestamp.tv_usec = 0;
+	}
+	rec->hst = ev->hst;
+	rec->svc = ev->svc;
+	if (ev->svc) {
+		rec->state = ev->svc->current_state;
+		rec->last_state = ev->svc->last_state;
+		rec->state_type = ev->svc->state_type;
+	} else if (ev->hst) {
+		rec->state = ev->hst->current_state;
+		rec->last_state = ev->hst->last_state;
+		rec->state_type = ev->hst->state_type;
+	} else {
+		rec->state = rec->last_state = rec->state_type = 0;
+	}
+
+	if (batch->count >= batch->max_events)
+		neb_batch_flush(batch);
+}
+
+
+static void neb_batch_unref(struct neb_batch *batch, int deliver)
+{
+	struct neb_batch **link;
+
+	if (--batch->refs > 0)
+		return;
+
+	/*
+	 * a module that stops getting some events still gets the ones it
+	 * was already promised. Delivering them unrefs the batch again,
+	 * which is when it goes away.
+	 */
+	if (deliver && batch->count) {
+		neb_batch_flush(batch);
+		return;
+	}
+
+	for (link = &neb_batch_list; *link; link = &(*link)->next) {
+		if (*link == batch) {
+			*link = batch->next;
+			break;
+		}
+	}
+	my_free(batch->events);
+	my_free(batch->spare);
+	my_free(batch);
+}
+
+
+/* hands all batched events to their modules */
+void neb_flush_batches(void)
+{
+	struct neb_batch *batch, **batches;
+	unsigned int i, num = 0;
+
+	/* batch functions may deregister callbacks, so the list may change under us */
+	for (batch = neb_batch_list; batch; batch = batch->next)
+		num++;
+	if (!num)
+		return;
+	batches = nm_malloc(num * sizeof(*batches));
+	for (i = 0, batch = neb_batch_list; batch; batch = batch->next, i++) {
+		batches[i] = batch;
+		batch->refs++;
+	}
+	for (i = 0; i < num; i++)
+		neb_batch_flush(batches[i]);
+	for (i = 0; i < num; i++)
+		neb_batch_unref(batches[i], TRUE);
+	free(batches);
+}
+
 
 /* make callbacks to modules */
 int neb_make_callbacks(int callback_type, void *data)
+{
+	neb_event ev;
+
+	/* all nebstructs start with their type */
+	neb_event_init(&ev, data ? *(int *)data : NEBTYPE_NONE, NULL, NULL);
+	return neb_make_event_callbacks(callback_type, &ev, data);
+}
+
+
+/* make callbacks to modules whose filters pass the event */
+int neb_make_event_callbacks(int callback_type, const neb_event *ev, void *data)
 {
 	nebcallback *temp_callback, *next_callback;
 	int (*callbackfunc)(int, void *);
@@ -508,6 +810,12 @@ int neb_make_callbacks(int callback_type, void *data)
 	/* make the callbacks... */
 	for (temp_callback = neb_callback_list[callback_type]; temp_callback; temp_callback = next_callback) {
 		next_callback = temp_callback->next;
+		if (temp_callback->filter && !neb_filter_passes(temp_callback->filter, ev))
+			continue;
+		if (temp_callback->batch) {
+			neb_batch_add(temp_callback->batch, callback_type, ev, data);
+			continue;
+		}
 		callbackfunc = temp_callback->callback_func;
 		cbresult = callbackfunc(callback_type, data);
 		temp_callback = next_callback;
@@ -530,6 +838,15 @@ int neb_make_callbacks(int callback_type, void *data)
 
 
 
+/* is anything registered for this type of callback? */
+int neb_has_callbacks(int callback_type)
+{
+	if (neb_callback_list == NULL || callback_type < 0 || callback_type >= NEBCALLBACK_NUMITEMS)
+		return FALSE;
+	return neb_callback_list[callback_type] != NULL;
+}
+
+
 /* initialize callback list */
 int neb_init_callback_list(void)
 {
@@ -556,10 +873,16 @@ int neb_free_callback_list(void)
 	if (neb_callback_list == NULL)
 		return OK;
 
+	/* deliver what's batched while the objects are still around */
+	neb_flush_batches();
+
 	for (x = 0; x < NEBCALLBACK_NUMITEMS; x++) {
 
 		for (temp_callback = neb_callback_list[x]; temp_callback != NULL; temp_callback = next_callback) {
 			next_callback = temp_callback->next;
+			if (temp_callback->batch)
+				neb_batch_unref(temp_callback->batch, FALSE);
+			my_free(temp_callback->filter);
 			my_free(temp_callback);
 		}
 
@@ -18,8 +18,19 @@ typedef struct nebcallback_struct {
 	void            *module_handle;
 	int             priority;
 	struct nebcallback_struct *next;
+	neb_cb_filter   *filter;
+	struct neb_batch *batch;  /* set for batched callbacks */
 } nebcallback;
 
+/* what an event is about, so filtered callbacks can be skipped */
+struct host;
+struct service;
+typedef struct neb_event {
+	int type;                /* NEBTYPE_* */
+	struct host *hst;        /* the host, or the service's host */
+	struct service *svc;
+} neb_event;
+
 
 /***** MODULE FUNCTIONS *****/
 int neb_init_modules(void);
@@ -31,12 +42,18 @@ int neb_unload_all_modules(int, int);
 int neb_unload_module(nebmodule *, int, int);
 int neb_add_module(char *, char *, int);
 int neb_add_core_module(nebmodule *mod);
+nebmodule *neb_add_isolated_module(char *filename, char *args);
 
 
 /***** CALLBACK FUNCTIONS *****/
 int neb_init_callback_list(void);
 int neb_free_callback_list(void);
+int neb_has_callbacks(int callback_type);
 int neb_make_callbacks(int, void *);
+void neb_event_init(neb_event *ev, int type, struct host *hst, struct service *svc);
+int neb_wants_event(int callback_type, const neb_event *ev);
+int neb_make_event_callbacks(int callback_type, const neb_event *ev, void *data);
+void neb_flush_batches(void);
 
 NAGIOS_END_DECL
 #endif
@@ -56,6 +56,7 @@ typedef struct nebmodule_struct {
 	void            *deinit_func;
 #endif
 	struct nebmodule_struct *next;
+	int             isolated; /* runs in a module host, see nebhost.h */
 } nebmodule;
 
 
@@ -12,7 +12,9 @@
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "simulation.h"
 #include <string.h>
+#include <limits.h>
 
 struct notification_job {
 	host *hst;
@@ -68,6 +70,331 @@ static void notification_handle_job_result(struct wproc_result *wpres, void *dat
 }
 
 
+/******************************************************************/
+/***************** ESCALATION SELECTOR FUNCTIONS ******************/
+/******************************************************************/
+
+/*
+ * Each host and service gets its escalations compiled into an array
+ * sorted on first_notification, with an implicit max-tree over the
+ * (open-ended as INT_MAX) last_notification on top of it. Finding the
+ * escalations that cover a notification number then only descends into
+ * subtrees that can hold a match, and the per-entry timeperiod verdict
+ * is cached for the second it was computed in.
+ */
+struct escalation_entry {
+	int first_notification;
+	int last_notification;
+	int escalation_options;
+	double notification_interval;
+	struct timeperiod *escalation_period_ptr;
+	struct objectarray *contacts;
+	struct objectarray *contact_groups;
+	time_t period_checked;
+	int period_valid;
+	unsigned int order;
+};
+
+struct escalation_selector {
+	void *owner;
+	unsigned int count;
+	unsigned int leaves;
+	struct escalation_entry *entries;
+	int *max_last;
+};
+
+typedef int (*escalation_visitor)(struct escalation_entry *, void *);
+
+static struct escalation_selector *host_escalation_selectors;
+static struct escalation_selector *service_escalation_selectors;
+static unsigned int num_host_escalation_selectors;
+static unsigned int num_service_escalation_selectors;
+
+static int escalation_entry_compare(const void *a_, const void *b_)
+{
+	const struct escalation_entry *a = a_, *b = b_;
+
+	if (a->first_notification != b->first_notification)
+		return a->first_notification < b->first_notification ? -1 : 1;
+	return a->order < b->order ? -1 : (a->order > b->order);
+}
+
+static void escalation_selector_clear(struct escalation_selector *sel)
+{
+	my_free(sel->entries);
+	my_free(sel->max_last);
+	sel->owner = NULL;
+	sel->count = sel->leaves = 0;
+}
+
+static void escalation_selector_compile(struct escalation_selector *sel)
+{
+	unsigned int i;
+
+	qsort(sel->entries, sel->count, sizeof(*sel->entries), escalation_entry_compare);
+
+	for (sel->leaves = 1; sel->leaves < sel->count; sel->leaves <<= 1)
+		;
+	sel->max_last = nm_malloc(sizeof(int) * sel->leaves * 2);
+	for (i = 0; i < sel->leaves; i++)
+		sel->max_last[sel->leaves + i] = i < sel->count ? sel->entries[i].last_notification : INT_MIN;
+	for (i = sel->leaves - 1; i > 0; i--)
+		sel->max_last[i] = sel->max_last[i * 2] > sel->max_last[i * 2 + 1] ? sel->max_last[i * 2] : sel->max_last[i * 2 + 1];
+}
+
+static struct escalation_selector *grow_escalation_selectors(struct escalation_selector **ary, unsigned int *size, unsigned int id, unsigned int hint)
+{
+	if (id >= *size) {
+		unsigned int new_size = id < hint ? hint : id + 1;
+		*ary = nm_realloc(*ary, sizeof(**ary) * new_size);
+		memset(*ary + *size, 0, sizeof(**ary) * (new_size - *size));
+		*size = new_size;
+	}
+	return &(*ary)[id];
+}
+
+static void escalation_entry_init(struct escalation_entry *entry, unsigned int order, int first, int last, double interval, timeperiod *period, int options, objectarray *contacts, objectarray *contact_groups)
+{
+	entry->order = order;
+	entry->first_notification = first;
+	entry->last_notification = last ? last : INT_MAX;
+	entry->notification_interval = interval;
+	entry->escalation_period_ptr = period;
+	entry->escalation_options = options;
+	entry->contacts = contacts;
+	entry->contact_groups = contact_groups;
+	entry->period_checked = (time_t)-1;
+}
+
+static struct escalation_selector *get_service_escalation_selector(service *svc)
+{
+	struct escalation_selector *sel;
+	objectlist *list;
+	unsigned int i = 0;
+
+	sel = grow_escalation_selectors(&service_escalation_selectors, &num_service_escalation_selectors, svc->id, num_objects.services);
+	if (sel->owner == svc)
+		return sel;
+
+	escalation_selector_clear(sel);
+	for (list = svc->escalation_list; list; list = list->next)
+		sel->count++;
+	sel->entries = nm_calloc(sel->count ? sel->count : 1, sizeof(*sel->entries));
+	for (list = svc->escalation_list; list; list = list->next, i++) {
+		serviceescalation *se = (serviceescalation *)list->object_ptr;
+		escalation_entry_init(&sel->entries[i], i, se->first_notification, se->last_notification,
+		                      se->notification_interval, se->escalation_period ? se->escalation_period_ptr : NULL,
+		                      se->escalation_options, &se->contact_objs, &se->contactgroup_objs);
+	}
+	escalation_selector_compile(sel);
+	sel->owner = svc;
+
+	return sel;
+}
+
+static struct escalation_selector *get_host_escalation_selector(host *hst)
+{
+	struct escalation_selector *sel;
+	objectlist *list;
+	unsigned int i = 0;
+
+	sel = grow_escalation_selectors(&host_escalation_selectors, &num_host_escalation_selectors, hst->id, num_objects.hosts);
+	if (sel->owner == hst)
+		return sel;
+
+	escalation_selector_clear(sel);
+	for (list = hst->escalation_list; list; list = list->next)
+		sel->count++;
+	sel->entries = nm_calloc(sel->count ? sel->count : 1, sizeof(*sel->entries));
+	for (list = hst->escalation_list; list; list = list->next, i++) {
+		hostescalation *he = (hostescalation *)list->object_ptr;
+		escalation_entry_init(&sel->entries[i], i, he->first_notification, he->last_notification,
+		                      he->notification_interval, he->escalation_period ? he->escalation_period_ptr : NULL,
+		                      he->escalation_options, &he->contact_objs, &he->contactgroup_objs);
+	}
+	escalation_selector_compile(sel);
+	sel->owner = hst;
+
+	return sel;
+}
+
+/* if this is a recovery, really we check for who got notified about a previous problem */
+static int service_escalation_number(service *svc)
+{
+	return svc->current_state == STATE_OK ? svc->current_notification_number - 1 : svc->current_notification_number;
+}
+
+static int host_escalation_number(host *hst)
+{
+	return hst->current_state == HOST_UP ? hst->current_notification_number - 1 : hst->current_notification_number;
+}
+
+/* state option and timeperiod part of is_valid_escalation_for_*_notification() */
+static int escalation_entry_applies(struct escalation_entry *entry, int state, time_t now)
+{
+	if (flag_isset(entry->escalation_options, 1 << state) == FALSE)
+		return FALSE;
+
+	if (entry->escalation_period_ptr == NULL)
+		return TRUE;
+
+	if (entry->period_checked != now) {
+		entry->period_valid = check_time_against_period(now, entry->escalation_period_ptr) == OK;
+		entry->period_checked = now;
+	}
+	return entry->period_valid;
+}
+
+static int escalation_selector_walk(struct escalation_selector *sel, unsigned int node, unsigned int lo, unsigned int width, unsigned int limit, int notification_number, int state, time_t now, escalation_visitor visit, void *arg)
+{
+	int ret;
+
+	if (lo >= limit || sel->max_last[node] < notification_number)
+		return 0;
+
+	if (width == 1) {
+		if (escalation_entry_applies(&sel->entries[lo], state, now) == FALSE)
+			return 0;
+		return visit(&sel->entries[lo], arg);
+	}
+
+	width /= 2;
+	ret = escalation_selector_walk(sel, node * 2, lo, width, limit, notification_number, state, now, visit, arg);
+	if (ret)
+		return ret;
+	return escalation_selector_walk(sel, node * 2 + 1, lo + width, width, limit, notification_number, state, now, visit, arg);
+}
+
+/*
+ * Calls visit() for every escalation valid for the given notification
+ * number and state, in the same way is_valid_escalation_for_*_notification()
+ * decides it. Stops and returns the first non-zero value visit() returns.
+ */
+static int select_escalations(struct escalation_selector *sel, int notification_number, int state, int options, escalation_visitor visit, void *arg)
+{
+	unsigned int lo = 0, hi = sel->count, i;
+	int ret;
+
+	if (!sel->count)
+		return 0;
+
+	/* broadcast options go to everyone, so every escalation is valid */
+	if (options & NOTIFICATION_OPTION_BROADCAST) {
+		for (i = 0; i < sel->count; i++) {
+			if ((ret = visit(&sel->entries[i], arg)))
+				return ret;
+		}
+		return 0;
+	}
+
+	/* find how many escalations start at or before this notification */
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (sel->entries[mid].first_notification <= notification_number)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return escalation_selector_walk(sel, 1, 0, sel->leaves, lo, notification_number, state, sim_time(NULL), visit, arg);
+}
+
+void free_escalation_selectors(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_host_escalation_selectors; i++)
+		escalation_selector_clear(&host_escalation_selectors[i]);
+	for (i = 0; i < num_service_escalation_selectors; i++)
+		escalation_selector_clear(&service_escalation_selectors[i]);
+	my_free(host_escalation_selectors);
+	my_free(service_escalation_selectors);
+	num_host_escalation_selectors = num_service_escalation_selectors = 0;
+}
+
+/* escalation visitors */
+static int escalation_found(struct escalation_entry *entry, void *arg)
+{
+	return TRUE;
+}
+
+struct escalation_interval {
+	double interval;
+	int found;
+};
+
+static int escalation_shortest_interval(struct escalation_entry *entry, void *arg)
+{
+	struct escalation_interval *ei = (struct escalation_interval *)arg;
+
+	/* interval < 0 means to use non-escalated interval */
+	if (entry->notification_interval < 0.0)
+		return 0;
+
+	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Found a valid escalation w/ interval of %f\n", entry->notification_interval);
+
+	/* use the shortest of all valid escalation intervals */
+	if (ei->found == FALSE || entry->notification_interval < ei->interval) {
+		ei->found = TRUE;
+		ei->interval = entry->notification_interval;
+	}
+
+	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "New interval: %f\n", ei->interval);
+	return 0;
+}
+
+struct escalation_recipients {
+	nagios_macros *mac;
+	host *hst;
+	service *svc;
+	int type;
+	int options;
+};
+
+static void add_escalation_recipient(struct escalation_recipients *er, contact *cntct)
+{
+	int result;
+
+	/* check now if the contact can be notified */
+	if (er->svc)
+		result = check_contact_service_notification_viability(cntct, er->svc, er->type, er->options);
+	else
+		result = check_contact_host_notification_viability(cntct, er->hst, er->type, er->options);
+
+	if (result == OK)
+		add_notification(er->mac, cntct);
+	else
+		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", cntct->name);
+}
+
+static int escalation_add_recipients(struct escalation_entry *entry, void *arg)
+{
+	struct escalation_recipients *er = (struct escalation_recipients *)arg;
+	contact *temp_contact;
+	contactgroup *temp_contactgroup;
+	unsigned int i, j;
+
+	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding individual contacts from escalation(s) to notification list.\n");
+
+	/* add all individual contacts for this escalation entry */
+	objectarray_foreach(entry->contacts, i, temp_contact) {
+		add_escalation_recipient(er, temp_contact);
+	}
+
+	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact groups from escalation(s) to notification list.\n");
+
+	/* add all contacts that belong to contactgroups for this escalation */
+	objectarray_foreach(entry->contact_groups, i, temp_contactgroup) {
+		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact group '%s' for escalation to notification list.\n", temp_contactgroup->group_name);
+		objectarray_foreach(&temp_contactgroup->member_objs, j, temp_contact) {
+			add_escalation_recipient(er, temp_contact);
+		}
+	}
+
+	return 0;
+}
+
+
 /******************************************************************/
 /***************** SERVICE NOTIFICATION FUNCTIONS *****************/
 /******************************************************************/
@@ -91,8 +418,8 @@ int service_notification(service *svc, int type, char *not_author, char *not_dat
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "service_notification()\n");
 
 	/* get the current time */
-	time(&current_time);
-	gettimeofday(&start_time, NULL);
+	sim_time(&current_time);
+	sim_gettimeofday(&start_time, NULL);
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 0, "** Service Notification Attempt ** Host: '%s', Service: '%s', Type: %s, Options: %d, Current State: %d, Last Notification: %s", svc->host_name, svc->description, notification_reason_name(type), options, svc->current_state, ctime(&svc->last_notification));
 
@@ -316,7 +643,7 @@ int service_notification(service *svc, int type, char *not_author, char *not_dat
 	my_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
 
 	/* get the time we finished */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -349,7 +676,7 @@ int check_service_notification_viability(service *svc, int type, int options)
 	}
 
 	/* get current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* are notifications enabled? */
 	if (enable_notifications == FALSE) {
@@ -621,7 +948,7 @@ int check_contact_service_notification_viability(contact *cntct, service *svc, i
 	}
 
 	/* see if the contact can be notified at this time */
-	if (check_time_against_period(time(NULL), cntct->service_notification_period_ptr) == ERROR) {
+	if (check_time_against_period(sim_time(NULL), cntct->service_notification_period_ptr) == ERROR) {
 		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "This contact shouldn't be notified at this time.\n");
 		return ERROR;
 	}
@@ -700,6 +1027,7 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 	char *command_name_ptr = NULL;
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	char *temp_buffer = NULL;
 	char *processed_buffer = NULL;
 	struct timeval start_time, end_time;
@@ -713,7 +1041,7 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "** Notifying contact '%s'\n", cntct->name);
 
 	/* get start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -730,7 +1058,7 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 	for (temp_commandsmember = cntct->service_notification_commands; temp_commandsmember != NULL; temp_commandsmember = temp_commandsmember->next) {
 
 		/* get start time */
-		gettimeofday(&method_start_time, NULL);
+		sim_gettimeofday(&method_start_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 		/* send data to event broker */
@@ -751,7 +1079,7 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Raw notification command: %s\n", raw_command);
 
 		/* process any macros contained in the argument */
-		process_macros_r(mac, raw_command, &processed_command, macro_options);
+		process_command_line_r(mac, temp_commandsmember->command_ptr, raw_command, &processed_command, &argv, macro_options);
 		my_free(raw_command);
 		if (processed_command == NULL)
 			continue;
@@ -808,7 +1136,7 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 		nj->ctc = cntct;
 		nj->hst = svc->host_ptr;
 		nj->svc = svc;
-		if(ERROR == wproc_run_callback(processed_command, notification_timeout, notification_handle_job_result, nj, mac)) {
+		if(ERROR == wproc_run_callback_argv(processed_command, argv, notification_timeout, notification_handle_job_result, nj, mac)) {
 			logit(NSLOG_RUNTIME_ERROR, TRUE, "Unable to send notification for service '%s on host '%s' to worker\n", svc->description, svc->host_ptr->name);
 			free(nj);
 		}
@@ -818,7 +1146,7 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 		my_free(processed_command);
 
 		/* get end time */
-		gettimeofday(&method_end_time, NULL);
+		sim_gettimeofday(&method_end_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 		/* send data to event broker */
@@ -827,7 +1155,7 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 	}
 
 	/* get end time */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 
 	/* update the contact's last service notification time */
 	cntct->last_service_notification = start_time.tv_sec;
@@ -851,7 +1179,7 @@ int is_valid_escalation_for_service_notification(service *svc, serviceescalation
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "is_valid_escalation_for_service_notification()\n");
 
 	/* get the current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* if this is a recovery, really we check for who got notified about a previous problem */
 	if (svc->current_state == STATE_OK)
@@ -892,19 +1220,12 @@ int is_valid_escalation_for_service_notification(service *svc, serviceescalation
 /* checks to see whether a service notification should be escalation */
 int should_service_notification_be_escalated(service *svc)
 {
-	objectlist *list;
-
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "should_service_notification_be_escalated()\n");
 
-	/* search the service escalation list */
-	for (list = svc->escalation_list; list; list = list->next) {
-		serviceescalation *temp_se = (serviceescalation *)list->object_ptr;
-
-		/* we found a matching entry, so escalate this notification! */
-		if (is_valid_escalation_for_service_notification(svc, temp_se, NOTIFICATION_OPTION_NONE) == TRUE) {
-			log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Service notification WILL be escalated.\n");
-			return TRUE;
-		}
+	/* search the service escalations for a matching entry */
+	if (svc->escalation_list && select_escalations(get_service_escalation_selector(svc), service_escalation_number(svc), svc->current_state, NOTIFICATION_OPTION_NONE, escalation_found, NULL)) {
+		log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Service notification WILL be escalated.\n");
+		return TRUE;
 	}
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Service notification will NOT be escalated.\n");
@@ -916,12 +1237,10 @@ int should_service_notification_be_escalated(service *svc)
 /* given a service, create a list of contacts to be notified, removing duplicates, checking contact notification viability */
 int create_notification_list_from_service(nagios_macros *mac, service *svc, int options, int *escalated, int type)
 {
-	serviceescalation *temp_se = NULL;
-	contactsmember *temp_contactsmember = NULL;
 	contact *temp_contact = NULL;
-	contactgroupsmember *temp_contactgroupsmember = NULL;
 	contactgroup *temp_contactgroup = NULL;
 	int escalate_notification = FALSE;
+	unsigned int i, j;
 
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "create_notification_list_from_service()\n");
@@ -943,49 +1262,15 @@ int create_notification_list_from_service(nagios_macros *mac, service *svc, int
 
 	/* use escalated contacts for this notification */
 	if (escalate_notification == TRUE || (options & NOTIFICATION_OPTION_BROADCAST)) {
-		objectlist *list;
+		struct escalation_recipients er = { NULL, NULL, NULL, 0, 0 };
 
 		log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Adding contacts from service escalation(s) to notification list.\n");
 
-		/* search all the escalation entries for valid matches */
-		for (list = svc->escalation_list; list; list = list->next) {
-			temp_se = (serviceescalation *)list->object_ptr;
-
-			/* skip this entry if it isn't appropriate */
-			if (is_valid_escalation_for_service_notification(svc, temp_se, options) == FALSE)
-				continue;
-
-			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding individual contacts from service escalation(s) to notification list.\n");
-
-			/* add all individual contacts for this escalation entry */
-			for (temp_contactsmember = temp_se->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
-				/* check now if the contact can be notified */
-				if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
-					add_notification(mac, temp_contact);
-				else
-					log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
-			}
-
-			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact groups from service escalation(s) to notification list.\n");
-
-			/* add all contacts that belong to contactgroups for this escalation */
-			for (temp_contactgroupsmember = temp_se->contact_groups; temp_contactgroupsmember != NULL; temp_contactgroupsmember = temp_contactgroupsmember->next) {
-				log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact group '%s' for service escalation to notification list.\n", temp_contactgroupsmember->group_name);
-				if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
-					continue;
-				for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-					if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-						continue;
-					/* check now if the contact can be notified */
-					if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
-						add_notification(mac, temp_contact);
-					else
-						log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
-				}
-			}
-		}
+		er.mac = mac;
+		er.svc = svc;
+		er.type = type;
+		er.options = options;
+		select_escalations(get_service_escalation_selector(svc), service_escalation_number(svc), svc->current_state, options, escalation_add_recipients, &er);
 	}
 
 	/* else use normal, non-escalated contacts */
@@ -994,9 +1279,7 @@ int create_notification_list_from_service(nagios_macros *mac, service *svc, int
 		log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Adding normal contacts for service to notification list.\n");
 
 		/* add all individual contacts for this service */
-		for (temp_contactsmember = svc->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-			if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-				continue;
+		objectarray_foreach(&svc->contact_objs, i, temp_contact) {
 			/* check now if the contact can be notified */
 			if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
 				add_notification(mac, temp_contact);
@@ -1005,13 +1288,9 @@ int create_notification_list_from_service(nagios_macros *mac, service *svc, int
 		}
 
 		/* add all contacts that belong to contactgroups for this service */
-		for (temp_contactgroupsmember = svc->contact_groups; temp_contactgroupsmember != NULL; temp_contactgroupsmember = temp_contactgroupsmember->next) {
-			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact group '%s' for service to notification list.\n", temp_contactgroupsmember->group_name);
-			if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
-				continue;
-			for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
+		objectarray_foreach(&svc->contactgroup_objs, i, temp_contactgroup) {
+			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact group '%s' for service to notification list.\n", temp_contactgroup->group_name);
+			objectarray_foreach(&temp_contactgroup->member_objs, j, temp_contact) {
 				/* check now if the contact can be notified */
 				if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
 					add_notification(mac, temp_contact);
@@ -1046,8 +1325,8 @@ int host_notification(host *hst, int type, char *not_author, char *not_data, int
 	int neb_result;
 
 	/* get the current time */
-	time(&current_time);
-	gettimeofday(&start_time, NULL);
+	sim_time(&current_time);
+	sim_gettimeofday(&start_time, NULL);
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 0, "** Host Notification Attempt ** Host: '%s', Type: %s, Options: %d, Current State: %d, Last Notification: %s", hst->name, notification_reason_name(type), options, hst->current_state, ctime(&hst->last_notification));
 
@@ -1263,7 +1542,7 @@ int host_notification(host *hst, int type, char *not_author, char *not_data, int
 	my_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
 
 	/* get the time we finished */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -1293,7 +1572,7 @@ int check_host_notification_viability(host *hst, int type, int options)
 	}
 
 	/* get current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* are notifications enabled? */
 	if (enable_notifications == FALSE) {
@@ -1526,7 +1805,7 @@ int check_contact_host_notification_viability(contact *cntct, host *hst, int typ
 	}
 
 	/* see if the contact can be notified at this time */
-	if (check_time_against_period(time(NULL), cntct->host_notification_period_ptr) == ERROR) {
+	if (check_time_against_period(sim_time(NULL), cntct->host_notification_period_ptr) == ERROR) {
 		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "This contact shouldn't be notified at this time.\n");
 		return ERROR;
 	}
@@ -1602,6 +1881,7 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 	char *processed_buffer = NULL;
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	struct timeval start_time;
 	struct timeval end_time;
 	struct timeval method_start_time;
@@ -1616,7 +1896,7 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "** Notifying contact '%s'\n", cntct->name);
 
 	/* get start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -1633,7 +1913,7 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 	for (temp_commandsmember = cntct->host_notification_commands; temp_commandsmember != NULL; temp_commandsmember = temp_commandsmember->next) {
 
 		/* get start time */
-		gettimeofday(&method_start_time, NULL);
+		sim_gettimeofday(&method_start_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 		/* send data to event broker */
@@ -1654,7 +1934,7 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Raw notification command: %s\n", raw_command);
 
 		/* process any macros contained in the argument */
-		process_macros_r(mac, raw_command, &processed_command, macro_options);
+		process_command_line_r(mac, temp_commandsmember->command_ptr, raw_command, &processed_command, &argv, macro_options);
 		my_free(raw_command);
 		if (processed_command == NULL)
 			continue;
@@ -1710,11 +1990,12 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 		nj = nm_calloc(1,sizeof(struct notification_job));
 		if(nj == NULL) {
 			logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Allocating storage for notification job\n");
+			free_command_argv(argv);
 		} else {
 			nj->ctc = cntct;
 			nj->hst = hst;
 			nj->svc = NULL;
-			if(ERROR == wproc_run_callback(processed_command, notification_timeout, notification_handle_job_result, nj, mac)) {
+			if(ERROR == wproc_run_callback_argv(processed_command, argv, notification_timeout, notification_handle_job_result, nj, mac)) {
 				logit(NSLOG_RUNTIME_ERROR, TRUE, "Unable to send notification for host '%s' to worker\n", hst->name);
 				free(nj);
 			}
@@ -1727,7 +2008,7 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 		my_free(processed_command);
 
 		/* get end time */
-		gettimeofday(&method_end_time, NULL);
+		sim_gettimeofday(&method_end_time, NULL);
 
 #ifdef USE_EVENT_BROKER
 		/* send data to event broker */
@@ -1736,7 +2017,7 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 	}
 
 	/* get end time */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 
 	/* update the contact's last host notification time */
 	cntct->last_host_notification = start_time.tv_sec;
@@ -1760,7 +2041,7 @@ int is_valid_escalation_for_host_notification(host *hst, hostescalation *he, int
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "is_valid_escalation_for_host_notification()\n");
 
 	/* get the current time */
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* if this is a recovery, really we check for who got notified about a previous problem */
 	if (hst->current_state == HOST_UP)
@@ -1801,20 +2082,14 @@ int is_valid_escalation_for_host_notification(host *hst, hostescalation *he, int
 /* checks to see whether a host notification should be escalation */
 int should_host_notification_be_escalated(host *hst)
 {
-	objectlist *list;
-
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "should_host_notification_be_escalated()\n");
 
 	if (hst == NULL)
 		return FALSE;
 
-	/* search the host escalation list */
-	for (list = hst->escalation_list; list; list = list->next) {
-		hostescalation *temp_he = (hostescalation *)list->object_ptr;
-		/* we found a matching entry, so escalate this notification! */
-		if (is_valid_escalation_for_host_notification(hst, temp_he, NOTIFICATION_OPTION_NONE) == TRUE)
-			return TRUE;
-	}
+	/* search the host escalations for a matching entry */
+	if (hst->escalation_list && select_escalations(get_host_escalation_selector(hst), host_escalation_number(hst), hst->current_state, NOTIFICATION_OPTION_NONE, escalation_found, NULL))
+		return TRUE;
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Host notification will NOT be escalated.\n");
 
@@ -1825,12 +2100,10 @@ int should_host_notification_be_escalated(host *hst)
 /* given a host, create a list of contacts to be notified, removing duplicates, checking contact notification viability */
 int create_notification_list_from_host(nagios_macros *mac, host *hst, int options, int *escalated, int type)
 {
-	hostescalation *temp_he = NULL;
-	contactsmember *temp_contactsmember = NULL;
 	contact *temp_contact = NULL;
-	contactgroupsmember *temp_contactgroupsmember = NULL;
 	contactgroup *temp_contactgroup = NULL;
 	int escalate_notification = FALSE;
+	unsigned int i, j;
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "create_notification_list_from_host()\n");
 
@@ -1851,49 +2124,15 @@ int create_notification_list_from_host(nagios_macros *mac, host *hst, int option
 
 	/* use escalated contacts for this notification */
 	if (escalate_notification == TRUE || (options & NOTIFICATION_OPTION_BROADCAST)) {
-		objectlist *list;
+		struct escalation_recipients er = { NULL, NULL, NULL, 0, 0 };
 
 		log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Adding contacts from host escalation(s) to notification list.\n");
 
-		/* check all the host escalation entries */
-		for (list = hst->escalation_list; list; list = list->next) {
-			temp_he = (hostescalation *)list->object_ptr;
-
-			/* see if this escalation if valid for this notification */
-			if (is_valid_escalation_for_host_notification(hst, temp_he, options) == FALSE)
-				continue;
-
-			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding individual contacts from host escalation(s) to notification list.\n");
-
-			/* add all individual contacts for this escalation */
-			for (temp_contactsmember = temp_he->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
-				/* check now if the contact can be notified */
-				if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
-					add_notification(mac, temp_contact);
-				else
-					log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
-			}
-
-			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact groups from host escalation(s) to notification list.\n");
-
-			/* add all contacts that belong to contactgroups for this escalation */
-			for (temp_contactgroupsmember = temp_he->contact_groups; temp_contactgroupsmember != NULL; temp_contactgroupsmember = temp_contactgroupsmember->next) {
-				log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact group '%s' for host escalation to notification list.\n", temp_contactgroupsmember->group_name);
-				if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
-					continue;
-				for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-					if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-						continue;
-					/* check now if the contact can be notified */
-					if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
-						add_notification(mac, temp_contact);
-					else
-						log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
-				}
-			}
-		}
+		er.mac = mac;
+		er.hst = hst;
+		er.type = type;
+		er.options = options;
+		select_escalations(get_host_escalation_selector(hst), host_escalation_number(hst), hst->current_state, options, escalation_add_recipients, &er);
 	}
 
 	/* use normal, non-escalated contacts for this notification */
@@ -1904,9 +2143,7 @@ int create_notification_list_from_host(nagios_macros *mac, host *hst, int option
 		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding individual contacts for host to notification list.\n");
 
 		/* add all individual contacts for this host */
-		for (temp_contactsmember = hst->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-			if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-				continue;
+		objectarray_foreach(&hst->contact_objs, i, temp_contact) {
 			/* check now if the contact can be notified */
 			if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
 				add_notification(mac, temp_contact);
@@ -1917,14 +2154,10 @@ int create_notification_list_from_host(nagios_macros *mac, host *hst, int option
 		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact groups for host to notification list.\n");
 
 		/* add all contacts that belong to contactgroups for this host */
-		for (temp_contactgroupsmember = hst->contact_groups; temp_contactgroupsmember != NULL; temp_contactgroupsmember = temp_contactgroupsmember->next) {
-			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact group '%s' for host to notification list.\n", temp_contactgroupsmember->group_name);
-
-			if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
-				continue;
-			for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
+		objectarray_foreach(&hst->contactgroup_objs, i, temp_contactgroup) {
+			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact group '%s' for host to notification list.\n", temp_contactgroup->group_name);
+
+			objectarray_foreach(&temp_contactgroup->member_objs, j, temp_contact) {
 				/* check now if the contact can be notified */
 				if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
 					add_notification(mac, temp_contact);
@@ -1947,8 +2180,6 @@ time_t get_next_service_notification_time(service *svc, time_t offset)
 {
 	time_t next_notification = 0L;
 	double interval_to_use = 0.0;
-	objectlist *list;
-	int have_escalated_interval = FALSE;
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "get_next_service_notification_time()\n");
 
@@ -1959,31 +2190,12 @@ time_t get_next_service_notification_time(service *svc, time_t offset)
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Default interval: %f\n", interval_to_use);
 
-	/* search all the escalation entries for valid matches for this service (at its current notification number) */
-	for (list = svc->escalation_list; list; list = list->next) {
-		serviceescalation *temp_se = (serviceescalation *)list->object_ptr;
-
-		/* interval < 0 means to use non-escalated interval */
-		if (temp_se->notification_interval < 0.0)
-			continue;
-
-		/* skip this entry if it isn't appropriate */
-		if (is_valid_escalation_for_service_notification(svc, temp_se, NOTIFICATION_OPTION_NONE) == FALSE)
-			continue;
-
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Found a valid escalation w/ interval of %f\n", temp_se->notification_interval);
-
-		/* if we haven't used a notification interval from an escalation yet, use this one */
-		if (have_escalated_interval == FALSE) {
-			have_escalated_interval = TRUE;
-			interval_to_use = temp_se->notification_interval;
-		}
-
-		/* else use the shortest of all valid escalation intervals */
-		else if (temp_se->notification_interval < interval_to_use)
-			interval_to_use = temp_se->notification_interval;
-
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "New interval: %f\n", interval_to_use);
+	/* use the shortest interval of the escalations valid for this service (at its current notification number) */
+	if (svc->escalation_list) {
+		struct escalation_interval ei = { 0.0, FALSE };
+		select_escalations(get_service_escalation_selector(svc), service_escalation_number(svc), svc->current_state, NOTIFICATION_OPTION_NONE, escalation_shortest_interval, &ei);
+		if (ei.found == TRUE)
+			interval_to_use = ei.interval;
 	}
 
 	/* if notification interval is 0, we shouldn't send any more problem notifications (unless service is volatile) */
@@ -2006,8 +2218,6 @@ time_t get_next_host_notification_time(host *hst, time_t offset)
 {
 	time_t next_notification = 0L;
 	double interval_to_use = 0.0;
-	objectlist *list;
-	int have_escalated_interval = FALSE;
 
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "get_next_host_notification_time()\n");
@@ -2019,31 +2229,12 @@ time_t get_next_host_notification_time(host *hst, time_t offset)
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Default interval: %f\n", interval_to_use);
 
-	/* check all the host escalation entries for valid matches for this host (at its current notification number) */
-	for (list = hst->escalation_list; list; list = list->next) {
-		hostescalation *temp_he = (hostescalation *)list->object_ptr;
-
-		/* interval < 0 means to use non-escalated interval */
-		if (temp_he->notification_interval < 0.0)
-			continue;
-
-		/* skip this entry if it isn't appropriate */
-		if (is_valid_escalation_for_host_notification(hst, temp_he, NOTIFICATION_OPTION_NONE) == FALSE)
-			continue;
-
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Found a valid escalation w/ interval of %f\n", temp_he->notification_interval);
-
-		/* if we haven't used a notification interval from an escalation yet, use this one */
-		if (have_escalated_interval == FALSE) {
-			have_escalated_interval = TRUE;
-			interval_to_use = temp_he->notification_interval;
-		}
-
-		/* else use the shortest of all valid escalation intervals  */
-		else if (temp_he->notification_interval < interval_to_use)
-			interval_to_use = temp_he->notification_interval;
-
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "New interval: %f\n", interval_to_use);
+	/* use the shortest interval of the escalations valid for this host (at its current notification number) */
+	if (hst->escalation_list) {
+		struct escalation_interval ei = { 0.0, FALSE };
+		select_escalations(get_host_escalation_selector(hst), host_escalation_number(hst), hst->current_state, NOTIFICATION_OPTION_NONE, escalation_shortest_interval, &ei);
+		if (ei.found == TRUE)
+			interval_to_use = ei.interval;
 	}
 
 	/* if interval is 0, no more notifications should be sent */
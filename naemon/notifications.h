@@ -48,6 +48,7 @@ int add_notification(nagios_macros *mac, contact *);						/* adds a notification
 notification *find_notification(contact *);					/* finds a notification object */
 time_t get_next_host_notification_time(host *, time_t);				/* calculates nex acceptable re-notification time for a host */
 time_t get_next_service_notification_time(service *, time_t);			/* calculates nex acceptable re-notification time for a service */
+void free_escalation_selectors(void);						/* frees the compiled per-object escalation selectors */
 
 NAGIOS_END_DECL
 
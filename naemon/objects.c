@@ -5,6 +5,7 @@
 #include "xodtemplate.h"
 #include "logging.h"
 #include "globals.h"
+#include "utils.h"
 #include "nm_alloc.h"
 
 
@@ -143,6 +144,58 @@ static int cmp_hostesc(const void *a_, const void *b_)
 }
 
 
+/*
+ * copies the resolved pointers of a member list into an objectarray,
+ * keeping the list's order and skipping members that didn't resolve
+ */
+#define freeze_member_list(ary, list, type, ptr_field) \
+	do { \
+		type *m_; \
+		unsigned int n_ = 0; \
+		my_free((ary)->objs); \
+		for (m_ = (list); m_; m_ = m_->next) \
+			n_ += m_->ptr_field != NULL; \
+		(ary)->objs = n_ ? nm_malloc(n_ * sizeof(void *)) : NULL; \
+		(ary)->count = 0; \
+		for (m_ = (list); m_; m_ = m_->next) { \
+			if (m_->ptr_field) \
+				(ary)->objs[(ary)->count++] = m_->ptr_field; \
+		} \
+	} while (0)
+
+static void freeze_member_lists(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_objects.hosts; i++) {
+		host *h = host_ary[i];
+		freeze_member_list(&h->service_objs, h->services, servicesmember, service_ptr);
+		freeze_member_list(&h->contact_objs, h->contacts, contactsmember, contact_ptr);
+		freeze_member_list(&h->contactgroup_objs, h->contact_groups, contactgroupsmember, group_ptr);
+	}
+	for (i = 0; i < num_objects.services; i++) {
+		service *s = service_ary[i];
+		freeze_member_list(&s->contact_objs, s->contacts, contactsmember, contact_ptr);
+		freeze_member_list(&s->contactgroup_objs, s->contact_groups, contactgroupsmember, group_ptr);
+	}
+	for (i = 0; i < num_objects.hostescalations; i++) {
+		hostescalation *he = hostescalation_ary[i];
+		freeze_member_list(&he->contact_objs, he->contacts, contactsmember, contact_ptr);
+		freeze_member_list(&he->contactgroup_objs, he->contact_groups, contactgroupsmember, group_ptr);
+	}
+	for (i = 0; i < num_objects.serviceescalations; i++) {
+		serviceescalation *se = serviceescalation_ary[i];
+		freeze_member_list(&se->contact_objs, se->contacts, contactsmember, contact_ptr);
+		freeze_member_list(&se->contactgroup_objs, se->contact_groups, contactgroupsmember, group_ptr);
+	}
+	for (i = 0; i < num_objects.hostgroups; i++)
+		freeze_member_list(&hostgroup_ary[i]->member_objs, hostgroup_ary[i]->members, hostsmember, host_ptr);
+	for (i = 0; i < num_objects.servicegroups; i++)
+		freeze_member_list(&servicegroup_ary[i]->member_objs, servicegroup_ary[i]->members, servicesmember, service_ptr);
+	for (i = 0; i < num_objects.contactgroups; i++)
+		freeze_member_list(&contactgroup_ary[i]->member_objs, contactgroup_ary[i]->members, contactsmember, contact_ptr);
+}
+
 static void post_process_object_config(void)
 {
 	objectlist *list;
@@ -186,6 +239,9 @@ static void post_process_object_config(void)
 		qsort(serviceescalation_ary, num_objects.serviceescalations, sizeof(serviceescalation *), cmp_serviceesc);
 	timing_point("Done post-sorting slave objects\n");
 
+	freeze_member_lists();
+	timing_point("Done freezing member lists\n");
+
 	timeperiod_list = timeperiod_ary ? *timeperiod_ary : NULL;
 	command_list = command_ary ? *command_ary : NULL;
 	hostgroup_list = hostgroup_ary ? *hostgroup_ary : NULL;
@@ -340,6 +396,71 @@ int create_object_tables(unsigned int *ocount)
 }
 
 
+/*
+ * Membership bitmaps backing the is_*_member_of_*() tests. Each group
+ * gets one bit per member object id, set as members are added through
+ * the add_*_to_*group() functions below. Groups whose members were put
+ * together some other way have no map and fall back to walking the
+ * member list.
+ */
+struct group_membership {
+	void *group;
+	bitmap *members;
+};
+
+struct group_membership_table {
+	unsigned int size;
+	struct group_membership *maps;
+};
+
+static struct group_membership_table hostgroup_hosts;
+static struct group_membership_table servicegroup_services;
+static struct group_membership_table servicegroup_hosts;
+static struct group_membership_table contactgroup_contacts;
+
+static void add_group_membership(struct group_membership_table *gmt, void *group, unsigned int group_id, unsigned int member_id, unsigned int num_members)
+{
+	struct group_membership *gm;
+
+	if (group_id >= gmt->size) {
+		unsigned int new_size = gmt->size ? gmt->size * 2 : 16;
+		while (new_size <= group_id)
+			new_size *= 2;
+		gmt->maps = nm_realloc(gmt->maps, sizeof(*gmt->maps) * new_size);
+		memset(gmt->maps + gmt->size, 0, sizeof(*gmt->maps) * (new_size - gmt->size));
+		gmt->size = new_size;
+	}
+
+	gm = &gmt->maps[group_id];
+	if (gm->group != group) {
+		bitmap_destroy(gm->members);
+		gm->members = bitmap_create(member_id < num_members ? num_members : member_id + 1);
+		gm->group = group;
+	} else if (member_id >= bitmap_cardinality(gm->members)) {
+		bitmap_resize(gm->members, (member_id + 1) * 2);
+	}
+	bitmap_set(gm->members, member_id);
+}
+
+/* returns the membership map of a group, or NULL if the member list has to be walked */
+static bitmap *get_group_membership(struct group_membership_table *gmt, void *group, unsigned int group_id)
+{
+	if (group_id >= gmt->size || gmt->maps[group_id].group != group)
+		return NULL;
+	return gmt->maps[group_id].members;
+}
+
+static void free_group_membership(struct group_membership_table *gmt)
+{
+	unsigned int i;
+
+	for (i = 0; i < gmt->size; i++)
+		bitmap_destroy(gmt->maps[i].members);
+	my_free(gmt->maps);
+	gmt->size = 0;
+}
+
+
 /* add a new timeperiod to the list in memory */
 timeperiod *add_timeperiod(char *name, char *alias)
 {
@@ -893,6 +1014,7 @@ hostsmember *add_host_to_hostgroup(hostgroup *temp_hostgroup, char *host_name)
 
 	/* add (unsorted) link from the host to its group */
 	prepend_object_to_objectlist(&h->hostgroups_ptr, (void *)temp_hostgroup);
+	add_group_membership(&hostgroup_hosts, temp_hostgroup, temp_hostgroup->id, h->id, num_objects.hosts);
 
 	/* add the new member to the member list, sorted by host name */
 	if (use_large_installation_tweaks == TRUE) {
@@ -1005,6 +1127,9 @@ servicesmember *add_service_to_servicegroup(servicegroup *temp_servicegroup, cha
 
 	/* add (unsorted) link from the service to its groups */
 	prepend_object_to_objectlist(&svc->servicegroups_ptr, temp_servicegroup);
+	add_group_membership(&servicegroup_services, temp_servicegroup, temp_servicegroup->id, svc->id, num_objects.services);
+	if (svc->host_ptr)
+		add_group_membership(&servicegroup_hosts, temp_servicegroup, temp_servicegroup->id, svc->host_ptr->id, num_objects.hosts);
 
 	/*
 	 * add new member to member list, sorted by host name then
@@ -1285,6 +1410,7 @@ contactsmember *add_contact_to_contactgroup(contactgroup *grp, char *contact_nam
 	grp->members = new_contactsmember;
 
 	prepend_object_to_objectlist(&c->contactgroups_ptr, (void *)grp);
+	add_group_membership(&contactgroup_contacts, grp, grp->id, c->id, num_objects.contacts);
 
 	return new_contactsmember;
 }
@@ -1500,6 +1626,7 @@ command *add_command(char *name, char *value)
 	/* assign vars */
 	new_command->name = name;
 	new_command->command_line = value;
+	new_command->tmpl = create_command_template(value);
 
 	/* add new command to hash table */
 	if (result == OK) {
@@ -1521,6 +1648,7 @@ command *add_command(char *name, char *value)
 
 	/* handle errors */
 	if (result == ERROR) {
+		destroy_command_template(new_command->tmpl);
 		my_free(new_command);
 		return NULL;
 	}
@@ -2045,10 +2173,14 @@ int is_host_immediate_parent_of_host(host *child_host, host *parent_host)
 int is_host_member_of_hostgroup(hostgroup *group, host *hst)
 {
 	hostsmember *temp_hostsmember = NULL;
+	bitmap *members;
 
 	if (group == NULL || hst == NULL)
 		return FALSE;
 
+	if ((members = get_group_membership(&hostgroup_hosts, group, group->id)))
+		return bitmap_isset(members, hst->id);
+
 	for (temp_hostsmember = group->members; temp_hostsmember != NULL; temp_hostsmember = temp_hostsmember->next) {
 		if (temp_hostsmember->host_ptr == hst)
 			return TRUE;
@@ -2063,10 +2195,14 @@ int is_host_member_of_hostgroup(hostgroup *group, host *hst)
 int is_host_member_of_servicegroup(servicegroup *group, host *hst)
 {
 	servicesmember *temp_servicesmember = NULL;
+	bitmap *members;
 
 	if (group == NULL || hst == NULL)
 		return FALSE;
 
+	if ((members = get_group_membership(&servicegroup_hosts, group, group->id)))
+		return bitmap_isset(members, hst->id);
+
 	for (temp_servicesmember = group->members; temp_servicesmember != NULL; temp_servicesmember = temp_servicesmember->next) {
 		if (temp_servicesmember->service_ptr != NULL && temp_servicesmember->service_ptr->host_ptr == hst)
 			return TRUE;
@@ -2081,10 +2217,14 @@ int is_host_member_of_servicegroup(servicegroup *group, host *hst)
 int is_service_member_of_servicegroup(servicegroup *group, service *svc)
 {
 	servicesmember *temp_servicesmember = NULL;
+	bitmap *members;
 
 	if (group == NULL || svc == NULL)
 		return FALSE;
 
+	if ((members = get_group_membership(&servicegroup_services, group, group->id)))
+		return bitmap_isset(members, svc->id);
+
 	for (temp_servicesmember = group->members; temp_servicesmember != NULL; temp_servicesmember = temp_servicesmember->next) {
 		if (temp_servicesmember->service_ptr == svc)
 			return TRUE;
@@ -2101,10 +2241,14 @@ int is_service_member_of_servicegroup(servicegroup *group, service *svc)
 int is_contact_member_of_contactgroup(contactgroup *group, contact *cntct)
 {
 	contactsmember *member;
+	bitmap *members;
 
 	if (!group || !cntct)
 		return FALSE;
 
+	if ((members = get_group_membership(&contactgroup_contacts, group, group->id)))
+		return bitmap_isset(members, cntct->id);
+
 	/* search all contacts in this contact group */
 	for (member = group->members; member; member = member->next) {
 		if (member->contact_ptr == cntct)
@@ -2392,6 +2536,9 @@ int free_object_data(void)
 		my_free(this_host->icon_image_alt);
 		my_free(this_host->vrml_image);
 		my_free(this_host->statusmap_image);
+		my_free(this_host->service_objs.objs);
+		my_free(this_host->contact_objs.objs);
+		my_free(this_host->contactgroup_objs.objs);
 		my_free(this_host);
 	}
 
@@ -2417,11 +2564,13 @@ int free_object_data(void)
 		my_free(this_hostgroup->notes);
 		my_free(this_hostgroup->notes_url);
 		my_free(this_hostgroup->action_url);
+		my_free(this_hostgroup->member_objs.objs);
 		my_free(this_hostgroup);
 	}
 
 	/* reset pointers */
 	my_free(hostgroup_ary);
+	free_group_membership(&hostgroup_hosts);
 
 	/**** free memory for the service group list ****/
 	for (i = 0; i < num_objects.servicegroups; i++) {
@@ -2441,11 +2590,14 @@ int free_object_data(void)
 		my_free(this_servicegroup->notes);
 		my_free(this_servicegroup->notes_url);
 		my_free(this_servicegroup->action_url);
+		my_free(this_servicegroup->member_objs.objs);
 		my_free(this_servicegroup);
 	}
 
 	/* reset pointers */
 	my_free(servicegroup_ary);
+	free_group_membership(&servicegroup_services);
+	free_group_membership(&servicegroup_hosts);
 
 	/**** free memory for the contact list ****/
 	for (i = 0; i < num_objects.contacts; i++) {
@@ -2513,11 +2665,13 @@ int free_object_data(void)
 		if (this_contactgroup->alias != this_contactgroup->group_name)
 			my_free(this_contactgroup->alias);
 		my_free(this_contactgroup->group_name);
+		my_free(this_contactgroup->member_objs.objs);
 		my_free(this_contactgroup);
 	}
 
 	/* reset pointers */
 	my_free(contactgroup_ary);
+	free_group_membership(&contactgroup_contacts);
 
 
 	/**** free memory for the service list ****/
@@ -2569,6 +2723,8 @@ int free_object_data(void)
 		my_free(this_service->action_url);
 		my_free(this_service->icon_image);
 		my_free(this_service->icon_image_alt);
+		my_free(this_service->contact_objs.objs);
+		my_free(this_service->contactgroup_objs.objs);
 		my_free(this_service);
 	}
 
@@ -2581,6 +2737,7 @@ int free_object_data(void)
 		command *this_command = command_ary[i];
 		my_free(this_command->name);
 		my_free(this_command->command_line);
+		destroy_command_template(this_command->tmpl);
 		my_free(this_command);
 	}
 
@@ -2607,6 +2764,8 @@ int free_object_data(void)
 			my_free(this_contactsmember);
 			this_contactsmember = next_contactsmember;
 		}
+		my_free(this_serviceescalation->contact_objs.objs);
+		my_free(this_serviceescalation->contactgroup_objs.objs);
 		my_free(this_serviceescalation);
 	}
 
@@ -2649,6 +2808,8 @@ int free_object_data(void)
 			my_free(this_contactsmember);
 			this_contactsmember = next_contactsmember;
 		}
+		my_free(this_hostescalation->contact_objs.objs);
+		my_free(this_hostescalation->contactgroup_objs.objs);
 		my_free(this_hostescalation);
 	}
 
@@ -2813,8 +2974,11 @@ void fcache_timeperiod(FILE *fp, timeperiod *temp_timeperiod)
 
 void fcache_command(FILE *fp, command *temp_command)
 {
-	fprintf(fp, "define command {\n\tcommand_name\t%s\n\tcommand_line\t%s\n\t}\n\n",
+	fprintf(fp, "define command {\n\tcommand_name\t%s\n\tcommand_line\t%s\n",
 	        temp_command->name, temp_command->command_line);
+	if (temp_command->max_concurrent_checks > 0)
+		fprintf(fp, "\tmax_concurrent_checks\t%d\n", temp_command->max_concurrent_checks);
+	fprintf(fp, "\t}\n\n");
 }
 
 void fcache_contactgroup(FILE *fp, contactgroup *temp_contactgroup)
@@ -2986,6 +3150,8 @@ void fcache_host(FILE *fp, host *temp_host)
 		fprintf(fp, "\taction_url\t%s\n", temp_host->action_url);
 	fprintf(fp, "\tretain_status_information\t%d\n", temp_host->retain_status_information);
 	fprintf(fp, "\tretain_nonstatus_information\t%d\n", temp_host->retain_nonstatus_information);
+	if (temp_host->max_concurrent_checks > 0)
+		fprintf(fp, "\tmax_concurrent_checks\t%d\n", temp_host->max_concurrent_checks);
 
 	/* custom variables */
 	fcache_customvars(fp, temp_host->custom_variables);
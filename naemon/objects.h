@@ -225,6 +225,23 @@ typedef struct objectlist {
 } objectlist;
 
 
+/*
+ * OBJECT ARRAY STRUCTURE
+ * Member lists are frozen into these once all objects are read, so
+ * walking a group or a contact list doesn't mean chasing a separately
+ * allocated node per member. The lists themselves are left as they
+ * are for modules and for anything running before that.
+ */
+typedef struct objectarray {
+	unsigned int count;
+	void **objs;
+} objectarray;
+
+/* iterate over an objectarray, assigning each member to obj */
+#define objectarray_foreach(ary, i, obj) \
+	for ((i) = 0; (i) < (ary)->count && ((obj) = (ary)->objs[i], 1); (i)++)
+
+
 /* TIMERANGE structure */
 typedef struct timerange {
 	unsigned long range_start;
@@ -287,6 +304,7 @@ typedef struct contactgroup {
 	char    *alias;
 	struct contactsmember *members;
 	struct contactgroup *next;
+	struct objectarray member_objs;
 } contactgroup;
 
 
@@ -307,12 +325,24 @@ typedef struct customvariablesmember {
 } customvariablesmember;
 
 
+/* COMMAND_TEMPLATE structure - a command_line split into words at config load */
+typedef struct command_template {
+	int     needs_shell; /* the command line only works through the shell */
+	int     argc;
+	char    **words; /* each word as it is in the command line, quotes and macros included */
+	char    **args; /* the argument a word without macros stands for, or NULL */
+	size_t  *offsets; /* where in the command line each word starts */
+} command_template;
+
+
 /* COMMAND structure */
 typedef struct command {
 	unsigned int id;
 	char    *name;
 	char    *command_line;
 	struct command *next;
+	struct command_template *tmpl;
+	int     max_concurrent_checks;  /* checks using this command that may run at once, 0 = unlimited */
 } command;
 
 
@@ -384,6 +414,7 @@ typedef struct hostgroup {
 	char    *notes_url;
 	char    *action_url;
 	struct	hostgroup *next;
+	struct objectarray member_objs;
 } hostgroup;
 
 
@@ -500,6 +531,9 @@ struct host {
 	struct objectlist *escalation_list;
 	struct  host *next;
 	struct timed_event *next_check_event;
+	struct objectarray service_objs;
+	struct objectarray contact_objs, contactgroup_objs;
+	int     max_concurrent_checks;  /* checks of the host and its services that may run at once, 0 = unlimited */
 };
 
 
@@ -513,6 +547,7 @@ typedef struct servicegroup {
 	char    *notes_url;
 	char    *action_url;
 	struct	servicegroup *next;
+	struct objectarray member_objs;
 } servicegroup;
 
 
@@ -620,6 +655,7 @@ struct service {
 	struct objectlist *escalation_list;
 	struct service *next;
 	struct timed_event *next_check_event;
+	struct objectarray contact_objs, contactgroup_objs;
 };
 
 
@@ -637,6 +673,7 @@ typedef struct serviceescalation {
 	struct contactsmember *contacts;
 	struct service *service_ptr;
 	struct timeperiod *escalation_period_ptr;
+	struct objectarray contact_objs, contactgroup_objs;
 } serviceescalation;
 
 /* SERVICE DEPENDENCY structure */
@@ -669,6 +706,7 @@ typedef struct hostescalation {
 	struct contactsmember *contacts;
 	struct host    *host_ptr;
 	struct timeperiod *escalation_period_ptr;
+	struct objectarray contact_objs, contactgroup_objs;
 } hostescalation;
 
 
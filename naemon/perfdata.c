@@ -4,6 +4,12 @@
 #include "perfdata.h"
 #include "macros.h"
 #include "xpddefault.h"
+#include "perfsink.h"
+#include "globals.h"
+#include "nm_alloc.h"
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
 
 
 /******************************************************************/
@@ -13,6 +19,7 @@
 /* initializes performance data */
 int initialize_performance_data(const char *cfgfile)
 {
+	perfsink_open();
 	return xpddefault_initialize_performance_data(cfgfile);
 }
 
@@ -20,6 +27,8 @@ int initialize_performance_data(const char *cfgfile)
 /* cleans up performance data */
 int cleanup_performance_data(void)
 {
+	perfsink_close();
+	my_free(perfdata_sink);
 	return xpddefault_cleanup_performance_data();
 }
 
@@ -41,6 +50,7 @@ int update_service_performance_data(service *svc)
 		return OK;
 
 	/* process the performance data! */
+	perfsink_service(svc);
 	xpddefault_update_service_performance_data(svc);
 
 	return OK;
@@ -60,7 +70,220 @@ int update_host_performance_data(host *hst)
 		return OK;
 
 	/* process the performance data! */
+	perfsink_host(hst);
 	xpddefault_update_host_performance_data(hst);
 
 	return OK;
 }
+
+
+/******************************************************************/
+/******************** PERFORMANCE DATA PARSING ********************/
+/******************************************************************/
+
+/*
+ * Parses a plain number, which may use a comma as decimal separator.
+ * If it has a decimal point too, commas only group its digits, as in
+ * 1,234.5. Infinities, NaN and hex numbers aren't something plugins
+ * print on purpose, so we refuse them.
+ */
+static int parse_number(char *str, char **end, double *result)
+{
+	char buf[64], *p = str, *digits_end, *buf_end;
+	size_t len = 0, used;
+	int has_point = FALSE;
+
+	if (*p == '+' || *p == '-')
+		p++;
+	if (!isdigit((unsigned char)*p) && *p != '.' && *p != ',')
+		return ERROR;
+	for (; isdigit((unsigned char)*p) || *p == '.' || *p == ','; p++) {
+		if (*p == '.')
+			has_point = TRUE;
+	}
+	if (*p == 'x' || *p == 'X')
+		return ERROR;
+	digits_end = p;
+
+	/* strtod() wants a point, and no grouping, but may need what follows for the exponent */
+	for (p = str; *p && len < sizeof(buf) - 1; p++) {
+		if (p < digits_end && *p == ',') {
+			if (has_point)
+				continue;
+			buf[len++] = '.';
+		} else {
+			buf[len++] = *p;
+		}
+	}
+	buf[len] = 0;
+
+	*result = strtod(buf, &buf_end);
+	if (buf_end == buf || !isfinite(*result))
+		return ERROR;
+
+	/* find where in str the number strtod() took ends */
+	for (p = str, used = buf_end - buf; used; p++) {
+		if (p >= digits_end || *p != ',' || !has_point)
+			used--;
+	}
+	*end = p;
+	return OK;
+}
+
+/* a number that must make up the whole field */
+static int parse_field(char *str, double *result)
+{
+	char *end;
+
+	if (parse_number(str, &end, result) != OK || *end)
+		return ERROR;
+	return OK;
+}
+
+/* parses [@][start:][end], where start may be ~ for negative infinity */
+static int parse_range(char *str, perfdata_range *range)
+{
+	char *colon;
+
+	range->inside = FALSE;
+	if (*str == '@') {
+		range->inside = TRUE;
+		str++;
+	}
+
+	if (!(colon = strchr(str, ':'))) {
+		range->start = 0;
+		return parse_field(str, &range->end);
+	}
+
+	*colon = 0;
+	if (!strcmp(str, "~"))
+		range->start = -INFINITY;
+	else if (!*str)
+		range->start = 0;
+	else if (parse_field(str, &range->start) != OK)
+		return ERROR;
+
+	if (!colon[1])
+		range->end = INFINITY;
+	else if (parse_field(colon + 1, &range->end) != OK)
+		return ERROR;
+
+	return range->start <= range->end ? OK : ERROR;
+}
+
+/* parses the value[uom];warn;crit;min;max part of a metric in place */
+static int parse_metric_values(char *str, perfdata_metric *m)
+{
+	char *field[5] = { NULL };
+	char *end;
+	int i;
+
+	for (i = 0; i < 5 && str; i++) {
+		field[i] = str;
+		if ((str = strchr(str, ';')))
+			*str++ = 0;
+	}
+
+	if (!strcmp(field[0], "U")) {
+		m->uom = "";
+	} else {
+		if (parse_number(field[0], &end, &m->value) != OK)
+			return ERROR;
+		m->uom = end;
+		m->flags |= PERFDATA_VALUE;
+	}
+
+	/* thresholds and limits that don't parse are ignored, not fatal */
+	if (field[1] && *field[1] && parse_range(field[1], &m->warn) == OK)
+		m->flags |= PERFDATA_WARN;
+	if (field[2] && *field[2] && parse_range(field[2], &m->crit) == OK)
+		m->flags |= PERFDATA_CRIT;
+	if (field[3] && *field[3] && parse_field(field[3], &m->min) == OK)
+		m->flags |= PERFDATA_MIN;
+	if (field[4] && *field[4] && parse_field(field[4], &m->max) == OK)
+		m->flags |= PERFDATA_MAX;
+
+	return OK;
+}
+
+int parse_perfdata(const char *perf_data, perfdata_list *list)
+{
+	size_t len;
+	char *p, *label, *end;
+	perfdata_metric *m;
+
+	list->count = 0;
+	if (!perf_data)
+		return 0;
+
+	/* unquoting only ever shortens labels, so we can parse in place */
+	len = strlen(perf_data) + 1;
+	if (len > list->buf_size) {
+		list->buf_size = len;
+		list->buf = nm_realloc(list->buf, len);
+	}
+	memcpy(list->buf, perf_data, len);
+
+	for (p = list->buf; *p;) {
+		if (isspace((unsigned char)*p)) {
+			p++;
+			continue;
+		}
+
+		if (*p == '\'') {
+			char *dst;
+
+			/* 'it''s quoted' */
+			label = dst = ++p;
+			for (;;) {
+				if (!*p)
+					return list->count;
+				if (*p == '\'') {
+					if (p[1] != '\'')
+						break;
+					p++;
+				}
+				*dst++ = *p++;
+			}
+			*dst = 0;
+			p++;
+		} else {
+			label = p;
+			while (*p && *p != '=' && !isspace((unsigned char)*p))
+				p++;
+		}
+
+		/* the value part can't contain whitespace */
+		for (end = p; *end && !isspace((unsigned char)*end); end++)
+			;
+		if (*p != '=' || p == label) {
+			p = end;
+			continue;
+		}
+		*p++ = 0;
+		if (*end)
+			*end++ = 0;
+
+		if (list->count == list->size) {
+			list->size = list->size ? list->size * 2 : 16;
+			list->metrics = nm_realloc(list->metrics, list->size * sizeof(*list->metrics));
+		}
+		m = &list->metrics[list->count];
+		memset(m, 0, sizeof(*m));
+		m->label = label;
+		if (parse_metric_values(p, m) == OK)
+			list->count++;
+		p = end;
+	}
+
+	return list->count;
+}
+
+void free_perfdata_list(perfdata_list *list)
+{
+	my_free(list->metrics);
+	my_free(list->buf);
+	list->count = list->size = 0;
+	list->buf_size = 0;
+}
@@ -10,11 +10,49 @@
 
 NAGIOS_BEGIN_DECL
 
+/*
+ * A warning or critical threshold. Plugins alert when the value is
+ * outside [start, end], or inside it if the range began with '@'.
+ * Open ends are -INFINITY and INFINITY.
+ */
+typedef struct perfdata_range {
+	double start, end;
+	int inside;
+} perfdata_range;
+
+/* which parts of a metric the plugin gave us */
+#define PERFDATA_VALUE (1 << 0)
+#define PERFDATA_WARN  (1 << 1)
+#define PERFDATA_CRIT  (1 << 2)
+#define PERFDATA_MIN   (1 << 3)
+#define PERFDATA_MAX   (1 << 4)
+
+/* a single label=value[uom];[warn];[crit];[min];[max] item */
+typedef struct perfdata_metric {
+	const char *label;
+	const char *uom;                            /* "" if there's none */
+	double value;                               /* unset when the plugin said 'U' */
+	perfdata_range warn, crit;
+	double min, max;
+	unsigned int flags;
+} perfdata_metric;
+
+/* parsed metrics, whose strings point into buf. Reused between parses */
+typedef struct perfdata_list {
+	perfdata_metric *metrics;
+	unsigned int count, size;
+	char *buf;
+	size_t buf_size;
+} perfdata_list;
+
 int initialize_performance_data(const char *);    /* initializes performance data */
 int cleanup_performance_data(void);               /* cleans up performance data */
 
 int update_host_performance_data(host *);         /* updates host performance data */
 int update_service_performance_data(service *);   /* updates service performance data */
 
+int parse_perfdata(const char *perf_data, perfdata_list *list); /* returns number of valid metrics */
+void free_perfdata_list(perfdata_list *list);
+
 NAGIOS_END_DECL
 #endif
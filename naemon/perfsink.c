@@ -0,0 +1,443 @@
+#include "config.h"
+#include "common.h"
+#include "objects.h"
+#include "perfdata.h"
+#include "perfsink.h"
+#include "globals.h"
+#include "logging.h"
+#include "nm_alloc.h"
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* we write what we have once this much is buffered... */
+#define PERFSINK_FLUSH_SIZE (64 * 1024)
+/* ...or when the oldest line has waited this many milliseconds */
+#define PERFSINK_FLUSH_INTERVAL 1000
+
+static int sink_fd = -1;
+static int sink_is_socket;
+static struct {
+	char *buf;
+	size_t len, size;
+	int partial; /* the first line has been written in part */
+} sbuf;
+static struct {
+	char *buf;
+	size_t len, size;
+} line;
+static struct timespec first_pending, last_attempt;
+#define have_pending() (first_pending.tv_sec || first_pending.tv_nsec)
+
+/*
+ * Set when the reader didn't take everything we had, or went away.
+ * We then leave it alone for a flush interval instead of retrying on
+ * every pass through the event loop.
+ */
+static int blocked;
+static unsigned long dropped;
+static time_t last_drop_warning;
+static perfdata_list metrics;
+
+static long long ms_since(const struct timespec *then)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - then->tv_sec) * 1000LL + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+static int sink_connect(void)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_attempt);
+	sink_is_socket = !stat(perfdata_sink, &st) && S_ISSOCK(st.st_mode);
+	if (!sink_is_socket) {
+		sink_fd = open(perfdata_sink, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644);
+		return sink_fd < 0 ? ERROR : OK;
+	}
+
+	if (strlen(perfdata_sink) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return ERROR;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, perfdata_sink);
+	if ((sink_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return ERROR;
+	if (connect(sink_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int saved_errno = errno;
+		close(sink_fd);
+		sink_fd = -1;
+		errno = saved_errno;
+		return ERROR;
+	}
+	return OK;
+}
+
+static void sink_disconnect(const char *why)
+{
+	logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Lost perfdata sink '%s': %s\n", perfdata_sink, why);
+	close(sink_fd);
+	sink_fd = -1;
+	/* whatever we write next must start on a fresh line */
+	if (sbuf.partial) {
+		char *nl = memchr(sbuf.buf, '\n', sbuf.len);
+		size_t skip = nl - sbuf.buf + 1;
+		memmove(sbuf.buf, sbuf.buf + skip, sbuf.len - skip);
+		sbuf.len -= skip;
+		sbuf.partial = FALSE;
+	}
+}
+
+static int sink_write(void)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < sbuf.len) {
+		if (sink_is_socket)
+			ret = send(sink_fd, sbuf.buf + done, sbuf.len - done, MSG_NOSIGNAL | MSG_DONTWAIT);
+		else
+			ret = write(sink_fd, sbuf.buf + done, sbuf.len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				if (done)
+					break;
+				sink_disconnect(strerror(errno));
+				return ERROR;
+			}
+			break;
+		}
+		done += ret;
+	}
+
+	if (done) {
+		sbuf.partial = sbuf.buf[done - 1] != '\n';
+		memmove(sbuf.buf, sbuf.buf + done, sbuf.len - done);
+		sbuf.len -= done;
+	}
+	return sbuf.len ? ERROR : OK;
+}
+
+int perfsink_flush(int force)
+{
+	if (!perfdata_sink || !have_pending())
+		return OK;
+	if (blocked && !force && ms_since(&last_attempt) < PERFSINK_FLUSH_INTERVAL)
+		return OK;
+	if (!blocked && !force && sbuf.len < PERFSINK_FLUSH_SIZE && ms_since(&first_pending) < PERFSINK_FLUSH_INTERVAL)
+		return OK;
+
+	if (sink_fd < 0 && sink_connect() != OK) {
+		blocked = TRUE;
+		return ERROR;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &last_attempt);
+	if (sink_write() != OK) {
+		blocked = TRUE;
+		return ERROR;
+	}
+
+	blocked = FALSE;
+	first_pending.tv_sec = first_pending.tv_nsec = 0;
+	return OK;
+}
+
+int perfsink_flush_delay(void)
+{
+	long long ms;
+
+	if (!perfdata_sink || !have_pending())
+		return -1;
+	if (blocked)
+		ms = PERFSINK_FLUSH_INTERVAL - ms_since(&last_attempt);
+	else if (sbuf.len >= PERFSINK_FLUSH_SIZE)
+		ms = 0;
+	else
+		ms = PERFSINK_FLUSH_INTERVAL - ms_since(&first_pending);
+
+	return ms < 0 ? 0 : (int)ms;
+}
+
+unsigned long perfsink_dropped(void)
+{
+	return dropped;
+}
+
+int perfsink_open(void)
+{
+	if (!perfdata_sink || sbuf.buf)
+		return OK;
+
+	sbuf.size = perfdata_sink_buffer_size;
+	sbuf.buf = nm_malloc(sbuf.size);
+	sbuf.len = 0;
+	sbuf.partial = FALSE;
+	blocked = FALSE;
+	dropped = 0;
+	last_drop_warning = 0;
+
+	/* a reader that isn't there yet is only a problem once it's still missing */
+	if (sink_connect() != OK) {
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Failed to open perfdata sink '%s': %s\n", perfdata_sink, strerror(errno));
+		blocked = TRUE;
+	}
+	return OK;
+}
+
+void perfsink_close(void)
+{
+	if (!sbuf.buf)
+		return;
+
+	if (sink_fd >= 0)
+		perfsink_flush(TRUE);
+	if (sbuf.len || dropped)
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Perfdata sink '%s' dropped %lu lines, and %lu unwritten bytes are lost\n",
+		      perfdata_sink, dropped, (unsigned long)sbuf.len);
+	if (sink_fd >= 0)
+		close(sink_fd);
+	sink_fd = -1;
+	my_free(sbuf.buf);
+	sbuf.len = sbuf.size = 0;
+	my_free(line.buf);
+	line.len = line.size = 0;
+	free_perfdata_list(&metrics);
+	first_pending.tv_sec = first_pending.tv_nsec = 0;
+}
+
+/* drops the oldest line we can, without touching a half written one */
+static int drop_oldest(void)
+{
+	size_t start = 0, end;
+	char *nl;
+
+	if (sbuf.partial) {
+		nl = memchr(sbuf.buf, '\n', sbuf.len);
+		start = nl - sbuf.buf + 1;
+	}
+	if (start >= sbuf.len)
+		return ERROR;
+
+	nl = memchr(sbuf.buf + start, '\n', sbuf.len - start);
+	end = nl - sbuf.buf + 1;
+	memmove(sbuf.buf + start, sbuf.buf + end, sbuf.len - end);
+	sbuf.len -= end - start;
+	dropped++;
+	return OK;
+}
+
+static void sink_add_line(void)
+{
+	while (sbuf.len + line.len > sbuf.size) {
+		if (time(NULL) - last_drop_warning >= 60) {
+			logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Perfdata sink '%s' can't keep up. Dropping the oldest metrics\n", perfdata_sink);
+			last_drop_warning = time(NULL);
+		}
+		if (drop_oldest() != OK) {
+			dropped++;
+			return;
+		}
+	}
+
+	memcpy(sbuf.buf + sbuf.len, line.buf, line.len);
+	sbuf.len += line.len;
+	if (!have_pending())
+		clock_gettime(CLOCK_MONOTONIC, &first_pending);
+}
+
+static void ladd(const char *s, size_t len)
+{
+	if (line.len + len > line.size) {
+		while (line.len + len > line.size)
+			line.size = line.size ? line.size * 2 : 512;
+		line.buf = nm_realloc(line.buf, line.size);
+	}
+	memcpy(line.buf + line.len, s, len);
+	line.len += len;
+}
+
+#define lstr(s) ladd(s, strlen(s))
+
+static void lnum(double v)
+{
+	char num[32];
+
+	ladd(num, snprintf(num, sizeof(num), "%.15g", v));
+}
+
+/* influx wants commas, spaces and equal signs in tags escaped */
+static void linflux_tag(const char *key, const char *value)
+{
+	const char *p;
+
+	ladd(",", 1);
+	lstr(key);
+	ladd("=", 1);
+	for (p = value; *p; p++) {
+		if (*p == '\n' || *p == '\r') {
+			ladd("\\ ", 2);
+			continue;
+		}
+		if (*p == ',' || *p == ' ' || *p == '=' || *p == '\\')
+			ladd("\\", 1);
+		ladd(p, 1);
+	}
+}
+
+static void linflux_field(const char *key, double v, int *first)
+{
+	ladd(*first ? " " : ",", 1);
+	*first = FALSE;
+	lstr(key);
+	ladd("=", 1);
+	lnum(v);
+}
+
+static void linflux_range(const char *key, const perfdata_range *r, int *first)
+{
+	char name[32];
+
+	if (isfinite(r->start)) {
+		sprintf(name, "%s_start", key);
+		linflux_field(name, r->start, first);
+	}
+	if (isfinite(r->end)) {
+		sprintf(name, "%s_end", key);
+		linflux_field(name, r->end, first);
+	}
+	if (r->inside) {
+		sprintf(name, "%s_inside", key);
+		ladd(*first ? " " : ",", 1);
+		*first = FALSE;
+		lstr(name);
+		ladd("=true", 5);
+	}
+}
+
+static void add_influx(const char *host_name, const char *description, const perfdata_metric *m, time_t when)
+{
+	char ts[32];
+	int first = TRUE;
+
+	line.len = 0;
+	lstr("perfdata");
+	linflux_tag("host", host_name);
+	if (description)
+		linflux_tag("service", description);
+	linflux_tag("metric", m->label);
+	if (*m->uom)
+		linflux_tag("unit", m->uom);
+
+	if (m->flags & PERFDATA_VALUE)
+		linflux_field("value", m->value, &first);
+	if (m->flags & PERFDATA_WARN)
+		linflux_range("warn", &m->warn, &first);
+	if (m->flags & PERFDATA_CRIT)
+		linflux_range("crit", &m->crit, &first);
+	if (m->flags & PERFDATA_MIN)
+		linflux_field("min", m->min, &first);
+	if (m->flags & PERFDATA_MAX)
+		linflux_field("max", m->max, &first);
+
+	/* a line without fields isn't valid, and has nothing to say anyway */
+	if (first)
+		return;
+	ladd(ts, sprintf(ts, " %lld000000000\n", (long long)when));
+	sink_add_line();
+}
+
+/* graphite paths can't have dots, spaces or much else in their nodes */
+static void lgraphite_node(const char *s)
+{
+	const char *p;
+
+	for (p = s; *p; p++) {
+		if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '-' || *p == '_')
+			ladd(p, 1);
+		else
+			ladd("_", 1);
+	}
+}
+
+/* every value gets its own line, all starting with the same path */
+static void add_graphite_value(size_t prefix_len, const char *key, double v, time_t when)
+{
+	char ts[32];
+
+	line.len = prefix_len;
+	lstr(key);
+	ladd(" ", 1);
+	lnum(v);
+	ladd(ts, sprintf(ts, " %lld\n", (long long)when));
+	sink_add_line();
+}
+
+static void add_graphite(const char *host_name, const char *description, const perfdata_metric *m, time_t when)
+{
+	size_t prefix_len;
+
+	line.len = 0;
+	lgraphite_node(host_name);
+	ladd(".", 1);
+	lgraphite_node(description ? description : "_HOST_");
+	ladd(".", 1);
+	lgraphite_node(m->label);
+	ladd(".", 1);
+	prefix_len = line.len;
+
+	if (m->flags & PERFDATA_VALUE)
+		add_graphite_value(prefix_len, "value", m->value, when);
+	if ((m->flags & PERFDATA_WARN) && isfinite(m->warn.start))
+		add_graphite_value(prefix_len, "warn_start", m->warn.start, when);
+	if ((m->flags & PERFDATA_WARN) && isfinite(m->warn.end))
+		add_graphite_value(prefix_len, "warn_end", m->warn.end, when);
+	if ((m->flags & PERFDATA_CRIT) && isfinite(m->crit.start))
+		add_graphite_value(prefix_len, "crit_start", m->crit.start, when);
+	if ((m->flags & PERFDATA_CRIT) && isfinite(m->crit.end))
+		add_graphite_value(prefix_len, "crit_end", m->crit.end, when);
+	if (m->flags & PERFDATA_MIN)
+		add_graphite_value(prefix_len, "min", m->min, when);
+	if (m->flags & PERFDATA_MAX)
+		add_graphite_value(prefix_len, "max", m->max, when);
+}
+
+static void perfsink_add(const char *host_name, const char *description, const char *perf_data, time_t when)
+{
+	unsigned int i;
+
+	if (!sbuf.buf || !perf_data || !*perf_data)
+		return;
+	if (!when)
+		when = time(NULL);
+
+	parse_perfdata(perf_data, &metrics);
+	for (i = 0; i < metrics.count; i++) {
+		if (perfdata_sink_format == PERFSINK_GRAPHITE)
+			add_graphite(host_name, description, &metrics.metrics[i], when);
+		else
+			add_influx(host_name, description, &metrics.metrics[i], when);
+	}
+
+	if (sbuf.len >= PERFSINK_FLUSH_SIZE && !blocked)
+		perfsink_flush(FALSE);
+}
+
+void perfsink_host(struct host *hst)
+{
+	perfsink_add(hst->name, NULL, hst->perf_data, hst->last_check);
+}
+
+void perfsink_service(struct service *svc)
+{
+	perfsink_add(svc->host_name, svc->description, svc->perf_data, svc->last_check);
+}
@@ -0,0 +1,38 @@
+#ifndef _PERFSINK_H
+#define _PERFSINK_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "common.h"
+#include "objects.h"
+
+/*
+ * The perfdata sink writes every metric of every host and service
+ * check to perfdata_sink, which is either a regular file or a unix
+ * stream socket, in InfluxDB line protocol or Graphite's plaintext
+ * protocol. Lines are buffered and written in batches, without ever
+ * blocking. If the reader can't keep up, at most
+ * perfdata_sink_buffer_size bytes are kept and the oldest lines are
+ * dropped to make room for new ones.
+ */
+
+/* values for perfdata_sink_format */
+#define PERFSINK_INFLUX   0
+#define PERFSINK_GRAPHITE 1
+
+NAGIOS_BEGIN_DECL
+
+int perfsink_open(void);                    /* starts writing to perfdata_sink */
+void perfsink_close(void);                  /* flushes what it can and stops */
+int perfsink_flush(int force);              /* writes buffered lines if it's time to */
+int perfsink_flush_delay(void);             /* ms until the next flush is due, or -1 if none is */
+unsigned long perfsink_dropped(void);       /* lines dropped since the sink was opened */
+
+void perfsink_host(struct host *hst);
+void perfsink_service(struct service *svc);
+
+NAGIOS_END_DECL
+
+#endif
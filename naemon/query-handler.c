@@ -8,7 +8,10 @@
 #include "loadctl.h"
 #include "globals.h"
 #include "commands.h"
+#include "objects.h"
+#include "snapshot.h"
 #include "nm_alloc.h"
+#include <pthread.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -29,6 +32,28 @@ static unsigned int qh_running;
 unsigned int qh_max_running = 0; /* defaults to unlimited */
 static dkhash_table *qh_table;
 
+/* a query answered by a worker thread, on its way there and back */
+struct qh_job {
+	mpscq_node node; /* must be first */
+	int sd;
+	iocache *ioc;
+	struct query_handler *qh;
+	char *query;
+	unsigned int query_len;
+	int keepalive;
+	int result;
+	struct qh_job *next;
+};
+
+unsigned int qh_threads = 0; /* answer QH_THREADSAFE queries in the event loop */
+static pthread_t *qh_thread_ids;
+static unsigned int qh_threads_running;
+static pthread_mutex_t qh_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qh_job_cond = PTHREAD_COND_INITIALIZER;
+static struct qh_job *qh_job_head, *qh_job_tail;
+static int qh_threads_stopping;
+static mpscq *qh_jobs_done;
+
 /* the echo service. stupid, but useful for testing */
 static int qh_echo(int sd, char *buf, unsigned int len)
 {
@@ -90,6 +115,173 @@ const char *qh_strerror(int code)
 	return "Unknown error";
 }
 
+static int qh_input(int sd, int events, void *ioc_);
+
+static int qh_run_handler(int sd, struct query_handler *qh, char *query, unsigned int query_len)
+{
+	int result;
+
+	if ((result = qh->handler(sd, query, query_len)) >= 100) {
+		nsock_printf_nul(sd, "%d: %s", result, qh_strerror(result));
+	}
+	return result;
+}
+
+/* closes or keeps the socket of an answered query, which must be registered */
+static void qh_finish(int sd, iocache *ioc, int keepalive, int result)
+{
+	if (result >= 300 || !keepalive) {
+		/* error code or one-shot query */
+		iobroker_close(nagios_iobs, sd);
+		iocache_destroy(ioc);
+		return;
+	}
+
+	/* check for magic handler codes */
+	switch (result) {
+	case QH_CLOSE: /* oneshot handler */
+	case -1:       /* general error */
+		iobroker_close(nagios_iobs, sd);
+		/* fallthrough */
+	case QH_TAKEOVER: /* handler takes over */
+	case 101:         /* switch protocol (takeover + message) */
+		iocache_destroy(ioc);
+		break;
+	}
+}
+
+/*
+ * The socket is kept away from the io broker until the query is
+ * answered, so nothing else touches it or its iocache meanwhile.
+ */
+static void qh_dispatch(int sd, iocache *ioc, struct query_handler *qh, char *query, unsigned int query_len, int keepalive)
+{
+	struct qh_job *job = nm_calloc(1, sizeof(*job));
+
+	job->sd = sd;
+	job->ioc = ioc;
+	job->qh = qh;
+	job->query = query;
+	job->query_len = query_len;
+	job->keepalive = keepalive;
+	iobroker_unregister(nagios_iobs, sd);
+
+	pthread_mutex_lock(&qh_job_lock);
+	if (qh_job_tail)
+		qh_job_tail->next = job;
+	else
+		qh_job_head = job;
+	qh_job_tail = job;
+	pthread_cond_signal(&qh_job_cond);
+	pthread_mutex_unlock(&qh_job_lock);
+}
+
+static void *qh_worker(void *arg)
+{
+	epoch_reader *reader = snapshot_reader_register();
+	struct qh_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&qh_job_lock);
+		while (!qh_job_head && !qh_threads_stopping)
+			pthread_cond_wait(&qh_job_cond, &qh_job_lock);
+		if ((job = qh_job_head)) {
+			qh_job_head = job->next;
+			if (!qh_job_head)
+				qh_job_tail = NULL;
+		}
+		pthread_mutex_unlock(&qh_job_lock);
+
+		/* we only stop once the queue is empty */
+		if (!job)
+			break;
+
+		snapshot_begin(reader);
+		job->result = qh_run_handler(job->sd, job->qh, job->query, job->query_len);
+		snapshot_end(reader);
+		mpscq_push(qh_jobs_done, &job->node);
+	}
+
+	snapshot_reader_unregister(reader);
+	return NULL;
+}
+
+/* hands sockets of answered queries back to the io broker */
+static void qh_jobs_drain(int shutdown)
+{
+	mpscq_node *node;
+
+	while ((node = mpscq_pop(qh_jobs_done))) {
+		struct qh_job *job = (struct qh_job *)node;
+
+		if (shutdown || iobroker_register(nagios_iobs, job->sd, job->ioc, qh_input) < 0) {
+			close(job->sd);
+			iocache_destroy(job->ioc);
+			qh_running--;
+		} else {
+			qh_finish(job->sd, job->ioc, job->keepalive, job->result);
+		}
+		free(job);
+	}
+}
+
+static int qh_jobs_done_input(int fd, int events, void *arg)
+{
+	mpscq_ack(qh_jobs_done);
+	qh_jobs_drain(FALSE);
+	return 0;
+}
+
+int qh_start_threads(void)
+{
+	unsigned int i;
+
+	if (!qh_threads || qh_threads_running || qh_listen_sock < 0)
+		return OK;
+
+	if (!(qh_jobs_done = mpscq_create()) || iobroker_register(nagios_iobs, mpscq_doorbell(qh_jobs_done), NULL, qh_jobs_done_input) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "qh: Failed to set up queue for worker threads: %s\n", strerror(errno));
+		mpscq_destroy(qh_jobs_done);
+		qh_jobs_done = NULL;
+		return ERROR;
+	}
+
+	qh_threads_stopping = 0;
+	qh_thread_ids = nm_calloc(qh_threads, sizeof(pthread_t));
+	for (i = 0; i < qh_threads; i++) {
+		if (pthread_create(&qh_thread_ids[i], NULL, qh_worker, NULL)) {
+			logit(NSLOG_RUNTIME_WARNING, TRUE, "qh: Failed to start worker thread %u: %s\n", i, strerror(errno));
+			break;
+		}
+	}
+	qh_threads_running = i;
+	logit(NSLOG_INFO_MESSAGE, FALSE, "qh: %u worker threads started\n", qh_threads_running);
+
+	return qh_threads_running ? OK : ERROR;
+}
+
+static void qh_stop_threads(void)
+{
+	unsigned int i;
+
+	if (!qh_jobs_done)
+		return;
+
+	pthread_mutex_lock(&qh_job_lock);
+	qh_threads_stopping = 1;
+	pthread_cond_broadcast(&qh_job_cond);
+	pthread_mutex_unlock(&qh_job_lock);
+	for (i = 0; i < qh_threads_running; i++)
+		pthread_join(qh_thread_ids[i], NULL);
+	my_free(qh_thread_ids);
+	qh_threads_running = 0;
+
+	iobroker_unregister(nagios_iobs, mpscq_doorbell(qh_jobs_done));
+	qh_jobs_drain(TRUE);
+	mpscq_destroy(qh_jobs_done);
+	qh_jobs_done = NULL;
+}
+
 static int qh_input(int sd, int events, void *ioc_)
 {
 	iocache *ioc = (iocache *)ioc_;
@@ -191,29 +383,15 @@ static int qh_input(int sd, int events, void *ioc_)
 		while (query_len > 0 && (query[query_len - 1] == 0 || query[query_len - 1] == '\n'))
 			query[--query_len] = 0;
 
-		/* now pass the query to the handler */
-		if ((result = qh->handler(sd, query, query_len)) >= 100) {
-			nsock_printf_nul(sd, "%d: %s", result, qh_strerror(result));
-		}
-
-		if (result >= 300 || *buf != '@') {
-			/* error code or one-shot query */
-			iobroker_close(nagios_iobs, sd);
-			iocache_destroy(ioc);
+		/* let a worker thread answer it if we can */
+		if ((qh->options & QH_THREADSAFE) && qh_threads_running) {
+			qh_dispatch(sd, ioc, qh, query, query_len, *buf == '@');
 			return 0;
 		}
 
-		/* check for magic handler codes */
-		switch (result) {
-		case QH_CLOSE: /* oneshot handler */
-		case -1:       /* general error */
-			iobroker_close(nagios_iobs, sd);
-			/* fallthrough */
-		case QH_TAKEOVER: /* handler takes over */
-		case 101:         /* switch protocol (takeover + message) */
-			iocache_destroy(ioc);
-			break;
-		}
+		/* now pass the query to the handler */
+		result = qh_run_handler(sd, qh, query, query_len);
+		qh_finish(sd, ioc, *buf == '@', result);
 	}
 	return 0;
 }
@@ -289,6 +467,8 @@ void qh_deinit(const char *path)
 {
 	struct query_handler *qh, *next;
 
+	qh_stop_threads();
+
 	for (qh = qhandlers; qh; qh = next) {
 		next = qh->next_qh;
 		qh_deregister_handler(qh->name);
@@ -365,6 +545,7 @@ static int qh_core(int sd, char *buf, unsigned int len)
 		                 "                    The options are the same parameters and format as\n"
 		                 "                    returned above.\n"
 		                 "  squeuestats       scheduling queue statistics\n"
+		                 "  passivestats      passive result coalescing statistics\n"
 		                );
 		return 0;
 	}
@@ -392,6 +573,9 @@ static int qh_core(int sd, char *buf, unsigned int len)
 	if (!space && !strcmp(buf, "squeuestats"))
 		return dump_event_stats(sd);
 
+	if (!space && !strcmp(buf, "passivestats"))
+		return dump_passive_coalesce_stats(sd);
+
 	if (space) {
 		len -= (unsigned long)space - (unsigned long)buf;
 		if (!strcmp(buf, "loadctl")) {
@@ -403,6 +587,45 @@ static int qh_core(int sd, char *buf, unsigned int len)
 	return 404;
 }
 
+/* may run in a worker thread, so it only reads what snapshots cover */
+static int qh_output(int sd, char *buf, unsigned int len)
+{
+	const char *output, *long_output, *perf_data;
+	char *sep;
+
+	if (!*buf || !strcmp(buf, "help")) {
+		nsock_printf_nul(sd, "Query handler for the output of the latest checks.\n"
+		                 "Available commands:\n"
+		                 "  <host>            Print the output of the host's latest check\n"
+		                 "  <host>;<service>  Print the output of the service's latest check\n"
+		                );
+		return 0;
+	}
+
+	if ((sep = strchr(buf, ';'))) {
+		service *svc;
+
+		*(sep++) = 0;
+		if (!(svc = find_service(buf, sep)))
+			return 404;
+		output = snapshot_read(svc->plugin_output);
+		long_output = snapshot_read(svc->long_plugin_output);
+		perf_data = snapshot_read(svc->perf_data);
+	} else {
+		host *hst;
+
+		if (!(hst = find_host(buf)))
+			return 404;
+		output = snapshot_read(hst->plugin_output);
+		long_output = snapshot_read(hst->long_plugin_output);
+		perf_data = snapshot_read(hst->perf_data);
+	}
+
+	nsock_printf_nul(sd, "plugin_output=%s\nlong_plugin_output=%s\nperf_data=%s\n",
+	                 output ? output : "", long_output ? long_output : "", perf_data ? perf_data : "");
+	return 0;
+}
+
 int qh_init(const char *path)
 {
 	int result, old_umask;
@@ -450,7 +673,8 @@ int qh_init(const char *path)
 	if (!qh_register_handler("core", "Naemon Core control and info", 0, qh_core))
 		logit(NSLOG_INFO_MESSAGE, FALSE, "qh: core query handler registered\n");
 	qh_register_handler("command", "Naemon external commands interface", 0, qh_command);
-	qh_register_handler("echo", "The Echo Service - What You Put Is What You Get", 0, qh_echo);
+	qh_register_handler("echo", "The Echo Service - What You Put Is What You Get", QH_THREADSAFE, qh_echo);
+	qh_register_handler("output", "Output of the latest host and service checks", QH_THREADSAFE, qh_output);
 	qh_register_handler("help", "Help for the query handler", 0, qh_help);
 
 	return 0;
@@ -11,6 +11,14 @@
 #define QH_INVALID   2  /* invalid query. Log and close */
 #define QH_TAKEOVER  3  /* handler will take full control. de-register but don't close */
 
+/*
+ * options for qh_register_handler(). With query_handler_threads set,
+ * queries for QH_THREADSAFE handlers are answered by worker threads
+ * inside a snapshot (see snapshot.h), so they must only read what's
+ * safe to read from there, and may not take over the socket.
+ */
+#define QH_THREADSAFE (1 << 0)
+
 NAGIOS_BEGIN_DECL
 
 /*** Query Handler functions, types and macros*/
@@ -19,6 +27,7 @@ typedef int (*qh_handler)(int, char *, unsigned int);
 int qh_init(const char *path);
 void qh_deinit(const char *path);
 int qh_register_handler(const char *name, const char *description, unsigned int options, qh_handler handler);
+int qh_start_threads(void);
 const char *qh_strerror(int code);
 
 NAGIOS_END_DECL
@@ -0,0 +1,230 @@
+#include "config.h"
+#include "common.h"
+#include "objects.h"
+#include "resultq.h"
+#include "checks.h"
+#include "globals.h"
+#include "logging.h"
+#include "utils.h"
+#include "nm_alloc.h"
+#include "lib/mpscq.h"
+#include <string.h>
+
+/* unchanged results processed per pass through the event loop */
+#define RESULTQ_BATCH_SIZE 512
+
+struct queued_result {
+	mpscq_node node;         /* must be first */
+	unsigned int *pending;   /* the object's count of results in the normal lane */
+	check_result cr;
+};
+
+static mpscq *urgent, *normal;
+
+/* results in the normal lane, per object id */
+static unsigned int *pending_hosts, *pending_services;
+static unsigned int num_pending_hosts, num_pending_services;
+
+static unsigned int *pending_slot(unsigned int **counts, unsigned int *len, unsigned int num, unsigned int id)
+{
+	if (!*counts) {
+		*counts = nm_calloc(num ? num : 1, sizeof(**counts));
+		*len = num;
+	}
+	return id < *len ? &(*counts)[id] : NULL;
+}
+
+static int service_result_state(check_result *cr)
+{
+	if (cr->early_timeout)
+		return service_check_timeout_state;
+	if (!cr->exited_ok || cr->return_code < STATE_OK || cr->return_code > STATE_UNKNOWN)
+		return STATE_UNKNOWN;
+	return cr->return_code;
+}
+
+/*
+ * A cheap guess at whether processing the result will change the
+ * object's state, or move a problem along towards a hard state. The
+ * real answer takes all of the result processing to figure out.
+ */
+static int result_is_urgent(check_result *cr, unsigned int **pending)
+{
+	*pending = NULL;
+
+	if (cr->object_check_type == SERVICE_CHECK) {
+		service *svc = find_service(cr->host_name, cr->service_description);
+		if (!svc)
+			return FALSE;
+		*pending = pending_slot(&pending_services, &num_pending_services, num_objects.services, svc->id);
+		if (svc->state_type == SOFT_STATE && svc->current_state != STATE_OK)
+			return TRUE;
+		return service_result_state(cr) != svc->current_state;
+	}
+	if (cr->object_check_type == HOST_CHECK) {
+		host *hst = find_host(cr->host_name);
+		int up;
+		if (!hst)
+			return FALSE;
+		*pending = pending_slot(&pending_hosts, &num_pending_hosts, num_objects.hosts, hst->id);
+		if (hst->state_type == SOFT_STATE && hst->current_state != STATE_UP)
+			return TRUE;
+		up = !cr->early_timeout && cr->exited_ok && cr->return_code == STATE_OK;
+		return up != (hst->current_state == STATE_UP);
+	}
+
+	return FALSE;
+}
+
+static void free_queued_result(struct queued_result *qr)
+{
+	free_check_result(&qr->cr);
+	free(qr);
+}
+
+int resultq_add(check_result *cr)
+{
+	struct queued_result *qr;
+	int is_urgent;
+
+	if (!cr)
+		return ERROR;
+	if (!normal)
+		return process_check_result(cr);
+
+	qr = nm_malloc(sizeof(*qr));
+	qr->cr = *cr;
+	qr->cr.output_file = NULL;
+	qr->cr.output_file_fp = NULL;
+	cr->host_name = cr->service_description = cr->output = NULL;
+
+	/* an object's results can't overtake the ones it already has queued */
+	is_urgent = result_is_urgent(&qr->cr, &qr->pending);
+	if (qr->pending && *qr->pending)
+		is_urgent = FALSE;
+
+	if (is_urgent && prioritize_state_changes) {
+		qr->pending = NULL;
+		mpscq_push(urgent, &qr->node);
+	} else {
+		if (qr->pending)
+			(*qr->pending)++;
+		mpscq_push(normal, &qr->node);
+	}
+
+	return OK;
+}
+
+static void process_queued_result(struct queued_result *qr)
+{
+	if (qr->pending)
+		(*qr->pending)--;
+	process_check_result(&qr->cr);
+	free_queued_result(qr);
+}
+
+static unsigned int drain_urgent(void)
+{
+	mpscq_node *node;
+	unsigned int i;
+
+	for (i = 0; (node = mpscq_pop(urgent)); i++)
+		process_queued_result((struct queued_result *)node);
+
+	return i;
+}
+
+static unsigned int drain_normal(unsigned int max)
+{
+	mpscq_node *node;
+	unsigned int i;
+
+	for (i = 0; i < max && (node = mpscq_pop(normal)); i++)
+		process_queued_result((struct queued_result *)node);
+
+	return i;
+}
+
+unsigned int resultq_drain(unsigned int max)
+{
+	unsigned int done = drain_urgent();
+
+	return done + drain_normal(max);
+}
+
+static int resultq_input(int fd, int events, void *arg)
+{
+	unsigned int changes, done;
+
+	mpscq_ack(urgent);
+	mpscq_ack(normal);
+	changes = drain_urgent();
+	done = drain_normal(RESULTQ_BATCH_SIZE);
+
+	/*
+	 * leave the rest for later, so state changes that arrive in the
+	 * meantime get to go first
+	 */
+	if (done == RESULTQ_BATCH_SIZE)
+		mpscq_kick(normal);
+
+	log_debug_info(DEBUGL_CHECKS, 2, "Processed %u queued check results, %u of them ahead of the rest\n", changes + done, changes);
+	return 0;
+}
+
+int resultq_init(void)
+{
+	if (normal)
+		return OK;
+
+	urgent = mpscq_create();
+	normal = mpscq_create();
+	if (!urgent || !normal) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to create check result queue: %s\n", strerror(errno));
+		resultq_deinit();
+		return ERROR;
+	}
+	if (iobroker_register(nagios_iobs, mpscq_doorbell(urgent), NULL, resultq_input) < 0 ||
+	    iobroker_register(nagios_iobs, mpscq_doorbell(normal), NULL, resultq_input) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to register check result queue with io broker\n");
+		resultq_deinit();
+		return ERROR;
+	}
+
+	return OK;
+}
+
+void resultq_discard(void)
+{
+	mpscq_node *node;
+	unsigned int dropped = 0;
+
+	while ((node = mpscq_pop(urgent))) {
+		free_queued_result((struct queued_result *)node);
+		dropped++;
+	}
+	while ((node = mpscq_pop(normal))) {
+		free_queued_result((struct queued_result *)node);
+		dropped++;
+	}
+	if (dropped)
+		log_debug_info(DEBUGL_CHECKS, 0, "Dropped %u queued check results\n", dropped);
+
+	my_free(pending_hosts);
+	my_free(pending_services);
+	num_pending_hosts = num_pending_services = 0;
+}
+
+void resultq_deinit(void)
+{
+	resultq_discard();
+	if (nagios_iobs) {
+		if (urgent)
+			iobroker_unregister(nagios_iobs, mpscq_doorbell(urgent));
+		if (normal)
+			iobroker_unregister(nagios_iobs, mpscq_doorbell(normal));
+	}
+	mpscq_destroy(urgent);
+	mpscq_destroy(normal);
+	urgent = normal = NULL;
+}
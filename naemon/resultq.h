@@ -0,0 +1,35 @@
+#ifndef _RESULTQ_H
+#define _RESULTQ_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "lib/lnae-utils.h"
+#include "objects.h"
+
+/*
+ * Check results from workers and the spool directory are queued here
+ * and processed from the event loop. Results that are likely to
+ * change an object's state go in a lane of their own, which is always
+ * drained before the rest, so a real problem doesn't have to wait for
+ * thousands of unchanged results to be processed first when they back
+ * up. A result is only let ahead if nothing is queued for the same
+ * object already, so each object sees its results in order.
+ *
+ * resultq_add() takes over the result's strings and clears them in
+ * the caller's check_result. Until resultq_init() has been called,
+ * it processes the result right away instead.
+ */
+
+NAGIOS_BEGIN_DECL
+
+int resultq_init(void);
+void resultq_deinit(void);
+void resultq_discard(void);   /* drops everything queued, before objects go away */
+int resultq_add(check_result *cr);
+unsigned int resultq_drain(unsigned int max);  /* processes up to max results, returns how many */
+
+NAGIOS_END_DECL
+
+#endif
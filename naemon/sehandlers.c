@@ -12,6 +12,7 @@
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "simulation.h"
 #include <string.h>
 
 #ifdef USE_EVENT_BROKER
@@ -49,6 +50,7 @@ int obsessive_compulsive_service_check_processor(service *svc)
 {
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	host *temp_host = NULL;
 	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
 	nagios_macros mac;
@@ -86,7 +88,7 @@ int obsessive_compulsive_service_check_processor(service *svc)
 	log_debug_info(DEBUGL_CHECKS, 2, "Raw obsessive compulsive service processor command line: %s\n", raw_command);
 
 	/* process any macros in the raw command line */
-	process_macros_r(&mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(&mac, ocsp_command_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL) {
 		clear_volatile_macros_r(&mac);
@@ -99,7 +101,7 @@ int obsessive_compulsive_service_check_processor(service *svc)
 	ocj = nm_calloc(1,sizeof(struct obsessive_compulsive_job));
 	ocj->hst = svc->host_ptr;
 	ocj->svc = svc;
-	if(ERROR == wproc_run_callback(processed_command, ocsp_timeout, obsessive_compulsive_job_handler, ocj, &mac)) {
+	if(ERROR == wproc_run_callback_argv(processed_command, argv, ocsp_timeout, obsessive_compulsive_job_handler, ocj, &mac)) {
 		logit(NSLOG_RUNTIME_ERROR, TRUE, "Unable to start OCSP job for service '%s on host '%s' to worker\n", svc->description, svc->host_ptr->name);
 		free(ocj);
 	}
@@ -117,6 +119,7 @@ int obsessive_compulsive_host_check_processor(host *hst)
 {
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
 	nagios_macros mac;
 	struct obsessive_compulsive_job *ocj;
@@ -148,7 +151,7 @@ int obsessive_compulsive_host_check_processor(host *hst)
 	log_debug_info(DEBUGL_CHECKS, 2, "Raw obsessive compulsive host processor command line: %s\n", raw_command);
 
 	/* process any macros in the raw command line */
-	process_macros_r(&mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(&mac, ochp_command_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL) {
 		clear_volatile_macros_r(&mac);
@@ -161,7 +164,7 @@ int obsessive_compulsive_host_check_processor(host *hst)
 	ocj = nm_calloc(1,sizeof(struct obsessive_compulsive_job));
 	ocj->hst = hst;
 	ocj->svc = NULL;
-	if(ERROR == wproc_run_callback(processed_command, ochp_timeout, obsessive_compulsive_job_handler, ocj, &mac)) {
+	if(ERROR == wproc_run_callback_argv(processed_command, argv, ochp_timeout, obsessive_compulsive_job_handler, ocj, &mac)) {
 		logit(NSLOG_RUNTIME_ERROR, TRUE, "Unable to start OCHP job for host '%s' to worker\n", hst->name);
 		free(ocj);
 	}
@@ -237,6 +240,7 @@ int run_global_service_event_handler(nagios_macros *mac, service *svc)
 {
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	char *raw_logentry = NULL;
 	char *processed_logentry = NULL;
 	char *command_output = NULL;
@@ -268,7 +272,7 @@ int run_global_service_event_handler(nagios_macros *mac, service *svc)
 
 #ifdef USE_EVENT_BROKER
 	/* get start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 #endif
 
 	/* get the raw command line */
@@ -280,7 +284,7 @@ int run_global_service_event_handler(nagios_macros *mac, service *svc)
 	log_debug_info(DEBUGL_EVENTHANDLERS, 2, "Raw global service event handler command line: %s\n", raw_command);
 
 	/* process any macros in the raw command line */
-	process_macros_r(mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(mac, global_service_event_handler_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL)
 		return ERROR;
@@ -302,6 +306,7 @@ int run_global_service_event_handler(nagios_macros *mac, service *svc)
 	/* neb module wants to override (or cancel) the event handler - perhaps it will run the eventhandler itself */
 	if (neb_result == NEBERROR_CALLBACKOVERRIDE) {
 		my_free(processed_command);
+		free_command_argv(argv);
 		my_free(raw_logentry);
 		my_free(processed_logentry);
 		return OK;
@@ -309,7 +314,7 @@ int run_global_service_event_handler(nagios_macros *mac, service *svc)
 #endif
 
 	/* run the command through a worker */
-	result = wproc_run_callback(processed_command, event_handler_timeout, event_handler_job_handler, "Global service", mac);
+	result = wproc_run_callback_argv(processed_command, argv, event_handler_timeout, event_handler_job_handler, "Global service", mac);
 
 	/* check to see if the event handler timed out */
 	if (early_timeout == TRUE)
@@ -317,7 +322,7 @@ int run_global_service_event_handler(nagios_macros *mac, service *svc)
 
 #ifdef USE_EVENT_BROKER
 	/* get end time */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 #endif
 
 #ifdef USE_EVENT_BROKER
@@ -340,6 +345,7 @@ int run_service_event_handler(nagios_macros *mac, service *svc)
 {
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	char *raw_logentry = NULL;
 	char *processed_logentry = NULL;
 	char *command_output = NULL;
@@ -367,7 +373,7 @@ int run_service_event_handler(nagios_macros *mac, service *svc)
 
 #ifdef USE_EVENT_BROKER
 	/* get start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 #endif
 
 
@@ -379,7 +385,7 @@ int run_service_event_handler(nagios_macros *mac, service *svc)
 	log_debug_info(DEBUGL_EVENTHANDLERS, 2, "Raw service event handler command line: %s\n", raw_command);
 
 	/* process any macros in the raw command line */
-	process_macros_r(mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(mac, svc->event_handler_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL)
 		return ERROR;
@@ -401,6 +407,7 @@ int run_service_event_handler(nagios_macros *mac, service *svc)
 	/* neb module wants to override (or cancel) the event handler - perhaps it will run the eventhandler itself */
 	if (neb_result == NEBERROR_CALLBACKOVERRIDE) {
 		my_free(processed_command);
+		free_command_argv(argv);
 		my_free(raw_logentry);
 		my_free(processed_logentry);
 		return OK;
@@ -408,7 +415,7 @@ int run_service_event_handler(nagios_macros *mac, service *svc)
 #endif
 
 	/* run the command through a worker */
-	result = wproc_run_callback(processed_command, event_handler_timeout, event_handler_job_handler, "Service", mac);
+	result = wproc_run_callback_argv(processed_command, argv, event_handler_timeout, event_handler_job_handler, "Service", mac);
 
 	/* check to see if the event handler timed out */
 	if (early_timeout == TRUE)
@@ -416,7 +423,7 @@ int run_service_event_handler(nagios_macros *mac, service *svc)
 
 #ifdef USE_EVENT_BROKER
 	/* get end time */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 #endif
 
 #ifdef USE_EVENT_BROKER
@@ -479,6 +486,7 @@ int run_global_host_event_handler(nagios_macros *mac, host *hst)
 {
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	char *raw_logentry = NULL;
 	char *processed_logentry = NULL;
 	char *command_output = NULL;
@@ -510,7 +518,7 @@ int run_global_host_event_handler(nagios_macros *mac, host *hst)
 
 #ifdef USE_EVENT_BROKER
 	/* get start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 #endif
 
 	/* get the raw command line */
@@ -521,7 +529,7 @@ int run_global_host_event_handler(nagios_macros *mac, host *hst)
 	log_debug_info(DEBUGL_EVENTHANDLERS, 2, "Raw global host event handler command line: %s\n", raw_command);
 
 	/* process any macros in the raw command line */
-	process_macros_r(mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(mac, global_host_event_handler_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL)
 		return ERROR;
@@ -543,6 +551,7 @@ int run_global_host_event_handler(nagios_macros *mac, host *hst)
 	/* neb module wants to override (or cancel) the event handler - perhaps it will run the eventhandler itself */
 	if (neb_result == NEBERROR_CALLBACKOVERRIDE) {
 		my_free(processed_command);
+		free_command_argv(argv);
 		my_free(raw_logentry);
 		my_free(processed_logentry);
 		return OK;
@@ -550,7 +559,7 @@ int run_global_host_event_handler(nagios_macros *mac, host *hst)
 #endif
 
 	/* run the command through a worker */
-	result = wproc_run_callback(processed_command, event_handler_timeout, event_handler_job_handler, "Global host", mac);
+	result = wproc_run_callback_argv(processed_command, argv, event_handler_timeout, event_handler_job_handler, "Global host", mac);
 
 	/* check for a timeout in the execution of the event handler command */
 	if (early_timeout == TRUE)
@@ -558,7 +567,7 @@ int run_global_host_event_handler(nagios_macros *mac, host *hst)
 
 #ifdef USE_EVENT_BROKER
 	/* get end time */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 #endif
 
 #ifdef USE_EVENT_BROKER
@@ -581,6 +590,7 @@ int run_host_event_handler(nagios_macros *mac, host *hst)
 {
 	char *raw_command = NULL;
 	char *processed_command = NULL;
+	char **argv = NULL;
 	char *raw_logentry = NULL;
 	char *processed_logentry = NULL;
 	char *command_output = NULL;
@@ -608,7 +618,7 @@ int run_host_event_handler(nagios_macros *mac, host *hst)
 
 #ifdef USE_EVENT_BROKER
 	/* get start time */
-	gettimeofday(&start_time, NULL);
+	sim_gettimeofday(&start_time, NULL);
 #endif
 
 	/* get the raw command line */
@@ -619,7 +629,7 @@ int run_host_event_handler(nagios_macros *mac, host *hst)
 	log_debug_info(DEBUGL_EVENTHANDLERS, 2, "Raw host event handler command line: %s\n", raw_command);
 
 	/* process any macros in the raw command line */
-	process_macros_r(mac, raw_command, &processed_command, macro_options);
+	process_command_line_r(mac, hst->event_handler_ptr, raw_command, &processed_command, &argv, macro_options);
 	my_free(raw_command);
 	if (processed_command == NULL)
 		return ERROR;
@@ -641,6 +651,7 @@ int run_host_event_handler(nagios_macros *mac, host *hst)
 	/* neb module wants to override (or cancel) the event handler - perhaps it will run the eventhandler itself */
 	if (neb_result == NEBERROR_CALLBACKOVERRIDE) {
 		my_free(processed_command);
+		free_command_argv(argv);
 		my_free(raw_logentry);
 		my_free(processed_logentry);
 		return OK;
@@ -648,7 +659,7 @@ int run_host_event_handler(nagios_macros *mac, host *hst)
 #endif
 
 	/* run the command through a worker */
-	result = wproc_run_callback(processed_command, event_handler_timeout, event_handler_job_handler, "Host", mac);
+	result = wproc_run_callback_argv(processed_command, argv, event_handler_timeout, event_handler_job_handler, "Host", mac);
 
 	/* check to see if the event handler timed out */
 	if (early_timeout == TRUE)
@@ -656,7 +667,7 @@ int run_host_event_handler(nagios_macros *mac, host *hst)
 
 #ifdef USE_EVENT_BROKER
 	/* get end time */
-	gettimeofday(&end_time, NULL);
+	sim_gettimeofday(&end_time, NULL);
 #endif
 
 #ifdef USE_EVENT_BROKER
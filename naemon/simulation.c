@@ -0,0 +1,599 @@
+#include "config.h"
+#include "common.h"
+#include "simulation.h"
+#include "workers.h"
+#include "events.h"
+#include "globals.h"
+#include "logging.h"
+#include "nm_alloc.h"
+#include "lib/dkhash.h"
+#include "lib/squeue.h"
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <fcntl.h>
+
+/*
+ * Finished jobs wait in a queue of their own, keyed on the virtual
+ * time they finish at. sim_poll() takes the place of iobroker_poll()
+ * and hands them to their callbacks as the clock passes them.
+ */
+
+int simulation_mode;
+struct timeval sim_clock;
+
+struct sim_command {
+	char *name;
+	double min_runtime, max_runtime;
+	double change_probability;
+	struct sim_command *next;
+};
+
+struct sim_sample {
+	long long runtime; /* microseconds */
+	int wait_status;
+	int early_timeout;
+	char *output;
+};
+
+/* what we know about one command line */
+struct sim_object {
+	char *command;
+	int state;
+	unsigned int checks;
+	struct sim_sample *samples;
+	unsigned int num_samples, next_sample;
+};
+
+struct sim_job {
+	struct wproc_result wpres;
+	void (*callback)(struct wproc_result *, void *, int);
+	void *data;
+	struct timeval done;
+};
+
+static struct sim_command *commands, *default_command;
+static dkhash_table *objects;
+static squeue_t *finished;
+#define SIM_DEFAULT_SEED 88172645463325252ULL
+static unsigned long long prng_state = SIM_DEFAULT_SEED;
+static long long end_time;
+static double cpu_scale;
+static struct timespec real_start, real_last;
+static struct sim_stats stats;
+static int recording_fd = -1;
+static struct {
+	char *buf;
+	size_t len, size;
+} rbuf;
+
+static const char *state_names[] = { "OK", "WARNING", "CRITICAL", "UNKNOWN" };
+
+static long long tv_usec(const struct timeval *tv)
+{
+	return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void set_clock(long long usec)
+{
+	sim_clock.tv_sec = usec / 1000000;
+	sim_clock.tv_usec = usec % 1000000;
+}
+
+static double real_since(const struct timespec *then)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - then->tv_sec) + (now.tv_nsec - then->tv_nsec) / 1000000000.0;
+}
+
+/* xorshift64*, so runs don't depend on the libc's random() */
+static double prng(void)
+{
+	prng_state ^= prng_state >> 12;
+	prng_state ^= prng_state << 25;
+	prng_state ^= prng_state >> 27;
+	return ((prng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static void histogram_add(struct sim_histogram *h, long long usec)
+{
+	unsigned int b = 0;
+
+	if (usec < 0)
+		usec = 0;
+	h->count++;
+	h->sum += usec / 1000000.0;
+	if (usec / 1000000.0 > h->max)
+		h->max = usec / 1000000.0;
+	while (usec > 1 && b < ARRAY_SIZE(h->buckets) - 1) {
+		usec >>= 1;
+		b++;
+	}
+	h->buckets[b]++;
+}
+
+/* the upper bound of the bucket the given percentile falls in, in seconds */
+double sim_percentile(const struct sim_histogram *h, double pct)
+{
+	unsigned long seen = 0, want;
+	unsigned int b;
+
+	if (!h->count)
+		return 0.0;
+	want = ceil(h->count * pct / 100.0);
+	for (b = 0; b < ARRAY_SIZE(h->buckets); b++) {
+		seen += h->buckets[b];
+		if (seen >= want)
+			break;
+	}
+	return (double)(1ULL << b) / 1000000.0 < h->max ? (double)(1ULL << b) / 1000000.0 : h->max;
+}
+
+/* undoes the escaping done by sim_record_result(), in place */
+static char *unescape(char *s)
+{
+	char *r, *w;
+
+	for (r = w = s; *r; r++, w++) {
+		if (*r == '\\' && r[1]) {
+			r++;
+			*w = *r == 't' ? '\t' : *r == 'n' ? '\n' : *r;
+		} else {
+			*w = *r;
+		}
+	}
+	*w = 0;
+	return s;
+}
+
+static void radd(const char *s, size_t len)
+{
+	if (rbuf.len + len > rbuf.size) {
+		while (rbuf.len + len > rbuf.size)
+			rbuf.size = rbuf.size ? rbuf.size * 2 : 8192;
+		rbuf.buf = nm_realloc(rbuf.buf, rbuf.size);
+	}
+	memcpy(rbuf.buf + rbuf.len, s, len);
+	rbuf.len += len;
+}
+
+static void rstr(const char *s)
+{
+	for (; s && *s; s++) {
+		if (*s == '\t')
+			radd("\\t", 2);
+		else if (*s == '\n')
+			radd("\\n", 2);
+		else if (*s == '\\')
+			radd("\\\\", 2);
+		else
+			radd(s, 1);
+	}
+}
+
+static struct sim_object *get_object(const char *cmd)
+{
+	struct sim_object *obj;
+
+	if ((obj = dkhash_get(objects, cmd, NULL)))
+		return obj;
+	obj = nm_calloc(1, sizeof(*obj));
+	obj->command = nm_strdup(cmd);
+	dkhash_insert(objects, obj->command, NULL, obj);
+	return obj;
+}
+
+/* plugins are matched by the basename of the first word, like specialized workers are */
+static struct sim_command *find_model(const char *cmd)
+{
+	struct sim_command *c;
+	const char *start = cmd, *end, *p;
+
+	end = cmd + strcspn(cmd, " \t");
+	for (p = cmd; p < end; p++) {
+		if (*p == '/')
+			start = p + 1;
+	}
+	for (c = commands; c; c = c->next) {
+		if (strlen(c->name) == (size_t)(end - start) && !memcmp(c->name, start, end - start))
+			return c;
+	}
+	return default_command;
+}
+
+static int read_recording(const char *path)
+{
+	FILE *fp;
+	char *line = NULL, *f[5], *p;
+	size_t size = 0;
+	int n, lineno = 0;
+
+	if (!(fp = fopen(path, "r"))) {
+		logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Failed to open simulation recording '%s': %s\n", path, strerror(errno));
+		return ERROR;
+	}
+
+	while (getline(&line, &size, fp) > 0) {
+		struct sim_object *obj;
+		struct sim_sample *s;
+
+		lineno++;
+		if (!(p = strchr(line, '\n')))
+			break; /* cut short while it was being written */
+		*p = 0;
+		if (!*line || *line == '#')
+			continue;
+		for (p = line, n = 0; p && n < 5; n++) {
+			f[n] = p;
+			if ((p = strchr(p, '\t')))
+				*p++ = 0;
+		}
+		if (n != 5 || p) {
+			logit(NSLOG_CONFIG_WARNING, TRUE, "Warning: Ignoring malformed line %d in simulation recording '%s'\n", lineno, path);
+			continue;
+		}
+
+		obj = get_object(unescape(f[3]));
+		obj->samples = nm_realloc(obj->samples, (obj->num_samples + 1) * sizeof(*obj->samples));
+		s = &obj->samples[obj->num_samples++];
+		s->runtime = strtoll(f[0], NULL, 10);
+		s->wait_status = atoi(f[1]);
+		s->early_timeout = atoi(f[2]);
+		s->output = nm_strdup(unescape(f[4]));
+	}
+	free(line);
+	fclose(fp);
+	return OK;
+}
+
+static int read_model(const char *path)
+{
+	FILE *fp;
+	char *line = NULL, *p, *key, *args;
+	size_t size = 0;
+	int lineno = 0, result = OK;
+
+	if (!(fp = fopen(path, "r"))) {
+		logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Failed to open simulation model '%s': %s\n", path, strerror(errno));
+		return ERROR;
+	}
+
+	while (result == OK && getline(&line, &size, fp) > 0) {
+		lineno++;
+		if ((p = strchr(line, '#')))
+			*p = 0;
+		key = line + strspn(line, " \t\r\n");
+		if (!*key)
+			continue;
+		args = key + strcspn(key, " \t\r\n");
+		if (*args)
+			*args++ = 0;
+		args += strspn(args, " \t");
+		for (p = args + strlen(args); p > args && isspace(p[-1]); p--)
+			*(p - 1) = 0;
+
+		if (!strcmp(key, "seed")) {
+			prng_state = strtoull(args, NULL, 10) * 2654435761ULL + 1;
+		} else if (!strcmp(key, "start")) {
+			sim_clock.tv_sec = strtoul(args, NULL, 10);
+		} else if (!strcmp(key, "duration")) {
+			end_time = strtoll(args, NULL, 10) * 1000000;
+		} else if (!strcmp(key, "cpu_scale")) {
+			cpu_scale = strtod(args, NULL);
+		} else if (!strcmp(key, "replay")) {
+			result = read_recording(args);
+		} else if (!strcmp(key, "command")) {
+			struct sim_command *c = nm_calloc(1, sizeof(*c));
+			char name[256];
+
+			if (sscanf(args, "%255s %lf %lf %lf", name, &c->min_runtime, &c->max_runtime, &c->change_probability) != 4 ||
+			    c->min_runtime < 0 || c->max_runtime < c->min_runtime) {
+				free(c);
+				logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Invalid command model on line %d of simulation model '%s'\n", lineno, path);
+				result = ERROR;
+				break;
+			}
+			c->name = nm_strdup(name);
+			if (!strcmp(name, "*")) {
+				if (default_command) {
+					free(default_command->name);
+					free(default_command);
+				}
+				default_command = c;
+			} else {
+				c->next = commands;
+				commands = c;
+			}
+		} else {
+			logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Unknown setting '%s' on line %d of simulation model '%s'\n", key, lineno, path);
+			result = ERROR;
+		}
+	}
+	free(line);
+	fclose(fp);
+	return result;
+}
+
+int sim_init(const char *model_file)
+{
+	memset(&stats, 0, sizeof(stats));
+	prng_state = SIM_DEFAULT_SEED;
+	sim_clock.tv_sec = time(NULL);
+	sim_clock.tv_usec = 0;
+	objects = dkhash_create(4096);
+	finished = squeue_create(1024);
+
+	if (read_model(model_file) != OK) {
+		sim_cleanup();
+		return ERROR;
+	}
+	if (!default_command) {
+		default_command = nm_calloc(1, sizeof(*default_command));
+		default_command->name = nm_strdup("*");
+	}
+
+	stats.start = sim_clock.tv_sec;
+	if (end_time)
+		end_time += tv_usec(&sim_clock);
+	simulation_mode = TRUE;
+	/* the clocks start with the event loop */
+	memset(&real_start, 0, sizeof(real_start));
+	memset(&real_last, 0, sizeof(real_last));
+
+	return OK;
+}
+
+static int free_object(void *data)
+{
+	struct sim_object *obj = (struct sim_object *)data;
+	unsigned int i;
+
+	for (i = 0; i < obj->num_samples; i++)
+		free(obj->samples[i].output);
+	free(obj->samples);
+	free(obj->command);
+	free(obj);
+	return DKHASH_WALK_REMOVE;
+}
+
+static void free_job(struct sim_job *job)
+{
+	free(job->wpres.command);
+	free(job->wpres.outstd);
+	free(job);
+}
+
+void sim_cleanup(void)
+{
+	struct sim_command *c, *next;
+	struct sim_job *job;
+
+	if (finished) {
+		/* let the callers free what they passed along with the job */
+		while ((job = squeue_pop(finished))) {
+			job->callback(NULL, job->data, 0);
+			free_job(job);
+		}
+		squeue_destroy(finished, 0);
+		finished = NULL;
+	}
+	if (objects) {
+		dkhash_walk_data(objects, free_object);
+		dkhash_destroy(objects);
+		objects = NULL;
+	}
+	for (c = commands; c; c = next) {
+		next = c->next;
+		free(c->name);
+		free(c);
+	}
+	commands = NULL;
+	if (default_command) {
+		free(default_command->name);
+		free(default_command);
+		default_command = NULL;
+	}
+	end_time = 0;
+	cpu_scale = 0;
+	simulation_mode = FALSE;
+}
+
+int sim_run_job(char *cmd, int timeout, void (*cb)(struct wproc_result *, void *, int), void *data)
+{
+	struct sim_object *obj;
+	struct sim_job *job;
+	long long runtime, done;
+	int code;
+
+	if (!cmd || !cb)
+		return ERROR;
+
+	obj = get_object(cmd);
+	obj->checks++;
+	job = nm_calloc(1, sizeof(*job));
+	job->callback = cb;
+	job->data = data;
+	job->wpres.command = nm_strdup(cmd);
+	job->wpres.timeout = timeout;
+	job->wpres.source = "simulation";
+	job->wpres.exited_ok = TRUE;
+
+	if (obj->num_samples) {
+		struct sim_sample *s = &obj->samples[obj->next_sample++ % obj->num_samples];
+
+		runtime = s->runtime;
+		job->wpres.wait_status = s->wait_status;
+		job->wpres.early_timeout = s->early_timeout;
+		job->wpres.outstd = nm_strdup(s->output);
+		stats.replayed++;
+	} else {
+		struct sim_command *c = find_model(cmd);
+
+		runtime = (c->min_runtime + (c->max_runtime - c->min_runtime) * prng()) * 1000000;
+		if (prng() < c->change_probability) {
+			/* any of the other three states */
+			code = (obj->state + 1 + (int)(prng() * 3)) % 4;
+			obj->state = code;
+			stats.state_changes++;
+		}
+		code = obj->state;
+		job->wpres.wait_status = code << 8;
+		nm_asprintf(&job->wpres.outstd, "%s - simulated result #%u", state_names[code], obj->checks);
+	}
+
+	if (timeout > 0 && runtime > timeout * 1000000LL) {
+		runtime = timeout * 1000000LL;
+		job->wpres.early_timeout = TRUE;
+	}
+	if (job->wpres.early_timeout) {
+		job->wpres.exited_ok = FALSE;
+		stats.timeouts++;
+	}
+
+	done = tv_usec(&sim_clock) + runtime;
+	job->wpres.start = sim_clock;
+	job->wpres.stop.tv_sec = job->done.tv_sec = done / 1000000;
+	job->wpres.stop.tv_usec = job->done.tv_usec = done % 1000000;
+	job->wpres.runtime.tv_sec = runtime / 1000000;
+	job->wpres.runtime.tv_usec = runtime % 1000000;
+
+	squeue_add_tv(finished, &job->done, job);
+	stats.jobs++;
+	if (++stats.running > stats.peak_running)
+		stats.peak_running = stats.running;
+
+	return OK;
+}
+
+int sim_poll(const struct timeval *next_event, int timeout_ms)
+{
+	struct sim_job *job;
+	long long now, target, done;
+	int delivered = 0;
+
+	if (!real_start.tv_sec && !real_start.tv_nsec)
+		clock_gettime(CLOCK_MONOTONIC, &real_start);
+
+	/* time spent handling events, as if it had passed on the virtual clock */
+	else if (cpu_scale > 0)
+		set_clock(tv_usec(&sim_clock) + real_since(&real_last) * cpu_scale * 1000000);
+
+	/*
+	 * events run once they're a millisecond overdue, and we must
+	 * always move forward, or a sub-millisecond wait spins forever
+	 */
+	now = tv_usec(&sim_clock);
+	target = now + (timeout_ms > 0 ? timeout_ms : 1) * 1000LL;
+	if (next_event && tv_usec(next_event) + 1000 < target)
+		target = tv_usec(next_event) + 1000 > now ? tv_usec(next_event) + 1000 : now;
+	if (end_time && target > end_time)
+		target = end_time;
+
+	/* jobs finishing at the same time are delivered together */
+	if ((job = squeue_peek(finished)) && (done = tv_usec(&job->done)) <= target) {
+		if (done > now)
+			set_clock(done);
+		while ((job = squeue_peek(finished)) && tv_usec(&job->done) <= tv_usec(&sim_clock)) {
+			squeue_pop(finished);
+			stats.running--;
+			job->callback(&job->wpres, job->data, 0);
+			free_job(job);
+			delivered++;
+		}
+	} else {
+		set_clock(target);
+		if (end_time && target >= end_time)
+			sigshutdown = TRUE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &real_last);
+	return delivered;
+}
+
+void sim_event_due(int event_type, const struct timeval *due, int postponed)
+{
+	long long lag = tv_usec(&sim_clock) - tv_usec(due);
+
+	stats.events++;
+	histogram_add(&stats.loop_lag, lag);
+	if (event_type != EVENT_SERVICE_CHECK && event_type != EVENT_HOST_CHECK)
+		return;
+	if (postponed)
+		stats.postponed_checks++;
+	else
+		histogram_add(&stats.check_latency, lag);
+}
+
+const struct sim_stats *sim_get_stats(void)
+{
+	if (real_start.tv_sec || real_start.tv_nsec)
+		stats.real_seconds = real_since(&real_start);
+	return &stats;
+}
+
+static void report_histogram(FILE *fp, const char *name, const struct sim_histogram *h)
+{
+	fprintf(fp, "%-15s avg %.3fs, p50 %.3fs, p99 %.3fs, max %.3fs (%lu samples)\n", name,
+	        h->count ? h->sum / h->count : 0.0, sim_percentile(h, 50), sim_percentile(h, 99), h->max, h->count);
+}
+
+void sim_report(FILE *fp)
+{
+	const struct sim_stats *s = sim_get_stats();
+	long virtual_seconds = sim_clock.tv_sec - s->start;
+
+	fprintf(fp, "Simulated %lds in %.2fs (%.0fx real time)\n", virtual_seconds, s->real_seconds,
+	        s->real_seconds > 0 ? virtual_seconds / s->real_seconds : 0.0);
+	fprintf(fp, "Events:         %lu handled, %lu checks postponed for lack of check slots\n", s->events, s->postponed_checks);
+	fprintf(fp, "Jobs:           %lu run (%lu replayed), %lu timed out, %lu state changes, at most %u at once\n",
+	        s->jobs, s->replayed, s->timeouts, s->state_changes, s->peak_running);
+	report_histogram(fp, "Check latency:", &s->check_latency);
+	report_histogram(fp, "Loop lag:", &s->loop_lag);
+}
+
+/*
+ * Recordings have one line per finished job, with the tab separated
+ * runtime in microseconds, wait status, timeout flag, command line
+ * and output, escaped like the state journal.
+ */
+void sim_record_result(const char *cmd, const struct wproc_result *wpres)
+{
+	char num[64];
+
+	if (!simulation_recording_file || !cmd || !wpres)
+		return;
+
+	if (recording_fd < 0) {
+		recording_fd = open(simulation_recording_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (recording_fd < 0) {
+			logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to open simulation recording '%s': %s\n",
+			      simulation_recording_file, strerror(errno));
+			my_free(simulation_recording_file);
+			return;
+		}
+	}
+
+	/* whole lines only, so a crash can't leave half a record behind for the next one */
+	rbuf.len = 0;
+	radd(num, snprintf(num, sizeof(num), "%lld\t%d\t%d\t", tv_usec(&wpres->stop) - tv_usec(&wpres->start),
+	                   wpres->wait_status, wpres->early_timeout));
+	rstr(cmd);
+	radd("\t", 1);
+	rstr(wpres->outstd);
+	radd("\n", 1);
+	if (write(recording_fd, rbuf.buf, rbuf.len) != (ssize_t)rbuf.len)
+		log_debug_info(DEBUGL_IPC, 0, "Failed to write to simulation recording '%s': %s\n",
+		               simulation_recording_file, strerror(errno));
+}
+
+void sim_record_close(void)
+{
+	if (recording_fd >= 0) {
+		close(recording_fd);
+		recording_fd = -1;
+	}
+	my_free(rbuf.buf);
+	rbuf.len = rbuf.size = 0;
+}
@@ -0,0 +1,94 @@
+#ifndef _SIMULATION_H
+#define _SIMULATION_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include "common.h"
+#include "workers.h"
+
+/*
+ * In simulation mode the event loop runs against a virtual clock and
+ * no processes are ever started. Jobs handed to the workers are
+ * answered by a model instead, read from a file like this one:
+ *
+ *   # comments and empty lines are ignored
+ *   seed 42
+ *   start 1700000000        # virtual start time, defaults to now
+ *   duration 3600           # seconds to simulate
+ *   cpu_scale 1.0           # charge real processing time to the clock
+ *   command check_ping 0.1 0.5 0.01
+ *   command * 0.5 2 0.05
+ *   replay /var/cache/naemon/results.rec
+ *
+ * A "command" line gives the runtime range in seconds and the chance
+ * that a check changes state, for plugins with that name ("*" matches
+ * the rest). Command lines found in a "replay" recording get their
+ * recorded results instead, in the order they were recorded.
+ * Recordings are written by any naemon with simulation_recording_file
+ * set.
+ *
+ * The clock only moves when the event loop would otherwise wait, so
+ * the same model and configuration always play out the same way,
+ * unless cpu_scale is set.
+ */
+
+NAGIOS_BEGIN_DECL
+
+extern int simulation_mode;
+extern struct timeval sim_clock;
+
+struct sim_histogram {
+	unsigned long count;
+	double sum, max;
+	unsigned long buckets[32]; /* by powers of two microseconds */
+};
+
+struct sim_stats {
+	unsigned long jobs, timeouts, replayed, state_changes;
+	unsigned int running, peak_running;
+	unsigned long events, postponed_checks;
+	struct sim_histogram loop_lag;      /* how late events ran */
+	struct sim_histogram check_latency; /* how late check events ran */
+	time_t start;
+	double real_seconds;
+};
+
+int sim_init(const char *model_file);      /* reads the model and starts the clock */
+void sim_cleanup(void);
+int sim_run_job(char *cmd, int timeout, void (*cb)(struct wproc_result *, void *, int), void *data);
+int sim_poll(const struct timeval *next_event, int timeout_ms);  /* moves the clock, returns jobs finished */
+void sim_event_due(int event_type, const struct timeval *due, int postponed);  /* called as events come due */
+const struct sim_stats *sim_get_stats(void);
+void sim_report(FILE *fp);
+double sim_percentile(const struct sim_histogram *h, double pct);
+
+void sim_record_result(const char *cmd, const struct wproc_result *wpres);
+void sim_record_close(void);
+
+/* time() and gettimeofday() that follow the virtual clock */
+static inline time_t sim_time(time_t *t)
+{
+	time_t now = simulation_mode ? sim_clock.tv_sec : time(NULL);
+
+	if (t)
+		*t = now;
+	return now;
+}
+
+static inline int sim_gettimeofday(struct timeval *tv, void *tz)
+{
+	if (simulation_mode) {
+		*tv = sim_clock;
+		return 0;
+	}
+	return gettimeofday(tv, tz);
+}
+
+NAGIOS_END_DECL
+
+#endif
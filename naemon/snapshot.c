@@ -0,0 +1,73 @@
+#include "config.h"
+#include "common.h"
+#include "snapshot.h"
+#include "logging.h"
+#include "nm_alloc.h"
+#include <string.h>
+
+static epoch_domain *snapshot_epochs;
+
+int snapshot_init(void)
+{
+	if (snapshot_epochs)
+		return OK;
+
+	if (!(snapshot_epochs = epoch_create())) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to create snapshot epochs: %s\n", strerror(errno));
+		return ERROR;
+	}
+	return OK;
+}
+
+/* all readers must be gone by now */
+void snapshot_deinit(void)
+{
+	epoch_destroy(snapshot_epochs);
+	snapshot_epochs = NULL;
+}
+
+void snapshot_publish(char **field, char *value)
+{
+	char *old = __atomic_exchange_n(field, value, __ATOMIC_SEQ_CST);
+
+	if (!old)
+		return;
+	if (snapshot_epochs)
+		epoch_retire(snapshot_epochs, old, free);
+	else
+		free(old);
+}
+
+void snapshot_reclaim(void)
+{
+	unsigned int freed;
+
+	if (!snapshot_epochs)
+		return;
+	if ((freed = epoch_reclaim(snapshot_epochs)))
+		log_debug_info(DEBUGL_IPC, 2, "Freed %u strings retired from snapshots\n", freed);
+}
+
+epoch_reader *snapshot_reader_register(void)
+{
+	if (!snapshot_epochs)
+		return NULL;
+	return epoch_reader_register(snapshot_epochs);
+}
+
+void snapshot_reader_unregister(epoch_reader *reader)
+{
+	epoch_reader_unregister(reader);
+}
+
+void snapshot_begin(epoch_reader *reader)
+{
+	if (reader)
+		epoch_enter(reader);
+}
+
+void snapshot_end(epoch_reader *reader)
+{
+	if (reader)
+		epoch_exit(reader);
+}
@@ -0,0 +1,41 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "lib/lnae-utils.h"
+#include "lib/epoch.h"
+
+/*
+ * The plugin_output, long_plugin_output and perf_data of hosts and
+ * services may be read from threads other than the main one. The
+ * main thread replaces them with snapshot_publish(), which defers
+ * freeing the old string until no reader can be looking at it.
+ *
+ * A reader thread registers once, and brackets each read with
+ * snapshot_begin() and snapshot_end(). In between, it loads the
+ * strings with snapshot_read() and may use them until it ends the
+ * snapshot. Object names and other fields that never change while
+ * the event loop runs can be read directly; everything else is
+ * still the main thread's alone.
+ */
+
+NAGIOS_BEGIN_DECL
+
+int snapshot_init(void);
+void snapshot_deinit(void);
+void snapshot_publish(char **field, char *value);
+void snapshot_reclaim(void);
+
+epoch_reader *snapshot_reader_register(void);
+void snapshot_reader_unregister(epoch_reader *reader);
+void snapshot_begin(epoch_reader *reader);
+void snapshot_end(epoch_reader *reader);
+
+#define snapshot_read(field) ((const char *)__atomic_load_n(&(field), __ATOMIC_SEQ_CST))
+
+NAGIOS_END_DECL
+
+#endif
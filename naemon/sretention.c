@@ -5,6 +5,7 @@
 #include "sretention.h"
 #include "broker.h"
 #include "xrddefault.h"
+#include "journal.h"
 #include "globals.h"
 #include "logging.h"
 #include "nm_alloc.h"
@@ -44,6 +45,8 @@ int cleanup_retention_data(void)
 	premod_hosts = NULL;
 	premod_services = NULL;
 
+	journal_close();
+
 	return xrddefault_cleanup_retention_data();
 }
 
@@ -71,6 +74,9 @@ int save_state_information(int autosave)
 	if (result == ERROR)
 		return ERROR;
 
+	/* the snapshot supersedes everything journaled so far */
+	journal_truncate();
+
 	if (autosave == TRUE)
 		logit(NSLOG_PROCESS_INFO, FALSE, "Auto-save of retention data completed successfully.\n");
 
@@ -93,6 +99,14 @@ int read_initial_state_information(void)
 
 	result = xrddefault_read_state_information();
 
+	/*
+	 * whatever happened after the snapshot was taken is in the journal,
+	 * which we replay even if the snapshot couldn't be read
+	 */
+	journal_close();
+	journal_replay();
+	journal_open();
+
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
 	broker_retention_data(NEBTYPE_RETENTIONDATA_ENDLOAD, NEBFLAG_NONE, NEBATTR_NONE, NULL);
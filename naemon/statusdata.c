@@ -1,9 +1,122 @@
+#include <string.h>
+#include <errno.h>
 #include "config.h"
 #include "common.h"
 #include "objects.h"
 #include "statusdata.h"
 #include "xsddefault.h"
 #include "broker.h"
+#include "journal.h"
+#include "logging.h"
+#include "globals.h"
+#include "lib/shmstatus.h"
+
+static shmstatus *status_shm;
+
+
+/******************************************************************/
+/**************** SHARED MEMORY STATUS FUNCTIONS ******************/
+/******************************************************************/
+
+/* hosts and services have the same names for everything we publish */
+#define fill_shm_record(rec, obj) \
+	do { \
+		rec->last_check = obj->last_check; \
+		rec->next_check = obj->next_check; \
+		rec->last_state_change = obj->last_state_change; \
+		rec->last_hard_state_change = obj->last_hard_state_change; \
+		rec->latency = obj->latency; \
+		rec->execution_time = obj->execution_time; \
+		rec->percent_state_change = obj->percent_state_change; \
+		rec->current_state = obj->current_state; \
+		rec->last_hard_state = obj->last_hard_state; \
+		rec->state_type = obj->state_type; \
+		rec->current_attempt = obj->current_attempt; \
+		rec->max_attempts = obj->max_attempts; \
+		rec->has_been_checked = obj->has_been_checked; \
+		rec->problem_has_been_acknowledged = obj->problem_has_been_acknowledged; \
+		rec->scheduled_downtime_depth = obj->scheduled_downtime_depth; \
+		rec->is_flapping = obj->is_flapping; \
+		rec->checks_enabled = obj->checks_enabled; \
+		rec->notifications_enabled = obj->notifications_enabled; \
+		copy_shm_output(rec, obj->plugin_output); \
+	} while (0)
+
+static inline void copy_shm_output(shmstatus_object *rec, const char *output)
+{
+	size_t len = output ? strlen(output) : 0;
+
+	if (len >= sizeof(rec->plugin_output))
+		len = sizeof(rec->plugin_output) - 1;
+	memcpy(rec->plugin_output, output ? output : "", len);
+	rec->plugin_output[len] = 0;
+}
+
+static void shm_host_status(host *hst)
+{
+	shmstatus_object *rec;
+
+	if (!(rec = shmstatus_write_begin(status_shm, SHMSTATUS_HOST, hst->id)))
+		return;
+	fill_shm_record(rec, hst);
+	shmstatus_write_end(status_shm, SHMSTATUS_HOST, hst->id);
+}
+
+static void shm_service_status(service *svc)
+{
+	shmstatus_object *rec;
+
+	if (!(rec = shmstatus_write_begin(status_shm, SHMSTATUS_SERVICE, svc->id)))
+		return;
+	fill_shm_record(rec, svc);
+	shmstatus_write_end(status_shm, SHMSTATUS_SERVICE, svc->id);
+}
+
+/*
+ * (re)creates the shared memory status segment for the current set
+ * of objects. Readers of a segment from before a restart see it go
+ * stale and have to reopen it.
+ */
+int initialize_status_shm(void)
+{
+	unsigned long names_size = 0;
+	unsigned int i;
+
+	cleanup_status_shm();
+	if (!status_shm_segment)
+		return OK;
+
+	for (i = 0; i < num_objects.hosts; i++)
+		names_size += strlen(host_ary[i]->name) + 1;
+	for (i = 0; i < num_objects.services; i++)
+		names_size += strlen(service_ary[i]->host_name) + strlen(service_ary[i]->description) + 2;
+
+	status_shm = shmstatus_create(status_shm_segment, num_objects.hosts, num_objects.services, names_size);
+	if (!status_shm) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to create shared memory status segment '%s': %s\n", status_shm_segment, strerror(errno));
+		return ERROR;
+	}
+
+	for (i = 0; i < num_objects.hosts; i++) {
+		shmstatus_set_name(status_shm, SHMSTATUS_HOST, i, host_ary[i]->name, NULL);
+		shm_host_status(host_ary[i]);
+	}
+	for (i = 0; i < num_objects.services; i++) {
+		shmstatus_set_name(status_shm, SHMSTATUS_SERVICE, i, service_ary[i]->host_name, service_ary[i]->description);
+		shm_service_status(service_ary[i]);
+	}
+	shmstatus_ready(status_shm);
+
+	return OK;
+}
+
+
+/* marks the shared memory status segment stale and removes it */
+void cleanup_status_shm(void)
+{
+	shmstatus_destroy(status_shm);
+	status_shm = NULL;
+}
 
 
 /******************************************************************/
@@ -21,6 +134,15 @@ int initialize_status_data(const char *cfgfile)
 int update_all_status_data(void)
 {
 	int result = OK;
+	unsigned int i;
+
+	/* catch up on anything that changed without a status update */
+	if (status_shm) {
+		for (i = 0; i < num_objects.hosts; i++)
+			shm_host_status(host_ary[i]);
+		for (i = 0; i < num_objects.services; i++)
+			shm_service_status(service_ary[i]);
+	}
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -40,6 +162,7 @@ int update_all_status_data(void)
 /* cleans up status data before program termination */
 int cleanup_status_data(int delete_status_data)
 {
+	cleanup_status_shm();
 	return xsddefault_cleanup_status_data(delete_status_data);
 }
 
@@ -61,6 +184,10 @@ int update_program_status(int aggregated_dump)
 /* updates host status info */
 int update_host_status(host *hst, int aggregated_dump)
 {
+	if (aggregated_dump == FALSE)
+		journal_host(hst);
+	if (status_shm)
+		shm_host_status(hst);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker (non-aggregated dumps only) */
@@ -75,6 +202,10 @@ int update_host_status(host *hst, int aggregated_dump)
 /* updates service status info */
 int update_service_status(service *svc, int aggregated_dump)
 {
+	if (aggregated_dump == FALSE)
+		journal_service(svc);
+	if (status_shm)
+		shm_service_status(svc);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker (non-aggregated dumps only) */
@@ -22,6 +22,8 @@ NAGIOS_BEGIN_DECL
 int initialize_status_data(const char *);               /* initializes status data at program start */
 int update_all_status_data(void);                       /* updates all status data */
 int cleanup_status_data(int);                           /* cleans up status data at program termination */
+int initialize_status_shm(void);                        /* (re)creates the shared memory status segment */
+void cleanup_status_shm(void);                          /* removes the shared memory status segment */
 int update_program_status(int);                         /* updates program status data */
 int update_host_status(host *, int);                    /* updates host status data */
 int update_service_status(service *, int);              /* updates service status data */
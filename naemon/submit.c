@@ -0,0 +1,171 @@
+#include "config.h"
+#include "common.h"
+#include "objects.h"
+#include "submit.h"
+#include "nebhost.h"
+#include "commands.h"
+#include "globals.h"
+#include "logging.h"
+#include "utils.h"
+#include "nm_alloc.h"
+#include "lib/mpscq.h"
+#include <string.h>
+
+/* submissions processed per pass through the event loop */
+#define SUBMIT_BATCH_SIZE 512
+
+struct submission {
+	mpscq_node node; /* must be first */
+	char *cmd;       /* an external command, or NULL for check results */
+	check_result cr;
+};
+
+static mpscq *submissions;
+
+/* results must outlive processing, as objects keep their source */
+static const char *submit_source = "Submission API";
+
+static void free_submission(struct submission *s)
+{
+	free(s->cmd);
+	free(s->cr.host_name);
+	free(s->cr.service_description);
+	free(s->cr.output);
+	free(s);
+}
+
+/*
+ * These run on the submitter's threads, so they must not touch
+ * anything but the queue. Not even nm_malloc(), which logs.
+ */
+static int submit(struct submission *s)
+{
+	mpscq *q = __atomic_load_n(&submissions, __ATOMIC_ACQUIRE);
+
+	if (!q || mpscq_push(q, &s->node) < 0) {
+		free_submission(s);
+		return ERROR;
+	}
+	return OK;
+}
+
+int naemon_submit_check_result(const check_result *cr)
+{
+	struct submission *s;
+
+	if (!cr || !cr->host_name)
+		return ERROR;
+	if (nebhost_child)
+		return nebhost_submit_check_result(cr);
+	if (!(s = calloc(1, sizeof(*s))))
+		return ERROR;
+
+	s->cr = *cr;
+	s->cr.host_name = strdup(cr->host_name);
+	s->cr.service_description = cr->service_description ? strdup(cr->service_description) : NULL;
+	s->cr.output = cr->output ? strdup(cr->output) : NULL;
+	s->cr.output_file = NULL;
+	s->cr.output_file_fp = NULL;
+	s->cr.engine = NULL;
+	s->cr.source = (void *)submit_source;
+	if (!s->cr.host_name || (cr->service_description && !s->cr.service_description) || (cr->output && !s->cr.output)) {
+		free_submission(s);
+		return ERROR;
+	}
+
+	return submit(s);
+}
+
+int naemon_submit_command(const char *cmd)
+{
+	struct submission *s;
+
+	if (!cmd)
+		return ERROR;
+	if (nebhost_child)
+		return nebhost_submit_command(cmd);
+	if (!(s = calloc(1, sizeof(*s))))
+		return ERROR;
+	if (!(s->cmd = strdup(cmd))) {
+		free_submission(s);
+		return ERROR;
+	}
+
+	return submit(s);
+}
+
+static void process_submission(struct submission *s)
+{
+	if (s->cmd)
+		process_external_command1(s->cmd);
+	else
+		process_check_result(&s->cr);
+	free_submission(s);
+}
+
+unsigned int submit_drain(unsigned int max)
+{
+	mpscq_node *node;
+	unsigned int i;
+
+	for (i = 0; i < max; i++) {
+		if (!(node = mpscq_pop(submissions)))
+			break;
+		process_submission((struct submission *)node);
+	}
+
+	return i;
+}
+
+static int submit_input(int fd, int events, void *arg)
+{
+	unsigned int done;
+
+	mpscq_ack(submissions);
+	done = submit_drain(SUBMIT_BATCH_SIZE);
+
+	/* leave the rest for later, so timed events don't starve */
+	if (done == SUBMIT_BATCH_SIZE)
+		mpscq_kick(submissions);
+
+	log_debug_info(DEBUGL_IPC, 2, "Processed %u submissions\n", done);
+	return 0;
+}
+
+int submit_init(void)
+{
+	mpscq *q;
+
+	if (submissions)
+		return OK;
+
+	if (!(q = mpscq_create())) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to create submission queue: %s\n", strerror(errno));
+		return ERROR;
+	}
+	if (iobroker_register(nagios_iobs, mpscq_doorbell(q), NULL, submit_input) < 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: Failed to register submission queue with io broker\n");
+		mpscq_destroy(q);
+		return ERROR;
+	}
+	__atomic_store_n(&submissions, q, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+void submit_deinit(void)
+{
+	mpscq *q;
+	mpscq_node *node;
+
+	if (!(q = __atomic_exchange_n(&submissions, NULL, __ATOMIC_ACQ_REL)))
+		return;
+
+	if (nagios_iobs)
+		iobroker_unregister(nagios_iobs, mpscq_doorbell(q));
+
+	/* nobody will process these anymore */
+	while ((node = mpscq_pop(q)))
+		free_submission((struct submission *)node);
+	mpscq_destroy(q);
+}
@@ -0,0 +1,41 @@
+#ifndef _SUBMIT_H
+#define _SUBMIT_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include "lib/lnae-utils.h"
+#include "objects.h"
+
+/*
+ * Nothing else in the core is thread safe, but these two functions
+ * may be called from any thread at any time while the event loop is
+ * running. Check results and external commands are copied onto a
+ * lock-free queue, and the event loop processes them in batches as
+ * if they'd come from a worker or the command file.
+ *
+ * naemon_submit_check_result() takes a check_result filled in the
+ * way process_check_result() expects it. Only the host name, service
+ * description and output are copied; the caller keeps ownership of
+ * everything it passed in. naemon_submit_command() takes an external
+ * command line, e.g. "[1700000000] SCHEDULE_FORCED_SVC_CHECK;...".
+ *
+ * Both return OK once the submission is queued, and ERROR if it
+ * couldn't be, which is always the case once the event loop has
+ * ended for good. Modules should stop submitting when they see
+ * NEBTYPE_PROCESS_EVENTLOOPEND.
+ */
+
+NAGIOS_BEGIN_DECL
+
+int naemon_submit_check_result(const check_result *cr);
+int naemon_submit_command(const char *cmd);
+
+int submit_init(void);
+void submit_deinit(void);
+unsigned int submit_drain(unsigned int max);  /* processes up to max submissions, returns how many */
+
+NAGIOS_END_DECL
+
+#endif
@@ -8,15 +8,20 @@
 #include "nebmods.h"
 #include "nebmodules.h"
 #include "workers.h"
+#include "resultq.h"
 #include "utils.h"
 #include "commands.h"
 #include "checks.h"
 #include "events.h"
+#include "notifications.h"
 #include "logging.h"
 #include "defaults.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "simulation.h"
+#include "perfsink.h"
 #include <assert.h>
+#include <ctype.h>
 #include <limits.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -42,6 +47,10 @@ char *check_result_path = NULL;
 char *lock_file = NULL;
 
 int num_check_workers = 0; /* auto-decide */
+int worker_shm_transport = FALSE;
+unsigned int worker_batch_window = DEFAULT_WORKER_BATCH_WINDOW;
+unsigned int worker_batch_size = DEFAULT_WORKER_BATCH_SIZE;
+char *simulation_recording_file = NULL;
 char *qh_socket_path = NULL; /* disabled */
 
 char *naemon_user = NULL;
@@ -81,6 +90,7 @@ int notification_timeout = DEFAULT_NOTIFICATION_TIMEOUT;
 
 
 char *object_precache_file;
+char *object_parse_cache_file = NULL;
 
 char *global_host_event_handler = NULL;
 char *global_service_event_handler = NULL;
@@ -92,9 +102,12 @@ int host_inter_check_delay_method = ICD_SMART;
 int service_interleave_factor_method = ILF_SMART;
 int max_host_check_spread = DEFAULT_HOST_CHECK_SPREAD;
 int max_service_check_spread = DEFAULT_SERVICE_CHECK_SPREAD;
+int check_placement_slack = DEFAULT_CHECK_PLACEMENT_SLACK;
 
 int check_reaper_interval = DEFAULT_CHECK_REAPER_INTERVAL;
 int max_check_reaper_time = DEFAULT_MAX_REAPER_TIME;
+int prioritize_state_changes = DEFAULT_PRIORITIZE_STATE_CHANGES;
+int passive_result_coalesce_window = DEFAULT_PASSIVE_RESULT_COALESCE_WINDOW;
 int service_freshness_check_interval = DEFAULT_FRESHNESS_CHECK_INTERVAL;
 int host_freshness_check_interval = DEFAULT_FRESHNESS_CHECK_INTERVAL;
 
@@ -122,7 +135,10 @@ int retention_update_interval = DEFAULT_RETENTION_UPDATE_INTERVAL;
 int use_retained_program_state = TRUE;
 int use_retained_scheduling_info = FALSE;
 int retention_scheduling_horizon = DEFAULT_RETENTION_SCHEDULING_HORIZON;
+unsigned int retention_load_threads = DEFAULT_RETENTION_LOAD_THREADS;
 char *retention_file = NULL;
+char *state_journal_file = NULL;
+unsigned int state_journal_commit_interval = DEFAULT_STATE_JOURNAL_COMMIT_INTERVAL;
 
 unsigned long modified_process_attributes = MODATTR_NONE;
 unsigned long modified_host_process_attributes = MODATTR_NONE;
@@ -162,6 +178,7 @@ int translate_passive_host_checks = DEFAULT_TRANSLATE_PASSIVE_HOST_CHECKS;
 int passive_host_checks_are_soft = DEFAULT_PASSIVE_HOST_CHECKS_SOFT;
 
 int status_update_interval = DEFAULT_STATUS_UPDATE_INTERVAL;
+char *status_shm_segment = NULL;
 
 int time_change_threshold = DEFAULT_TIME_CHANGE_THRESHOLD;
 
@@ -199,6 +216,9 @@ char    *host_perfdata_file_processing_command = NULL;
 char    *service_perfdata_file_processing_command = NULL;
 int     host_perfdata_process_empty_results = DEFAULT_HOST_PERFDATA_PROCESS_EMPTY_RESULTS;
 int     service_perfdata_process_empty_results = DEFAULT_SERVICE_PERFDATA_PROCESS_EMPTY_RESULTS;
+char    *perfdata_sink = NULL;
+int     perfdata_sink_format = PERFSINK_INFLUX;
+unsigned long perfdata_sink_buffer_size = DEFAULT_PERFDATA_SINK_BUFFER_SIZE;
 /*** end perfdata variables */
 
 static long long check_file_size(char *, unsigned long, struct rlimit);
@@ -576,14 +596,47 @@ int my_system(char *cmd, int timeout, int *early_timeout, double *exectime, char
 }
 
 
+/*
+ * copy the argument of cmd ("name!arg1!arg2") that starts at *pos into
+ * buf. Returns FALSE when there are no more arguments
+ */
+static int next_command_arg(const char *cmd, int *pos, char *buf, size_t len)
+{
+	int y;
+
+	/* we reached the end of the arguments... */
+	if (cmd[*pos] == '\x0')
+		return FALSE;
+
+	/* get the next argument */
+	/* can't use strtok(), as that's used in process_macros... */
+	for ((*pos)++, y = 0; y < (int)len - 1; (*pos)++) {
+
+		/* handle escaped argument delimiters */
+		if (cmd[*pos] == '\\' && cmd[*pos + 1] == '!') {
+			(*pos)++;
+		} else if (cmd[*pos] == '!' || cmd[*pos] == '\x0') {
+			/* end of argument */
+			break;
+		}
+
+		/* copy the character */
+		buf[y] = cmd[*pos];
+		y++;
+	}
+	buf[y] = '\x0';
+
+	return TRUE;
+}
+
+
 /* given a "raw" command, return the "expanded" or "whole" command line */
 int get_raw_command_line_r(nagios_macros *mac, command *cmd_ptr, char *cmd, char **full_command, int macro_options)
 {
 	char temp_arg[MAX_COMMAND_BUFFER] = "";
 	char *arg_buffer = NULL;
 	register int x = 0;
-	register int y = 0;
-	register int arg_index = 0;
+	int arg_index = 0;
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "get_raw_command_line_r()\n");
 
@@ -599,44 +652,20 @@ int get_raw_command_line_r(nagios_macros *mac, command *cmd_ptr, char *cmd, char
 	/* get the full command line */
 	*full_command = nm_strdup((cmd_ptr->command_line == NULL) ? "" : cmd_ptr->command_line);
 
-	/* XXX: Crazy indent */
 	/* get the command arguments */
 	if (cmd != NULL) {
 
 		/* skip the command name (we're about to get the arguments)... */
-		for (arg_index = 0;; arg_index++) {
-			if (cmd[arg_index] == '!' || cmd[arg_index] == '\x0')
-				break;
-		}
+		arg_index = strcspn(cmd, "!");
 
 		/* get each command argument */
 		for (x = 0; x < MAX_COMMAND_ARGUMENTS; x++) {
-
-			/* we reached the end of the arguments... */
-			if (cmd[arg_index] == '\x0')
+			if (!next_command_arg(cmd, &arg_index, temp_arg, sizeof(temp_arg)))
 				break;
 
-			/* get the next argument */
-			/* can't use strtok(), as that's used in process_macros... */
-			for (arg_index++, y = 0; y < (int)sizeof(temp_arg) - 1; arg_index++) {
-
-				/* handle escaped argument delimiters */
-				if (cmd[arg_index] == '\\' && cmd[arg_index + 1] == '!') {
-					arg_index++;
-				} else if (cmd[arg_index] == '!' || cmd[arg_index] == '\x0') {
-					/* end of argument */
-					break;
-				}
-
-				/* copy the character */
-				temp_arg[y] = cmd[arg_index];
-				y++;
-			}
-			temp_arg[y] = '\x0';
-
 			/* ADDED 01/29/04 EG */
 			/* process any macros we find in the argument */
-			process_macros_r(mac, temp_arg, &arg_buffer, macro_options);
+			process_macros_marked_r(mac, temp_arg, &arg_buffer, &mac->argv_marks[x], macro_options);
 
 			mac->argv[x] = arg_buffer;
 		}
@@ -647,6 +676,299 @@ int get_raw_command_line_r(nagios_macros *mac, command *cmd_ptr, char *cmd, char
 	return OK;
 }
 
+
+/*
+ * Does str hand a '$' that isn't part of a macro to the command?
+ * That's either "$$" or a lone '$', and only the shell knows what
+ * to make of them
+ */
+static int has_literal_dollar(const char *str)
+{
+	const char *p = str, *q;
+	int in_macro = FALSE;
+
+	while ((q = strchr(p, '$'))) {
+		if (in_macro && q == p)
+			return TRUE;
+		in_macro = !in_macro;
+		p = q + 1;
+	}
+	return in_macro;
+}
+
+
+/*
+ * Only the shell can run command lines with redirections, pipes,
+ * wildcards and the like, whatever the macros in them expand to
+ */
+static int command_line_needs_shell(const char *str)
+{
+	char **argv;
+	int argc, ret;
+
+	/* runcmd_cmd2strv() leaks its buffer when there are no words */
+	if (!str[strspn(str, " \t\r\n")])
+		return TRUE;
+
+	argv = nm_calloc(strlen(str) / 2 + 5, sizeof(char *));
+	ret = runcmd_cmd2strv(str, &argc, argv) & ~RUNCMD_HAS_SHVAR;
+	free(argv[0]);
+	free(argv);
+
+	return ret || has_literal_dollar(str);
+}
+
+
+static void add_command_arg(char ***argv, int *argc, char *arg)
+{
+	*argv = nm_realloc(*argv, (*argc + 2) * sizeof(char *));
+	(*argv)[(*argc)++] = arg;
+	(*argv)[*argc] = NULL;
+}
+
+
+/* characters that mean something to the shell outside of quotes */
+#define SHELL_SPECIAL_CHARS "|&;<>()$`*?[]{}~#"
+
+/*
+ * Split a word of a command line, with its macros expanded, into the
+ * arguments the shell would have made of it and add them to argv. The
+ * configured parts, including $ARGn$, $USERn$ and custom variable
+ * values, are parsed like the shell would. The rest of the macro
+ * values, as noted in marks, are taken as they are, although they
+ * still separate words on whitespace outside of quotes. Returns ERROR
+ * if only the shell knows what to make of the word.
+ */
+static int split_expanded_word(const char *str, const unsigned char *marks, char ***argv, int *argc)
+{
+	char *word = nm_malloc(strlen(str) + 1), quote = 0;
+	size_t i, len = 0;
+	int in_word = FALSE;
+
+	for (i = 0; str[i]; i++) {
+		char c = str[i];
+
+		if (marks && marks[i]) {
+			if (!quote && strchr(" \t\r\n", c)) {
+				if (in_word)
+					add_command_arg(argv, argc, nm_strndup(word, len));
+				in_word = FALSE;
+				len = 0;
+				continue;
+			}
+			word[len++] = c;
+			in_word = TRUE;
+			continue;
+		}
+
+		if (quote == '\'') {
+			if (c == '\'')
+				quote = 0;
+			else
+				word[len++] = c;
+			continue;
+		}
+		if (quote == '"') {
+			if (c == '"') {
+				quote = 0;
+			} else if (c == '$' || c == '`') {
+				break;
+			} else if (c == '\\' && str[i + 1] && !(marks && marks[i + 1]) && strchr("\"\\$`\n", str[i + 1])) {
+				if (str[++i] == '\n')
+					break;
+				word[len++] = str[i];
+			} else {
+				word[len++] = c;
+			}
+			continue;
+		}
+
+		if (strchr(" \t\r\n", c)) {
+			if (in_word)
+				add_command_arg(argv, argc, nm_strndup(word, len));
+			in_word = FALSE;
+			len = 0;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			in_word = TRUE;
+		} else if (c == '\\') {
+			if (!str[i + 1] || str[i + 1] == '\n')
+				break;
+			word[len++] = str[++i];
+			in_word = TRUE;
+		} else if (strchr(SHELL_SPECIAL_CHARS, c)) {
+			break;
+		} else {
+			word[len++] = c;
+			in_word = TRUE;
+		}
+	}
+
+	if (!str[i] && !quote && in_word)
+		add_command_arg(argv, argc, nm_strndup(word, len));
+	free(word);
+
+	return (str[i] || quote) ? ERROR : OK;
+}
+
+
+/* how long the word str starts with is, before any macros are expanded */
+static size_t command_word_length(const char *str)
+{
+	size_t i;
+	char quote = 0;
+
+	for (i = 0; str[i]; i++) {
+		if (quote) {
+			if (str[i] == quote)
+				quote = 0;
+			else if (quote == '"' && str[i] == '\\' && str[i + 1])
+				i++;
+			continue;
+		}
+		if (strchr(" \t\r\n", str[i]))
+			break;
+		if (str[i] == '\'' || str[i] == '"')
+			quote = str[i];
+		else if (str[i] == '\\' && str[i + 1])
+			i++;
+	}
+	return i;
+}
+
+
+/*
+ * Split a command line into words once, at config load, so running
+ * it only means expanding the macros in each word. Words without
+ * macros are turned into their argument right away.
+ */
+command_template *create_command_template(const char *command_line)
+{
+	command_template *tmpl;
+	size_t i = 0, len;
+	char **args;
+	int n, argc;
+
+	tmpl = nm_calloc(1, sizeof(*tmpl));
+	tmpl->needs_shell = command_line_needs_shell(command_line);
+	while (!tmpl->needs_shell) {
+		i += strspn(command_line + i, " \t\r\n");
+		if (!command_line[i])
+			break;
+		len = command_word_length(command_line + i);
+
+		n = tmpl->argc++;
+		tmpl->words = nm_realloc(tmpl->words, tmpl->argc * sizeof(char *));
+		tmpl->args = nm_realloc(tmpl->args, tmpl->argc * sizeof(char *));
+		tmpl->offsets = nm_realloc(tmpl->offsets, tmpl->argc * sizeof(size_t));
+		tmpl->words[n] = nm_strndup(command_line + i, len);
+		tmpl->args[n] = NULL;
+		tmpl->offsets[n] = i;
+		i += len;
+
+		/* a macro split over two words can't be expanded one word at a time */
+		if (has_literal_dollar(tmpl->words[n])) {
+			tmpl->needs_shell = TRUE;
+		} else if (!strchr(tmpl->words[n], '$')) {
+			args = NULL;
+			argc = 0;
+			if (split_expanded_word(tmpl->words[n], NULL, &args, &argc) == OK && argc == 1)
+				tmpl->args[n] = args[0];
+			else
+				tmpl->needs_shell = TRUE;
+			if (argc == 1)
+				free(args);
+			else
+				free_command_argv(args);
+		}
+	}
+	return tmpl;
+}
+
+
+void destroy_command_template(command_template *tmpl)
+{
+	int i;
+
+	if (!tmpl)
+		return;
+	for (i = 0; i < tmpl->argc; i++) {
+		free(tmpl->words[i]);
+		free(tmpl->args[i]);
+	}
+	free(tmpl->words);
+	free(tmpl->args);
+	free(tmpl->offsets);
+	free(tmpl);
+}
+
+
+static void add_command_text(char **buf, size_t *len, const char *str, size_t n)
+{
+	*buf = nm_realloc(*buf, *len + n + 1);
+	memcpy(*buf + *len, str, n);
+	*len += n;
+	(*buf)[*len] = 0;
+}
+
+
+int process_command_line_r(nagios_macros *mac, command *cmd_ptr, char *raw_command, char **processed_command, char ***argv, int macro_options)
+{
+	command_template *tmpl = cmd_ptr ? cmd_ptr->tmpl : NULL;
+	char *value = NULL, *buf = NULL;
+	unsigned char *marks = NULL;
+	size_t len = 0, end = 0;
+	int i, argc = 0, direct = TRUE;
+
+	*argv = NULL;
+
+	/* the raw command line is the command's own, unless someone changed it */
+	if (!tmpl || tmpl->needs_shell || !raw_command || !cmd_ptr->command_line || strcmp(raw_command, cmd_ptr->command_line))
+		return process_macros_r(mac, raw_command, processed_command, macro_options);
+
+	for (i = 0; i < tmpl->argc; i++) {
+		add_command_text(&buf, &len, raw_command + end, tmpl->offsets[i] - end);
+		end = tmpl->offsets[i] + strlen(tmpl->words[i]);
+
+		if (tmpl->args[i]) {
+			add_command_text(&buf, &len, tmpl->words[i], strlen(tmpl->words[i]));
+			if (direct)
+				add_command_arg(argv, &argc, nm_strdup(tmpl->args[i]));
+			continue;
+		}
+
+		process_macros_marked_r(mac, tmpl->words[i], &value, &marks, macro_options);
+		add_command_text(&buf, &len, value, strlen(value));
+		if (direct && split_expanded_word(value, marks, argv, &argc) != OK)
+			direct = FALSE;
+		my_free(value);
+		my_free(marks);
+	}
+	add_command_text(&buf, &len, raw_command + end, strlen(raw_command + end));
+	*processed_command = buf;
+
+	/* something needs the shell after all, or nothing is left to run */
+	if (!direct || !argc || !**argv) {
+		free_command_argv(*argv);
+		*argv = NULL;
+	}
+
+	return OK;
+}
+
+
+void free_command_argv(char **argv)
+{
+	int i;
+
+	if (!argv)
+		return;
+	for (i = 0; argv[i]; i++)
+		free(argv[i]);
+	free(argv);
+}
+
+
 /*
  * This function modifies the global macro struct and is thus not
  * threadsafe
@@ -1165,7 +1487,7 @@ void get_next_valid_time(time_t pref_time, time_t *valid_time, timeperiod *tperi
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "get_next_valid_time()\n");
 
 	/* get time right now, preferred time must be now or in the future */
-	time(&current_time);
+	sim_time(&current_time);
 
 	pref_time = (pref_time < current_time) ? current_time : pref_time;
 
@@ -2003,8 +2325,8 @@ int process_check_result_file(char *fname)
 			/* do we have the minimum amount of data? */
 			if (cr.host_name != NULL && cr.output != NULL) {
 
-				/* process the check result */
-				process_check_result(&cr);
+				/* queue the check result */
+				resultq_add(&cr);
 
 			}
 
@@ -2074,8 +2396,8 @@ int process_check_result_file(char *fname)
 	/* do we have the minimum amount of data? */
 	if (cr.host_name != NULL && cr.output != NULL) {
 
-		/* process check result */
-		process_check_result(&cr);
+		/* queue check result */
+		resultq_add(&cr);
 	}
 
 	free_check_result(&cr);
@@ -2525,7 +2847,7 @@ int update_check_stats(int check_type, time_t check_time)
 	if (check_type < 0 || check_type >= MAX_CHECK_STATS_TYPES)
 		return ERROR;
 
-	time(&current_time);
+	sim_time(&current_time);
 
 	if ((unsigned long)check_time == 0L) {
 #ifdef DEBUG_CHECK_STATS
@@ -2614,7 +2936,7 @@ int generate_check_stats(void)
 	float this_bucket_weight = 0.0;
 	float last_bucket_weight = 0.0;
 
-	time(&current_time);
+	sim_time(&current_time);
 
 	/* do some sanity checks on the age of the stats data before we start... */
 	/* get the new current bucket number */
@@ -2806,6 +3128,7 @@ void free_memory(nagios_macros *mac)
 
 	my_free(object_cache_file);
 	my_free(object_precache_file);
+	my_free(object_parse_cache_file);
 
 	/*
 	 * free memory associated with macros.
@@ -2816,9 +3139,13 @@ void free_memory(nagios_macros *mac)
 	 * command pipe, or when we receive a SIGHUP.
 	 */
 	clear_volatile_macros_r(mac);
+	free_macro_environment_blocks();
 
 	free_macrox_names();
 
+	/* free compiled escalation selectors */
+	free_escalation_selectors();
+
 	/* free illegal char strings */
 	my_free(illegal_object_chars);
 	my_free(illegal_output_chars);
@@ -2838,6 +3165,9 @@ void free_memory(nagios_macros *mac)
 	my_free(check_result_path);
 	my_free(command_file);
 	my_free(qh_socket_path);
+	my_free(state_journal_file);
+	my_free(status_shm_segment);
+	my_free(simulation_recording_file);
 	mac->x[MACRO_COMMANDFILE] = NULL; /* assigned from command_file */
 	my_free(log_archive_path);
 
@@ -2886,6 +3216,7 @@ int reset_variables(void)
 	check_result_path = nm_strdup(get_default_check_result_path());
 	command_file = nm_strdup(get_default_command_file());
 	qh_socket_path = nm_strdup(get_default_query_socket());
+	qh_threads = 0;
 	if (lock_file) /* this is kept across restarts */
 		free(lock_file);
 	lock_file = nm_strdup(get_default_lock_file());
@@ -2927,6 +3258,7 @@ int reset_variables(void)
 	host_inter_check_delay_method = ICD_SMART;
 	service_interleave_factor_method = ILF_SMART;
 	max_service_check_spread = DEFAULT_SERVICE_CHECK_SPREAD;
+	check_placement_slack = DEFAULT_CHECK_PLACEMENT_SLACK;
 	max_host_check_spread = DEFAULT_HOST_CHECK_SPREAD;
 
 	use_aggressive_host_checking = DEFAULT_AGGRESSIVE_HOST_CHECKING;
@@ -2939,9 +3271,11 @@ int reset_variables(void)
 
 	retain_state_information = FALSE;
 	retention_update_interval = DEFAULT_RETENTION_UPDATE_INTERVAL;
+	state_journal_commit_interval = DEFAULT_STATE_JOURNAL_COMMIT_INTERVAL;
 	use_retained_program_state = TRUE;
 	use_retained_scheduling_info = FALSE;
 	retention_scheduling_horizon = DEFAULT_RETENTION_SCHEDULING_HORIZON;
+	retention_load_threads = DEFAULT_RETENTION_LOAD_THREADS;
 	modified_host_process_attributes = MODATTR_NONE;
 	modified_service_process_attributes = MODATTR_NONE;
 	retained_host_attribute_mask = 0L;
@@ -2953,6 +3287,8 @@ int reset_variables(void)
 
 	check_reaper_interval = DEFAULT_CHECK_REAPER_INTERVAL;
 	max_check_reaper_time = DEFAULT_MAX_REAPER_TIME;
+	prioritize_state_changes = DEFAULT_PRIORITIZE_STATE_CHANGES;
+	passive_result_coalesce_window = DEFAULT_PASSIVE_RESULT_COALESCE_WINDOW;
 	max_check_result_file_age = DEFAULT_MAX_CHECK_RESULT_AGE;
 	service_freshness_check_interval = DEFAULT_FRESHNESS_CHECK_INTERVAL;
 	host_freshness_check_interval = DEFAULT_FRESHNESS_CHECK_INTERVAL;
@@ -2997,6 +3333,8 @@ int reset_variables(void)
 	high_host_flap_threshold = DEFAULT_HIGH_HOST_FLAP_THRESHOLD;
 
 	process_performance_data = DEFAULT_PROCESS_PERFORMANCE_DATA;
+	perfdata_sink_format = PERFSINK_INFLUX;
+	perfdata_sink_buffer_size = DEFAULT_PERFDATA_SINK_BUFFER_SIZE;
 
 	translate_passive_host_checks = DEFAULT_TRANSLATE_PASSIVE_HOST_CHECKS;
 	passive_host_checks_are_soft = DEFAULT_PASSIVE_HOST_CHECKS_SOFT;
@@ -52,6 +52,19 @@ int my_fdcopy(char *, char *, int);                     /* copies a named source
 /* thread-safe version of get_raw_command_line_r() */
 int get_raw_command_line_r(nagios_macros *mac, command *, char *, char **, int);
 
+/*
+ * Expands the macros in raw_command, the command line of cmd_ptr, one
+ * word of its template at a time. processed_command gets the whole
+ * command line, and argv the arguments to run it with instead of
+ * passing it to the shell, or NULL if it needs the shell after all.
+ * Macro values other than $ARGn$, $USERn$ and custom variables never
+ * get parsed as shell syntax.
+ */
+int process_command_line_r(nagios_macros *mac, command *cmd_ptr, char *raw_command, char **processed_command, char ***argv, int macro_options);
+void free_command_argv(char **argv);
+command_template *create_command_template(const char *command_line);
+void destroy_command_template(command_template *tmpl);
+
 /**
  * Write all of nbyte bytes of buf to fd, and don't let EINTR/EAGAIN stop you.
  * Returns 0 on success. On error, returns -1 and errno is set to indicate the
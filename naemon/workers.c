@@ -16,6 +16,7 @@
 #include "globals.h"
 #include "defaults.h"
 #include "nm_alloc.h"
+#include "simulation.h"
 
 #include "loadctl.h"
 
@@ -28,6 +29,9 @@ struct wproc_job {
 	unsigned int id;
 	unsigned int timeout;
 	char *command;
+	struct kvvec *env; /**< "env" key/value pairs, or NULL */
+	char **argv; /**< arguments to run without the shell, or NULL */
+	int shell; /**< the worker will run the command through the shell */
 	void (*callback)(struct wproc_result *, void *, int);
 	void *data;
 	struct wproc_worker *wp;
@@ -42,10 +46,15 @@ struct wproc_worker {
 	int max_jobs; /**< Max number of jobs the worker can handle */
 	int jobs_running; /**< jobs running */
 	int jobs_started; /**< jobs started */
+	unsigned int jobs_direct; /**< jobs started without the shell */
+	unsigned int jobs_shell; /**< jobs started through the shell */
 	int job_index; /**< round-robin slot allocator (this wraps) */
 	iocache *ioc;  /**< iocache for reading from worker */
 	fanout_table *jobs; /**< array of jobs */
 	struct wproc_list *wp_list;
+	shmring *job_ring; /**< shared memory jobs, if the worker takes them */
+	shmring *result_ring; /**< shared memory results */
+	unsigned int batch_left; /**< results still to come in the current batch */
 };
 
 struct wproc_list {
@@ -56,6 +65,13 @@ struct wproc_list {
 
 static struct wproc_list workers = {0, 0, NULL};
 
+/*
+ * Sizes of the shared memory rings. Jobs are small, but results
+ * carry plugin output. Records that don't fit go through the socket.
+ */
+#define WPROC_JOB_RING_SIZE (256 * 1024)
+#define WPROC_RESULT_RING_SIZE (1024 * 1024)
+
 static dkhash_table *specialized_workers;
 static struct wproc_list *to_remove = NULL;
 
@@ -214,6 +230,9 @@ static void destroy_job(struct wproc_job *job)
 	run_job_callback(job, NULL, 0);
 
 	my_free(job->command);
+	if (job->env)
+		kvvec_destroy(job->env, KVVEC_FREE_VALUES);
+	free_command_argv(job->argv);
 	if (job->wp) {
 		fanout_remove(job->wp->jobs, job->id);
 		job->wp->jobs_running--;
@@ -237,6 +256,21 @@ static int wproc_is_alive(struct wproc_worker *wp)
 	return 0;
 }
 
+static int handle_worker_ring(int fd, int events, void *arg);
+
+static void destroy_worker_rings(struct wproc_worker *wp)
+{
+	/*
+	 * the io broker is shared with our parent if we were forked,
+	 * so only the master may unregister things from it
+	 */
+	if (wp->result_ring && getpid() == nagios_pid)
+		iobroker_unregister(nagios_iobs, shmring_doorbell(wp->result_ring));
+	shmring_destroy(wp->job_ring);
+	shmring_destroy(wp->result_ring);
+	wp->job_ring = wp->result_ring = NULL;
+}
+
 static int wproc_destroy(struct wproc_worker *wp, int flags)
 {
 	int i = 0, force = 0, self;
@@ -255,6 +289,7 @@ static int wproc_destroy(struct wproc_worker *wp, int flags)
 	/* free all memory when either forcing or a worker called us */
 	iocache_destroy(wp->ioc);
 	wp->ioc = NULL;
+	destroy_worker_rings(wp);
 	my_free(wp->name);
 	fanout_destroy(wp->jobs, fo_destroy_job);
 	wp->jobs = NULL;
@@ -327,11 +362,15 @@ void free_worker_memory(int flags)
 		free(workers.wps);
 	}
 	to_remove = NULL;
-	dkhash_walk_data(specialized_workers, remove_specialized);
-	dkhash_destroy(specialized_workers);
+	if (specialized_workers) {
+		dkhash_walk_data(specialized_workers, remove_specialized);
+		dkhash_destroy(specialized_workers);
+		specialized_workers = NULL;
+	}
 	workers.wps = NULL;
 	workers.len = 0;
 	workers.idx = 0;
+	sim_record_close();
 }
 
 static int str2timeval(char *str, struct timeval *tv)
@@ -463,16 +502,112 @@ static void fo_reassign_wproc_job(void *job_)
 	struct wproc_job *job = (struct wproc_job *)job_;
 	job->wp = get_worker(job->command);
 	job->id = get_job_id(job->wp);
-	/* macros aren't used right now anyways */
+	/* environment macros were stashed with the job when it was created */
 	wproc_run_job(job, NULL);
 }
 
+static void handle_worker_message(struct wproc_worker *wp, char *buf, unsigned long size)
+{
+	static struct kvvec kvv = KVVEC_INITIALIZER;
+	char *error_reason = NULL;
+	struct wproc_job *job;
+	wproc_result wpres;
+
+	/* log messages are handled first */
+	if (size > 5 && !memcmp(buf, "log=", 4)) {
+		logit(NSLOG_INFO_MESSAGE, TRUE, "wproc: %s: %s\n", wp->name, buf + 4);
+		return;
+	}
+
+	/* a batch header tells us how many results are right behind it */
+	if (size > 6 && !memcmp(buf, "batch=", 6)) {
+		wp->batch_left = strtoul(buf + 6, NULL, 10);
+		return;
+	}
+	/* for everything else we need to actually parse */
+	if (buf2kvvec_prealloc(&kvv, buf, size, '=', '\0', KVVEC_ASSIGN) <= 0) {
+		logit(NSLOG_RUNTIME_ERROR, TRUE,
+		      "wproc: Failed to parse key/value vector from worker response with len %lu. First kv=%s",
+		      size, buf ? buf : "(NULL)");
+		return;
+	}
+
+	memset(&wpres, 0, sizeof(wpres));
+	wpres.job_id = -1;
+	wpres.response = &kvv;
+	wpres.source = wp->name;
+	parse_worker_result(&wpres, &kvv);
+
+	job = get_job(wp, wpres.job_id);
+	if (!job) {
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "wproc: Job with id '%d' doesn't exist on %s.\n",
+		      wpres.job_id, wp->name);
+		return;
+	}
+
+	/*
+	 * ETIME ("Timer expired") doesn't really happen
+	 * on any modern systems, so we reuse it to mean
+	 * "program timed out"
+	 */
+	if (wpres.error_code == ETIME) {
+		wpres.early_timeout = TRUE;
+	}
+
+	if (wpres.early_timeout) {
+		nm_asprintf(&error_reason, "timed out after %.2fs", tv_delta_f(&wpres.start, &wpres.stop));
+	} else if (WIFSIGNALED(wpres.wait_status)) {
+		nm_asprintf(&error_reason, "died by signal %d%s after %.2f seconds",
+		         WTERMSIG(wpres.wait_status),
+		         WCOREDUMP(wpres.wait_status) ? " (core dumped)" : "",
+		         tv_delta_f(&wpres.start, &wpres.stop));
+	}
+	if (error_reason) {
+		log_debug_info(DEBUGL_IPC, DEBUGV_BASIC, "wproc: job %d from worker %s %s",
+				job->id, wp->name, error_reason);
+		log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   command: %s\n", job->command);
+		log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   early_timeout=%d; exited_ok=%d; wait_status=%d; error_code=%d;\n",
+		      wpres.early_timeout, wpres.exited_ok, wpres.wait_status, wpres.error_code);
+		wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MOST, "wproc:   stderr", wpres.outerr);
+		wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MOST, "wproc:   stdout", wpres.outstd);
+	}
+	my_free(error_reason);
+
+	sim_record_result(job->command, &wpres);
+	run_job_callback(job, &wpres, 0);
+
+	destroy_job(job);
+}
+
+/* results are parsed in place, straight out of the shared memory */
+static int handle_worker_ring(int fd, int events, void *arg)
+{
+	struct wproc_worker *wp = (struct wproc_worker *)arg;
+	unsigned int size;
+	char *buf;
+
+	shmring_ack(wp->result_ring);
+	while ((buf = shmring_peek(wp->result_ring, &size))) {
+		handle_worker_message(wp, buf, size);
+		shmring_consume(wp->result_ring);
+	}
+
+	return 0;
+}
+
+/* only results sent over the socket count towards a batch, not the ones from the ring */
+static void handle_worker_socket_message(struct wproc_worker *wp, char *buf, unsigned long size)
+{
+	if (wp->batch_left && !(size > 6 && !memcmp(buf, "batch=", 6)) && !(size > 5 && !memcmp(buf, "log=", 4)))
+		wp->batch_left--;
+	handle_worker_message(wp, buf, size);
+}
+
 static int handle_worker_result(int sd, int events, void *arg)
 {
-	char *buf, *error_reason = NULL;
+	char *buf;
 	unsigned long size;
 	int ret;
-	static struct kvvec kvv = KVVEC_INITIALIZER;
 	struct wproc_worker *wp = (struct wproc_worker *)arg;
 
 	if (iocache_capacity(wp->ioc) == 0) {
@@ -496,73 +631,26 @@ static int handle_worker_result(int sd, int events, void *arg)
 			logit(NSLOG_RUNTIME_ERROR, TRUE, "wproc: All our workers are dead, we can't do anything!");
 		}
 		remove_worker(wp);
+		/* don't rerun jobs whose results are already waiting for us */
+		if (wp->result_ring)
+			handle_worker_ring(-1, 0, wp);
+		destroy_worker_rings(wp);
 		fanout_destroy(wp->jobs, fo_reassign_wproc_job);
 		wp->jobs = NULL;
 		wproc_destroy(wp, 0);
 		return 0;
 	}
-	while ((buf = worker_ioc2msg(wp->ioc, &size, 0))) {
-		struct wproc_job *job;
-		wproc_result wpres;
-
-		/* log messages are handled first */
-		if (size > 5 && !memcmp(buf, "log=", 4)) {
-			logit(NSLOG_INFO_MESSAGE, TRUE, "wproc: %s: %s\n", wp->name, buf + 4);
-			continue;
-		}
+	while ((buf = worker_ioc2msg(wp->ioc, &size, 0)))
+		handle_worker_socket_message(wp, buf, size);
 
-		/* for everything else we need to actually parse */
-		if (buf2kvvec_prealloc(&kvv, buf, size, '=', '\0', KVVEC_ASSIGN) <= 0) {
-			logit(NSLOG_RUNTIME_ERROR, TRUE,
-			      "wproc: Failed to parse key/value vector from worker response with len %lu. First kv=%s",
-			      size, buf ? buf : "(NULL)");
-			continue;
-		}
-
-		memset(&wpres, 0, sizeof(wpres));
-		wpres.job_id = -1;
-		wpres.response = &kvv;
-		wpres.source = wp->name;
-		parse_worker_result(&wpres, &kvv);
-
-		job = get_job(wp, wpres.job_id);
-		if (!job) {
-			logit(NSLOG_RUNTIME_WARNING, TRUE, "wproc: Job with id '%d' doesn't exist on %s.\n",
-			      wpres.job_id, wp->name);
-			continue;
-		}
-
-		/*
-		 * ETIME ("Timer expired") doesn't really happen
-		 * on any modern systems, so we reuse it to mean
-		 * "program timed out"
-		 */
-		if (wpres.error_code == ETIME) {
-			wpres.early_timeout = TRUE;
-		}
-
-		if (wpres.early_timeout) {
-			nm_asprintf(&error_reason, "timed out after %.2fs", tv_delta_f(&wpres.start, &wpres.stop));
-		} else if (WIFSIGNALED(wpres.wait_status)) {
-			nm_asprintf(&error_reason, "died by signal %d%s after %.2f seconds",
-			         WTERMSIG(wpres.wait_status),
-			         WCOREDUMP(wpres.wait_status) ? " (core dumped)" : "",
-			         tv_delta_f(&wpres.start, &wpres.stop));
-		}
-		if (error_reason) {
-			log_debug_info(DEBUGL_IPC, DEBUGV_BASIC, "wproc: job %d from worker %s %s",
-					job->id, wp->name, error_reason);
-			log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   command: %s\n", job->command);
-			log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   early_timeout=%d; exited_ok=%d; wait_status=%d; error_code=%d;\n",
-			      wpres.early_timeout, wpres.exited_ok, wpres.wait_status, wpres.error_code);
-			wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MOST, "wproc:   stderr", wpres.outerr);
-			wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MOST, "wproc:   stdout", wpres.outstd);
-		}
-		my_free(error_reason);
-
-		run_job_callback(job, &wpres, 0);
-
-		destroy_job(job);
+	/*
+	 * A batch is written all at once, so whatever is left of it is
+	 * most likely waiting for us already. Grab it while we're here,
+	 * but never wait for it: the socket is a blocking one.
+	 */
+	while (wp->batch_left && iocache_recv(wp->ioc, wp->sd, MSG_DONTWAIT) > 0) {
+		while ((buf = worker_ioc2msg(wp->ioc, &size, 0)))
+			handle_worker_socket_message(wp, buf, size);
 	}
 
 	return 0;
@@ -581,10 +669,46 @@ int workers_alive(void)
 	return alive;
 }
 
+/*
+ * Set up the shared memory rings for a worker and hand them over
+ * along with the response to its registration request
+ */
+static int setup_worker_rings(struct wproc_worker *worker)
+{
+	int fds[4];
+
+	worker->job_ring = shmring_create(WPROC_JOB_RING_SIZE);
+	worker->result_ring = shmring_create(WPROC_RESULT_RING_SIZE);
+	if (!worker->job_ring || !worker->result_ring) {
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "wproc: Failed to create shared memory rings for %s: %s\n",
+		      worker->name, strerror(errno));
+		destroy_worker_rings(worker);
+		return -1;
+	}
+
+	fds[0] = shmring_fd(worker->job_ring);
+	fds[1] = shmring_doorbell(worker->job_ring);
+	fds[2] = shmring_fd(worker->result_ring);
+	fds[3] = shmring_doorbell(worker->result_ring);
+	if (nsock_send_fds(worker->sd, "OK", 3, fds, 4) != 3) {
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "wproc: Failed to pass shared memory rings to %s: %s\n",
+		      worker->name, strerror(errno));
+		destroy_worker_rings(worker);
+		return -1;
+	}
+
+	/* the worker has its own copies now */
+	shmring_close_fd(worker->job_ring);
+	shmring_close_fd(worker->result_ring);
+	iobroker_register(nagios_iobs, shmring_doorbell(worker->result_ring), worker, handle_worker_ring);
+
+	return 0;
+}
+
 /* a service for registering workers */
 static int register_worker(int sd, char *buf, unsigned int len)
 {
-	int i, is_global = 1;
+	int i, is_global = 1, want_shm = 0;
 	struct kvvec *info;
 	struct wproc_worker *worker;
 
@@ -611,6 +735,8 @@ static int register_worker(int sd, char *buf, unsigned int len)
 			worker->pid = atoi(kv->value);
 		} else if (!strcmp(kv->key, "max_jobs")) {
 			worker->max_jobs = atoi(kv->value);
+		} else if (!strcmp(kv->key, "shm")) {
+			want_shm = atoi(kv->value);
 		} else if (!strcmp(kv->key, "plugin")) {
 			struct wproc_list *command_handlers;
 			is_global = 0;
@@ -648,7 +774,8 @@ static int register_worker(int sd, char *buf, unsigned int len)
 	}
 	wproc_num_workers_online++;
 	kvvec_destroy(info, 0);
-	nsock_printf_nul(sd, "OK");
+	if (!want_shm || worker_shm_transport == FALSE || setup_worker_rings(worker) < 0)
+		nsock_printf_nul(sd, "OK");
 
 	/* signal query handler to release its iocache for this one */
 	return QH_TAKEOVER;
@@ -663,7 +790,7 @@ static int wproc_query_handler(int sd, char *buf, unsigned int len)
 		                 "Valid commands:\n"
 		                 "  wpstats              Print general job information\n"
 		                 "  register <options>   Register a new worker\n"
-		                 "                       <options> can be name, pid, max_jobs and/or plugin.\n"
+		                 "                       <options> can be name, pid, max_jobs, shm and/or plugin.\n"
 		                 "                       There can be many plugin args.");
 		return 0;
 	}
@@ -681,9 +808,10 @@ static int wproc_query_handler(int sd, char *buf, unsigned int len)
 
 		for (i = 0; i < workers.len; i++) {
 			struct wproc_worker *wp = workers.wps[i];
-			nsock_printf(sd, "name=%s;pid=%d;jobs_running=%u;jobs_started=%u\n",
+			nsock_printf(sd, "name=%s;pid=%d;jobs_running=%u;jobs_started=%u;jobs_direct=%u;jobs_shell=%u\n",
 			             wp->name, wp->pid,
-			             wp->jobs_running, wp->jobs_started);
+			             wp->jobs_running, wp->jobs_started,
+			             wp->jobs_direct, wp->jobs_shell);
 		}
 		return 0;
 	}
@@ -693,9 +821,12 @@ static int wproc_query_handler(int sd, char *buf, unsigned int len)
 
 static int spawn_core_worker(void)
 {
-	char *argvec[] = {naemon_binary_path, "--worker", qh_socket_path ? qh_socket_path : DEFAULT_QUERY_SOCKET, NULL};
+	char batch[32];
+	char *argvec[] = {naemon_binary_path, "--worker", qh_socket_path ? qh_socket_path : DEFAULT_QUERY_SOCKET, "--worker-batch", batch, NULL};
 	int ret;
 
+	snprintf(batch, sizeof(batch), "%u,%u", worker_batch_window, worker_batch_size);
+
 	if ((ret = spawn_helper(argvec)) < 0)
 		logit(NSLOG_RUNTIME_ERROR, TRUE, "wproc: Failed to launch core worker: %s\n", strerror(errno));
 	else
@@ -785,27 +916,44 @@ static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 	static struct kvvec kvv = KVVEC_INITIALIZER;
 	struct kvvec_buf *kvvb;
 	struct wproc_worker *wp;
-	int ret, result = OK;
+	int ret, i, result = OK;
 
 	if (!job || !job->wp)
 		return ERROR;
 
 	wp = job->wp;
 
-	/*
-	 * XXX FIXME: add environment macros as
-	 *  kvvec_addkv(kvv, "env", "NAGIOS_LALAMACRO=VALUE");
-	 *  kvvec_addkv(kvv, "env", "NAGIOS_LALAMACRO2=VALUE");
-	 * so workers know to add them to environment. For now,
-	 * we don't support that though.
-	 */
-	if (!kvvec_init(&kvv, 4))	/* job_id, command and timeout */
+	/* job_id, type, command, timeout, environment macros and arguments */
+	for (i = 0; job->argv && job->argv[i]; i++)
+		;
+	if (!kvvec_init(&kvv, 5 + (job->env ? job->env->kv_pairs : 0) + i))
 		return ERROR;
 
 	kvvec_addkv(&kvv, "job_id", (char *)mkstr("%d", job->id));
 	kvvec_addkv(&kvv, "type", "0");
 	kvvec_addkv(&kvv, "command", job->command);
 	kvvec_addkv(&kvv, "timeout", (char *)mkstr("%u", job->timeout));
+	if (job->env) {
+		for (i = 0; i < job->env->kv_pairs; i++) {
+			struct key_value *kv = &job->env->kv[i];
+			kvvec_addkv_wlen(&kvv, kv->key, kv->key_len, kv->value, kv->value_len);
+		}
+	}
+	for (i = 0; job->argv && job->argv[i]; i++)
+		kvvec_addkv(&kvv, "arg", job->argv[i]);
+
+	/* jobs that don't fit in the ring take the socket */
+	if (wp->job_ring && worker_ring_send_kvvec(wp->job_ring, &kvv) >= 0) {
+		wp->jobs_running++;
+		wp->jobs_started++;
+		if (job->shell)
+			wp->jobs_shell++;
+		else
+			wp->jobs_direct++;
+		loadctl.jobs_running++;
+		return OK;
+	}
+
 	kvvb = build_kvvec_buf(&kvv);
 	ret = write(wp->sd, kvvb->buf, kvvb->bufsize);
 	if (ret != (int)kvvb->bufsize) {
@@ -819,6 +967,10 @@ static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 	} else {
 		wp->jobs_running++;
 		wp->jobs_started++;
+		if (job->shell)
+			wp->jobs_shell++;
+		else
+			wp->jobs_direct++;
 		loadctl.jobs_running++;
 	}
 	free(kvvb->buf);
@@ -827,11 +979,57 @@ static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 	return result;
 }
 
-int wproc_run_callback(char *cmd, int timeout,
-                       void (*cb)(struct wproc_result *, void *, int), void *data,
-                       nagios_macros *mac)
+/* would the worker have to run cmd through the shell? */
+static int command_needs_shell(const char *cmd)
+{
+	char **argv;
+	int argc = 0, ret;
+
+	argv = nm_calloc(strlen(cmd) / 2 + 5, sizeof(char *));
+	ret = runcmd_cmd2strv(cmd, &argc, argv);
+	free(argv[0]);
+	free(argv);
+
+	return ret != 0;
+}
+
+int wproc_run_callback_argv(char *cmd, char **argv, int timeout,
+                            void (*cb)(struct wproc_result *, void *, int), void *data,
+                            nagios_macros *mac)
 {
 	struct wproc_job *job;
+
+	if (simulation_mode) {
+		free_command_argv(argv);
+		return sim_run_job(cmd, timeout, cb, data);
+	}
+
 	job = create_job(cb, data, timeout, cmd);
+	if (!job) {
+		free_command_argv(argv);
+		return ERROR;
+	}
+	job->argv = argv;
+	job->shell = !argv && command_needs_shell(cmd);
+
+	/*
+	 * The environment is stored with the job, so it survives
+	 * being reassigned to another worker
+	 */
+	if (mac && enable_environment_macros == TRUE) {
+		job->env = kvvec_create(MACRO_X_COUNT);
+		if (job->env && add_macro_environment_vars_to_kvvec_r(mac, job->env) != OK) {
+			kvvec_destroy(job->env, KVVEC_FREE_VALUES);
+			job->env = NULL;
+		}
+	}
+
 	return wproc_run_job(job, mac);
 }
+
+int wproc_run_callback(char *cmd, int timeout,
+                       void (*cb)(struct wproc_result *, void *, int), void *data,
+                       nagios_macros *mac)
+{
+	return wproc_run_callback_argv(cmd, NULL, timeout, cb, data, mac);
+}
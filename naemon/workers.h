@@ -44,6 +44,8 @@ int workers_alive(void);
 int init_workers(int desired_workers);
 
 int wproc_run_callback(char *cmt, int timeout, void (*cb)(struct wproc_result *, void *, int), void *data, nagios_macros *mac);
+/* as above, but argv (which the job takes over) is run without the shell */
+int wproc_run_callback_argv(char *cmd, char **argv, int timeout, void (*cb)(struct wproc_result *, void *, int), void *data, nagios_macros *mac);
 
 NAGIOS_END_DECL;
 #endif
@@ -36,6 +36,7 @@
 #include <string.h>
 #include "globals.h"
 #include "nm_alloc.h"
+#include "lib/dkhash.h"
 
 #define XOD_NEW   0 /* not seen */
 #define XOD_SEEN  1 /* seen, but not yet loopy */
@@ -3725,6 +3726,7 @@ static int xodtemplate_resolve_command(xodtemplate_command *this_command)
 		/* apply missing properties from template command... */
 		xod_inherit_str_nohave(this_command, template_command, command_name);
 		xod_inherit_str_nohave(this_command, template_command, command_line);
+		xod_inherit(this_command, template_command, max_concurrent_checks);
 	}
 
 	my_free(template_names);
@@ -4194,6 +4196,7 @@ static int xodtemplate_resolve_host(xodtemplate_host *this_host)
 		xod_inherit(this_host, template_host, stalking_options);
 		xod_inherit(this_host, template_host, process_perf_data);
 		xod_inherit(this_host, template_host, hourly_value);
+		xod_inherit(this_host, template_host, max_concurrent_checks);
 
 		if (this_host->have_2d_coords == FALSE && template_host->have_2d_coords == TRUE) {
 			this_host->x_2d = template_host->x_2d;
@@ -6050,6 +6053,7 @@ static int xodtemplate_register_command(void *cmnd, void *discard)
 		logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not register command (config file '%s', starting on line %d)\n", xodtemplate_config_file_name(this_command->_config_file), this_command->_start_line);
 		return ERROR;
 	}
+	new_command->max_concurrent_checks = this_command->max_concurrent_checks;
 
 	return OK;
 }
@@ -6185,6 +6189,7 @@ static int xodtemplate_register_host(void *host_, void *discard)
 		logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not register host (config file '%s', starting on line %d)\n", xodtemplate_config_file_name(this_host->_config_file), this_host->_start_line);
 		return ERROR;
 	}
+	new_host->max_concurrent_checks = this_host->max_concurrent_checks;
 
 	/* add the parent hosts */
 	if (this_host->parents != NULL) {
@@ -7235,6 +7240,9 @@ static int xodtemplate_add_object_property(char *input, int options)
 			}
 		} else if (!strcmp(variable, "command_line")) {
 			temp_command->command_line = nm_strdup(value);
+		} else if (!strcmp(variable, "max_concurrent_checks")) {
+			temp_command->max_concurrent_checks = atoi(value);
+			temp_command->have_max_concurrent_checks = TRUE;
 		} else if (!strcmp(variable, "register"))
 			temp_command->register_object = (atoi(value) > 0) ? TRUE : FALSE;
 		else {
@@ -8000,6 +8008,9 @@ static int xodtemplate_add_object_property(char *input, int options)
 		} else if (!strcmp(variable, "hourly_value")) {
 			temp_host->hourly_value = (unsigned int)strtoul(value, NULL, 10);
 			temp_host->have_hourly_value = 1;
+		} else if (!strcmp(variable, "max_concurrent_checks")) {
+			temp_host->max_concurrent_checks = atoi(value);
+			temp_host->have_max_concurrent_checks = TRUE;
 		} else if (!strcmp(variable, "max_check_attempts")) {
 			temp_host->max_check_attempts = atoi(value);
 			temp_host->have_max_check_attempts = TRUE;
@@ -8851,6 +8862,266 @@ static int xodtemplate_add_object_property(char *input, int options)
 
 /* forward decl */
 static int xodtemplate_process_config_dir(char *dir_name, int options);
+static int xodtemplate_process_config_file(char *filename, int options);
+
+
+/******************************************************************/
+/************************* PARSE CACHE ****************************/
+/******************************************************************/
+
+/*
+ * Tokenizing config files line by line is what we spend most of the
+ * read step on, and on most restarts only a handful of files have
+ * changed. When object_parse_cache_file is set we remember the
+ * directives each file boiled down to, keyed by the file's path,
+ * mtime, size and a hash of its contents, and feed unchanged files'
+ * directives straight to the object builders the next time.
+ *
+ * Each directive is stored as its type, the line it was found on and
+ * its (stripped) text, as a nul-terminated string:
+ *   D<line> <object type>
+ *   P<line> <variable> <value>
+ *   E<line> }
+ *   F<line> <included file>
+ *   R<line> <included directory>
+ */
+#define PARSE_CACHE_MAGIC "# Naemon object parse cache v1\n"
+#define PTOK_DEFINE 'D'
+#define PTOK_PROPERTY 'P'
+#define PTOK_END 'E'
+#define PTOK_INCLUDE_FILE 'F'
+#define PTOK_INCLUDE_DIR 'R'
+
+struct parse_cache_entry {
+	char *path;
+	unsigned long long mtime, size, hash;
+	char *tokens;
+	size_t len;
+	int owned; /* tokens were recorded this run, rather than loaded */
+	struct parse_cache_entry *next;
+};
+
+static struct {
+	char *buf;                              /* the cache file we loaded */
+	dkhash_table *loaded;                   /* entries from the cache file, by path */
+	dkhash_table *current;                  /* entries for files we've read this time */
+	struct parse_cache_entry *list;         /* all entries we've allocated */
+	unsigned int hits, misses;
+} parse_cache;
+
+struct parse_tokens {
+	char *buf;
+	size_t len, size;
+};
+
+static unsigned long long parse_cache_hash(const char *buf, unsigned long len)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	unsigned long i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)buf[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static void parse_tokens_add(struct parse_tokens *pt, int token, int line, const char *text)
+{
+	char head[24];
+	size_t hlen, tlen = strlen(text) + 1;
+
+	hlen = snprintf(head, sizeof(head), "%c%d ", token, line);
+	if (pt->len + hlen + tlen > pt->size) {
+		while (pt->len + hlen + tlen > pt->size)
+			pt->size = pt->size ? pt->size * 2 : 4096;
+		pt->buf = nm_realloc(pt->buf, pt->size);
+	}
+	memcpy(pt->buf + pt->len, head, hlen);
+	memcpy(pt->buf + pt->len + hlen, text, tlen);
+	pt->len += hlen + tlen;
+}
+
+static struct parse_cache_entry *parse_cache_add(const char *path, unsigned long long mtime, unsigned long long size, unsigned long long hash)
+{
+	struct parse_cache_entry *entry = nm_calloc(1, sizeof(*entry));
+
+	entry->path = nm_strdup(path);
+	entry->mtime = mtime;
+	entry->size = size;
+	entry->hash = hash;
+	entry->next = parse_cache.list;
+	parse_cache.list = entry;
+	return entry;
+}
+
+/* reads whatever is in the parse cache file, ignoring it if it looks damaged */
+static void xodtemplate_load_parse_cache(void)
+{
+	mmapfile *thefile;
+	char *p, *end;
+	size_t file_size;
+
+	parse_cache.loaded = dkhash_create(1024);
+	parse_cache.current = dkhash_create(1024);
+	parse_cache.hits = parse_cache.misses = 0;
+
+	if (!(thefile = mmap_fopen(object_parse_cache_file)))
+		return;
+	if (thefile->file_size > strlen(PARSE_CACHE_MAGIC) && !memcmp(thefile->mmap_buf, PARSE_CACHE_MAGIC, strlen(PARSE_CACHE_MAGIC))) {
+		parse_cache.buf = nm_malloc(thefile->file_size + 1);
+		memcpy(parse_cache.buf, thefile->mmap_buf, thefile->file_size);
+		parse_cache.buf[thefile->file_size] = 0;
+	}
+	file_size = thefile->file_size;
+	mmap_fclose(thefile);
+	if (!parse_cache.buf)
+		return;
+	end = parse_cache.buf + file_size;
+
+	for (p = parse_cache.buf + strlen(PARSE_CACHE_MAGIC); p < end;) {
+		unsigned long long mtime, size, hash;
+		size_t len;
+		int pos = 0;
+		char *eol = strchr(p, '\n');
+		struct parse_cache_entry *entry;
+
+		if (!eol)
+			break;
+		*eol = 0;
+		if (sscanf(p, "%llu %llu %llx %zu %n", &mtime, &size, &hash, &len, &pos) < 4 || !pos || (size_t)(end - eol - 1) < len)
+			break;
+		entry = parse_cache_add(p + pos, mtime, size, hash);
+		entry->tokens = eol + 1;
+		entry->len = len;
+		dkhash_insert(parse_cache.loaded, entry->path, NULL, entry);
+		p = eol + 1 + len;
+	}
+}
+
+/* saves what we know about the files we read this time around */
+static void xodtemplate_save_parse_cache(void)
+{
+	struct parse_cache_entry *entry;
+	char *tmp_file = NULL;
+	FILE *fp;
+	int fd;
+
+	nm_asprintf(&tmp_file, "%sXXXXXX", object_parse_cache_file);
+	if ((fd = mkstemp(tmp_file)) < 0 || !(fp = fdopen(fd, "w"))) {
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Failed to create object parse cache '%s': %s\n", object_parse_cache_file, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		my_free(tmp_file);
+		return;
+	}
+
+	fputs(PARSE_CACHE_MAGIC, fp);
+	for (entry = parse_cache.list; entry; entry = entry->next) {
+		if (dkhash_get(parse_cache.current, entry->path, NULL) != entry)
+			continue;
+		fprintf(fp, "%llu %llu %llx %zu %s\n", entry->mtime, entry->size, entry->hash, entry->len, entry->path);
+		fwrite(entry->tokens, 1, entry->len, fp);
+	}
+
+	if (fflush(fp) || ferror(fp) || fsync(fd) || fclose(fp) || rename(tmp_file, object_parse_cache_file)) {
+		logit(NSLOG_RUNTIME_WARNING, TRUE, "Warning: Failed to write object parse cache '%s': %s\n", object_parse_cache_file, strerror(errno));
+		unlink(tmp_file);
+	}
+	my_free(tmp_file);
+}
+
+static void xodtemplate_free_parse_cache(void)
+{
+	struct parse_cache_entry *entry, *next;
+
+	for (entry = parse_cache.list; entry; entry = next) {
+		next = entry->next;
+		if (entry->owned)
+			my_free(entry->tokens);
+		my_free(entry->path);
+		my_free(entry);
+	}
+	parse_cache.list = NULL;
+	dkhash_destroy(parse_cache.loaded);
+	dkhash_destroy(parse_cache.current);
+	parse_cache.loaded = parse_cache.current = NULL;
+	my_free(parse_cache.buf);
+}
+
+
+/* hands a single directive from a config file to whoever deals with it */
+static int xodtemplate_process_directive(int token, char *input, const char *filename, int line, int options)
+{
+	switch (token) {
+	case PTOK_DEFINE:
+		if (!strcmp(input, "hostextinfo") || !strcmp(input, "serviceextinfo"))
+			logit(NSLOG_CONFIG_WARNING, TRUE, "WARNING: Extinfo objects are deprecated and will be removed in future versions\n");
+
+		/* start a new definition */
+		if (xodtemplate_begin_object_definition(input, options, xodtemplate_current_config_file, line) == ERROR) {
+			logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not add object definition in file '%s' on line %d.\n", filename, line);
+			return ERROR;
+		}
+		return OK;
+
+	case PTOK_END:
+		/* close out current definition */
+		if (xodtemplate_end_object_definition(options) == ERROR) {
+			logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not complete object definition in file '%s' on line %d. Have you named all your objects?\n", filename, line);
+			return ERROR;
+		}
+		return OK;
+
+	case PTOK_PROPERTY:
+		/* add directive to object definition */
+		if (xodtemplate_add_object_property(input, options) == ERROR) {
+			logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not add object property in file '%s' on line %d.\n", filename, line);
+			return ERROR;
+		}
+		return OK;
+
+	case PTOK_INCLUDE_FILE:
+		return xodtemplate_process_config_file(input, options);
+
+	case PTOK_INCLUDE_DIR:
+		return xodtemplate_process_config_dir(input, options);
+	}
+
+	return ERROR;
+}
+
+
+/* replays the directives we saved the last time we read a file */
+static int xodtemplate_replay_config_file(struct parse_cache_entry *entry, int options)
+{
+	char *p, *text, *end = entry->tokens + entry->len;
+	char *input = NULL;
+	size_t input_size = 0;
+	int result = OK;
+
+	for (p = entry->tokens; p < end && result == OK; p = text + strlen(text) + 1) {
+		int token = *p;
+		int line = (int)strtol(p + 1, &text, 10);
+		size_t len;
+
+		text++;
+		len = strlen(text) + 1;
+
+		/* properties are chopped up in place, but the cache must survive */
+		if (len > input_size) {
+			input_size = len * 2;
+			input = nm_realloc(input, input_size);
+		}
+		memcpy(input, text, len);
+		result = xodtemplate_process_directive(token, input, entry->path, line, options);
+	}
+	my_free(input);
+
+	return result;
+}
+
+
 /* process data in a specific config file */
 static int xodtemplate_process_config_file(char *filename, int options)
 {
@@ -8862,6 +9133,11 @@ static int xodtemplate_process_config_file(char *filename, int options)
 	register int x = 0;
 	register int y = 0;
 	char *ptr = NULL;
+	int token;
+	struct parse_tokens pt = { NULL, 0, 0 };
+	struct parse_cache_entry *entry = NULL;
+	unsigned long long mtime = 0, size = 0, hash = 0;
+	struct stat st;
 
 
 	if (verify_config >= 2)
@@ -8881,6 +9157,23 @@ static int xodtemplate_process_config_file(char *filename, int options)
 		return ERROR;
 	}
 
+	/* if the file hasn't changed since we last read it, we know what's in it */
+	if (parse_cache.loaded) {
+		if (!fstat(thefile->fd, &st))
+			mtime = (unsigned long long)st.st_mtime;
+		size = thefile->file_size;
+		hash = parse_cache_hash(thefile->mmap_buf, thefile->file_size);
+		entry = dkhash_get(parse_cache.loaded, filename, NULL);
+		if (entry && entry->mtime == mtime && entry->size == size && entry->hash == hash) {
+			mmap_fclose(thefile);
+			parse_cache.hits++;
+			if (!dkhash_get(parse_cache.current, entry->path, NULL))
+				dkhash_insert(parse_cache.current, entry->path, NULL, entry);
+			return xodtemplate_replay_config_file(entry, options);
+		}
+		parse_cache.misses++;
+	}
+
 	/* read in all lines from the config file */
 	while (1) {
 
@@ -8934,13 +9227,10 @@ static int xodtemplate_process_config_file(char *filename, int options)
 			}
 
 			/* check validity of object type */
-			if (strcmp(input, "timeperiod") && strcmp(input, "command") && strcmp(input, "contact") && strcmp(input, "contactgroup") && strcmp(input, "host") && strcmp(input, "hostgroup") && strcmp(input, "servicegroup") && strcmp(input, "service") && strcmp(input, "servicedependency") && strcmp(input, "serviceescalation") && strcmp(input, "hostgroupescalation") && strcmp(input, "hostdependency") && strcmp(input, "hostescalation")) {
-				if (strcmp(input, "hostextinfo") && strcmp(input, "serviceextinfo")) {
-					logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Invalid object definition type '%s' in file '%s' on line %d.\n", input, filename, current_line);
-					result = ERROR;
-					break;
-				}
-				logit(NSLOG_CONFIG_WARNING, TRUE, "WARNING: Extinfo objects are deprecated and will be removed in future versions\n");
+			if (strcmp(input, "timeperiod") && strcmp(input, "command") && strcmp(input, "contact") && strcmp(input, "contactgroup") && strcmp(input, "host") && strcmp(input, "hostgroup") && strcmp(input, "servicegroup") && strcmp(input, "service") && strcmp(input, "servicedependency") && strcmp(input, "serviceescalation") && strcmp(input, "hostgroupescalation") && strcmp(input, "hostdependency") && strcmp(input, "hostescalation") && strcmp(input, "hostextinfo") && strcmp(input, "serviceextinfo")) {
+				logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Invalid object definition type '%s' in file '%s' on line %d.\n", input, filename, current_line);
+				result = ERROR;
+				break;
 			}
 
 			/* we're already in an object definition... */
@@ -8950,13 +9240,7 @@ static int xodtemplate_process_config_file(char *filename, int options)
 				break;
 			}
 
-			/* start a new definition */
-			if (xodtemplate_begin_object_definition(input, options, xodtemplate_current_config_file, current_line) == ERROR) {
-				logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not add object definition in file '%s' on line %d.\n", filename, current_line);
-				result = ERROR;
-				break;
-			}
-
+			token = PTOK_DEFINE;
 			in_definition = TRUE;
 		}
 
@@ -8965,27 +9249,13 @@ static int xodtemplate_process_config_file(char *filename, int options)
 
 			/* this is the close of an object definition */
 			if (!strcmp(input, "}")) {
-
+				token = PTOK_END;
 				in_definition = FALSE;
-
-				/* close out current definition */
-				if (xodtemplate_end_object_definition(options) == ERROR) {
-					logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not complete object definition in file '%s' on line %d. Have you named all your objects?\n", filename, current_line);
-					result = ERROR;
-					break;
-				}
 			}
 
 			/* this is a directive inside an object definition */
-			else {
-
-				/* add directive to object definition */
-				if (xodtemplate_add_object_property(input, options) == ERROR) {
-					logit(NSLOG_CONFIG_ERROR, TRUE, "Error: Could not add object property in file '%s' on line %d.\n", filename, current_line);
-					result = ERROR;
-					break;
-				}
-			}
+			else
+				token = PTOK_PROPERTY;
 		}
 
 		/* include another file */
@@ -8994,11 +9264,10 @@ static int xodtemplate_process_config_file(char *filename, int options)
 			ptr = strtok(input, "=");
 			ptr = strtok(NULL, "\n");
 
-			if (ptr != NULL) {
-				result = xodtemplate_process_config_file(ptr, options);
-				if (result == ERROR)
-					break;
-			}
+			if (ptr == NULL)
+				continue;
+			memmove(input, ptr, strlen(ptr) + 1);
+			token = PTOK_INCLUDE_FILE;
 		}
 
 		/* include a directory */
@@ -9007,11 +9276,10 @@ static int xodtemplate_process_config_file(char *filename, int options)
 			ptr = strtok(input, "=");
 			ptr = strtok(NULL, "\n");
 
-			if (ptr != NULL) {
-				result = xodtemplate_process_config_dir(ptr, options);
-				if (result == ERROR)
-					break;
-			}
+			if (ptr == NULL)
+				continue;
+			memmove(input, ptr, strlen(ptr) + 1);
+			token = PTOK_INCLUDE_DIR;
 		}
 
 		/* unexpected token or statement */
@@ -9020,6 +9288,13 @@ static int xodtemplate_process_config_file(char *filename, int options)
 			result = ERROR;
 			break;
 		}
+
+		/* properties are chopped up when they're added, so save them first */
+		if (parse_cache.loaded)
+			parse_tokens_add(&pt, token, current_line, input);
+
+		if ((result = xodtemplate_process_directive(token, input, filename, current_line, options)) == ERROR)
+			break;
 	}
 
 	/* free memory and close file */
@@ -9032,6 +9307,17 @@ static int xodtemplate_process_config_file(char *filename, int options)
 		result = ERROR;
 	}
 
+	/* remember what we found, unless we've already seen this file */
+	if (parse_cache.loaded && result == OK && !dkhash_get(parse_cache.current, filename, NULL)) {
+		entry = parse_cache_add(filename, mtime, size, hash);
+		entry->tokens = pt.buf;
+		entry->len = pt.len;
+		entry->owned = TRUE;
+		dkhash_insert(parse_cache.current, entry->path, NULL, entry);
+	} else {
+		my_free(pt.buf);
+	}
+
 	return result;
 }
 
@@ -9189,6 +9475,10 @@ int xodtemplate_read_config_data(const char *main_config_file, int options)
 			return ERROR;
 		}
 
+		/* files that haven't changed needn't be parsed again */
+		if (object_parse_cache_file != NULL)
+			xodtemplate_load_parse_cache();
+
 		/* daemon reads all config files/dirs specified in the main config file */
 		/* read in all lines from the main config file */
 		while (1) {
@@ -9265,6 +9555,13 @@ int xodtemplate_read_config_data(const char *main_config_file, int options)
 
 	timing_point("Done parsing config files\n");
 
+	if (parse_cache.loaded) {
+		timing_point("%u config files unchanged, %u parsed\n", parse_cache.hits, parse_cache.misses);
+		if (result == OK && parse_cache.misses)
+			xodtemplate_save_parse_cache();
+		xodtemplate_free_parse_cache();
+	}
+
 	/* only perform intensive operations if we're not using the precached object file */
 	if (use_precached_objects == FALSE) {
 
@@ -98,7 +98,9 @@ typedef struct xodtemplate_command_struct {
 
     char       *command_name;
     char       *command_line;
+    int        max_concurrent_checks;
 
+    unsigned have_max_concurrent_checks : 1;
     unsigned has_been_resolved : 1;
     unsigned register_object : 1;
     struct xodtemplate_command_struct *next;
@@ -238,6 +240,7 @@ typedef struct xodtemplate_host_struct {
     double    z_3d;
     int       retain_status_information;
     int       retain_nonstatus_information;
+    int       max_concurrent_checks;
     xodtemplate_customvariablesmember *custom_variables;
 
     /* these can't be bitfields */
@@ -284,6 +287,7 @@ typedef struct xodtemplate_host_struct {
     unsigned have_retain_status_information : 1;
     unsigned have_retain_nonstatus_information : 1;
     unsigned have_hourly_value : 1;
+    unsigned have_max_concurrent_checks : 1;
 
     unsigned has_been_resolved : 1;
     unsigned register_object : 1;
@@ -275,6 +275,7 @@ int xpddefault_run_service_performance_data_command(nagios_macros *mac, service
 {
 	char *raw_command_line = NULL;
 	char *processed_command_line = NULL;
+	char **argv = NULL;
 	int result = OK;
 	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
 
@@ -295,7 +296,7 @@ int xpddefault_run_service_performance_data_command(nagios_macros *mac, service
 	log_debug_info(DEBUGL_PERFDATA, 2, "Raw service performance data command line: %s\n", raw_command_line);
 
 	/* process any macros in the raw command line */
-	process_macros_r(mac, raw_command_line, &processed_command_line, macro_options);
+	process_command_line_r(mac, service_perfdata_command_ptr, raw_command_line, &processed_command_line, &argv, macro_options);
 	my_free(raw_command_line);
 	if (processed_command_line == NULL)
 		return ERROR;
@@ -303,7 +304,7 @@ int xpddefault_run_service_performance_data_command(nagios_macros *mac, service
 	log_debug_info(DEBUGL_PERFDATA, 2, "Processed service performance data command line: %s\n", processed_command_line);
 
 	/* run the command */
-	wproc_run_callback(processed_command_line, perfdata_timeout, xpddefault_perfdata_job_handler, NULL, mac);
+	wproc_run_callback_argv(processed_command_line, argv, perfdata_timeout, xpddefault_perfdata_job_handler, NULL, mac);
 
 	/* free memory */
 	my_free(processed_command_line);
@@ -317,6 +318,7 @@ int xpddefault_run_host_performance_data_command(nagios_macros *mac, host *hst)
 {
 	char *raw_command_line = NULL;
 	char *processed_command_line = NULL;
+	char **argv = NULL;
 	int result = OK;
 	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
 
@@ -337,7 +339,7 @@ int xpddefault_run_host_performance_data_command(nagios_macros *mac, host *hst)
 	log_debug_info(DEBUGL_PERFDATA, 2, "Raw host performance data command line: %s\n", raw_command_line);
 
 	/* process any macros in the raw command line */
-	process_macros_r(mac, raw_command_line, &processed_command_line, macro_options);
+	process_command_line_r(mac, host_perfdata_command_ptr, raw_command_line, &processed_command_line, &argv, macro_options);
 	my_free(raw_command_line);
 	if (!processed_command_line)
 		return ERROR;
@@ -345,7 +347,7 @@ int xpddefault_run_host_performance_data_command(nagios_macros *mac, host *hst)
 	log_debug_info(DEBUGL_PERFDATA, 2, "Processed host performance data command line: %s\n", processed_command_line);
 
 	/* run the command */
-	wproc_run_callback(processed_command_line, perfdata_timeout, xpddefault_perfdata_job_handler, NULL, mac);
+	wproc_run_callback_argv(processed_command_line, argv, perfdata_timeout, xpddefault_perfdata_job_handler, NULL, mac);
 
 	/* free memory */
 	my_free(processed_command_line);
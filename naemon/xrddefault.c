@@ -15,6 +15,8 @@
 #include "defaults.h"
 #include "nm_alloc.h"
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 /******************************************************************/
 /********************* INIT/CLEANUP FUNCTIONS *********************/
@@ -469,12 +471,136 @@ int xrddefault_save_state_information(void)
 		} \
 	} while(0)
 
-int xrddefault_read_state_information(void)
+/*
+ * Big retention files are split into chunks of whole blocks that are
+ * read in several passes. Threads first find the object each host,
+ * service and contact block is for, then read the state of objects
+ * that have a single block straight into them. That touches nothing
+ * but the object itself. The main thread then goes through the chunks
+ * in file order for everything else: program state, comments,
+ * downtime, objects with several blocks and the wrap-up of each
+ * object, which checks for flapping and tells the event broker.
+ * Small files are read in one go, as XRD_ALL.
+ */
+#define XRD_ALL     0
+#define XRD_RESOLVE 1
+#define XRD_PARSE   2
+#define XRD_APPLY   3
+
+#define XRD_MIN_CHUNK_SIZE (256 * 1024) /* smaller chunks aren't worth a thread */
+#define XRD_MAX_AUTO_THREADS 8
+
+struct xrd_block {
+	int type;
+	void *obj;
+	unsigned int id;
+	int was_flapping;
+	int deferred; /* object has several blocks, so it's read in file order */
+};
+
+struct xrd_chunk {
+	const char *data;
+	unsigned long len, pos;
+	char *line;
+	size_t line_size;
+	int mode;
+	struct xrd_block *blocks;
+	unsigned int num_blocks, alloc_blocks, next_block;
+	pthread_t tid;
+	int threaded;
+};
+
+/* set by the info block, which comes before any object */
+static int scheduling_info_is_ok;
+
+/* copy the next line of a chunk, without its newline */
+static char *xrd_next_line(struct xrd_chunk *c)
+{
+	const char *p = c->data + c->pos, *nl;
+	unsigned long len;
+
+	if (c->pos >= c->len)
+		return NULL;
+
+	nl = memchr(p, '\n', c->len - c->pos);
+	len = nl ? (unsigned long)(nl - p) : c->len - c->pos;
+	c->pos += nl ? len + 1 : len;
+
+	if (len >= c->line_size) {
+		c->line_size = len + 1 > c->line_size * 2 ? len + 1 : c->line_size * 2;
+		c->line = nm_realloc(c->line, c->line_size);
+	}
+	memcpy(c->line, p, len);
+	c->line[len] = 0;
+
+	return c->line;
+}
+
+/* jump to the line closing the current block */
+static void xrd_skip_block(struct xrd_chunk *c)
+{
+	const char *p;
+
+	if (c->pos == 0 || c->pos >= c->len)
+		return;
+	if ((p = memmem(c->data + c->pos - 1, c->len - c->pos + 1, "\n}", 2)))
+		c->pos = p - c->data + 1;
+}
+
+/* get the staging record for an object block, or NULL when reading in one go */
+static struct xrd_block *xrd_next_block(struct xrd_chunk *c, int type)
+{
+	struct xrd_block *blk;
+
+	if (c->mode == XRD_ALL)
+		return NULL;
+	if (c->mode != XRD_RESOLVE)
+		return &c->blocks[c->next_block++];
+
+	if (c->num_blocks == c->alloc_blocks) {
+		c->alloc_blocks = c->alloc_blocks ? c->alloc_blocks * 2 : 64;
+		c->blocks = nm_realloc(c->blocks, c->alloc_blocks * sizeof(*c->blocks));
+	}
+	blk = &c->blocks[c->num_blocks++];
+	memset(blk, 0, sizeof(*blk));
+	blk->type = type;
+
+	return blk;
+}
+
+/* does this pass handle blocks of this type at all? */
+static int xrd_reads_block(int mode, int type)
+{
+	switch (type) {
+	case XRDDEFAULT_INFO_DATA:
+		return mode == XRD_ALL || mode == XRD_RESOLVE;
+	case XRDDEFAULT_HOSTSTATUS_DATA:
+	case XRDDEFAULT_SERVICESTATUS_DATA:
+	case XRDDEFAULT_CONTACTSTATUS_DATA:
+		return TRUE;
+	default:
+		return mode == XRD_ALL || mode == XRD_APPLY;
+	}
+}
+
+/* does this pass skip the directives of an object block? */
+static int xrd_skips_body(int mode, struct xrd_block *blk, int resolved)
+{
+	if (blk == NULL)
+		return FALSE;
+	if (mode == XRD_RESOLVE)
+		return resolved;
+	if (blk->obj == NULL)
+		return TRUE;
+	return mode == XRD_PARSE ? blk->deferred : !blk->deferred;
+}
+
+static void xrd_read_chunk(struct xrd_chunk *c)
 {
 	char *input = NULL;
 	char *inputbuf = NULL;
 	char *temp_ptr = NULL;
-	mmapfile *thefile;
+	struct xrd_block *blk = NULL;
 	char *host_name = NULL;
 	char *service_description = NULL;
 	char *contact_name = NULL;
@@ -502,7 +628,6 @@ int xrddefault_read_state_information(void)
 	time_t entry_time = 0L;
 	time_t creation_time;
 	time_t current_time;
-	int scheduling_info_is_ok = FALSE;
 	unsigned long downtime_id = 0;
 	time_t start_time = 0L;
 	time_t flex_downtime_start = (time_t)0;
@@ -521,8 +646,6 @@ int xrddefault_read_state_information(void)
 	int ack = FALSE;
 	int was_flapping = FALSE;
 	int allow_flapstart_notification = TRUE;
-	struct timeval tv[2];
-	double runtime[2];
 	int found_directive = FALSE;
 	int is_in_effect = FALSE;
 	int start_notification_sent = FALSE;
@@ -530,22 +653,8 @@ int xrddefault_read_state_information(void)
 	struct contact cont_conf, cont_have;
 
 
-	log_debug_info(DEBUGL_FUNCTIONS, 0, "xrddefault_read_state_information() start\n");
-
-	/* make sure we have what we need */
-	if (retention_file == NULL) {
-
-		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: We don't have a filename for retention data!\n");
-
-		return ERROR;
-	}
-
-	if (test_scheduling == TRUE)
-		gettimeofday(&tv[0], NULL);
-
-	/* open the retention file for reading */
-	if ((thefile = mmap_fopen(retention_file)) == NULL)
-		return ERROR;
+	c->pos = 0;
+	c->next_block = 0;
 
 	/* what attributes should be masked out? */
 	/* NOTE: host/service/contact-specific values may be added in the future, but for now we only have global masks */
@@ -556,19 +665,8 @@ int xrddefault_read_state_information(void)
 	contact_host_attribute_mask = retained_contact_host_attribute_mask;
 	contact_service_attribute_mask = retained_contact_service_attribute_mask;
 
-	/* Big speedup when reading retention.dat in bulk */
-	defer_downtime_sorting = 1;
-	defer_comment_sorting = 1;
-
 	/* read all lines in the retention file */
-	while (1) {
-		/* free memory */
-		my_free(inputbuf);
-
-		/* read the next line */
-		if ((inputbuf = mmap_fgets(thefile)) == NULL)
-			break;
-
+	while ((inputbuf = xrd_next_line(c)) != NULL) {
 		input = inputbuf;
 
 		/* far better than strip()ing */
@@ -583,14 +681,21 @@ int xrddefault_read_state_information(void)
 			memset(&cont_conf, 0, sizeof(cont_conf));
 			memset(&cont_have, 0, sizeof(cont_have));
 			data_type = XRDDEFAULT_SERVICESTATUS_DATA;
+			if ((blk = xrd_next_block(c, data_type)))
+				temp_service = blk->obj;
 		}
 		else if (!strcmp(input, "host {")) {
 			memset(&conf, 0, sizeof(conf));
 			memset(&have, 0, sizeof(have));
 			data_type = XRDDEFAULT_HOSTSTATUS_DATA;
+			if ((blk = xrd_next_block(c, data_type)))
+				temp_host = blk->obj;
 		}
-		else if (!strcmp(input, "contact {"))
+		else if (!strcmp(input, "contact {")) {
 			data_type = XRDDEFAULT_CONTACTSTATUS_DATA;
+			if ((blk = xrd_next_block(c, data_type)))
+				temp_contact = blk->obj;
+		}
 		else if (!strcmp(input, "hostcomment {"))
 			data_type = XRDDEFAULT_HOSTCOMMENT_DATA;
 		else if (!strcmp(input, "servicecomment {"))
@@ -606,6 +711,41 @@ int xrddefault_read_state_information(void)
 
 		else if (!strcmp(input, "}")) {
 
+			if (!xrd_reads_block(c->mode, data_type)) {
+				data_type = XRDDEFAULT_NO_DATA;
+				continue;
+			}
+
+			/* stash what the main thread needs to finish the block */
+			if (blk != NULL && (c->mode == XRD_RESOLVE || c->mode == XRD_PARSE)) {
+				if (c->mode == XRD_RESOLVE) {
+					if (temp_host != NULL) {
+						blk->obj = temp_host;
+						blk->id = temp_host->id;
+					} else if (temp_service != NULL) {
+						blk->obj = temp_service;
+						blk->id = temp_service->id;
+					} else if (temp_contact != NULL) {
+						blk->obj = temp_contact;
+						blk->id = temp_contact->id;
+					}
+				} else if (!blk->deferred)
+					blk->was_flapping = was_flapping;
+
+				was_flapping = FALSE;
+				my_free(host_name);
+				my_free(contact_name);
+				temp_host = NULL;
+				temp_service = NULL;
+				temp_contact = NULL;
+				blk = NULL;
+				data_type = XRDDEFAULT_NO_DATA;
+				continue;
+			}
+			if (blk != NULL && !blk->deferred)
+				was_flapping = blk->was_flapping;
+			blk = NULL;
+
 			switch (data_type) {
 
 			case XRDDEFAULT_INFO_DATA:
@@ -820,6 +960,8 @@ int xrddefault_read_state_information(void)
 				my_free(comment_data);
 
 				/* reset defaults */
+				temp_host = NULL;
+				temp_service = NULL;
 				entry_type = USER_COMMENT;
 				comment_id = 0;
 				source = COMMENTSOURCE_INTERNAL;
@@ -869,6 +1011,11 @@ int xrddefault_read_state_information(void)
 
 		else if (data_type != XRDDEFAULT_NO_DATA) {
 
+			if (!xrd_reads_block(c->mode, data_type) || xrd_skips_body(c->mode, blk, temp_host || temp_service || temp_contact)) {
+				xrd_skip_block(c);
+				continue;
+			}
+
 			/* slightly faster than strtok () */
 			var = input;
 			if ((val = strchr(input, '=')) == NULL)
@@ -1654,10 +1801,168 @@ int xrddefault_read_state_information(void)
 		}
 	}
 
+	/* inputbuf is the chunk's line buffer, freed with the chunk */
+}
+
+static void *xrd_chunk_thread(void *arg)
+{
+	xrd_read_chunk(arg);
+	return NULL;
+}
+
+/* read all chunks in parallel, or in this thread if we can't get more */
+static void xrd_run_pass(struct xrd_chunk *chunks, unsigned int num_chunks, int mode)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_chunks; i++) {
+		chunks[i].mode = mode;
+		chunks[i].threaded = !pthread_create(&chunks[i].tid, NULL, xrd_chunk_thread, &chunks[i]);
+		if (!chunks[i].threaded)
+			xrd_read_chunk(&chunks[i]);
+	}
+	for (i = 0; i < num_chunks; i++) {
+		if (chunks[i].threaded)
+			pthread_join(chunks[i].tid, NULL);
+	}
+}
+
+/*
+ * An object with more than one block in the file (which we never
+ * write) must have them read in order, so leave all of them to the
+ * main thread.
+ */
+static void xrd_defer_duplicates(struct xrd_chunk *chunks, unsigned int num_chunks)
+{
+	bitmap *seen[3], *dupes[3];
+	unsigned int sizes[3] = { num_objects.hosts, num_objects.services, num_objects.contacts };
+	struct xrd_block *blk;
+	unsigned int i, j, k;
+
+	for (k = 0; k < 3; k++) {
+		seen[k] = bitmap_create(sizes[k]);
+		dupes[k] = bitmap_create(sizes[k]);
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		for (j = 0; j < chunks[i].num_blocks; j++) {
+			blk = &chunks[i].blocks[j];
+			if (blk->obj == NULL)
+				continue;
+			k = blk->type == XRDDEFAULT_HOSTSTATUS_DATA ? 0 : blk->type == XRDDEFAULT_SERVICESTATUS_DATA ? 1 : 2;
+			if (bitmap_isset(seen[k], blk->id))
+				bitmap_set(dupes[k], blk->id);
+			bitmap_set(seen[k], blk->id);
+		}
+	}
+	for (i = 0; i < num_chunks; i++) {
+		for (j = 0; j < chunks[i].num_blocks; j++) {
+			blk = &chunks[i].blocks[j];
+			if (blk->obj == NULL)
+				continue;
+			k = blk->type == XRDDEFAULT_HOSTSTATUS_DATA ? 0 : blk->type == XRDDEFAULT_SERVICESTATUS_DATA ? 1 : 2;
+			blk->deferred = bitmap_isset(dupes[k], blk->id);
+		}
+	}
+
+	for (k = 0; k < 3; k++) {
+		bitmap_destroy(seen[k]);
+		bitmap_destroy(dupes[k]);
+	}
+}
+
+/* split the file into up to retention_load_threads chunks of whole blocks */
+static struct xrd_chunk *xrd_split(mmapfile *f, unsigned int *num_chunks)
+{
+	struct xrd_chunk *chunks;
+	const char *buf = f->mmap_buf, *p;
+	unsigned long start, end, size = f->file_size;
+	unsigned int i, n = retention_load_threads;
+
+	if (n == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = cpus > XRD_MAX_AUTO_THREADS ? XRD_MAX_AUTO_THREADS : cpus > 0 ? cpus : 1;
+	}
+	if (n > size / XRD_MIN_CHUNK_SIZE)
+		n = size / XRD_MIN_CHUNK_SIZE;
+	if (n == 0)
+		n = 1;
+
+	chunks = nm_calloc(n, sizeof(*chunks));
+	for (i = 0, start = 0; i < n; i++) {
+		if (i > 0 && start >= size)
+			break;
+		end = size / n * (i + 1);
+		if (end < start)
+			end = start;
+		/* a block ends with a line that's nothing but a closing brace */
+		if (i < n - 1 && end < size && (p = memmem(buf + end, size - end, "\n}\n", 3)))
+			end = p - buf + 3;
+		else
+			end = size;
+		chunks[i].data = buf + start;
+		chunks[i].len = end - start;
+		start = end;
+	}
+	*num_chunks = i;
+
+	return chunks;
+}
+
+int xrddefault_read_state_information(void)
+{
+	mmapfile *thefile;
+	struct xrd_chunk *chunks;
+	unsigned int i, num_chunks;
+	struct timeval tv[2];
+	double runtime[2];
+
+	log_debug_info(DEBUGL_FUNCTIONS, 0, "xrddefault_read_state_information() start\n");
+
+	/* make sure we have what we need */
+	if (retention_file == NULL) {
+
+		logit(NSLOG_RUNTIME_ERROR, TRUE, "Error: We don't have a filename for retention data!\n");
+
+		return ERROR;
+	}
+
+	if (test_scheduling == TRUE)
+		gettimeofday(&tv[0], NULL);
+
+	/* open the retention file for reading */
+	if ((thefile = mmap_fopen(retention_file)) == NULL)
+		return ERROR;
+
+	/* Big speedup when reading retention.dat in bulk */
+	defer_downtime_sorting = 1;
+	defer_comment_sorting = 1;
+
+	scheduling_info_is_ok = FALSE;
+	chunks = xrd_split(thefile, &num_chunks);
+	if (num_chunks == 1) {
+		chunks[0].mode = XRD_ALL;
+		xrd_read_chunk(&chunks[0]);
+	} else {
+		log_debug_info(DEBUGL_PROCESS, 1, "Reading retention data in %u chunks\n", num_chunks);
+		xrd_run_pass(chunks, num_chunks, XRD_RESOLVE);
+		xrd_defer_duplicates(chunks, num_chunks);
+		xrd_run_pass(chunks, num_chunks, XRD_PARSE);
+		for (i = 0; i < num_chunks; i++) {
+			chunks[i].mode = XRD_APPLY;
+			xrd_read_chunk(&chunks[i]);
+		}
+	}
+
 	/* free memory and close the file */
-	my_free(inputbuf);
+	for (i = 0; i < num_chunks; i++) {
+		my_free(chunks[i].line);
+		my_free(chunks[i].blocks);
+	}
+	my_free(chunks);
 	mmap_fclose(thefile);
 
+
 	if (sort_downtime() != OK)
 		return ERROR;
 	if (sort_comments() != OK)
@@ -0,0 +1,79 @@
+/*
+ * A broker module for test_nebhost, which loads it as an isolated
+ * module. What it does with service check results depends on its
+ * argument:
+ *
+ *   echo   submits "echo: <output>" as host1's check result, and
+ *          an ECHO command, for results that start with "ping"
+ *   crash  crashes
+ *   hang   never returns
+ */
+#include <string.h>
+#include <unistd.h>
+#include "naemon/objects.h"
+#include "naemon/nebmodules.h"
+#include "naemon/nebcallbacks.h"
+#include "naemon/nebstructs.h"
+#include "naemon/nebmods.h"
+#include "naemon/broker.h"
+#include "naemon/checks.h"
+#include "naemon/utils.h"
+#include "naemon/submit.h"
+
+NEB_API_VERSION(CURRENT_NEB_API_VERSION)
+
+static void *handle;
+static char mode[16];
+
+static void echo(service *svc)
+{
+	check_result cr;
+	char output[256], cmd[300];
+
+	/* the module host keeps our copy of the service up to date */
+	if (!svc || !svc->plugin_output || strncmp(svc->plugin_output, "ping", 4))
+		return;
+
+	snprintf(output, sizeof(output), "echo: %s", svc->plugin_output);
+	init_check_result(&cr);
+	cr.object_check_type = HOST_CHECK;
+	cr.check_type = CHECK_TYPE_PASSIVE;
+	cr.host_name = svc->host_name;
+	cr.output = output;
+	gettimeofday(&cr.start_time, NULL);
+	cr.finish_time = cr.start_time;
+	naemon_submit_check_result(&cr);
+
+	snprintf(cmd, sizeof(cmd), "[%lu] ECHO;%s", (unsigned long)time(NULL), svc->plugin_output);
+	naemon_submit_command(cmd);
+}
+
+static int service_check(int type, void *data)
+{
+	nebstruct_service_check_data *ds = data;
+
+	if (ds->type != NEBTYPE_SERVICECHECK_PROCESSED)
+		return 0;
+
+	if (!strcmp(mode, "crash"))
+		*(volatile int *)0 = 0;
+	if (!strcmp(mode, "hang")) {
+		for (;;)
+			sleep(1000);
+	}
+	echo(ds->object_ptr);
+	return 0;
+}
+
+int nebmodule_init(int flags, char *args, void *mod_handle)
+{
+	handle = mod_handle;
+	if (args)
+		snprintf(mode, sizeof(mode), "%s", args);
+	return neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, handle, 0, service_check);
+}
+
+int nebmodule_deinit(int flags, int reason)
+{
+	return neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, service_check);
+}
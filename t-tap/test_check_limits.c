@@ -0,0 +1,167 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/checks.h"
+#include "naemon/events.h"
+#include "naemon/nebmods.h"
+#include "naemon/nebstructs.h"
+#include "naemon/broker.h"
+#include "naemon/simulation.h"
+#include "naemon/nm_alloc.h"
+
+#define DURATION 1800
+#define SERVICES 20
+
+/* the slow command may run 3 checks at once, the fragile host 2 */
+enum { SLOW, FRAGILE, FREE, GROUPS };
+static const char *group_host[GROUPS] = { "busy", "fragile", "free" };
+static const char *group_command[GROUPS] = { "check_slow", "check_fast", "check_long" };
+static unsigned int running[GROUPS], peak[GROUPS];
+static unsigned int *initiated;
+static char dir[64];
+
+static int group_of(service *svc)
+{
+	if (!strcmp(svc->check_command, "check_slow"))
+		return SLOW;
+	return !strcmp(svc->host_name, "fragile") ? FRAGILE : FREE;
+}
+
+static int track_checks(int type, void *data)
+{
+	nebstruct_service_check_data *ds = (nebstruct_service_check_data *)data;
+	service *svc = (service *)ds->object_ptr;
+	int group = group_of(svc);
+
+	if (ds->type == NEBTYPE_SERVICECHECK_INITIATE) {
+		initiated[svc->id]++;
+		if (++running[group] > peak[group])
+			peak[group] = running[group];
+	} else if (ds->type == NEBTYPE_SERVICECHECK_PROCESSED && running[group]) {
+		running[group]--;
+	}
+	return 0;
+}
+
+static void write_file(const char *name, const char *content)
+{
+	char path[128];
+	FILE *fp;
+
+	sprintf(path, "%s/%s", dir, name);
+	fp = fopen(path, "w");
+	assert(fp);
+	fputs(content, fp);
+	fclose(fp);
+}
+
+static void write_config(void)
+{
+	char path[128];
+	FILE *fp;
+	int g, s;
+
+	sprintf(path, "%s/objects.cfg", dir);
+	fp = fopen(path, "w");
+	assert(fp);
+	fprintf(fp, "define command {\n\tcommand_name check_slow\n\tcommand_line /bin/check_slow $HOSTNAME$ $SERVICEDESC$\n"
+	        "\tmax_concurrent_checks 3\n}\n");
+	fprintf(fp, "define command {\n\tcommand_name check_fast\n\tcommand_line /bin/check_fast $HOSTNAME$ $SERVICEDESC$\n}\n");
+	fprintf(fp, "define command {\n\tcommand_name check_long\n\tcommand_line /bin/check_long $HOSTNAME$ $SERVICEDESC$\n}\n");
+	fprintf(fp, "define timeperiod {\n\ttimeperiod_name 24x7\n\talias 24x7\n\tmonday 00:00-24:00\n\ttuesday 00:00-24:00\n"
+	        "\twednesday 00:00-24:00\n\tthursday 00:00-24:00\n\tfriday 00:00-24:00\n\tsaturday 00:00-24:00\n\tsunday 00:00-24:00\n}\n");
+	fprintf(fp, "define contact {\n\tcontact_name nobody\n\thost_notification_period 24x7\n\tservice_notification_period 24x7\n"
+	        "\thost_notification_commands check_fast\n\tservice_notification_commands check_fast\n}\n");
+	fprintf(fp, "define host {\n\tname limited\n\tmax_concurrent_checks 2\n\tregister 0\n}\n");
+	for (g = 0; g < GROUPS; g++) {
+		fprintf(fp, "define host {\n\thost_name %s\n\taddress 127.0.0.1\n\tmax_check_attempts 2\n"
+		        "\tcheck_period 24x7\n\tnotification_period 24x7\n\tcontacts nobody\n%s}\n",
+		        group_host[g], g == FRAGILE ? "\tuse limited\n" : "");
+		for (s = 0; s < SERVICES; s++) {
+			fprintf(fp, "define service {\n\thost_name %s\n\tservice_description s%d\n\tcheck_command %s\n"
+			        "\tmax_check_attempts 1\n\tcheck_interval 1\n\tretry_interval 1\n"
+			        "\tcheck_period 24x7\n\tnotification_period 24x7\n\tcontacts nobody\n}\n",
+			        group_host[g], s, group_command[g]);
+		}
+	}
+	fclose(fp);
+
+	write_file("naemon.cfg", "cfg_file=objects.cfg\nlog_file=naemon.log\ncheck_result_path=.\n"
+	           "interval_length=60\nuse_syslog=0\nretain_state_information=0\n"
+	           "enable_notifications=0\nenable_event_handlers=0\nenable_flap_detection=0\n");
+	write_file("model", "seed 11\nstart 1700000000\nduration 1800\n"
+	           "command check_slow 5 8 0\ncommand check_fast 2 4 0\ncommand check_long 10 20 0\n");
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	nebmodule *mod = nm_calloc(1, sizeof(*mod));
+	unsigned int i, too_few[GROUPS] = { 0 }, expected = DURATION / 60;
+	char path[128];
+
+	plan_tests(6);
+	sprintf(dir, "/tmp/naemon-test-check-limits-%d", (int)getpid());
+	mkdir(dir, 0755);
+	write_config();
+
+	sprintf(path, "%s/model", dir);
+	assert(sim_init(path) == OK);
+	init_macros();
+	init_event_queue();
+	sprintf(path, "%s/naemon.cfg", dir);
+	config_file_dir = nspath_absolute_dirname(path, NULL);
+	assert(OK == read_main_config_file(path));
+	assert(OK == read_all_object_data(path));
+	assert(OK == pre_flight_check());
+	ok(find_host("fragile")->max_concurrent_checks == 2 && find_command("check_slow")->max_concurrent_checks == 3,
+	   "max_concurrent_checks is read for commands and hosts, and inherited from templates");
+
+	neb_init_callback_list();
+	mod->module_handle = mod;
+	neb_add_core_module(mod);
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, mod, 0, track_checks);
+	event_broker_options = BROKER_EVERYTHING;
+	initiated = nm_calloc(num_objects.services, sizeof(*initiated));
+
+	init_timing_loop();
+	event_execution_loop();
+
+	for (i = 0; i < num_objects.services; i++) {
+		/* the first check lands anywhere in the first interval */
+		if (initiated[i] + 1 < expected)
+			too_few[group_of(service_ary[i])]++;
+	}
+
+	ok(peak[SLOW] == 3, "no more than 3 checks of the limited command run at once (peak %u)", peak[SLOW]);
+	ok(peak[FRAGILE] == 2, "no more than 2 checks of the limited host run at once (peak %u)", peak[FRAGILE]);
+	ok(peak[FREE] > 2, "checks of the unlimited host overlap freely (peak %u)", peak[FREE]);
+	ok(!too_few[SLOW] && !too_few[FRAGILE], "checks held back still run once per check interval (%u, %u behind)",
+	   too_few[SLOW], too_few[FRAGILE]);
+	ok(!too_few[FREE], "... as do the unlimited ones");
+
+	discard_deferred_checks();
+	sprintf(path, "rm -rf %s", dir);
+	system(path);
+	return exit_status();
+}
@@ -0,0 +1,260 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/checks.h"
+#include "naemon/events.h"
+#include "naemon/nebmods.h"
+#include "naemon/nebstructs.h"
+#include "naemon/broker.h"
+#include "naemon/simulation.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_HOSTS 10
+#define SERVICES_PER_HOST 5
+#define WARMUP 600
+
+static char dir[64];
+
+/* what a simulation run tells the parent */
+struct outcome {
+	int ok;
+	double mean, variance;
+	unsigned int peak, late, too_few;
+	double long_runtime;
+	unsigned long jobs;
+	int forced_clears;
+};
+
+/* occupancy, weighted by how long it lasted */
+static unsigned int running;
+static double weighted, weighted_sq, sampled;
+static struct timeval last_change;
+static time_t *last_start;
+static unsigned int *initiated;
+static struct outcome result;
+
+static void account_running(void)
+{
+	double dt = (sim_clock.tv_sec - last_change.tv_sec) + (sim_clock.tv_usec - last_change.tv_usec) / 1000000.0;
+
+	if (sim_clock.tv_sec >= sim_get_stats()->start + WARMUP && dt > 0) {
+		weighted += running * dt;
+		weighted_sq += (double)running * running * dt;
+		sampled += dt;
+	}
+	last_change = sim_clock;
+}
+
+static int track_checks(int type, void *data)
+{
+	nebstruct_service_check_data *ds = (nebstruct_service_check_data *)data;
+	service *svc = (service *)ds->object_ptr;
+
+	if (ds->type == NEBTYPE_SERVICECHECK_INITIATE) {
+		account_running();
+		if (++running > result.peak)
+			result.peak = running;
+		/* checks may be moved by up to the slack, but no further */
+		if (last_start[svc->id] && ds->start_time.tv_sec - last_start[svc->id] > svc->check_interval * interval_length + check_placement_slack + 1)
+			result.late++;
+		last_start[svc->id] = ds->start_time.tv_sec;
+		initiated[svc->id]++;
+	} else if (ds->type == NEBTYPE_SERVICECHECK_PROCESSED && running) {
+		account_running();
+		running--;
+	}
+	return 0;
+}
+
+/*
+ * moves a check by placing it where others run, then forces it to run
+ * elsewhere. The next check should be placed as if it was never moved
+ */
+static int forced_check_clears_placement(void)
+{
+	time_t t, placed;
+	unsigned int i;
+
+	for (t = sim_clock.tv_sec + 1; t < sim_clock.tv_sec + interval_length; t++) {
+		for (i = 0; i < num_objects.services; i++) {
+			placed = place_service_check(service_ary[i], t, t + check_placement_slack);
+			if (placed == t)
+				continue;
+			schedule_service_check(service_ary[i], sim_clock.tv_sec, CHECK_OPTION_FORCE_EXECUTION);
+			/* with no slack, only what it was moved by before could move it */
+			t += 2 * interval_length;
+			return place_service_check(service_ary[i], t, t) == t;
+		}
+	}
+	return FALSE;
+}
+
+static void write_file(const char *name, const char *content)
+{
+	char path[128];
+	FILE *fp;
+
+	sprintf(path, "%s/%s", dir, name);
+	fp = fopen(path, "w");
+	assert(fp);
+	fputs(content, fp);
+	fclose(fp);
+}
+
+/* every host has one long-running check, and they're all first in line */
+static void write_config(int slack)
+{
+	char path[128], buf[512];
+	FILE *fp;
+	int h, s;
+
+	sprintf(path, "%s/objects.cfg", dir);
+	fp = fopen(path, "w");
+	assert(fp);
+	fprintf(fp, "define command {\n\tcommand_name check_long\n\tcommand_line /bin/check_long $HOSTNAME$ $SERVICEDESC$\n}\n");
+	fprintf(fp, "define command {\n\tcommand_name check_short\n\tcommand_line /bin/check_short $HOSTNAME$ $SERVICEDESC$\n}\n");
+	fprintf(fp, "define timeperiod {\n\ttimeperiod_name 24x7\n\talias 24x7\n\tmonday 00:00-24:00\n\ttuesday 00:00-24:00\n"
+	        "\twednesday 00:00-24:00\n\tthursday 00:00-24:00\n\tfriday 00:00-24:00\n\tsaturday 00:00-24:00\n\tsunday 00:00-24:00\n}\n");
+	fprintf(fp, "define contact {\n\tcontact_name nobody\n\thost_notification_period 24x7\n\tservice_notification_period 24x7\n"
+	        "\thost_notification_commands check_short\n\tservice_notification_commands check_short\n}\n");
+	for (h = 0; h < NUM_HOSTS; h++) {
+		fprintf(fp, "define host {\n\thost_name h%d\n\taddress 127.0.0.1\n\tmax_check_attempts 2\n"
+		        "\tcheck_period 24x7\n\tnotification_period 24x7\n\tcontacts nobody\n}\n", h);
+		for (s = 0; s < SERVICES_PER_HOST; s++) {
+			fprintf(fp, "define service {\n\thost_name h%d\n\tservice_description s%d\n\tcheck_command %s\n"
+			        "\tmax_check_attempts 1\n\tcheck_interval 1\n\tretry_interval 1\n"
+			        "\tcheck_period 24x7\n\tnotification_period 24x7\n\tcontacts nobody\n}\n",
+			        h, s, s ? "check_short" : "check_long");
+		}
+	}
+	fclose(fp);
+
+	sprintf(buf, "cfg_file=objects.cfg\nlog_file=naemon.log\ncheck_result_path=.\n"
+	        "interval_length=60\ncheck_placement_slack=%d\nuse_syslog=0\nretain_state_information=0\n"
+	        "enable_notifications=0\nenable_event_handlers=0\nenable_flap_detection=0\n", slack);
+	write_file("naemon.cfg", buf);
+}
+
+/* runs the simulation in a child, so every run starts from scratch */
+static struct outcome simulate(int slack)
+{
+	char path[128];
+	int pfd[2], status;
+	struct outcome out;
+	pid_t pid;
+
+	write_config(slack);
+	memset(&out, 0, sizeof(out));
+	assert(!pipe(pfd));
+	fflush(stdout);
+	if (!(pid = fork())) {
+		nebmodule *mod = nm_calloc(1, sizeof(*mod));
+		unsigned int i, expected;
+		int devnull = open("/dev/null", O_WRONLY);
+
+		/* the simulation logs a lot, and we speak TAP */
+		dup2(devnull, STDOUT_FILENO);
+		close(pfd[0]);
+
+		sprintf(path, "%s/model", dir);
+		assert(sim_init(path) == OK);
+		init_macros();
+		init_event_queue();
+		sprintf(path, "%s/naemon.cfg", dir);
+		config_file_dir = nspath_absolute_dirname(path, NULL);
+		assert(OK == read_main_config_file(path));
+		assert(OK == read_all_object_data(path));
+		assert(OK == pre_flight_check());
+
+		neb_init_callback_list();
+		mod->module_handle = mod;
+		neb_add_core_module(mod);
+		neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, mod, 0, track_checks);
+		event_broker_options = BROKER_EVERYTHING;
+		last_start = nm_calloc(num_objects.services, sizeof(*last_start));
+		initiated = nm_calloc(num_objects.services, sizeof(*initiated));
+		last_change = sim_clock;
+
+		init_timing_loop();
+		event_execution_loop();
+		account_running();
+
+		result.mean = weighted / sampled;
+		result.variance = weighted_sq / sampled - result.mean * result.mean;
+		result.long_runtime = predicted_check_runtime(find_service("h0", "s0"));
+		result.jobs = sim_get_stats()->jobs;
+		result.forced_clears = forced_check_clears_placement();
+		expected = (sim_clock.tv_sec - sim_get_stats()->start) / interval_length;
+		for (i = 0; i < num_objects.services; i++) {
+			if (initiated[i] + 1 < expected)
+				result.too_few++;
+		}
+		result.ok = TRUE;
+		write(pfd[1], &result, sizeof(result));
+		_exit(0);
+	}
+
+	close(pfd[1]);
+	if (read(pfd[0], &out, sizeof(out)) != sizeof(out))
+		out.ok = FALSE;
+	close(pfd[0]);
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		out.ok = FALSE;
+	return out;
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	struct outcome even, placed;
+	char path[128];
+
+	plan_tests(7);
+	sprintf(dir, "/tmp/naemon-test-check-placement-%d", (int)getpid());
+	mkdir(dir, 0755);
+	write_file("model", "seed 5\nstart 1700000000\nduration 3600\n"
+	           "command check_long 28 32 0\ncommand check_short 1 3 0\n");
+
+	even = simulate(0);
+	placed = simulate(30);
+	ok(even.ok && placed.ok, "a simulated site with a few 30 second checks runs with and without placement");
+	diag("checks running at once: mean %.2f, variance %.2f, peak %u when spread by count",
+	     even.mean, even.variance, even.peak);
+	diag("checks running at once: mean %.2f, variance %.2f, peak %u when placed by runtime",
+	     placed.mean, placed.variance, placed.peak);
+	ok(placed.variance < even.variance / 2, "placing checks by runtime keeps the number running at once more level");
+	ok(placed.peak < even.peak, "... and lowers the peak (%u vs %u)", placed.peak, even.peak);
+	ok(placed.long_runtime > 28 && placed.long_runtime < 32,
+	   "the runtime of a command is learned from its checks (%.1fs)", placed.long_runtime);
+	ok(!placed.late && !even.late, "no check is moved by more than the slack (%u, %u late)", placed.late, even.late);
+	ok(!placed.too_few && placed.jobs + NUM_HOSTS * SERVICES_PER_HOST >= even.jobs, "... and they all still run regularly (%lu vs %lu checks)",
+	   placed.jobs, even.jobs);
+	ok(placed.forced_clears, "a forced check doesn't leave the next one moved back for where it was placed");
+
+	sprintf(path, "rm -rf %s", dir);
+	system(path);
+	return exit_status();
+}
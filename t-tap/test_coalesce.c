@@ -0,0 +1,157 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/checks.h"
+#include "naemon/commands.h"
+#include "naemon/events.h"
+#include "naemon/broker.h"
+#include "naemon/nebmods.h"
+#include "naemon/nebstructs.h"
+#include "naemon/nm_alloc.h"
+
+#define FLOOD 5000
+
+static nebmodule test_mod;
+static service *svc;
+static unsigned int processed;
+
+static int count_results(int type, void *data)
+{
+	nebstruct_service_check_data *ds = data;
+
+	if (ds->type == NEBTYPE_SERVICECHECK_PROCESSED && ds->object_ptr == svc)
+		processed++;
+	return 0;
+}
+
+static void submit(int code, const char *output)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "[%lu] PROCESS_SERVICE_CHECK_RESULT;host1;Dummy service;%d;%s",
+	         (unsigned long)time(NULL), code, output);
+	assert(CMD_ERROR_OK == process_external_command1(buf));
+}
+
+static double flood(int code)
+{
+	struct timeval start, stop;
+	char buf[32];
+	int i;
+
+	processed = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < FLOOD; i++) {
+		sprintf(buf, "flood %d", i);
+		submit(code, buf);
+	}
+	gettimeofday(&stop, NULL);
+	return (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+static void read_stats(char *buf, size_t len)
+{
+	int sv[2];
+	ssize_t got;
+
+	assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	dump_passive_coalesce_stats(sv[0]);
+	got = read(sv[1], buf, len - 1);
+	buf[got > 0 ? got : 0] = 0;
+	close(sv[0]);
+	close(sv[1]);
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	const char *test_config_file = get_default_config_file();
+	timed_event *event;
+	double all, coalesced;
+	char stats[256];
+
+	plan_tests(11);
+	init_event_queue();
+
+	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
+	assert(OK == read_main_config_file(test_config_file));
+	assert(OK == read_all_object_data(test_config_file));
+	assert((svc = find_service("host1", "Dummy service")));
+	registered_commands_init(200);
+	register_core_commands();
+	log_passive_checks = FALSE;
+
+	event_broker_options = BROKER_EVERYTHING;
+	neb_init_callback_list();
+	test_mod.filename = (char *)"test_coalesce";
+	neb_add_core_module(&test_mod);
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, &test_mod, 0, count_results);
+
+	submit(STATE_OK, "ok");
+	passive_result_coalesce_window = 0;
+	all = flood(STATE_OK);
+	ok(processed == FLOOD, "without a window, all %d results are processed", FLOOD);
+
+	passive_result_coalesce_window = 3600;
+	coalesced = flood(STATE_OK);
+	ok(processed == 1, "with a window, only the first result is processed right away");
+	ok(!strcmp(svc->plugin_output, "flood 0"), "... and it's the first one");
+	read_stats(stats, sizeof(stats));
+	ok(strstr(stats, "coalesced=4998;held=1;") != NULL, "the ones in between are counted as coalesced (%s)", stats);
+	diag("flood of %d: %.3fs coalesced, %.3fs processing them all", FLOOD, coalesced, all);
+
+	processed = 0;
+	submit(STATE_CRITICAL, "outage");
+	ok(processed == 1 && svc->current_state == STATE_CRITICAL, "a state change goes through right away");
+	read_stats(stats, sizeof(stats));
+	ok(strstr(stats, "coalesced=4999;held=0;") != NULL, "... and replaces the held result (%s)", stats);
+	submit(STATE_CRITICAL, "still failing");
+	ok(processed == 2 && !strcmp(svc->plugin_output, "still failing"), "a soft problem isn't held back either");
+
+	submit(STATE_OK, "recovered");
+	svc->state_type = HARD_STATE;
+	processed = 0;
+	flood(STATE_OK);
+	ok(processed == 0 && !strcmp(svc->plugin_output, "recovered"), "unchanged results are held while the window is open");
+	/* there may be other events queued ahead of it, which we skip */
+	while ((event = squeue_peek(nagios_squeue)) && event->event_type != EVENT_USER_FUNCTION)
+		remove_event(nagios_squeue, event);
+	ok(event != NULL, "a flush is scheduled for when the window ends");
+	if (event) {
+		handle_timed_event(event);
+		remove_event(nagios_squeue, event);
+		my_free(event);
+	}
+	ok(processed == 1 && !strcmp(svc->plugin_output, "flood 4999"), "... which processes only the latest result");
+
+	submit(STATE_OK, "before shutdown");
+	flush_coalesced_passive_results();
+	ok(processed == 2 && !strcmp(svc->plugin_output, "before shutdown"), "held results are processed before objects go away");
+
+	neb_free_callback_list();
+	registered_commands_deinit();
+	return exit_status();
+}
@@ -31,7 +31,114 @@
 #include "naemon/nebmods.h"
 #include "naemon/nebmodules.h"
 #include "naemon/xrddefault.h"
+#include "naemon/notifications.h"
 #include "tap.h"
+#include <assert.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define BIG_GROUP 10000
+
+/* the frozen array must hold the list's resolved pointers, in order */
+#define member_list_matches(ary, list, type, ptr_field) \
+	({ \
+		type *m_; \
+		unsigned int i_ = 0; \
+		for (m_ = (list); m_ && i_ < (ary)->count; m_ = m_->next) { \
+			if (m_->ptr_field && m_->ptr_field != (ary)->objs[i_++]) \
+				break; \
+		} \
+		!m_ && i_ == (ary)->count; \
+	})
+
+static double elapsed_ms(struct timeval *start)
+{
+	struct timeval stop;
+
+	gettimeofday(&stop, NULL);
+	return (stop.tv_sec - start->tv_sec) * 1000.0 + (stop.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/*
+ * Walks a BIG_GROUP sized host- and contactgroup both ways, and times
+ * what group commands and notifications do with them
+ */
+static void test_big_groups(void)
+{
+	char dir[] = "/tmp/test_config.XXXXXX", main_cfg[64], objects_cfg[64];
+	FILE *fp;
+	hostgroup *hg;
+	contactgroup *cg;
+	hostsmember *hm;
+	host *h, *owner;
+	nagios_macros mac;
+	struct timeval start;
+	unsigned long list_sum = 0, ary_sum = 0;
+	double list_ms, ary_ms;
+	char *members = NULL;
+	int escalated = FALSE, round;
+	unsigned int i, notified = 0;
+	notification *n;
+
+	memset(&mac, 0, sizeof(mac));
+	assert(mkdtemp(dir) != NULL);
+	sprintf(main_cfg, "%s/naemon.cfg", dir);
+	sprintf(objects_cfg, "%s/objects.cfg", dir);
+	fp = fopen(main_cfg, "w");
+	fprintf(fp, "cfg_file=%s\n", objects_cfg);
+	fclose(fp);
+
+	fp = fopen(objects_cfg, "w");
+	fprintf(fp, "define contactgroup {\n\tcontactgroup_name big\n}\n");
+	fprintf(fp, "define hostgroup {\n\thostgroup_name big\n}\n");
+	for (i = 0; i < BIG_GROUP; i++) {
+		fprintf(fp, "define contact {\n\tcontact_name c%u\n\tcontactgroups big\n\thost_notifications_enabled 1\n}\n", i);
+		fprintf(fp, "define host {\n\thost_name h%u\n\taddress 127.0.0.1\n\tmax_check_attempts 1\n\thostgroups big\n\tcontact_groups big\n}\n", i);
+	}
+	fclose(fp);
+
+	ok(read_all_object_data(main_cfg) == OK, "Read a config with %d member groups", BIG_GROUP);
+	unlink(objects_cfg);
+	unlink(main_cfg);
+	rmdir(dir);
+	hg = find_hostgroup("big");
+	cg = find_contactgroup("big");
+	owner = find_host("h0");
+	assert(hg && cg && owner);
+	ok(hg->member_objs.count == BIG_GROUP && cg->member_objs.count == BIG_GROUP, "Big groups are frozen whole");
+
+	gettimeofday(&start, NULL);
+	for (round = 0; round < 100; round++) {
+		for (hm = hg->members; hm; hm = hm->next)
+			list_sum += hm->host_ptr->id;
+	}
+	list_ms = elapsed_ms(&start);
+	gettimeofday(&start, NULL);
+	for (round = 0; round < 100; round++) {
+		objectarray_foreach(&hg->member_objs, i, h)
+			ary_sum += h->id;
+	}
+	ary_ms = elapsed_ms(&start);
+	ok(list_sum == ary_sum, "Walking the array visits what walking the list does");
+	diag("100 walks of %d members: %.2fms over the list, %.2fms over the array", BIG_GROUP, list_ms, ary_ms);
+
+	gettimeofday(&start, NULL);
+	grab_standard_hostgroup_macro_r(&mac, MACRO_HOSTGROUPMEMBERS, hg, &members);
+	diag("$HOSTGROUPMEMBERS$ for %d hosts: %.2fms", BIG_GROUP, elapsed_ms(&start));
+	ok(members && !strncmp(members, "h0,", 3) && strlen(members) > BIG_GROUP * 2, "$HOSTGROUPMEMBERS$ lists the whole group");
+	my_free(members);
+
+	gettimeofday(&start, NULL);
+	create_notification_list_from_host(&mac, owner, NOTIFICATION_OPTION_NONE, &escalated, NOTIFICATION_CUSTOM);
+	diag("Notification list for a %d contact group: %.2fms", BIG_GROUP, elapsed_ms(&start));
+	for (n = notification_list; n; n = n->next)
+		notified++;
+	ok(notified == BIG_GROUP, "Every member of the contact group is notified");
+	free_notification_list();
+	my_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
+
+	free_object_data();
+}
 
 int main(int argc, char **argv)
 {
@@ -40,8 +147,12 @@ int main(int argc, char **argv)
 	struct host *host1, *host2;
 	hostgroup *temp_hostgroup = NULL;
 	hostsmember *temp_member = NULL;
+	servicegroup *temp_servicegroup = NULL;
+	servicesmember *temp_servicesmember = NULL;
+	contactgroup *temp_contactgroup = NULL;
+	contactsmember *temp_contactsmember = NULL;
 
-	plan_tests(19);
+	plan_tests(29);
 
 	/* reset program variables */
 	reset_variables();
@@ -76,6 +187,74 @@ int main(int argc, char **argv)
 		//printf("host pointer=%d\n", temp_member->host_ptr);
 	}
 
+	/* membership tests must agree with the member lists */
+	c = 0;
+	for (temp_hostgroup = hostgroup_list; temp_hostgroup != NULL; temp_hostgroup = temp_hostgroup->next) {
+		struct host *temp_host;
+		for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
+			int listed = FALSE;
+			for (temp_member = temp_hostgroup->members; temp_member != NULL; temp_member = temp_member->next)
+				listed |= temp_member->host_ptr == temp_host;
+			if (is_host_member_of_hostgroup(temp_hostgroup, temp_host) != listed)
+				c++;
+		}
+	}
+	ok(c == 0, "is_host_member_of_hostgroup() matches the hostgroup member lists");
+
+	c = 0;
+	for (temp_servicegroup = servicegroup_list; temp_servicegroup != NULL; temp_servicegroup = temp_servicegroup->next) {
+		struct service *temp_service;
+		for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
+			int listed = FALSE, host_listed = FALSE;
+			for (temp_servicesmember = temp_servicegroup->members; temp_servicesmember != NULL; temp_servicesmember = temp_servicesmember->next) {
+				listed |= temp_servicesmember->service_ptr == temp_service;
+				host_listed |= temp_servicesmember->service_ptr->host_ptr == temp_service->host_ptr;
+			}
+			if (is_service_member_of_servicegroup(temp_servicegroup, temp_service) != listed)
+				c++;
+			if (is_host_member_of_servicegroup(temp_servicegroup, temp_service->host_ptr) != host_listed)
+				c++;
+		}
+	}
+	ok(c == 0, "Servicegroup membership tests match the servicegroup member lists");
+
+	c = 0;
+	for (temp_contactgroup = contactgroup_list; temp_contactgroup != NULL; temp_contactgroup = temp_contactgroup->next) {
+		struct contact *temp_contact;
+		for (temp_contact = contact_list; temp_contact != NULL; temp_contact = temp_contact->next) {
+			int listed = FALSE;
+			for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next)
+				listed |= temp_contactsmember->contact_ptr == temp_contact;
+			if (is_contact_member_of_contactgroup(temp_contactgroup, temp_contact) != listed)
+				c++;
+		}
+	}
+	ok(c == 0, "is_contact_member_of_contactgroup() matches the contactgroup member lists");
+
+	c = 0;
+	for (temp_hostgroup = hostgroup_list; temp_hostgroup != NULL; temp_hostgroup = temp_hostgroup->next)
+		c += !member_list_matches(&temp_hostgroup->member_objs, temp_hostgroup->members, hostsmember, host_ptr);
+	for (temp_servicegroup = servicegroup_list; temp_servicegroup != NULL; temp_servicegroup = temp_servicegroup->next)
+		c += !member_list_matches(&temp_servicegroup->member_objs, temp_servicegroup->members, servicesmember, service_ptr);
+	for (temp_contactgroup = contactgroup_list; temp_contactgroup != NULL; temp_contactgroup = temp_contactgroup->next)
+		c += !member_list_matches(&temp_contactgroup->member_objs, temp_contactgroup->members, contactsmember, contact_ptr);
+	ok(c == 0, "Frozen group member arrays match the member lists");
+
+	c = 0;
+	for (host1 = host_list; host1 != NULL; host1 = host1->next) {
+		struct service *temp_service;
+		c += !member_list_matches(&host1->service_objs, host1->services, servicesmember, service_ptr);
+		c += !member_list_matches(&host1->contact_objs, host1->contacts, contactsmember, contact_ptr);
+		c += !member_list_matches(&host1->contactgroup_objs, host1->contact_groups, contactgroupsmember, group_ptr);
+		for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
+			if (temp_service->host_ptr != host1)
+				continue;
+			c += !member_list_matches(&temp_service->contact_objs, temp_service->contacts, contactsmember, contact_ptr);
+			c += !member_list_matches(&temp_service->contactgroup_objs, temp_service->contact_groups, contactgroupsmember, group_ptr);
+		}
+	}
+	ok(c == 0, "Frozen contact arrays match the contact lists");
+
 	host1 = find_host("host1");
 	host2 = find_host("host2");
 	ok(host1 != NULL && host2 != NULL, "find_host() should work");
@@ -103,6 +282,8 @@ int main(int argc, char **argv)
 
 	cleanup();
 
+	test_big_groups();
+
 	my_free(config_file);
 
 	return exit_status();
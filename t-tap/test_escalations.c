@@ -0,0 +1,220 @@
+/*****************************************************************************
+ *
+ * test_escalations.c - Test escalation selection
+ *
+ * Program: Naemon Core Testing
+ * License: GPL
+ *
+ * Description:
+ *
+ * Tests that the compiled escalation selectors pick the same escalations
+ * as checking every escalation with is_valid_escalation_for_*_notification(),
+ * and compares their speed on objects with thousands of escalations.
+ *
+ * License:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *****************************************************************************/
+
+#include <string.h>
+#include <sys/time.h>
+#include "naemon/objects.h"
+#include "naemon/notifications.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "tap.h"
+
+#define NUM_ESCALATIONS 5000
+#define MAX_NOTIFICATION_NUMBER 60
+#define BENCH_ROUNDS 20
+
+static service test_service;
+static host test_host;
+
+static double tv_delta(struct timeval *start, struct timeval *stop)
+{
+	return (double)(stop->tv_sec - start->tv_sec) + (double)(stop->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* the escalations are spread over notification numbers 1-50 with mixed state options */
+static void setup_escalations(void)
+{
+	int i;
+
+	test_host.name = "escalated host";
+	test_host.id = 0;
+	test_service.host_name = test_host.name;
+	test_service.description = "escalated service";
+	test_service.host_ptr = &test_host;
+	test_service.id = 0;
+	test_service.notification_interval = 60.0;
+	test_host.notification_interval = 60.0;
+
+	for (i = 0; i < NUM_ESCALATIONS; i++) {
+		serviceescalation *se = calloc(1, sizeof(*se));
+		hostescalation *he = calloc(1, sizeof(*he));
+
+		se->first_notification = he->first_notification = 1 + (i * 7) % 50;
+		se->last_notification = he->last_notification = (i % 5) ? se->first_notification + i % 11 : 0;
+		se->notification_interval = he->notification_interval = (i % 13) - 1 + (i % 3) * 0.5;
+		se->escalation_options = (i % 3) ? OPT_ALL : OPT_WARNING;
+		he->escalation_options = (i % 3) ? OPT_ALL : OPT_UNREACHABLE;
+		se->service_ptr = &test_service;
+		he->host_ptr = &test_host;
+		prepend_object_to_objectlist(&test_service.escalation_list, se);
+		prepend_object_to_objectlist(&test_host.escalation_list, he);
+	}
+}
+
+/* the old way of doing things, one escalation at a time */
+static int linear_service_escalated(service *svc, double *interval)
+{
+	objectlist *list;
+	int escalated = FALSE, have_interval = FALSE;
+
+	*interval = svc->notification_interval;
+	for (list = svc->escalation_list; list; list = list->next) {
+		serviceescalation *se = (serviceescalation *)list->object_ptr;
+		if (is_valid_escalation_for_service_notification(svc, se, NOTIFICATION_OPTION_NONE) == FALSE)
+			continue;
+		escalated = TRUE;
+		if (se->notification_interval < 0.0)
+			continue;
+		if (have_interval == FALSE || se->notification_interval < *interval) {
+			have_interval = TRUE;
+			*interval = se->notification_interval;
+		}
+	}
+	return escalated;
+}
+
+static int linear_host_escalated(host *hst, double *interval)
+{
+	objectlist *list;
+	int escalated = FALSE, have_interval = FALSE;
+
+	*interval = hst->notification_interval;
+	for (list = hst->escalation_list; list; list = list->next) {
+		hostescalation *he = (hostescalation *)list->object_ptr;
+		if (is_valid_escalation_for_host_notification(hst, he, NOTIFICATION_OPTION_NONE) == FALSE)
+			continue;
+		escalated = TRUE;
+		if (he->notification_interval < 0.0)
+			continue;
+		if (have_interval == FALSE || he->notification_interval < *interval) {
+			have_interval = TRUE;
+			*interval = he->notification_interval;
+		}
+	}
+	return escalated;
+}
+
+static void test_service_selection(void)
+{
+	int states[] = { STATE_OK, STATE_WARNING, STATE_CRITICAL, STATE_UNKNOWN };
+	int s, n, escalated = 0, bad_escalated = 0, bad_interval = 0;
+	double interval;
+	time_t next;
+
+	for (s = 0; s < 4; s++) {
+		test_service.current_state = states[s];
+		for (n = 0; n <= MAX_NOTIFICATION_NUMBER; n++) {
+			int expect;
+			test_service.current_notification_number = n;
+			expect = linear_service_escalated(&test_service, &interval);
+			escalated += expect;
+			if (should_service_notification_be_escalated(&test_service) != expect)
+				bad_escalated++;
+			next = get_next_service_notification_time(&test_service, 0);
+			if (next != (time_t)(interval * interval_length))
+				bad_interval++;
+		}
+	}
+	ok(escalated > 0 && escalated < 4 * (MAX_NOTIFICATION_NUMBER + 1), "Service escalations cover some but not all notifications");
+	ok(bad_escalated == 0, "Service escalation decisions match the linear walk (%d mismatches)", bad_escalated);
+	ok(bad_interval == 0, "Escalated service notification intervals match the linear walk (%d mismatches)", bad_interval);
+}
+
+static void test_host_selection(void)
+{
+	int states[] = { HOST_UP, HOST_DOWN, HOST_UNREACHABLE };
+	int s, n, bad_escalated = 0, bad_interval = 0;
+	double interval;
+	time_t next;
+
+	for (s = 0; s < 3; s++) {
+		test_host.current_state = states[s];
+		for (n = 0; n <= MAX_NOTIFICATION_NUMBER; n++) {
+			test_host.current_notification_number = n;
+			if (should_host_notification_be_escalated(&test_host) != linear_host_escalated(&test_host, &interval))
+				bad_escalated++;
+			next = get_next_host_notification_time(&test_host, 0);
+			if (next != (time_t)(interval * interval_length))
+				bad_interval++;
+		}
+	}
+	ok(bad_escalated == 0, "Host escalation decisions match the linear walk (%d mismatches)", bad_escalated);
+	ok(bad_interval == 0, "Escalated host notification intervals match the linear walk (%d mismatches)", bad_interval);
+}
+
+static void test_benchmark(void)
+{
+	struct timeval start, stop;
+	double interval, linear_time, selector_time;
+	int i, n, hits = 0;
+
+	test_service.current_state = STATE_CRITICAL;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		for (n = 0; n <= MAX_NOTIFICATION_NUMBER; n++) {
+			test_service.current_notification_number = n;
+			hits += linear_service_escalated(&test_service, &interval);
+		}
+	}
+	gettimeofday(&stop, NULL);
+	linear_time = tv_delta(&start, &stop);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		for (n = 0; n <= MAX_NOTIFICATION_NUMBER; n++) {
+			test_service.current_notification_number = n;
+			hits -= should_service_notification_be_escalated(&test_service);
+			get_next_service_notification_time(&test_service, 0);
+		}
+	}
+	gettimeofday(&stop, NULL);
+	selector_time = tv_delta(&start, &stop);
+
+	ok(hits == 0, "Benchmark runs select the same escalations");
+	diag("%d escalations, %d lookups: linear walk %.4fs, compiled selector %.4fs",
+	     NUM_ESCALATIONS, BENCH_ROUNDS * (MAX_NOTIFICATION_NUMBER + 1), linear_time, selector_time);
+}
+
+int main(void)
+{
+	plan_tests(6);
+
+	interval_length = 60;
+	setup_escalations();
+
+	test_service_selection();
+	test_host_selection();
+	test_benchmark();
+
+	free_escalation_selectors();
+
+	return exit_status();
+}
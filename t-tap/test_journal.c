@@ -0,0 +1,221 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/comments.h"
+#include "naemon/downtime.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/sretention.h"
+#include "naemon/statusdata.h"
+#include "naemon/events.h"
+#include "naemon/journal.h"
+#include "naemon/nm_alloc.h"
+
+#define COMMENT_EVERY 10
+
+static char journal_path[] = "/tmp/naemon-journal-XXXXXX";
+static char retention_path[] = "/tmp/naemon-retention-XXXXXX";
+
+static off_t journal_size(void)
+{
+	struct stat st;
+
+	if (stat(journal_path, &st) < 0)
+		return -1;
+	return st.st_size;
+}
+
+static void apply_iteration(int i)
+{
+	unsigned int x;
+
+	for (x = 0; x < num_objects.services; x++) {
+		service *svc = service_ary[x];
+		svc->has_been_checked = TRUE;
+		svc->current_state = i % 4;
+		svc->current_attempt = i;
+		svc->last_check = i;
+		my_free(svc->plugin_output);
+		nm_asprintf(&svc->plugin_output, "iteration %d", i);
+		update_service_status(svc, FALSE);
+	}
+	if (!(i % COMMENT_EVERY)) {
+		char data[32];
+		sprintf(data, "iteration %d", i);
+		add_new_comment(HOST_COMMENT, USER_COMMENT, "host1", NULL, i, "tester", data, TRUE, COMMENTSOURCE_INTERNAL, FALSE, 0, NULL);
+	}
+}
+
+/* hammers the journal and reports every iteration it has committed */
+static void run_load(int fd)
+{
+	int i;
+
+	for (i = 1;; i++) {
+		apply_iteration(i);
+		journal_commit(FALSE);
+		if (journal_commit_delay() < 0 && write(fd, &i, sizeof(i)) < 0)
+			_exit(1);
+	}
+}
+
+static int count_comments(int upto)
+{
+	comment *c;
+	int i, found = 0;
+
+	for (i = COMMENT_EVERY; i <= upto; i += COMMENT_EVERY) {
+		char data[32];
+		sprintf(data, "iteration %d", i);
+		for (c = comment_list; c; c = c->next) {
+			if (c->comment_data && !strcmp(c->comment_data, data)) {
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+static void test_crash_replay(void)
+{
+	int pfd[2], i, committed = 0, consistent = 0;
+	unsigned int x;
+	pid_t pid;
+	struct timeval start, stop;
+	double secs;
+
+	assert(pipe(pfd) == 0);
+	gettimeofday(&start, NULL);
+	if (!(pid = fork())) {
+		close(pfd[0]);
+		run_load(pfd[1]);
+	}
+	close(pfd[1]);
+
+	/* let it run for a while, then pull the plug */
+	while (committed < 20000 && read(pfd[0], &i, sizeof(i)) == sizeof(i))
+		committed = i;
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	gettimeofday(&stop, NULL);
+	while (read(pfd[0], &i, sizeof(i)) == sizeof(i))
+		committed = i;
+	close(pfd[0]);
+
+	secs = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+	diag("%d iterations committed in %.2fs, %.0f service records/sec, journal is %ld bytes",
+	     committed, secs, committed * num_objects.services / secs, (long)journal_size());
+
+	ok(service_ary[0]->current_attempt != committed, "the crashed process' state isn't in our memory");
+	ok(journal_replay() == OK, "a journal cut off by a crash can be replayed");
+
+	for (x = 0; x < num_objects.services; x++) {
+		service *svc = service_ary[x];
+		char buf[32];
+		sprintf(buf, "iteration %d", svc->current_attempt);
+		if (svc->current_attempt >= committed && svc->current_state == svc->current_attempt % 4 &&
+		    svc->plugin_output && !strcmp(svc->plugin_output, buf))
+			consistent++;
+	}
+	ok(consistent == (int)num_objects.services, "every committed service state survives the crash");
+	i = count_comments(committed);
+	ok(i == committed / COMMENT_EVERY, "every committed comment survives the crash");
+	if (i != committed / COMMENT_EVERY)
+		diag("found %d of %d comments", i, committed / COMMENT_EVERY);
+	ok(next_comment_id > (unsigned long)i, "replayed comment ids are never handed out again");
+}
+
+static void test_torn_record(void)
+{
+	int fd, state = find_host("host1")->current_state;
+	const char *torn = "H\thost1\t1\t2\t2\t2\t1\t3";
+
+	fd = open(journal_path, O_WRONLY | O_APPEND);
+	assert(fd >= 0);
+	assert(write(fd, torn, strlen(torn)) == (ssize_t)strlen(torn));
+	close(fd);
+	ok(journal_replay() == OK, "a journal with a torn last record can be replayed");
+	ok(find_host("host1")->current_state == state, "the torn record is ignored");
+}
+
+static void test_snapshot(void)
+{
+	service *svc = service_ary[0];
+	off_t size;
+
+	ok(save_state_information(FALSE) == OK, "retention data can be saved");
+	ok(journal_size() == 0, "saving retention data truncates the journal");
+
+	svc->current_state = (svc->current_state + 1) % 4;
+	update_service_status(svc, FALSE);
+	journal_commit(TRUE);
+	size = journal_size();
+	ok(size > 0, "a state change is journaled");
+	update_service_status(svc, FALSE);
+	journal_commit(TRUE);
+	ok(journal_size() == size, "a status update without a state change is not");
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	const char *test_config_file = get_default_config_file();
+	int fd;
+
+	plan_tests(11);
+	init_event_queue();
+
+	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
+	assert(OK == read_main_config_file(test_config_file));
+	assert(OK == read_all_object_data(test_config_file));
+	assert(OK == initialize_downtime_data());
+	assert(OK == initialize_retention_data(test_config_file));
+	assert(OK == initialize_comment_data());
+
+	/* never touch the fixture's retention file */
+	assert((fd = mkstemp(journal_path)) >= 0);
+	close(fd);
+	assert((fd = mkstemp(retention_path)) >= 0);
+	close(fd);
+	my_free(retention_file);
+	retention_file = nm_strdup(retention_path);
+	my_free(temp_file);
+	temp_file = nm_strdup("/tmp/naemon-test-");
+	state_journal_file = nm_strdup(journal_path);
+	state_journal_commit_interval = 5;
+	journal_open();
+
+	test_crash_replay();
+	test_torn_record();
+	test_snapshot();
+
+	journal_close();
+	unlink(journal_path);
+	unlink(retention_path);
+	return exit_status();
+}
@@ -29,9 +29,11 @@
  *****************************************************************************/
 
 #include <string.h>
+#include <sys/time.h>
 #include "naemon/objects.h"
 #include "naemon/macros.h"
 #include "naemon/utils.h"
+#include "naemon/globals.h"
 #include "tap.h"
 
 /*****************************************************************************/
@@ -179,6 +181,158 @@ void test_escaping(nagios_macros *mac)
 	               URL_ENCODE_MACRO_CHARS);
 }
 
+static int kvvec_has_env(struct kvvec *kvv, const char *var)
+{
+	int i;
+
+	for (i = 0; i < kvv->kv_pairs; i++) {
+		if (!strcmp(kvv->kv[i].key, "env") && !strcmp(kvv->kv[i].value, var))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+void test_environment_blocks(nagios_macros *mac)
+{
+	customvariablesmember cvar = { .variable_name = "FOO", .variable_value = "bar" };
+	struct kvvec *kvv;
+	struct timeval start, stop;
+	int i, iterations = 10000;
+
+	test_host.custom_variables = &cvar;
+	enable_environment_macros = TRUE;
+
+	kvv = kvvec_create(MACRO_X_COUNT);
+	ok(OK == add_macro_environment_vars_to_kvvec_r(mac, kvv), "Environment macros can be added to a kvvec");
+	ok(kvvec_has_env(kvv, "NAGIOS_HOSTNAME=name'&%"), "NAGIOS_HOSTNAME is part of the environment");
+	ok(kvvec_has_env(kvv, "NAGIOS_SERVICEDESC=service description"), "NAGIOS_SERVICEDESC is part of the environment");
+	ok(kvvec_has_env(kvv, "NAGIOS__HOSTFOO=bar"), "Custom host variables are part of the environment");
+	kvvec_destroy(kvv, KVVEC_FREE_VALUES);
+
+	/* cached blocks stay until invalidated */
+	cvar.variable_value = "baz";
+	kvv = kvvec_create(MACRO_X_COUNT);
+	add_macro_environment_vars_to_kvvec_r(mac, kvv);
+	ok(kvvec_has_env(kvv, "NAGIOS__HOSTFOO=bar"), "Cached host environment block is reused");
+	kvvec_destroy(kvv, KVVEC_FREE_VALUES);
+
+	invalidate_host_macro_environment(&test_host);
+	kvv = kvvec_create(MACRO_X_COUNT);
+	add_macro_environment_vars_to_kvvec_r(mac, kvv);
+	ok(kvvec_has_env(kvv, "NAGIOS__HOSTFOO=baz"), "Invalidated host environment block is rebuilt");
+	kvvec_destroy(kvv, KVVEC_FREE_VALUES);
+
+	/* check dispatch cost, with and without environment macros */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		kvv = kvvec_create(MACRO_X_COUNT);
+		add_macro_environment_vars_to_kvvec_r(mac, kvv);
+		kvvec_destroy(kvv, KVVEC_FREE_VALUES);
+	}
+	gettimeofday(&stop, NULL);
+	diag("%d environment blocks built in %.3fs with environment macros enabled",
+	     iterations, tv_delta_f(&start, &stop));
+
+	enable_environment_macros = FALSE;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		kvv = kvvec_create(MACRO_X_COUNT);
+		add_macro_environment_vars_to_kvvec_r(mac, kvv);
+		kvvec_destroy(kvv, KVVEC_FREE_VALUES);
+	}
+	gettimeofday(&stop, NULL);
+	diag("%d environment blocks built in %.3fs with environment macros disabled",
+	     iterations, tv_delta_f(&start, &stop));
+
+	kvv = kvvec_create(MACRO_X_COUNT);
+	ok(ERROR == add_macro_environment_vars_to_kvvec_r(mac, kvv) && kvv->kv_pairs == 0,
+	   "No environment macros are added when they're disabled");
+	kvvec_destroy(kvv, KVVEC_FREE_VALUES);
+
+	free_macro_environment_blocks();
+	test_host.custom_variables = NULL;
+}
+
+static void argv_test(nagios_macros *mac, char *command_line, char *cmd, const char *expect)
+{
+	command cmd_obj = { .name = "cmd", .command_line = command_line };
+	char **argv, *raw_command = NULL, *processed_command = NULL, *whole_command = NULL, buf[1024] = "";
+	int i;
+
+	cmd_obj.tmpl = create_command_template(command_line);
+	get_raw_command_line_r(mac, &cmd_obj, cmd ? cmd : "cmd", &raw_command, 0);
+	process_command_line_r(mac, &cmd_obj, raw_command, &processed_command, &argv, 0);
+	process_macros_r(mac, raw_command, &whole_command, 0);
+	if (!argv)
+		strcpy(buf, "(shell)");
+	for (i = 0; argv && argv[i]; i++) {
+		if (i)
+			strcat(buf, ",");
+		strcat(buf, argv[i]);
+	}
+	/* expanding one word at a time makes the same command line */
+	ok(!strcmp(buf, expect) && !strcmp(processed_command, whole_command), "'%s' runs as '%s'", command_line, buf);
+	free_command_argv(argv);
+	my_free(raw_command);
+	my_free(processed_command);
+	my_free(whole_command);
+	destroy_command_template(cmd_obj.tmpl);
+}
+
+static void test_command_template(void)
+{
+	command_template *tmpl;
+
+	tmpl = create_command_template("/bin/check_x -w 'a b' $ARG1$");
+	ok(!tmpl->needs_shell && tmpl->argc == 4 && !strcmp(tmpl->args[2], "a b") && !tmpl->args[3] && !strcmp(tmpl->words[3], "$ARG1$"),
+	   "command lines are split into words when they're loaded, and words without macros into arguments");
+	destroy_command_template(tmpl);
+
+	tmpl = create_command_template("/bin/check_x $ARG1$ > /dev/null");
+	ok(tmpl->needs_shell, "command lines that only work through the shell aren't split");
+	destroy_command_template(tmpl);
+}
+
+void test_command_argv(void)
+{
+	customvariablesmember cvar = { .variable_name = "X", .variable_value = "-C \"a b\"" };
+	host evil_host = { .name = "evil", .plugin_output = "x; touch /tmp/pwned | `id` $(id) 'q' \"dq\" \\", .custom_variables = &cvar };
+	nagios_macros *mac = calloc(1, sizeof(nagios_macros));
+
+	grab_host_macros_r(mac, &evil_host);
+	macro_user[0] = "/plugins";
+
+	/* macro values are never parsed by the shell */
+	argv_test(mac, "/bin/echo \"$HOSTOUTPUT$\"", NULL,
+	          "/bin/echo,x; touch /tmp/pwned | `id` $(id) 'q' \"dq\" \\");
+	argv_test(mac, "/bin/echo $HOSTOUTPUT$", NULL,
+	          "/bin/echo,x;,touch,/tmp/pwned,|,`id`,$(id),'q',\"dq\",\\");
+
+	/* $ARGn$ and $USERn$ are split into words, like the shell would */
+	argv_test(mac, "check_x $ARG1$", "x!-w 5 -c \"a b\"", "check_x,-w,5,-c,a b");
+	argv_test(mac, "check_x \"$ARG1$\"", "x!-w 5", "check_x,-w 5");
+	argv_test(mac, "check_x -H $HOSTNAME$ $ARG1$", "x!-o \"$HOSTOUTPUT$\"",
+	          "check_x,-H,evil,-o,x; touch /tmp/pwned | `id` $(id) 'q' \"dq\" \\");
+	argv_test(mac, "$USER1$/check_x $ARG2$ end", "x!a", "/plugins/check_x,end");
+
+	/* ... and so are custom variables */
+	argv_test(mac, "check_x $_HOSTX$", NULL, "check_x,-C,a b");
+	argv_test(mac, "check_x $ARG1$", "x!-H $HOSTNAME$ $_HOSTX$", "check_x,-H,evil,-C,a b");
+
+	/* words without macros are the same every time */
+	argv_test(mac, "check_x  'a b'\t\"$HOSTNAME$\"x -c\\ d", NULL, "check_x,a b,evilx,-c d");
+
+	/* only the configuration decides whether the shell is used */
+	argv_test(mac, "check_x $ARG1$ | mail root", "x!a", "(shell)");
+	argv_test(mac, "check_x $ARG1$", "x!a; rm -rf /", "(shell)");
+	argv_test(mac, "check_x $$HOME", NULL, "(shell)");
+	argv_test(mac, "check_x \"$ARG1$\"", "x!a \" b", "(shell)");
+
+	macro_user[0] = NULL;
+	clear_volatile_macros_r(mac);
+	free(mac);
+}
+
 /*****************************************************************************/
 /*                             Main function                                 */
 /*****************************************************************************/
@@ -187,7 +341,7 @@ int main(void)
 {
 	nagios_macros *mac;
 
-	plan_tests(22);
+	plan_tests(44);
 
 	reset_variables();
 	init_environment();
@@ -196,6 +350,9 @@ int main(void)
 	mac = setup_macro_object();
 
 	test_escaping(mac);
+	test_environment_blocks(mac);
+	test_command_template();
+	test_command_argv();
 
 	cleanup();
 	free(mac);
@@ -6,8 +6,10 @@
 #include "naemon/statusdata.h"
 #include "naemon/globals.h"
 #include "naemon/checks.h"
+#include "naemon/lib/bitmap.h"
 #include "tap.h"
 #include <assert.h>
+#include <sys/time.h>
 #define NUM_NEBTYPES 2000
 nebmodule *test_nebmodule;
 void *received_callback_data[NEBCALLBACK_NUMITEMS][NUM_NEBTYPES];
@@ -119,13 +121,257 @@ int test_cb_host_check_processed(void)
 	return 0;
 }
 
+static int counted;
+static int _count_cb(int type, void *data)
+{
+	counted++;
+	return 0;
+}
+
+static int count_host_status(host *hst)
+{
+	counted = 0;
+	broker_host_status(NEBTYPE_HOSTSTATUS_UPDATE, NEBFLAG_NONE, NEBATTR_NONE, hst, NULL);
+	return counted;
+}
+
+int test_cb_filters(void)
+{
+	struct host *hst = host_new("MyHost"), *other = host_new("OtherHost");
+	struct service *svc = service_new(hst, "MyService");
+	struct timeval now;
+	neb_cb_filter filter;
+
+	event_broker_options = BROKER_EVERYTHING;
+	neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _test_cb);
+	gettimeofday(&now, NULL);
+	hst->id = 1;
+	other->id = 2;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.subtypes = neb_subtype_flag(NEBTYPE_SERVICECHECK_PROCESSED);
+	assert(OK == neb_register_callback_filtered(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, &filter, _count_cb));
+	counted = 0;
+	broker_service_check(NEBTYPE_SERVICECHECK_PROCESSED, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+	                     now, now, "check_dummy!0", 0.0, 0.0, 0, 0, 0, NULL, NULL, NULL);
+	ok(counted == 1, "callbacks are made for subtypes in the mask");
+	counted = 0;
+	broker_service_check(NEBTYPE_SERVICECHECK_INITIATE, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+	                     now, now, "check_dummy!0", 0.0, 0.0, 0, 0, 0, NULL, NULL, NULL);
+	ok(counted == 0, "... but not for subtypes outside it");
+	neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _count_cb);
+
+	memset(&filter, 0, sizeof(filter));
+	filter.hosts = bitmap_create(16);
+	bitmap_set(filter.hosts, hst->id);
+	assert(OK == neb_register_callback_filtered(NEBCALLBACK_HOST_STATUS_DATA, test_nebmodule->module_handle, 0, &filter, _count_cb));
+	ok(count_host_status(hst) == 1, "callbacks are made for hosts in the bitmap");
+	ok(count_host_status(other) == 0, "... but not for other hosts");
+	neb_deregister_callback(NEBCALLBACK_HOST_STATUS_DATA, _count_cb);
+	bitmap_destroy(filter.hosts);
+
+	memset(&filter, 0, sizeof(filter));
+	filter.flags = NEBFILTER_STATE_CHANGES;
+	assert(OK == neb_register_callback_filtered(NEBCALLBACK_HOST_STATUS_DATA, test_nebmodule->module_handle, 0, &filter, _count_cb));
+	hst->current_state = hst->last_state = STATE_UP;
+	ok(count_host_status(hst) == 0, "state change filters skip unchanged states");
+	hst->current_state = STATE_DOWN;
+	ok(count_host_status(hst) == 1, "... and let changed ones through");
+	neb_deregister_callback(NEBCALLBACK_HOST_STATUS_DATA, _count_cb);
+
+	filter.flags = NEBFILTER_HARD_STATES;
+	assert(OK == neb_register_callback_filtered(NEBCALLBACK_HOST_STATUS_DATA, test_nebmodule->module_handle, 0, &filter, _count_cb));
+	hst->state_type = SOFT_STATE;
+	ok(count_host_status(hst) == 0, "hard state filters skip soft states");
+	hst->state_type = HARD_STATE;
+	ok(count_host_status(hst) == 1, "... and let hard ones through");
+
+	/* an unfiltered callback gets everything, the filtered one still doesn't */
+	assert(OK == neb_register_callback(NEBCALLBACK_HOST_STATUS_DATA, test_nebmodule->module_handle, 0, _count_cb));
+	hst->state_type = SOFT_STATE;
+	ok(count_host_status(hst) == 1, "filters apply per callback");
+	neb_deregister_callback(NEBCALLBACK_HOST_STATUS_DATA, _count_cb);
+	neb_deregister_callback(NEBCALLBACK_HOST_STATUS_DATA, _count_cb);
+
+	service_destroy(svc);
+	host_destroy(other);
+	host_destroy(hst);
+	return 0;
+}
+
+static double time_service_checks(service *svc, int iterations)
+{
+	struct timeval start, stop, now;
+	int i;
+
+	gettimeofday(&now, NULL);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		broker_service_check(NEBTYPE_SERVICECHECK_PROCESSED, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+		                     now, now, "check_dummy!0", 0.0, 0.0, 0, 0, 0, NULL, NULL, NULL);
+	}
+	gettimeofday(&stop, NULL);
+	return ((stop.tv_sec - start.tv_sec) * 1000000.0 + (stop.tv_usec - start.tv_usec)) * 1000.0 / iterations;
+}
+
+int test_cb_overhead(void)
+{
+	struct host *hst = host_new("MyHost");
+	struct service *svc = service_new(hst, "MyService");
+	neb_cb_filter filter;
+	double none, unfiltered, filtered;
+	const int iterations = 200000;
+
+	event_broker_options = BROKER_EVERYTHING;
+	none = time_service_checks(svc, iterations);
+
+	assert(OK == neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, _count_cb));
+	counted = 0;
+	unfiltered = time_service_checks(svc, iterations);
+	ok(counted == iterations, "unfiltered callbacks see every check");
+	neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _count_cb);
+
+	memset(&filter, 0, sizeof(filter));
+	filter.flags = NEBFILTER_STATE_CHANGES;
+	svc->current_state = svc->last_state = STATE_OK;
+	assert(OK == neb_register_callback_filtered(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, &filter, _count_cb));
+	counted = 0;
+	filtered = time_service_checks(svc, iterations);
+	ok(counted == 0, "filtered callbacks see none of them");
+	neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _count_cb);
+
+	diag("service check broker overhead: %.0fns without callbacks, %.0fns unfiltered, %.0fns filtered",
+	     none, unfiltered, filtered);
+
+	service_destroy(svc);
+	host_destroy(hst);
+	return 0;
+}
+
+static unsigned int batches, batched, batch_errors;
+static int batch_state;
+static int _batch_cb(const neb_batch_event *events, unsigned int count)
+{
+	unsigned int i;
+
+	batches++;
+	for (i = 0; i < count; i++) {
+		if (events[i].svc && events[i].state != batch_state)
+			batch_errors++;
+		batched++;
+	}
+	return 0;
+}
+
+static const neb_batch_event *last_batch;
+static unsigned int last_batch_count;
+static int _keep_batch_cb(const neb_batch_event *events, unsigned int count)
+{
+	static neb_batch_event copy[8];
+
+	memcpy(copy, events, (count < 8 ? count : 8) * sizeof(*events));
+	last_batch = copy;
+	last_batch_count = count;
+	return 0;
+}
+
+/* stops getting events as soon as it gets the first batch */
+static unsigned int self_deregistered;
+static int _deregister_batch_cb(const neb_batch_event *events, unsigned int count)
+{
+	self_deregistered += count;
+	neb_deregister_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _deregister_batch_cb);
+	return 0;
+}
+
+int test_cb_batches(void)
+{
+	struct host *hst = host_new("MyHost");
+	struct service *svc = service_new(hst, "MyService");
+	struct timeval now;
+	double per_event, batched_event;
+	const int iterations = 200000;
+	int i;
+
+	event_broker_options = BROKER_EVERYTHING;
+	gettimeofday(&now, NULL);
+
+	assert(OK == neb_register_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, NULL, 100, _batch_cb));
+	batch_state = svc->current_state = STATE_WARNING;
+	for (i = 0; i < 250; i++) {
+		broker_service_check(NEBTYPE_SERVICECHECK_PROCESSED, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+		                     now, now, "check_dummy!0", 0.0, 0.0, 0, 0, 0, NULL, NULL, NULL);
+	}
+	ok(batches == 2 && batched == 200, "full batches are delivered right away");
+	svc->current_state = STATE_CRITICAL;
+	neb_flush_batches();
+	ok(batches == 3 && batched == 250, "the rest is delivered when batches are flushed");
+	ok(batch_errors == 0, "records have the state from when the event happened");
+	neb_flush_batches();
+	ok(batches == 3, "empty batches aren't delivered");
+	neb_deregister_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _batch_cb);
+
+	/* one buffer for all types a batch function is registered for */
+	assert(OK == neb_register_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, NULL, 0, _keep_batch_cb));
+	assert(OK == neb_register_batch_callback(NEBCALLBACK_HOST_STATUS_DATA, test_nebmodule->module_handle, 0, NULL, 0, _keep_batch_cb));
+	broker_service_check(NEBTYPE_SERVICECHECK_PROCESSED, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+	                     now, now, "check_dummy!0", 0.0, 0.0, 0, 0, 0, NULL, NULL, NULL);
+	broker_host_status(NEBTYPE_HOSTSTATUS_UPDATE, NEBFLAG_NONE, NEBATTR_NONE, hst, &now);
+	neb_flush_batches();
+	ok(last_batch_count == 2, "events of different types share a batch");
+	ok(last_batch && last_batch[0].callback_type == NEBCALLBACK_SERVICE_CHECK_DATA && last_batch[0].type == NEBTYPE_SERVICECHECK_PROCESSED
+	   && last_batch[0].svc == svc && last_batch[0].hst == hst, "service events carry their service and host");
+	ok(last_batch && last_batch[1].callback_type == NEBCALLBACK_HOST_STATUS_DATA && last_batch[1].svc == NULL
+	   && last_batch[1].hst == hst && last_batch[1].timestamp.tv_sec == now.tv_sec, "host events carry their host and timestamp");
+	neb_deregister_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _keep_batch_cb);
+	neb_deregister_batch_callback(NEBCALLBACK_HOST_STATUS_DATA, _keep_batch_cb);
+	last_batch_count = 0;
+	broker_host_status(NEBTYPE_HOSTSTATUS_UPDATE, NEBFLAG_NONE, NEBATTR_NONE, hst, &now);
+	neb_flush_batches();
+	ok(last_batch_count == 0, "nothing is batched once deregistered");
+
+	assert(OK == neb_register_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, NULL, 0, _keep_batch_cb));
+	broker_service_check(NEBTYPE_SERVICECHECK_PROCESSED, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+	                     now, now, "check_dummy!0", 0.0, 0.0, 0, 0, 0, NULL, NULL, NULL);
+	neb_deregister_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _keep_batch_cb);
+	ok(last_batch_count == 1, "what was batched before deregistering is still delivered");
+
+	assert(OK == neb_register_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, NULL, 2, _deregister_batch_cb));
+	for (i = 0; i < 4; i++) {
+		broker_service_check(NEBTYPE_SERVICECHECK_PROCESSED, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+		                     now, now, "check_dummy!0", 0.0, 0.0, 0, 0, 0, NULL, NULL, NULL);
+	}
+	neb_flush_batches();
+	ok(self_deregistered == 2, "a batch function may deregister itself");
+
+	/* what a forwarding module pays per event, either way */
+	assert(OK == neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, _count_cb));
+	per_event = time_service_checks(svc, iterations);
+	neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _count_cb);
+	assert(OK == neb_register_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, NULL, 0, _batch_cb));
+	batches = batched = 0;
+	batched_event = time_service_checks(svc, iterations);
+	neb_flush_batches();
+	neb_deregister_batch_callback(NEBCALLBACK_SERVICE_CHECK_DATA, _batch_cb);
+	ok(batched == (unsigned int)iterations, "every event makes it into a batch");
+	diag("service check broker overhead: %.0fns per event, %.0fns batched (%u batches)",
+	     per_event, batched_event, batches);
+
+	service_destroy(svc);
+	host_destroy(hst);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
-	plan_tests(11);
+	plan_tests(33);
 	assert(OK == neb_init_callback_list());
 	test_nebmodule = malloc(sizeof(nebmodule));
 	neb_add_core_module(test_nebmodule);
 	test_cb_service_check_processed();
 	test_cb_host_check_processed();
+	test_cb_filters();
+	test_cb_overhead();
+	test_cb_batches();
 	return exit_status();
 }
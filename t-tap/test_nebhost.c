@@ -0,0 +1,154 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/checks.h"
+#include "naemon/commands.h"
+#include "naemon/events.h"
+#include "naemon/broker.h"
+#include "naemon/nebmods.h"
+#include "naemon/neberrors.h"
+#include "naemon/nm_alloc.h"
+
+#define FLOOD 20000
+
+static unsigned int echoed;
+static char last_echo[256];
+
+static int echo_handler(const struct external_command *ext_command, time_t entry_time)
+{
+	snprintf(last_echo, sizeof(last_echo), "%s", (char *)command_argument_get_value(ext_command, "output"));
+	echoed++;
+	return OK;
+}
+
+static void service_result(service *svc, const char *output)
+{
+	check_result cr;
+
+	init_check_result(&cr);
+	cr.object_check_type = SERVICE_CHECK;
+	cr.check_type = CHECK_TYPE_PASSIVE;
+	cr.host_name = svc->host_name;
+	cr.service_description = svc->description;
+	cr.output = (char *)output;
+	gettimeofday(&cr.start_time, NULL);
+	cr.finish_time = cr.start_time;
+	process_check_result(&cr);
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	const char *test_config_file = get_default_config_file();
+	struct external_command *ext_command;
+	nebmodule *echo, *crash, *hang, *broken;
+	host *hst;
+	service *svc;
+	struct timeval start;
+	char buf[64];
+	time_t when;
+	int i;
+
+	plan_tests(14);
+	init_event_queue();
+
+	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
+	assert(OK == read_main_config_file(test_config_file));
+	assert(OK == read_all_object_data(test_config_file));
+	assert((hst = find_host("host1")));
+	assert((svc = find_service("host1", "Dummy service")));
+	event_broker_options = BROKER_EVERYTHING;
+
+	registered_commands_init(20);
+	ext_command = command_create("ECHO", echo_handler, "Records what the echo module saw", NULL);
+	command_argument_add(ext_command, "output", STRING, NULL, NULL);
+	command_register(ext_command, -1);
+
+	nagios_iobs = iobroker_create();
+	neb_init_modules();
+	neb_init_callback_list();
+
+	echo = neb_add_isolated_module(NEBHOST_MODULE, "echo");
+	crash = neb_add_isolated_module(NEBHOST_MODULE, "crash");
+	hang = neb_add_isolated_module(NEBHOST_MODULE, "hang");
+	broken = neb_add_isolated_module("/nonexistent/module.so", NULL);
+
+	ok(neb_load_module(echo) == OK && neb_load_module(crash) == OK && neb_load_module(hang) == OK,
+	   "isolated modules are loaded in module hosts");
+	ok(echo->is_currently_loaded && crash->is_currently_loaded && hang->is_currently_loaded, "... and count as loaded");
+	ok(neb_load_module(broken) == ERROR && !broken->is_currently_loaded, "a module that fails to load is reported as such");
+
+	service_result(svc, "ping 1");
+	for (i = 0; i < 1000 && (echoed < 1 || crash->is_currently_loaded || !hst->plugin_output || strcmp(hst->plugin_output, "echo: ping 1")); i++)
+		iobroker_poll(nagios_iobs, 10);
+	ok(hst->plugin_output && !strcmp(hst->plugin_output, "echo: ping 1"),
+	   "a check result submitted by an isolated module is processed by the core");
+	ok(echoed == 1 && !strcmp(last_echo, "ping 1"), "... and so is a command, which saw the service's current output");
+	ok(!crash->is_currently_loaded, "a module that crashes is noticed");
+	ok(echo->is_currently_loaded && hang->is_currently_loaded, "... without affecting the others");
+
+	/* the hanging module won't take any of these */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < FLOOD; i++) {
+		snprintf(buf, sizeof(buf), "result %d", i);
+		service_result(svc, buf);
+	}
+	ok(elapsed(&start) < 10, "the core isn't held up by a module that hangs (%d results in %.3fs)", FLOOD, elapsed(&start));
+	ok(svc->plugin_output && !strcmp(svc->plugin_output, "result 19999"), "... and keeps processing results");
+
+	when = time(NULL) + 10;
+	schedule_service_check(svc, when, CHECK_OPTION_FORCE_EXECUTION);
+	ok(svc->next_check == when, "... and scheduling checks");
+
+	/* it may have had to drop some of the flood, so keep at it */
+	for (i = 0; i < 1000 && echoed < 2; i++) {
+		if (!(i % 100))
+			service_result(svc, "ping 2");
+		iobroker_poll(nagios_iobs, 10);
+	}
+	ok(echoed >= 2 && !strcmp(last_echo, "ping 2"), "the module that kept up still gets events");
+
+	ok(neb_unload_module(echo, NEBMODULE_FORCE_UNLOAD, NEBMODULE_NEB_SHUTDOWN) == OK && !echo->is_currently_loaded,
+	   "an isolated module is unloaded");
+	gettimeofday(&start, NULL);
+	ok(neb_unload_module(hang, NEBMODULE_FORCE_UNLOAD, NEBMODULE_NEB_SHUTDOWN) == OK && !hang->is_currently_loaded,
+	   "a module that hangs is killed when unloaded");
+	ok(elapsed(&start) < 10, "... after a while (%.3fs)", elapsed(&start));
+
+	neb_free_callback_list();
+	neb_free_module_list();
+	neb_deinit_modules();
+	registered_commands_deinit();
+	iobroker_destroy(nagios_iobs, 0);
+	return exit_status();
+}
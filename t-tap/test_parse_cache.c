@@ -0,0 +1,270 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/nm_alloc.h"
+
+#define GEN_FILES 200
+#define GEN_HOSTS 25
+
+static char tmpdir[] = "/tmp/naemon-parse-cache-XXXXXX";
+static char *cache_path;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* returns the object cache file without its timestamped header */
+static char *slurp_objects(const char *path)
+{
+	FILE *fp;
+	struct stat st;
+	char *buf, *body;
+
+	if (stat(path, &st) < 0 || !(fp = fopen(path, "r")))
+		return NULL;
+	buf = nm_malloc(st.st_size + 1);
+	buf[fread(buf, 1, st.st_size, fp)] = 0;
+	fclose(fp);
+	body = strstr(buf, "\n\n");
+	body = nm_strdup(body ? body : buf);
+	free(buf);
+	return body;
+}
+
+/* reads the objects of a config and returns them as objects.cache would have them */
+static char *read_objects(const char *cfg, const char *parse_cache, double *elapsed)
+{
+	char *out = NULL;
+	double start;
+	int result;
+
+	nm_asprintf(&out, "%s/objects.cache", tmpdir);
+	reset_variables();
+	my_free(config_file_dir);
+	config_file_dir = nspath_absolute_dirname(cfg, NULL);
+	assert(OK == read_main_config_file(cfg));
+	my_free(object_parse_cache_file);
+	if (parse_cache)
+		object_parse_cache_file = nm_strdup(parse_cache);
+
+	start = now();
+	result = read_object_config_data(cfg, READ_ALL_OBJECT_DATA);
+	if (elapsed)
+		*elapsed = now() - start;
+	if (result != OK) {
+		free(out);
+		return NULL;
+	}
+	fcache_objects(out);
+	free_object_data();
+	my_free(object_parse_cache_file);
+
+	return slurp_objects(out);
+}
+
+static void write_file(const char *path, const char *fmt, ...)
+{
+	FILE *fp = fopen(path, "w");
+	va_list ap;
+
+	assert(fp);
+	va_start(ap, fmt);
+	vfprintf(fp, fmt, ap);
+	va_end(ap);
+	fclose(fp);
+}
+
+static void write_host_file(int f, int extra)
+{
+	char *path;
+	FILE *fp;
+	int h;
+
+	nm_asprintf(&path, "%s/conf.d/hosts%03d.cfg", tmpdir, f);
+	assert((fp = fopen(path, "w")));
+	for (h = 0; h < GEN_HOSTS + extra; h++) {
+		fprintf(fp, "; host %d in file %d\n", h, f);
+		fprintf(fp, "define host {\n\tuse\t\tgeneric-host\n\thost_name\thost-%d-%d\n", f, h);
+		fprintf(fp, "\talias\t\tHost %d \\; in file %d ; with a comment\n", h, f);
+		fprintf(fp, "\taddress\t\t10.%d.%d.1\n\t_CUSTOM\t\tvalue with \\\n\t\tcontinuation\n}\n", f, h);
+		fprintf(fp, "define service {\n\tuse\t\t\tgeneric-service\n\thost_name\t\thost-%d-%d\n", f, h);
+		fprintf(fp, "\tservice_description\tPING\n}\n\n");
+	}
+	fclose(fp);
+	free(path);
+}
+
+/* a config tree with many files, includes, templates and odd syntax */
+static char *generate_config(void)
+{
+	char *path;
+	int f;
+
+	nm_asprintf(&path, "%s/conf.d", tmpdir);
+	assert(!mkdir(path, 0755));
+	free(path);
+
+	nm_asprintf(&path, "%s/included.cfg", tmpdir);
+	write_file(path,
+	           "define command {\n\tcommand_name\tcheck-host-alive\n\tcommand_line\t/bin/true $HOSTADDRESS$\n}\n"
+	           "define command {\n\tcommand_name\tcheck_ping\n\tcommand_line\t/bin/true -w 100,20%%\n}\n"
+	           "define timeperiod {\n\ttimeperiod_name\t24x7\n\talias\t24x7\n\tmonday\t00:00-24:00\n}\n");
+	free(path);
+
+	nm_asprintf(&path, "%s/templates.cfg", tmpdir);
+	write_file(path,
+	           "include_file=%s/included.cfg\n"
+	           "define host {\n\tname\t\t\tgeneric-host\n\tcheck_command\t\tcheck-host-alive\n"
+	           "\tmax_check_attempts\t3\n\tcheck_period\t\t24x7\n\tregister\t\t0\n}\n"
+	           "define service {\n\tname\t\t\tgeneric-service\n\tcheck_command\t\tcheck_ping\n"
+	           "\tmax_check_attempts\t3\n\tcheck_interval\t\t5\n\tregister\t\t0\n}\n",
+	           tmpdir);
+	free(path);
+
+	for (f = 0; f < GEN_FILES; f++)
+		write_host_file(f, 0);
+
+	nm_asprintf(&path, "%s/naemon.cfg", tmpdir);
+	write_file(path, "cfg_file=templates.cfg\ncfg_dir=conf.d\n");
+
+	return path;
+}
+
+static void remove_tmpdir(void)
+{
+	char *path;
+	int f;
+
+	for (f = 0; f < GEN_FILES; f++) {
+		nm_asprintf(&path, "%s/conf.d/hosts%03d.cfg", tmpdir, f);
+		unlink(path);
+		free(path);
+	}
+	nm_asprintf(&path, "%s/conf.d", tmpdir);
+	rmdir(path);
+	free(path);
+	nm_asprintf(&path, "rm -f %s/*.cfg %s/objects.*", tmpdir, tmpdir);
+	if (system(path) == 0)
+		rmdir(tmpdir);
+	free(path);
+}
+
+static void test_fixture(const char *name, const char *cfg)
+{
+	char *plain, *cold, *warm;
+
+	unlink(cache_path);
+	plain = read_objects(cfg, NULL, NULL);
+	cold = read_objects(cfg, cache_path, NULL);
+	warm = read_objects(cfg, cache_path, NULL);
+	ok(plain != NULL, "%s: objects can be read", name);
+	ok(cold && plain && !strcmp(plain, cold), "%s: same objects when filling the parse cache", name);
+	ok(warm && plain && !strcmp(plain, warm), "%s: same objects from the parse cache", name);
+	free(plain);
+	free(cold);
+	free(warm);
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	char *cfg, *plain, *warm;
+	double plain_time, cold_time, warm_time;
+	struct stat st;
+
+	plan_tests(18);
+	assert(mkdtemp(tmpdir));
+	nm_asprintf(&cache_path, "%s/objects.parsecache", tmpdir);
+
+	test_fixture("smallconfig", get_default_config_file());
+	test_fixture("services", TESTS_CONFIGDIR "services/naemon.cfg");
+	test_fixture("recursive", TESTS_CONFIGDIR "recursive/naemon.cfg");
+
+	cfg = generate_config();
+	test_fixture("generated", cfg);
+	ok(stat(cache_path, &st) == 0 && st.st_size > 0, "the parse cache is saved");
+
+	unlink(cache_path);
+	plain = read_objects(cfg, NULL, &plain_time);
+	free(read_objects(cfg, cache_path, &cold_time));
+	warm = read_objects(cfg, cache_path, &warm_time);
+	ok(plain && warm && !strcmp(plain, warm), "objects from a warm cache match");
+	diag("%d files, %d hosts: uncached %.3fs, filling the cache %.3fs, warm cache %.3fs",
+	     GEN_FILES + 3, GEN_FILES * GEN_HOSTS, plain_time, cold_time, warm_time);
+	free(plain);
+	free(warm);
+
+	/* edit one file without changing its size or mtime - only the hash notices */
+	plain = read_objects(cfg, NULL, NULL);
+	{
+		char *path;
+		FILE *fp;
+		struct stat before;
+
+		nm_asprintf(&path, "%s/conf.d/hosts007.cfg", tmpdir);
+		assert(!stat(path, &before));
+		assert((fp = fopen(path, "r+")));
+		fseek(fp, strlen("; host 0 in file 7\ndefine host {\n\tuse\t\tgeneric-host\n\thost_name\thost-7-0\n\talias\t\t"), SEEK_SET);
+		fputc('X', fp);
+		fclose(fp);
+		{
+			struct timeval tv[2];
+			tv[0].tv_sec = tv[1].tv_sec = before.st_mtime;
+			tv[0].tv_usec = tv[1].tv_usec = 0;
+			utimes(path, tv);
+		}
+		free(path);
+	}
+	warm = read_objects(cfg, cache_path, NULL);
+	ok(warm && strstr(warm, "Xost 0"), "a changed file is parsed again");
+	ok(warm && plain && strcmp(plain, warm), "objects reflect the changed file");
+	free(warm);
+	free(plain);
+
+	/* more objects in a file changes its size */
+	write_host_file(3, 5);
+	plain = read_objects(cfg, NULL, NULL);
+	warm = read_objects(cfg, cache_path, NULL);
+	ok(plain && warm && !strcmp(plain, warm) && strstr(warm, "host-3-27"), "a grown file is parsed again");
+	free(plain);
+	free(warm);
+
+	/* a damaged cache is ignored */
+	write_file(cache_path, "# Naemon object parse cache v1\n1 2 3 999999 %s/templates.cfg\ngarbage", tmpdir);
+	plain = read_objects(cfg, NULL, NULL);
+	warm = read_objects(cfg, cache_path, NULL);
+	ok(plain && warm && !strcmp(plain, warm), "a damaged parse cache is ignored");
+	free(plain);
+	free(warm);
+
+	remove_tmpdir();
+	return exit_status();
+}
@@ -0,0 +1,255 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/defaults.h"
+#include "naemon/perfdata.h"
+#include "naemon/perfsink.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_LINES 20000
+#define TS 1700000000
+
+static perfdata_list list;
+
+static perfdata_metric *parse_one(const char *perf_data)
+{
+	if (parse_perfdata(perf_data, &list) != 1)
+		return NULL;
+	return &list.metrics[0];
+}
+
+static void test_parser(void)
+{
+	perfdata_metric *m;
+
+	m = parse_one("time=0.5s;1;2;0;10");
+	ok(m && !strcmp(m->label, "time") && m->value == 0.5 && !strcmp(m->uom, "s"), "plain metrics are parsed");
+	ok(m && m->flags == (PERFDATA_VALUE | PERFDATA_WARN | PERFDATA_CRIT | PERFDATA_MIN | PERFDATA_MAX) &&
+	   m->warn.start == 0 && m->warn.end == 1 && m->crit.end == 2 && m->min == 0 && m->max == 10,
+	   "... along with their thresholds and limits");
+
+	ok(parse_perfdata("'quoted label'=5 'it''s'=1B", &list) == 2 &&
+	   !strcmp(list.metrics[0].label, "quoted label") && !strcmp(list.metrics[1].label, "it's") &&
+	   !strcmp(list.metrics[1].uom, "B"), "quoted labels may contain spaces and escaped quotes");
+	ok(parse_perfdata("'a=b;c'=1;2", &list) == 1 && !strcmp(list.metrics[0].label, "a=b;c") &&
+	   list.metrics[0].warn.end == 2, "quoted labels may contain = and ;");
+	ok(parse_perfdata("'unterminated=1 ok=2", &list) == 0, "unterminated quotes swallow the rest");
+
+	m = parse_one("empty=1;;;;");
+	ok(m && m->flags == PERFDATA_VALUE && !*m->uom, "empty fields are left unset");
+	m = parse_one("sparse=1;;5;;7");
+	ok(m && m->flags == (PERFDATA_VALUE | PERFDATA_CRIT | PERFDATA_MAX) && m->crit.end == 5 && m->max == 7,
+	   "fields after empty ones are still found");
+	m = parse_one("unknown=U;1;2");
+	ok(m && !(m->flags & PERFDATA_VALUE) && (m->flags & PERFDATA_WARN), "U is an undetermined value");
+
+	m = parse_one("pct=99,5%;80:;~:90");
+	ok(m && m->value == 99.5 && !strcmp(m->uom, "%"), "comma decimal separators are understood");
+	ok(m && m->warn.start == 80 && isinf(m->warn.end) && isinf(m->crit.start) && m->crit.start < 0 &&
+	   m->crit.end == 90, "open ended ranges are understood");
+	m = parse_one("bytes=1,234.5B;-1,000.25");
+	ok(m && m->value == 1234.5 && !strcmp(m->uom, "B") && m->warn.end == -1000.25,
+	   "commas only group digits in numbers with a decimal point");
+	m = parse_one("in=1;@10:20;-5:-1");
+	ok(m && m->warn.inside && m->warn.start == 10 && m->warn.end == 20 && !m->crit.inside &&
+	   m->crit.start == -5 && m->crit.end == -1, "inside ranges and negative numbers are understood");
+	m = parse_one("bad=1;20:10;abc;x;1e3");
+	ok(m && m->flags == (PERFDATA_VALUE | PERFDATA_MAX) && m->max == 1000,
+	   "broken thresholds and limits are ignored, but the metric is kept");
+
+	ok(parse_perfdata("a=1ms b=2KB c=3c d=4.5e2MiB e=-1", &list) == 5 &&
+	   !strcmp(list.metrics[0].uom, "ms") && !strcmp(list.metrics[1].uom, "KB") &&
+	   !strcmp(list.metrics[2].uom, "c") && list.metrics[3].value == 450 &&
+	   !strcmp(list.metrics[3].uom, "MiB") && list.metrics[4].value == -1 && !*list.metrics[4].uom,
+	   "units of measurement follow the value");
+	ok(parse_perfdata("novalue= =3 noequals x=abc y=nan z=inf h=0x10 ok=1", &list) == 1 &&
+	   !strcmp(list.metrics[0].label, "ok"), "malformed metrics are skipped");
+	ok(parse_perfdata("  \tlead=1  \n trail=2  ", &list) == 2 && list.metrics[1].value == 2,
+	   "any amount of whitespace separates metrics");
+	ok(parse_perfdata("", &list) == 0 && parse_perfdata(NULL, &list) == 0, "no perfdata means no metrics");
+}
+
+static char *slurp(const char *path)
+{
+	static char buf[4096];
+	int fd, len;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	buf[len < 0 ? 0 : len] = 0;
+	return buf;
+}
+
+static void test_file_sink(void)
+{
+	host hst;
+	service svc;
+	char path[64];
+	char *out;
+
+	memset(&hst, 0, sizeof(hst));
+	memset(&svc, 0, sizeof(svc));
+	hst.name = "host1";
+	hst.perf_data = "rta=0.1ms pl=U;20";
+	hst.last_check = TS;
+	svc.host_name = "host,1";
+	svc.description = "Disk usage";
+	svc.perf_data = "'/var'=55%;80;@90:;0;100";
+	svc.last_check = TS;
+
+	sprintf(path, "/tmp/naemon-test-perfdata-%d", (int)getpid());
+	unlink(path);
+	perfdata_sink = path;
+	perfdata_sink_format = PERFSINK_INFLUX;
+	perfsink_open();
+	perfsink_service(&svc);
+	perfsink_host(&hst);
+	ok(perfsink_flush_delay() > 0 && (out = slurp(path)) && !*out, "metrics are batched");
+	perfsink_flush(TRUE);
+	out = slurp(path);
+	ok(out && !strcmp(out,
+	                  "perfdata,host=host\\,1,service=Disk\\ usage,metric=/var,unit=% value=55,warn_start=0,warn_end=80,crit_start=90,crit_inside=true,min=0,max=100 1700000000000000000\n"
+	                  "perfdata,host=host1,metric=rta,unit=ms value=0.1 1700000000000000000\n"
+	                  "perfdata,host=host1,metric=pl warn_start=0,warn_end=20 1700000000000000000\n"),
+	   "influx lines are written");
+	perfsink_close();
+	unlink(path);
+
+	perfdata_sink_format = PERFSINK_GRAPHITE;
+	perfsink_open();
+	perfsink_service(&svc);
+	perfsink_host(&hst);
+	perfsink_close();
+	out = slurp(path);
+	ok(out && !strcmp(out,
+	                  "host_1.Disk_usage._var.value 55 1700000000\n"
+	                  "host_1.Disk_usage._var.warn_start 0 1700000000\n"
+	                  "host_1.Disk_usage._var.warn_end 80 1700000000\n"
+	                  "host_1.Disk_usage._var.crit_start 90 1700000000\n"
+	                  "host_1.Disk_usage._var.min 0 1700000000\n"
+	                  "host_1.Disk_usage._var.max 100 1700000000\n"
+	                  "host1._HOST_.rta.value 0.1 1700000000\n"
+	                  "host1._HOST_.pl.warn_start 0 1700000000\n"
+	                  "host1._HOST_.pl.warn_end 20 1700000000\n"),
+	   "graphite lines are written, and closing the sink flushes it");
+	unlink(path);
+	perfdata_sink = NULL;
+}
+
+/* reads what's there, returns 1 if a line was torn or out of order */
+static int drain(int sd, char *buf, size_t *len, size_t size, int *last)
+{
+	ssize_t ret;
+	char *p, *nl;
+	int n, bad = 0;
+
+	while ((ret = read(sd, buf + *len, size - *len)) > 0) {
+		*len += ret;
+		for (p = buf; (nl = memchr(p, '\n', buf + *len - p)); p = nl + 1) {
+			if (sscanf(p, "perfdata,host=host1,service=svc1,metric=m value=%d 1700000000000000000\n", &n) != 1 ||
+			    n <= *last || memchr(p, '\n', nl - p))
+				bad = 1;
+			*last = n;
+		}
+		memmove(buf, p, buf + *len - p);
+		*len -= p - buf;
+	}
+	return bad;
+}
+
+static void test_socket_sink(void)
+{
+	struct sockaddr_un addr;
+	service svc;
+	char path[64], perf[32], buf[8192];
+	int i, lsd, sd, last = 0, bad = 0, result;
+	size_t len = 0;
+
+	memset(&svc, 0, sizeof(svc));
+	svc.host_name = "host1";
+	svc.description = "svc1";
+	svc.perf_data = perf;
+	svc.last_check = TS;
+
+	sprintf(path, "/tmp/naemon-test-perfsink-%d", (int)getpid());
+	unlink(path);
+	perfdata_sink = path;
+	perfdata_sink_format = PERFSINK_INFLUX;
+	perfdata_sink_buffer_size = 4096;
+
+	/* the reader isn't listening at first, and then doesn't read */
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	lsd = socket(AF_UNIX, SOCK_STREAM, 0);
+	bind(lsd, (struct sockaddr *)&addr, sizeof(addr));
+	perfsink_open();
+	sprintf(perf, "m=1");
+	perfsink_service(&svc);
+	ok(perfsink_flush(TRUE) == ERROR, "metrics are kept while there's no reader");
+
+	listen(lsd, 1);
+	for (i = 2; i <= NUM_LINES; i++) {
+		sprintf(perf, "m=%d", i);
+		perfsink_service(&svc);
+		if (!(i % 100))
+			perfsink_flush(TRUE);
+	}
+	ok(perfsink_dropped() > 0, "the oldest metrics are dropped when the reader falls behind");
+
+	sd = accept(lsd, NULL, NULL);
+	fcntl(sd, F_SETFL, O_NONBLOCK);
+	do {
+		result = perfsink_flush(TRUE);
+		bad |= drain(sd, buf, &len, sizeof(buf), &last);
+	} while (result != OK);
+	perfsink_close();
+	fcntl(sd, F_SETFL, 0);
+	bad |= drain(sd, buf, &len, sizeof(buf), &last);
+	ok(!bad && !len, "the reader only ever sees whole lines, oldest first");
+	ok(last == NUM_LINES, "the newest metrics make it through");
+	diag("%d of %d lines were dropped", (int)perfsink_dropped(), NUM_LINES);
+
+	close(sd);
+	close(lsd);
+	unlink(path);
+	perfdata_sink = NULL;
+	perfdata_sink_buffer_size = DEFAULT_PERFDATA_SINK_BUFFER_SIZE;
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	plan_tests(24);
+
+	test_parser();
+	test_file_sink();
+	test_socket_sink();
+
+	free_perfdata_list(&list);
+	return exit_status();
+}
@@ -0,0 +1,198 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/checks.h"
+#include "naemon/events.h"
+#include "naemon/broker.h"
+#include "naemon/nebmods.h"
+#include "naemon/nebstructs.h"
+#include "naemon/resultq.h"
+#include "naemon/nm_alloc.h"
+
+#define BACKLOG 20000
+
+static nebmodule test_mod;
+static service *busy, *svc;
+static host *hst;
+static unsigned int processed, changed_at;
+static char seen[256];
+
+/* notes when the result we're waiting for gets processed */
+static int count_results(int type, void *data)
+{
+	nebstruct_service_check_data *ds = data;
+	nebstruct_host_check_data *dh = data;
+
+	if (type == NEBCALLBACK_SERVICE_CHECK_DATA && ds->type == NEBTYPE_SERVICECHECK_PROCESSED) {
+		processed++;
+		if (ds->object_ptr == svc) {
+			if (!changed_at && ds->state != STATE_OK)
+				changed_at = processed;
+			if (strlen(seen) + strlen(ds->output) + 2 < sizeof(seen))
+				sprintf(seen + strlen(seen), "%s%s", *seen ? "," : "", ds->output);
+		}
+	}
+	if (type == NEBCALLBACK_HOST_CHECK_DATA && dh->type == NEBTYPE_HOSTCHECK_PROCESSED) {
+		processed++;
+		if (dh->object_ptr == hst && !changed_at)
+			changed_at = processed;
+	}
+	return 0;
+}
+
+static void queue_result(int check_type, void *obj, int code, const char *output)
+{
+	check_result cr;
+
+	init_check_result(&cr);
+	cr.object_check_type = check_type;
+	cr.check_type = CHECK_TYPE_PASSIVE;
+	if (check_type == SERVICE_CHECK) {
+		cr.host_name = nm_strdup(((service *)obj)->host_name);
+		cr.service_description = nm_strdup(((service *)obj)->description);
+	} else {
+		cr.host_name = nm_strdup(((host *)obj)->name);
+	}
+	cr.return_code = code;
+	cr.exited_ok = TRUE;
+	cr.output = nm_strdup(output);
+	gettimeofday(&cr.start_time, NULL);
+	cr.finish_time = cr.start_time;
+	resultq_add(&cr);
+	free_check_result(&cr);
+}
+
+static void queue_backlog(void)
+{
+	char buf[32];
+	int i;
+
+	for (i = 0; i < BACKLOG; i++) {
+		sprintf(buf, "unchanged %d", i);
+		queue_result(SERVICE_CHECK, busy, STATE_OK, buf);
+	}
+}
+
+static void drain(void)
+{
+	while (resultq_drain(BACKLOG))
+		;
+	processed = changed_at = 0;
+	*seen = 0;
+}
+
+/* time from queueing a state change until it's processed */
+static double time_to_change(void)
+{
+	struct timeval start, stop;
+	int polls;
+
+	gettimeofday(&start, NULL);
+	queue_result(SERVICE_CHECK, svc, STATE_CRITICAL, "outage");
+	for (polls = 0; !changed_at && polls < 10000; polls++)
+		iobroker_poll(nagios_iobs, 100);
+	gettimeofday(&stop, NULL);
+	return (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	const char *test_config_file = get_default_config_file();
+	double with, without;
+
+	plan_tests(9);
+	init_event_queue();
+
+	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
+	assert(OK == read_main_config_file(test_config_file));
+	assert(OK == read_all_object_data(test_config_file));
+	assert((hst = find_host("host1")));
+	assert((svc = find_service("host1", "Dummy service")));
+	assert((busy = find_service("host1", "Dummy service2")));
+
+	event_broker_options = BROKER_EVERYTHING;
+	neb_init_callback_list();
+	test_mod.filename = (char *)"test_resultq";
+	neb_add_core_module(&test_mod);
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, &test_mod, 0, count_results);
+	neb_register_callback(NEBCALLBACK_HOST_CHECK_DATA, &test_mod, 0, count_results);
+
+	nagios_iobs = iobroker_create();
+	assert(OK == resultq_init());
+
+	queue_result(SERVICE_CHECK, svc, STATE_OK, "ok");
+	queue_result(SERVICE_CHECK, busy, STATE_OK, "ok");
+	queue_result(HOST_CHECK, hst, STATE_OK, "ok");
+	drain();
+
+	prioritize_state_changes = TRUE;
+	queue_backlog();
+	with = time_to_change();
+	ok(changed_at == 1, "a state change is processed ahead of a backlog of %d unchanged results", BACKLOG);
+	ok(svc->current_state == STATE_CRITICAL, "... and changes the state");
+	drain();
+
+	queue_result(SERVICE_CHECK, svc, STATE_OK, "recovery");
+	drain();
+	prioritize_state_changes = FALSE;
+	queue_backlog();
+	without = time_to_change();
+	ok(changed_at == BACKLOG + 1, "without prioritization, it waits for the backlog");
+	ok(svc->current_state == STATE_CRITICAL, "... before it changes the state");
+	ok(with < without, "time to state change: %.3fs prioritized, %.3fs in arrival order", with, without);
+	drain();
+
+	prioritize_state_changes = TRUE;
+	queue_backlog();
+	queue_result(HOST_CHECK, hst, STATE_CRITICAL, "host outage");
+	while (!changed_at && resultq_drain(1))
+		;
+	ok(changed_at == 1, "host state changes are prioritized too");
+	drain();
+
+	/* the first result for svc changes nothing, so the second has to wait for it */
+	queue_result(SERVICE_CHECK, svc, STATE_OK, "ok");
+	drain();
+	queue_result(SERVICE_CHECK, svc, STATE_OK, "still up");
+	queue_backlog();
+	queue_result(SERVICE_CHECK, svc, STATE_CRITICAL, "down");
+	while (resultq_drain(BACKLOG))
+		;
+	ok(changed_at == BACKLOG + 2 && !strcmp(seen, "still up,down"),
+	   "a state change doesn't overtake results already queued for the same object");
+	drain();
+	queue_result(SERVICE_CHECK, svc, STATE_OK, "first");
+	queue_result(SERVICE_CHECK, svc, STATE_CRITICAL, "second");
+	queue_result(SERVICE_CHECK, svc, STATE_OK, "third");
+	resultq_drain(BACKLOG);
+	ok(!strcmp(seen, "first,second,third"), "an object's results are processed in order (%s)", seen);
+	ok(svc->current_state == STATE_OK && !strcmp(svc->plugin_output, "third"), "... leaving the last one's state");
+
+	resultq_deinit();
+	neb_free_callback_list();
+	iobroker_destroy(nagios_iobs, 0);
+	return exit_status();
+}
@@ -0,0 +1,278 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/comments.h"
+#include "naemon/downtime.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/defaults.h"
+#include "naemon/sretention.h"
+#include "naemon/xrddefault.h"
+#include "naemon/events.h"
+#include "naemon/nm_alloc.h"
+
+#define HOSTS 2000
+#define SERVICES_PER_HOST 25
+#define CONTACTS 1000
+
+static char dir[] = "/tmp/test_retention.XXXXXX";
+static char main_cfg[64], objects_cfg[64], generated[64], sequential[64], parallel[64];
+
+static void write_config(void)
+{
+	FILE *fp;
+	unsigned int i, j;
+
+	fp = fopen(main_cfg, "w");
+	fprintf(fp, "cfg_file=%s\n", objects_cfg);
+	fclose(fp);
+
+	fp = fopen(objects_cfg, "w");
+	fprintf(fp, "define command {\n\tcommand_name check\n\tcommand_line /bin/true\n}\n");
+	fprintf(fp, "define command {\n\tcommand_name other_check\n\tcommand_line /bin/false\n}\n");
+	for (i = 0; i < CONTACTS; i++)
+		fprintf(fp, "define contact {\n\tcontact_name c%u\n}\n", i);
+	for (i = 0; i < HOSTS; i++) {
+		/* flap detection depends on the time between a host's blocks */
+		fprintf(fp, "define host {\n\thost_name h%u\n\taddress 127.0.0.1\n\tmax_check_attempts 3\n\tflap_detection_options %s\n\t_COLOR red\n}\n", i, i == 1 ? "n" : "a");
+		for (j = 0; j < SERVICES_PER_HOST; j++)
+			fprintf(fp, "define service {\n\thost_name h%u\n\tservice_description s%u\n\tcheck_command check\n\tmax_check_attempts 3\n}\n", i, j);
+	}
+	fclose(fp);
+}
+
+static void load_config(void)
+{
+	if (read_all_object_data(main_cfg) != OK)
+		_exit(2);
+	init_event_queue();
+	initialize_downtime_data();
+	initialize_retention_data(main_cfg);
+	initialize_comment_data();
+	my_free(temp_file);
+	temp_file = nm_strdup("/tmp/naemon-test-");
+}
+
+/* give every object some state worth retaining, and save it */
+static void generate(void)
+{
+	unsigned int i;
+	unsigned long id;
+	time_t now = time(NULL);
+
+	for (i = 0; i < num_objects.hosts; i++) {
+		host *h = host_ary[i];
+		h->has_been_checked = TRUE;
+		h->current_state = i % 3;
+		h->state_type = i % 2 ? HARD_STATE : SOFT_STATE;
+		h->current_attempt = 1 + i % 3;
+		h->last_check = now - i;
+		h->last_state_change = now - 2 * i;
+		h->is_flapping = !(i % 7);
+		h->percent_state_change = (i % 100) / 2.0;
+		nm_asprintf(&h->plugin_output, "host output %u", i);
+		if (!(i % 5)) {
+			h->modified_attributes |= MODATTR_NOTIFICATIONS_ENABLED | MODATTR_CUSTOM_VARIABLE;
+			h->notifications_enabled = FALSE;
+			my_free(h->custom_variables->variable_value);
+			h->custom_variables->variable_value = nm_strdup("blue");
+			h->custom_variables->has_been_modified = TRUE;
+		}
+		if (!(i % 11)) {
+			h->problem_has_been_acknowledged = TRUE;
+			add_new_comment(HOST_COMMENT, ACKNOWLEDGEMENT_COMMENT, h->name, NULL, now, "tester", "ack", FALSE, COMMENTSOURCE_INTERNAL, FALSE, 0, &id);
+		}
+		if (!(i % 13))
+			add_new_host_downtime(h->name, now, "tester", "down", now + 3600, now + 7200, TRUE, 0, 3600, &id, FALSE, FALSE);
+	}
+	for (i = 0; i < num_objects.services; i++) {
+		service *s = service_ary[i];
+		s->has_been_checked = TRUE;
+		s->current_state = i % 4;
+		s->state_type = i % 3 ? HARD_STATE : SOFT_STATE;
+		s->current_attempt = 1 + i % 3;
+		s->last_check = now - i;
+		s->last_notification = s->current_state ? now - 60 : 0;
+		s->current_notification_number = s->current_state ? 1 : 0;
+		s->is_flapping = !(i % 9);
+		nm_asprintf(&s->plugin_output, "service output %u", i);
+		nm_asprintf(&s->perf_data, "value=%u", i);
+		if (!(i % 17)) {
+			s->modified_attributes |= MODATTR_CHECK_COMMAND;
+			my_free(s->check_command);
+			s->check_command = nm_strdup("other_check!arg");
+		}
+		if (!(i % 23))
+			add_new_comment(SERVICE_COMMENT, USER_COMMENT, s->host_name, s->description, now, "tester", "comment", TRUE, COMMENTSOURCE_EXTERNAL, FALSE, 0, &id);
+		if (!(i % 29))
+			add_new_service_downtime(s->host_name, s->description, now, "tester", "down", now + 3600, now + 7200, FALSE, 0, 600, &id, FALSE, FALSE);
+	}
+	for (i = 0; i < num_objects.contacts; i++) {
+		contact *c = contact_ary[i];
+		c->last_host_notification = now - i;
+		c->last_service_notification = now - 2 * i;
+		if (!(i % 3)) {
+			c->modified_host_attributes |= MODATTR_NOTIFICATIONS_ENABLED;
+			c->host_notifications_enabled = FALSE;
+		}
+	}
+
+	retention_file = generated;
+	if (xrddefault_save_state_information() != OK)
+		_exit(3);
+}
+
+/* a second block for an object must be read after the first */
+static void append_duplicates(void)
+{
+	FILE *fp = fopen(generated, "a");
+
+	fprintf(fp, "host {\n\thost_name=h1\n\tmodified_attributes=1\n\tcurrent_state=2\n\tplugin_output=second block\n\tnotifications_enabled=1\n}\n");
+	fprintf(fp, "service {\n\thost_name=h0\n\tservice_description=s0\n\tcurrent_state=3\n\tplugin_output=second block\n}\n");
+	fprintf(fp, "contact {\n\tcontact_name=c0\n\tlast_host_notification=1234\n}\n");
+	fclose(fp);
+}
+
+static void load_and_save(unsigned int threads, char *out)
+{
+	struct timeval start, stop;
+
+	retention_file = generated;
+	retention_load_threads = threads;
+	gettimeofday(&start, NULL);
+	if (xrddefault_read_state_information() != OK)
+		_exit(4);
+	gettimeofday(&stop, NULL);
+	diag("Loading in %u thread(s) took %.3fs", threads,
+	     (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0);
+	retention_file = out;
+	if (xrddefault_save_state_information() != OK)
+		_exit(5);
+}
+
+static int run_child(void (*fn)(unsigned int, char *), unsigned int threads, char *out)
+{
+	int status;
+	pid_t pid;
+
+	if (!(pid = fork())) {
+		load_config();
+		fn(threads, out);
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void generate_child(unsigned int threads, char *out)
+{
+	generate();
+	append_duplicates();
+}
+
+/*
+ * compare two retention files, except for when they were created and
+ * when the comments that come with downtime were added when loading
+ */
+static int same_state(const char *a, const char *b, unsigned int *lines)
+{
+	FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+	char la[8192], lb[8192];
+	int same = 1, in_comment = 0;
+
+	*lines = 0;
+	while (same) {
+		char *ra = fgets(la, sizeof(la), fa), *rb = fgets(lb, sizeof(lb), fb);
+		if (!ra || !rb) {
+			same = !ra && !rb;
+			break;
+		}
+		(*lines)++;
+		if (strstr(la, "comment {"))
+			in_comment = 1;
+		else if (!strcmp(la, "}\n"))
+			in_comment = 0;
+		if (!strncmp(la, "created=", 8) && !strncmp(lb, "created=", 8))
+			continue;
+		if (in_comment && !strncmp(la, "entry_time=", 11) && !strncmp(lb, "entry_time=", 11))
+			continue;
+		if (strcmp(la, lb)) {
+			diag("line %u differs:\n#  %s#  %s", *lines, la, lb);
+			same = 0;
+		}
+	}
+	fclose(fa);
+	fclose(fb);
+	return same;
+}
+
+static int contains(const char *path, const char *str)
+{
+	FILE *fp = fopen(path, "r");
+	char line[8192];
+	int found = 0;
+
+	while (!found && fgets(line, sizeof(line), fp))
+		found = strstr(line, str) != NULL;
+	fclose(fp);
+	return found;
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	struct stat st;
+	unsigned int lines;
+
+	plan_tests(8);
+
+	assert(mkdtemp(dir) != NULL);
+	sprintf(main_cfg, "%s/naemon.cfg", dir);
+	sprintf(objects_cfg, "%s/objects.cfg", dir);
+	sprintf(generated, "%s/generated.dat", dir);
+	sprintf(sequential, "%s/sequential.dat", dir);
+	sprintf(parallel, "%s/parallel.dat", dir);
+	write_config();
+
+	ok(run_child(generate_child, 0, NULL) == 0, "Generated retention data for %u objects", HOSTS * (SERVICES_PER_HOST + 1) + CONTACTS);
+	assert(stat(generated, &st) == 0);
+	diag("The retention file is %lu bytes", (unsigned long)st.st_size);
+
+	ok(run_child(load_and_save, 1, sequential) == 0, "Loaded it in one thread");
+	ok(run_child(load_and_save, 4, parallel) == 0, "Loaded it in four threads");
+	ok(same_state(sequential, parallel, &lines), "Both loads end up in the same state");
+	ok(lines > HOSTS * SERVICES_PER_HOST, "... of %u lines", lines);
+	ok(contains(parallel, "plugin_output=service output 12345"), "Service state is retained");
+	ok(contains(parallel, "_COLOR=1;blue"), "Custom variables are retained");
+	ok(contains(parallel, "plugin_output=second block"), "Later blocks for an object win");
+
+	unlink(objects_cfg);
+	unlink(main_cfg);
+	unlink(generated);
+	unlink(sequential);
+	unlink(parallel);
+	rmdir(dir);
+
+	return exit_status();
+}
@@ -0,0 +1,347 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/commands.h"
+#include "naemon/sretention.h"
+#include "naemon/events.h"
+#include "naemon/nebmods.h"
+#include "naemon/nebstructs.h"
+#include "naemon/broker.h"
+#include "naemon/simulation.h"
+#include "naemon/resultq.h"
+#include "naemon/submit.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_HOSTS 100
+#define SERVICES_PER_HOST 20
+
+static char dir[64];
+
+/* what a simulation run tells the parent */
+struct outcome {
+	int ok;
+	unsigned int digest;
+	unsigned int too_few, too_many, early, late;
+	unsigned int replay_mismatch;
+	int submitted_command_ran;
+	long virtual_seconds;
+	struct sim_stats stats;
+	double p99;
+};
+
+/* per service, as seen from the check initiation callback */
+static unsigned int *initiated;
+static time_t *last_start;
+static struct outcome result;
+static int submit_on_start;
+
+static int check_started(int type, void *data)
+{
+	nebstruct_service_check_data *ds = (nebstruct_service_check_data *)data;
+	service *svc = (service *)ds->object_ptr;
+
+	if (ds->type != NEBTYPE_SERVICECHECK_INITIATE)
+		return 0;
+
+	/* checks must never start before they're due, nor go overdue */
+	if (ds->start_time.tv_sec < svc->next_check)
+		result.early++;
+	if (last_start[svc->id] && ds->start_time.tv_sec - last_start[svc->id] > svc->check_interval * interval_length + 1)
+		result.late++;
+	last_start[svc->id] = ds->start_time.tv_sec;
+	initiated[svc->id]++;
+
+	/* a module that submits a command as the first check starts */
+	if (submit_on_start) {
+		submit_on_start = FALSE;
+		naemon_submit_command("[1700000000] DISABLE_SVC_NOTIFICATIONS;h0;s1");
+	}
+	return 0;
+}
+
+static void write_file(const char *name, const char *content)
+{
+	char path[128];
+	FILE *fp;
+
+	sprintf(path, "%s/%s", dir, name);
+	fp = fopen(path, "w");
+	assert(fp);
+	fputs(content, fp);
+	fclose(fp);
+}
+
+static void write_config(int max_concurrent_checks, int host_checks)
+{
+	char path[128], buf[512];
+	FILE *fp;
+	int h, s;
+
+	sprintf(path, "%s/objects.cfg", dir);
+	fp = fopen(path, "w");
+	assert(fp);
+	fprintf(fp, "define command {\n\tcommand_name check_sim\n\tcommand_line /bin/check_sim $HOSTNAME$ $SERVICEDESC$\n}\n");
+	fprintf(fp, "define timeperiod {\n\ttimeperiod_name 24x7\n\talias 24x7\n\tmonday 00:00-24:00\n\ttuesday 00:00-24:00\n"
+	        "\twednesday 00:00-24:00\n\tthursday 00:00-24:00\n\tfriday 00:00-24:00\n\tsaturday 00:00-24:00\n\tsunday 00:00-24:00\n}\n");
+	fprintf(fp, "define contact {\n\tcontact_name nobody\n\thost_notification_period 24x7\n\tservice_notification_period 24x7\n"
+	        "\thost_notification_commands check_host\n\tservice_notification_commands check_host\n}\n");
+	fprintf(fp, "define command {\n\tcommand_name check_host\n\tcommand_line /bin/check_host $HOSTNAME$\n}\n");
+	for (h = 0; h < NUM_HOSTS; h++) {
+		fprintf(fp, "define host {\n\thost_name h%d\n\taddress 127.0.0.1\n\tmax_check_attempts 2\n"
+		        "\tcheck_period 24x7\n\tnotification_period 24x7\n\tcontacts nobody\n", h);
+		if (host_checks)
+			fprintf(fp, "\tcheck_command check_host\n\tcheck_interval 5\n");
+		fprintf(fp, "}\n");
+		for (s = 0; s < SERVICES_PER_HOST; s++) {
+			fprintf(fp, "define service {\n\thost_name h%d\n\tservice_description s%d\n\tcheck_command check_sim\n"
+			        "\tmax_check_attempts 1\n\tcheck_interval 1\n\tretry_interval 1\n"
+			        "\tcheck_period 24x7\n\tnotification_period 24x7\n\tcontacts nobody\n}\n", h, s);
+		}
+	}
+	fclose(fp);
+
+	sprintf(buf, "cfg_file=objects.cfg\nlog_file=naemon.log\ncheck_result_path=.\n"
+	        "interval_length=60\nmax_concurrent_checks=%d\nuse_syslog=0\nretain_state_information=0\n"
+	        "enable_notifications=0\nenable_event_handlers=0\nenable_flap_detection=0\n",
+	        max_concurrent_checks);
+	write_file("naemon.cfg", buf);
+}
+
+static unsigned int digest_str(unsigned int h, const char *s)
+{
+	for (; s && *s; s++)
+		h = h * 31 + (unsigned char)*s;
+	return h;
+}
+
+/*
+ * runs the simulation in a child, so every run starts from scratch.
+ * With queues set, results and submissions are queued the way naemon
+ * queues them.
+ */
+static struct outcome simulate(const char *model, int queues)
+{
+	char path[128];
+	int pfd[2], status;
+	struct outcome out;
+	pid_t pid;
+
+	write_file("model", model);
+	memset(&out, 0, sizeof(out));
+	assert(!pipe(pfd));
+	fflush(stdout);
+	if (!(pid = fork())) {
+		nebmodule *mod = nm_calloc(1, sizeof(*mod));
+		unsigned int i, expected;
+		int devnull = open("/dev/null", O_WRONLY);
+
+		/* the simulation logs a lot, and we speak TAP */
+		dup2(devnull, STDOUT_FILENO);
+		close(pfd[0]);
+
+		sprintf(path, "%s/model", dir);
+		assert(sim_init(path) == OK);
+		init_macros();
+		init_event_queue();
+		sprintf(path, "%s/naemon.cfg", dir);
+		config_file_dir = nspath_absolute_dirname(path, NULL);
+		assert(OK == read_main_config_file(path));
+		assert(OK == read_all_object_data(path));
+		assert(OK == pre_flight_check());
+
+		if (queues) {
+			assert((nagios_iobs = iobroker_create()));
+			assert(resultq_init() == OK);
+			assert(submit_init() == OK);
+			/* submitted commands need what naemon sets up for external commands */
+			assert(initialize_retention_data(path) == OK);
+			registered_commands_init(200);
+			register_core_commands();
+			submit_on_start = TRUE;
+		}
+
+		neb_init_callback_list();
+		mod->module_handle = mod;
+		neb_add_core_module(mod);
+		neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, mod, 0, check_started);
+		event_broker_options = BROKER_EVERYTHING;
+		initiated = nm_calloc(num_objects.services, sizeof(*initiated));
+		last_start = nm_calloc(num_objects.services, sizeof(*last_start));
+
+		init_timing_loop();
+		event_execution_loop();
+
+		result.stats = *sim_get_stats();
+		result.virtual_seconds = sim_clock.tv_sec - result.stats.start;
+		result.p99 = sim_percentile(&result.stats.check_latency, 99);
+		expected = result.virtual_seconds / interval_length;
+		result.digest = result.stats.jobs;
+		for (i = 0; i < num_objects.services; i++) {
+			service *svc = service_ary[i];
+			unsigned int n;
+
+			/* the first check lands anywhere in the first interval */
+			if (initiated[i] + 1 < expected)
+				result.too_few++;
+			if (initiated[i] > expected + 1)
+				result.too_many++;
+
+			/* results made up by the model count the checks, and the last one may still be running */
+			if (svc->plugin_output && sscanf(svc->plugin_output, "%*s - simulated result #%u", &n) == 1 && n != initiated[i] && n + 1 != initiated[i])
+				result.replay_mismatch++;
+
+			result.digest = result.digest * 31 + svc->last_check;
+			result.digest = result.digest * 31 + svc->next_check;
+			result.digest = result.digest * 31 + svc->current_state;
+			result.digest = digest_str(result.digest, svc->plugin_output);
+		}
+		result.submitted_command_ran = !find_service("h0", "s1")->notifications_enabled;
+		result.ok = TRUE;
+		write(pfd[1], &result, sizeof(result));
+		_exit(0);
+	}
+
+	close(pfd[1]);
+	if (read(pfd[0], &out, sizeof(out)) != sizeof(out))
+		out.ok = FALSE;
+	close(pfd[0]);
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		out.ok = FALSE;
+	return out;
+}
+
+static void test_schedule(void)
+{
+	struct outcome out;
+
+	write_config(100, FALSE);
+	out = simulate("seed 7\nstart 1700000000\nduration 7200\ncommand check_sim 0.5 2 0\n", FALSE);
+	ok(out.ok, "a simulated site runs for two virtual hours");
+	ok(out.virtual_seconds == 7200, "the virtual clock stops at the end of the run");
+	if (!ok(out.stats.jobs >= 2000 * 119 && !out.too_few && !out.too_many,
+	        "every service is checked once per check interval"))
+		diag("%lu jobs, %u too few, %u too many", out.stats.jobs, out.too_few, out.too_many);
+	ok(!out.early, "no check starts before it's due");
+	ok(!out.late, "no check starts later than a check interval after the last one");
+	ok(!out.replay_mismatch, "check results are delivered to the services that ran them");
+	if (!ok(out.stats.peak_running > 0 && out.stats.peak_running <= 100, "the concurrent check limit holds"))
+		diag("%u checks at once", out.stats.peak_running);
+	diag("%lu checks over %lds virtual in %.2fs, %.0fx real time",
+	     out.stats.jobs, out.virtual_seconds, out.stats.real_seconds, out.virtual_seconds / out.stats.real_seconds);
+}
+
+static void test_determinism(void)
+{
+	const char *model = "seed 3\nstart 1700000000\nduration 3600\n"
+	                    "command check_sim 0.5 2 0.05\ncommand check_host 0.1 0.5 0.01\n";
+	struct outcome a, b, c;
+
+	/* too few slots for this many checks, and plenty of state changes */
+	write_config(30, TRUE);
+	a = simulate(model, FALSE);
+	b = simulate(model, FALSE);
+	ok(a.ok && b.ok && a.stats.state_changes > 0 && a.stats.postponed_checks > 0,
+	   "an overloaded site changes state and postpones checks");
+	ok(a.digest == b.digest && a.stats.events == b.stats.events && a.stats.postponed_checks == b.stats.postponed_checks,
+	   "the same model and seed play out exactly the same way");
+	c = simulate("seed 4\nstart 1700000000\nduration 3600\n"
+	             "command check_sim 0.5 2 0.05\ncommand check_host 0.1 0.5 0.01\n", FALSE);
+	ok(c.ok && c.digest != a.digest, "a different seed plays out differently");
+	ok(!a.early, "even postponed checks never start early");
+	diag("%lu checks, %lu postponed, %lu state changes, p99 check latency %.3fs",
+	     a.stats.jobs, a.stats.postponed_checks, a.stats.state_changes, a.p99);
+}
+
+static void test_replay(void)
+{
+	struct wproc_result wpres;
+	struct outcome out;
+	char path[128], model[256];
+	int h, s;
+
+	/* record two alternating results for every service */
+	sprintf(path, "%s/results.rec", dir);
+	unlink(path);
+	simulation_recording_file = nm_strdup(path);
+	memset(&wpres, 0, sizeof(wpres));
+	wpres.stop.tv_sec = 1;
+	for (h = 0; h < NUM_HOSTS; h++) {
+		for (s = 0; s < SERVICES_PER_HOST; s++) {
+			char cmd[64];
+
+			sprintf(cmd, "/bin/check_sim h%d s%d", h, s);
+			wpres.wait_status = 2 << 8;
+			wpres.outstd = "CRITICAL - recorded";
+			sim_record_result(cmd, &wpres);
+			wpres.wait_status = 0;
+			wpres.outstd = "OK - recorded\twith a tab";
+			sim_record_result(cmd, &wpres);
+		}
+	}
+	sim_record_close();
+	my_free(simulation_recording_file);
+
+	write_config(100, FALSE);
+	sprintf(model, "seed 1\nstart 1700000000\nduration 600\nreplay %s\n", path);
+	out = simulate(model, FALSE);
+	if (!ok(out.ok && out.stats.replayed == out.stats.jobs && out.stats.jobs >= 2000 * 9,
+	        "recorded results are replayed"))
+		diag("%lu of %lu jobs replayed", out.stats.replayed, out.stats.jobs);
+	ok(!out.early && !out.late, "replayed runs keep the schedule too");
+	unlink(path);
+}
+
+static void test_queued_results(void)
+{
+	struct outcome out;
+
+	write_config(100, FALSE);
+	out = simulate("seed 7\nstart 1700000000\nduration 600\ncommand check_sim 0.5 2 0\n", TRUE);
+	if (!ok(out.ok && out.stats.jobs >= 2000 * 9 && !out.too_few,
+	        "results that go through the result queue are processed while the simulation runs"))
+		diag("%lu jobs, %u too few", out.stats.jobs, out.too_few);
+	ok(!out.late && !out.replay_mismatch, "... and the services they belong to are rescheduled on time");
+	ok(out.submitted_command_ran, "commands modules submit are run while the simulation runs");
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	char path[128];
+
+	plan_tests(16);
+	sprintf(dir, "/tmp/naemon-test-simulation-%d", (int)getpid());
+	mkdir(dir, 0755);
+
+	test_schedule();
+	test_determinism();
+	test_replay();
+	test_queued_results();
+
+	sprintf(path, "rm -rf %s", dir);
+	system(path);
+	return exit_status();
+}
@@ -0,0 +1,202 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/checks.h"
+#include "naemon/events.h"
+#include "naemon/query-handler.h"
+#include "naemon/snapshot.h"
+#include "naemon/nm_alloc.h"
+#include "naemon/lib/nsock.h"
+
+#define CLIENTS 4
+#define QUERIES_PER_CLIENT 500
+
+static char socket_path[] = "/tmp/test_snapshot.XXXXXX";
+static int clients_done;
+
+/* what a client thread saw */
+struct client {
+	pthread_t thread;
+	unsigned int answered, malformed, went_back, last_seen;
+};
+
+/* reads a whole response, up to the nul byte or until the core hangs up */
+static int query(const char *q, char *buf, size_t size)
+{
+	size_t len = 0;
+	ssize_t n;
+	int sd;
+
+	if ((sd = nsock_unix(socket_path, NSOCK_TCP | NSOCK_CONNECT | NSOCK_BLOCK)) < 0)
+		return -1;
+	if (write(sd, q, strlen(q) + 1) < 0) {
+		close(sd);
+		return -1;
+	}
+	while (len < size - 1 && (n = read(sd, buf + len, size - 1 - len)) > 0) {
+		len += n;
+		if (!buf[len - 1])
+			break;
+	}
+	buf[len] = 0;
+	close(sd);
+	return (int)len;
+}
+
+static void *client(void *arg)
+{
+	struct client *c = arg;
+	char buf[1024];
+	unsigned int i, output, perf;
+
+	for (i = 0; i < QUERIES_PER_CLIENT; i++) {
+		if (query("#output host1;Dummy service", buf, sizeof(buf)) <= 0)
+			continue;
+		c->answered++;
+		if (sscanf(buf, "plugin_output=result %u\nlong_plugin_output=\nperf_data=n=%u", &output, &perf) != 2) {
+			c->malformed++;
+			continue;
+		}
+		/* each string is intact and new ones replace old ones for good */
+		if (output < c->last_seen)
+			c->went_back++;
+		c->last_seen = output;
+	}
+
+	__atomic_add_fetch(&clients_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void submit_result(unsigned int seq)
+{
+	check_result cr;
+	char output[64];
+
+	init_check_result(&cr);
+	cr.object_check_type = SERVICE_CHECK;
+	cr.check_type = CHECK_TYPE_PASSIVE;
+	cr.host_name = "host1";
+	cr.service_description = "Dummy service";
+	cr.return_code = seq % 4;
+	sprintf(output, "result %u|n=%u", seq, seq);
+	cr.output = output;
+	gettimeofday(&cr.start_time, NULL);
+	cr.finish_time = cr.start_time;
+	process_check_result(&cr);
+}
+
+static void test_threaded_queries(void)
+{
+	struct client clients[CLIENTS];
+	unsigned int i, seq = 0, answered = 0, malformed = 0, went_back = 0;
+	char buf[1024];
+
+	memset(clients, 0, sizeof(clients));
+	for (i = 0; i < CLIENTS; i++)
+		pthread_create(&clients[i].thread, NULL, client, &clients[i]);
+
+	/* keep the output changing while the clients ask for it */
+	while (__atomic_load_n(&clients_done, __ATOMIC_ACQUIRE) < CLIENTS) {
+		submit_result(++seq);
+		iobroker_poll(nagios_iobs, 1);
+		snapshot_reclaim();
+	}
+
+	for (i = 0; i < CLIENTS; i++) {
+		pthread_join(clients[i].thread, NULL);
+		answered += clients[i].answered;
+		malformed += clients[i].malformed;
+		went_back += clients[i].went_back;
+	}
+
+	ok(answered == CLIENTS * QUERIES_PER_CLIENT, "every query is answered");
+	ok(malformed == 0, "answers are never torn or freed under the reader");
+	ok(went_back == 0, "readers never see older output than they've seen before");
+	diag("%u queries answered while the output changed %u times", answered, seq);
+
+	/* keepalive queries get their socket back */
+	{
+		int sd = nsock_unix(socket_path, NSOCK_TCP | NSOCK_CONNECT | NSOCK_BLOCK);
+		unsigned int rounds = 0;
+		ssize_t n;
+
+		for (i = 0; i < 2; i++) {
+			if (write(sd, "@echo hello", 12) < 0)
+				break;
+			n = 0;
+			while (n <= 0 && rounds++ < 1000) {
+				iobroker_poll(nagios_iobs, 1);
+				n = recv(sd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+			}
+			if (n <= 0 || strncmp(buf, "hello", 5))
+				break;
+		}
+		ok(i == 2, "keepalive sockets are handed back after threaded queries");
+		close(sd);
+	}
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	const char *test_config_file = get_default_config_file();
+	service *svc;
+	int fd;
+
+	plan_tests(7);
+	init_event_queue();
+
+	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
+	assert(OK == read_main_config_file(test_config_file));
+	assert(OK == read_all_object_data(test_config_file));
+	svc = find_service("host1", "Dummy service");
+	assert(svc != NULL);
+
+	/* nsock_unix() wants to create the socket itself */
+	fd = mkstemp(socket_path);
+	close(fd);
+	unlink(socket_path);
+
+	nagios_iobs = iobroker_create();
+	assert(OK == snapshot_init());
+	assert(0 == qh_init(socket_path));
+	qh_threads = CLIENTS;
+	ok(OK == qh_start_threads(), "query handler threads start");
+
+	test_threaded_queries();
+
+	qh_deinit(socket_path);
+	ok(svc->plugin_output && !strncmp(svc->plugin_output, "result ", 7), "the main thread still reads output directly");
+	snapshot_deinit();
+
+	/* without a domain, replaced output is freed right away */
+	submit_result(1);
+	ok(svc->plugin_output && !strcmp(svc->plugin_output, "result 1"), "output is replaced without snapshots, too");
+
+	iobroker_destroy(nagios_iobs, IOBROKER_CLOSE_SOCKETS);
+	return exit_status();
+}
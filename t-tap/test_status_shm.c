@@ -0,0 +1,173 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/checks.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/statusdata.h"
+#include "naemon/events.h"
+#include "naemon/nm_alloc.h"
+#include "naemon/lib/shmstatus.h"
+
+#define NUM_READERS 3
+#define ROUNDS 250
+
+static char segname[64];
+
+/* results the readers can check for consistency on their own */
+static void submit_result(service *svc, int n)
+{
+	check_result cr;
+	struct timeval now;
+
+	memset(&cr, 0, sizeof(cr));
+	gettimeofday(&now, NULL);
+	cr.object_check_type = SERVICE_CHECK;
+	cr.check_type = SERVICE_CHECK_PASSIVE;
+	cr.host_name = svc->host_name;
+	cr.service_description = svc->description;
+	cr.start_time = cr.finish_time = now;
+	cr.exited_ok = TRUE;
+	cr.return_code = n % 4;
+	nm_asprintf(&cr.output, "RC %d #%d", n % 4, n);
+	handle_async_service_check_result(svc, &cr);
+	free(cr.output);
+}
+
+/*
+ * Reads every service until the segment goes stale. Exits with 1 if
+ * a record ever contradicts itself or goes back in time.
+ */
+static int reader(void)
+{
+	shmstatus *s;
+	shmstatus_object obj;
+	int *last, id, rc, n, stale, bad = 0;
+	unsigned int i, count;
+
+	while (!(s = shmstatus_open(segname)))
+		usleep(1000);
+	count = shmstatus_count(s, SHMSTATUS_SERVICE);
+	last = calloc(count, sizeof(int));
+	do {
+		/* one more pass after it goes stale picks up the final writes */
+		stale = shmstatus_is_stale(s);
+		for (i = 0; i < count; i++) {
+			shmstatus_read(s, SHMSTATUS_SERVICE, i, &obj);
+			if (sscanf(obj.plugin_output, "RC %d #%d", &rc, &n) != 2)
+				continue;
+			if (rc != obj.current_state || n < last[i])
+				bad = 1;
+			last[i] = n;
+		}
+		usleep(100);
+	} while (!stale);
+
+	/* the last round must be in place when the writer lets go */
+	id = shmstatus_find_service(s, "host1", "Dummy service");
+	if (id < 0 || last[id] < ROUNDS)
+		bad = 1;
+	shmstatus_destroy(s);
+	free(last);
+	return bad;
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	const char *test_config_file = get_default_config_file();
+	shmstatus *s;
+	shmstatus_object obj;
+	pid_t pids[NUM_READERS];
+	struct timeval start, stop;
+	unsigned int i;
+	int n, id, status, bad = 0;
+	double secs;
+
+	plan_tests(12);
+	init_event_queue();
+	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
+	assert(OK == read_main_config_file(test_config_file));
+	assert(OK == read_all_object_data(test_config_file));
+	enable_notifications = FALSE;
+	enable_event_handlers = FALSE;
+
+	ok(initialize_status_shm() == OK, "nothing is published unless asked to");
+	sprintf(segname, "/naemon-test-status-%d", (int)getpid());
+	ok(shmstatus_open(segname) == NULL, "... so there's no segment");
+
+	status_shm_segment = nm_strdup(segname);
+	ok(initialize_status_shm() == OK, "the status segment can be created");
+	s = shmstatus_open(segname);
+	ok(s != NULL, "readers can open the segment");
+	ok(s && shmstatus_count(s, SHMSTATUS_HOST) == num_objects.hosts &&
+	   shmstatus_count(s, SHMSTATUS_SERVICE) == num_objects.services, "the segment has a record for every object");
+	id = s ? shmstatus_find_service(s, "host1", "Dummy service") : -1;
+	ok(id >= 0 && (unsigned int)id == find_service("host1", "Dummy service")->id, "services are found by name");
+
+	submit_result(service_ary[id], 2);
+	shmstatus_read(s, SHMSTATUS_SERVICE, id, &obj);
+	ok(obj.current_state == 2 && !strcmp(obj.plugin_output, "RC 2 #2"), "check results are published right away");
+
+	find_host("host1")->problem_has_been_acknowledged = TRUE;
+	update_host_status(find_host("host1"), FALSE);
+	shmstatus_read(s, SHMSTATUS_HOST, find_host("host1")->id, &obj);
+	ok(obj.problem_has_been_acknowledged == TRUE, "other status updates are published too");
+
+	fflush(stdout);
+	for (i = 0; i < NUM_READERS; i++) {
+		if (!(pids[i] = fork()))
+			_exit(reader());
+	}
+
+	/* pick up after the result submitted above */
+	gettimeofday(&start, NULL);
+	for (n = 3; n <= ROUNDS; n++) {
+		for (i = 0; i < num_objects.services; i++)
+			submit_result(service_ary[i], n);
+	}
+	gettimeofday(&stop, NULL);
+
+	/* a restart replaces the segment */
+	ok(initialize_status_shm() == OK, "the status segment can be recreated");
+	ok(s && shmstatus_is_stale(s), "readers of the old segment see it go stale");
+	shmstatus_destroy(s);
+
+	cleanup_status_shm();
+	for (i = 0; i < NUM_READERS; i++) {
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			bad++;
+	}
+	ok(bad == 0, "readers always see consistent and current records");
+	ok(shmstatus_open(segname) == NULL && errno == ENOENT, "the segment is removed on shutdown");
+
+	secs = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+	diag("%u check results with %d readers in %.2fs, %.0f results/sec",
+	     (ROUNDS - 2) * num_objects.services, NUM_READERS, secs, (ROUNDS - 2) * num_objects.services / secs);
+
+	my_free(status_shm_segment);
+	return exit_status();
+}
@@ -0,0 +1,158 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/configuration.h"
+#include "naemon/defaults.h"
+#include "naemon/checks.h"
+#include "naemon/commands.h"
+#include "naemon/events.h"
+#include "naemon/submit.h"
+#include "naemon/nm_alloc.h"
+
+#define THREADS 4
+#define COMMANDS_PER_THREAD 5000
+#define RESULTS 100
+
+static unsigned int counted, out_of_order;
+static int next_seq[THREADS + 1];
+
+static int count_handler(const struct external_command *ext_command, time_t entry_time)
+{
+	int thread = *(int *)command_argument_get_value(ext_command, "thread");
+	int seq = *(int *)command_argument_get_value(ext_command, "seq");
+
+	if (thread < 0 || thread > THREADS || seq != next_seq[thread])
+		out_of_order++;
+	else
+		next_seq[thread]++;
+	counted++;
+	return OK;
+}
+
+static void submit_result(int code, const char *output)
+{
+	check_result cr;
+
+	init_check_result(&cr);
+	cr.object_check_type = SERVICE_CHECK;
+	cr.check_type = CHECK_TYPE_PASSIVE;
+	cr.host_name = "host1";
+	cr.service_description = "Dummy service";
+	cr.return_code = code;
+	cr.output = (char *)output;
+	gettimeofday(&cr.start_time, NULL);
+	cr.finish_time = cr.start_time;
+	naemon_submit_check_result(&cr);
+}
+
+static void *submitter(void *arg)
+{
+	int id = (int)(long)arg, i;
+	char buf[128];
+
+	for (i = 0; i < COMMANDS_PER_THREAD; i++) {
+		if (!id && i < RESULTS) {
+			sprintf(buf, "result %d", i);
+			submit_result(i == RESULTS - 1 ? STATE_CRITICAL : STATE_OK, buf);
+		}
+		sprintf(buf, "[%lu] COUNT_SUBMISSION;%d;%d", (unsigned long)time(NULL), id, i);
+		if (naemon_submit_command(buf) != OK)
+			break;
+	}
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	pthread_t threads[THREADS];
+	service *svc = find_service("host1", "Dummy service");
+	int i, polls;
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, submitter, (void *)(long)i);
+
+	for (polls = 0; counted < THREADS * COMMANDS_PER_THREAD && polls < 1000; polls++)
+		iobroker_poll(nagios_iobs, 1000);
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	ok(counted == THREADS * COMMANDS_PER_THREAD, "every command submitted from %d threads is processed", THREADS);
+	ok(!out_of_order, "commands from each thread are processed in order");
+	ok(svc && svc->plugin_output && !strcmp(svc->plugin_output, "result 99"),
+	   "submitted check results are processed in order too");
+	ok(svc && svc->current_state == STATE_CRITICAL, "... and change the service's state");
+}
+
+static void test_batches(void)
+{
+	char buf[128];
+	unsigned int before;
+	int i;
+
+	/* a single thread can queue more than one pass processes */
+	for (i = 0; i < 2000; i++) {
+		sprintf(buf, "[%lu] COUNT_SUBMISSION;%d;%d", (unsigned long)time(NULL), THREADS, i);
+		naemon_submit_command(buf);
+	}
+	before = counted;
+	iobroker_poll(nagios_iobs, 1000);
+	ok(counted - before > 0 && counted - before < 2000, "a busy queue is drained in batches");
+	for (i = 0; i < 10 && counted - before < 2000; i++)
+		iobroker_poll(nagios_iobs, 1000);
+	ok(counted - before == 2000 && !out_of_order, "... and the event loop comes back for the rest");
+	ok(iobroker_poll(nagios_iobs, 0) == 0, "an empty queue keeps quiet");
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	const char *test_config_file = get_default_config_file();
+	struct external_command *ext_command;
+
+	plan_tests(8);
+	init_event_queue();
+
+	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
+	assert(OK == read_main_config_file(test_config_file));
+	assert(OK == read_all_object_data(test_config_file));
+
+	registered_commands_init(20);
+	ext_command = command_create("COUNT_SUBMISSION", count_handler, "Counts submissions", NULL);
+	command_argument_add(ext_command, "thread", INTEGER, NULL, NULL);
+	command_argument_add(ext_command, "seq", INTEGER, NULL, NULL);
+	command_register(ext_command, -1);
+
+	nagios_iobs = iobroker_create();
+	assert(OK == submit_init());
+
+	test_threads();
+	test_batches();
+
+	submit_deinit();
+	ok(naemon_submit_command("[0] COUNT_SUBMISSION;0;0") == ERROR, "nothing is accepted once the queue is gone");
+
+	registered_commands_deinit();
+	iobroker_destroy(nagios_iobs, 0);
+	return exit_status();
+}